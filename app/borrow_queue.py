@@ -0,0 +1,106 @@
+"""
+FIFO wait queues for blocking borrows.
+
+POST /licenses/borrow/wait parks a request here while its tool has no free
+seat, instead of answering 409 and leaving the client to poll. Whenever a
+seat may have been freed (a return, a batch return, a lease reclaimed) the
+tool's queue is dispatched: waiters are granted in arrival order for as long
+as seats last, on the thread that freed the seat, so a returned seat goes to
+the longest waiter rather than to whichever client retries first. Plain
+borrows of a tool that has waiters are refused, so they cannot jump the queue.
+
+Queues live in this process; with several server workers each worker keeps
+its own order.
+"""
+
+import asyncio
+import threading
+from collections import deque
+from typing import Any, Callable, Deque, Dict, Optional
+
+
+class Waiter:
+    """One queued borrow. result/error are set once, under the queue lock."""
+
+    __slots__ = ("tool", "user", "loop", "event", "done", "result", "error")
+
+    def __init__(self, tool: str, user: str, loop: asyncio.AbstractEventLoop):
+        self.tool = tool
+        self.user = user
+        self.loop = loop
+        self.event = asyncio.Event()
+        self.done = False
+        self.result: Any = None
+        self.error: Optional[BaseException] = None
+
+
+class BorrowQueue:
+    def __init__(self, grant: Callable[[str, str], Any]):
+        """
+        grant(tool, user) borrows a seat and returns the response for the
+        waiter, None while no seat is free, or raises to refuse the waiter.
+        """
+        self._grant = grant
+        self._lock = threading.Lock()
+        self._queues: Dict[str, Deque[Waiter]] = {}
+
+    def has_waiters(self, tool: str) -> bool:
+        return bool(self._queues.get(tool))
+
+    def waiting(self, tool: str) -> int:
+        return len(self._queues.get(tool, ()))
+
+    def enqueue(self, tool: str, user: str) -> Waiter:
+        """Join the end of tool's queue; call from the event loop."""
+        waiter = Waiter(tool, user, asyncio.get_running_loop())
+        with self._lock:
+            self._queues.setdefault(tool, deque()).append(waiter)
+        return waiter
+
+    def dispatch(self, tool: str) -> int:
+        """Grant tool's waiters in order while seats last; returns how many were served."""
+        if not self._queues.get(tool):
+            return 0
+        served = 0
+        with self._lock:
+            queue = self._queues.get(tool)
+            while queue:
+                waiter = queue[0]
+                try:
+                    result = self._grant(waiter.tool, waiter.user)
+                except Exception as exc:
+                    queue.popleft()
+                    self._finish(waiter, None, exc)
+                    served += 1
+                    continue
+                if result is None:
+                    break
+                queue.popleft()
+                self._finish(waiter, result, None)
+                served += 1
+            if queue is not None and not queue:
+                del self._queues[tool]
+        return served
+
+    def cancel(self, waiter: Waiter) -> bool:
+        """Leave the queue; False if the waiter was served meanwhile (see its result)."""
+        with self._lock:
+            if waiter.done:
+                return False
+            queue = self._queues.get(waiter.tool)
+            if queue is not None:
+                queue.remove(waiter)
+                if not queue:
+                    del self._queues[waiter.tool]
+            waiter.done = True
+            return True
+
+    @staticmethod
+    def _finish(waiter: Waiter, result: Any, error: Optional[BaseException]) -> None:
+        waiter.result = result
+        waiter.error = error
+        waiter.done = True
+        try:
+            waiter.loop.call_soon_threadsafe(waiter.event.set)
+        except RuntimeError:
+            pass  # loop closed: nobody is waiting any more
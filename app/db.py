@@ -1,10 +1,12 @@
+import functools
 import os
 import sqlite3
 import secrets
 import hashlib
+import time
 from contextlib import contextmanager
 from pathlib import Path
-from typing import Iterator, Optional, List
+from typing import Callable, Iterator, Optional, List
 from passlib.context import CryptContext
 from datetime import datetime
 
@@ -37,6 +39,52 @@ def get_connection(readonly: bool = False) -> Iterator[sqlite3.Connection]:
         conn.close()
 
 
+def get_lease_seconds() -> int:
+    """Lease length for new borrows (LICENSE_LEASE_SECONDS); 0 means borrows never expire."""
+    try:
+        return max(int(os.getenv("LICENSE_LEASE_SECONDS", "0")), 0)
+    except ValueError:
+        return 0
+
+
+def _lease_expiry(lease_seconds: int, now: Optional[float] = None) -> Optional[float]:
+    if lease_seconds <= 0:
+        return None
+    return (time.time() if now is None else now) + lease_seconds
+
+
+def _ledger():
+    """The in-memory seat ledger when LICENSE_LEDGER=memory, else None (see app/ledger.py)."""
+    from .ledger import active_ledger
+    return active_ledger()
+
+
+def _changes_limits(fn):
+    """For writers of seat limits: flush the ledger first, so they see current
+    borrow counts, and have it reload the limits afterwards."""
+    @functools.wraps(fn)
+    def wrapper(*args, **kwargs):
+        ledger = _ledger()
+        if ledger is not None:
+            ledger.flush()
+        try:
+            return fn(*args, **kwargs)
+        finally:
+            if ledger is not None:
+                ledger.refresh_limits()
+    return wrapper
+
+
+def _ensure_borrow_lease_column(conn) -> None:
+    """Ensure borrows.lease_expires_at exists (for existing DBs)."""
+    cur = conn.cursor()
+    cur.execute("PRAGMA table_info(borrows)")
+    cols = {row[1] for row in cur.fetchall()}
+    if "lease_expires_at" not in cols:
+        cur.execute("ALTER TABLE borrows ADD COLUMN lease_expires_at REAL")
+    cur.execute("CREATE INDEX IF NOT EXISTS idx_borrows_lease ON borrows(lease_expires_at)")
+
+
 def initialize_database(tools_config: Optional[List[dict]] = None, enable_multitenant: bool = False) -> None:
     """
     Initialize database with optional seed data.
@@ -165,6 +213,7 @@ def initialize_database(tools_config: Optional[List[dict]] = None, enable_multit
                 )
                 """
             )
+        _ensure_borrow_lease_column(conn)
         cur.execute(
             """
             CREATE TABLE IF NOT EXISTS users (
@@ -247,10 +296,17 @@ def initialize_database(tools_config: Optional[List[dict]] = None, enable_multit
             pwd = get_password_context().hash("demo123")
             cur.execute("INSERT INTO users(username, password_hash) VALUES (?, ?)", ("demo", pwd))
         conn.commit()
+    # Opened only now that the tables exist; replays its log on first open
+    ledger = _ledger()
+    if ledger is not None and tools_config:
+        ledger.refresh_limits()
 
 
 def borrow_license(tool: str, user: str, borrow_id: str, borrowed_at_iso: str) -> tuple[bool, bool]:
     """Returns (success, is_overage)"""
+    ledger = _ledger()
+    if ledger is not None:
+        return ledger.borrow(tool, user, borrow_id, borrowed_at_iso)
     with get_connection(False) as conn:
         cur = conn.cursor()
         cur.execute("SELECT total, borrowed, commit_qty, max_overage, overage_price_per_license FROM licenses WHERE tool = ?", (tool,))
@@ -277,8 +333,8 @@ def borrow_license(tool: str, user: str, borrow_id: str, borrowed_at_iso: str) -
         
         cur.execute("UPDATE licenses SET borrowed = borrowed + 1 WHERE tool = ?", (tool,))
         cur.execute(
-            "INSERT INTO borrows(id, tool, user, borrowed_at, is_overage) VALUES (?, ?, ?, ?, ?)",
-            (borrow_id, tool, user, borrowed_at_iso, 1 if is_overage else 0),
+            "INSERT INTO borrows(id, tool, user, borrowed_at, is_overage, lease_expires_at) VALUES (?, ?, ?, ?, ?, ?)",
+            (borrow_id, tool, user, borrowed_at_iso, 1 if is_overage else 0, _lease_expiry(get_lease_seconds())),
         )
         
         # Record overage charge if this is an overage borrow
@@ -295,6 +351,9 @@ def borrow_license(tool: str, user: str, borrow_id: str, borrowed_at_iso: str) -
 
 
 def return_license(borrow_id: str) -> Optional[str]:
+    ledger = _ledger()
+    if ledger is not None:
+        return ledger.return_one(borrow_id)
     with get_connection(False) as conn:
         cur = conn.cursor()
         cur.execute("SELECT tool FROM borrows WHERE id = ?", (borrow_id,))
@@ -308,7 +367,176 @@ def return_license(borrow_id: str) -> Optional[str]:
         return tool
 
 
+def borrow_licenses_batch(tool: str, user: str, count: int, borrowed_at_iso: str, max_overage_grants: Optional[int] = None,
+                          new_id: Optional[Callable[[], str]] = None) -> tuple[List[tuple[str, bool]], Optional[str]]:
+    """Borrow up to `count` licenses in a single transaction.
+
+    Grants as many seats as the commit/overage limits allow and stops at the
+    first limit hit (partial success). `max_overage_grants` optionally caps
+    how many of the grants may be overage seats (spend protection).
+    `new_id` makes borrow ids (default: a random UUID).
+
+    Returns (granted, reason) where granted is a list of (borrow_id, is_overage)
+    and reason is None if all seats were granted, otherwise one of
+    "unknown_tool", "exhausted", "max_overage" or "max_spend".
+    """
+    ledger = _ledger()
+    if ledger is not None:
+        return ledger.borrow_batch(tool, user, count, borrowed_at_iso, max_overage_grants, new_id)
+    import uuid
+    new_id = new_id or (lambda: str(uuid.uuid4()))
+    with get_connection(False) as conn:
+        cur = conn.cursor()
+        cur.execute("SELECT total, borrowed, commit_qty, max_overage, overage_price_per_license FROM licenses WHERE tool = ?", (tool,))
+        row = cur.fetchone()
+        if row is None:
+            return [], "unknown_tool"
+        total = int(row["total"])
+        borrowed = int(row["borrowed"])
+        commit = int(row["commit_qty"] or 0)
+        max_overage = int(row["max_overage"] or 0)
+        overage_price = float(row["overage_price_per_license"] or 0.0)
+
+        granted: List[tuple[str, bool]] = []
+        overage_granted = 0
+        reason = None
+        # Same admission rules as borrow_license, applied seat by seat
+        for _ in range(count):
+            if borrowed >= total:
+                reason = "exhausted"
+                break
+            is_overage = borrowed >= commit
+            if is_overage:
+                if borrowed - commit >= max_overage:
+                    reason = "max_overage"
+                    break
+                if max_overage_grants is not None and overage_granted >= max_overage_grants:
+                    reason = "max_spend"
+                    break
+                overage_granted += 1
+            borrowed += 1
+            granted.append((new_id(), is_overage))
+
+        if not granted:
+            return [], reason
+
+        cur.execute("UPDATE licenses SET borrowed = borrowed + ? WHERE tool = ?", (len(granted), tool))
+        expires = _lease_expiry(get_lease_seconds())
+        cur.executemany(
+            "INSERT INTO borrows(id, tool, user, borrowed_at, is_overage, lease_expires_at) VALUES (?, ?, ?, ?, ?, ?)",
+            [(borrow_id, tool, user, borrowed_at_iso, 1 if is_overage else 0, expires) for borrow_id, is_overage in granted],
+        )
+        if overage_price > 0:
+            cur.executemany(
+                "INSERT INTO overage_charges(id, tool, borrow_id, user, charged_at, amount) VALUES (?, ?, ?, ?, ?, ?)",
+                [(str(uuid.uuid4()), tool, borrow_id, user, borrowed_at_iso, overage_price) for borrow_id, is_overage in granted if is_overage],
+            )
+
+        conn.commit()
+        return granted, reason
+
+
+def return_licenses_batch(borrow_ids: List[str]) -> dict:
+    """Return many borrows in a single transaction.
+
+    Returns a dict mapping each returned borrow id to its tool. Unknown ids
+    are left out so the caller can report them as not found.
+    """
+    if not borrow_ids:
+        return {}
+    ledger = _ledger()
+    if ledger is not None:
+        return ledger.return_many(borrow_ids)
+    with get_connection(False) as conn:
+        cur = conn.cursor()
+        unique_ids = list(dict.fromkeys(borrow_ids))
+        returned = {}
+        # Stay well below SQLite's bound-parameter limit
+        for start in range(0, len(unique_ids), 500):
+            chunk = unique_ids[start:start + 500]
+            placeholders = ",".join("?" for _ in chunk)
+            cur.execute(f"SELECT id, tool FROM borrows WHERE id IN ({placeholders})", chunk)
+            for r in cur.fetchall():
+                returned[r["id"]] = r["tool"]
+        if not returned:
+            return {}
+
+        per_tool: dict = {}
+        for tool in returned.values():
+            per_tool[tool] = per_tool.get(tool, 0) + 1
+        cur.executemany("DELETE FROM borrows WHERE id = ?", [(borrow_id,) for borrow_id in returned])
+        cur.executemany(
+            "UPDATE licenses SET borrowed = borrowed - ? WHERE tool = ?",
+            [(n, tool) for tool, n in per_tool.items()],
+        )
+        conn.commit()
+        return returned
+
+
+def renew_leases(borrow_ids: List[str], now: Optional[float] = None) -> List[str]:
+    """Extend the leases of many borrows in a single transaction.
+
+    Returns the ids that exist (and were renewed); unknown ids, including
+    borrows already reclaimed, are left out.
+    """
+    if not borrow_ids:
+        return []
+    ledger = _ledger()
+    if ledger is not None:
+        return ledger.renew(borrow_ids, now)
+    expires = _lease_expiry(get_lease_seconds(), now)
+    with get_connection(False) as conn:
+        cur = conn.cursor()
+        unique_ids = list(dict.fromkeys(borrow_ids))
+        renewed = []
+        for start in range(0, len(unique_ids), 500):
+            chunk = unique_ids[start:start + 500]
+            placeholders = ",".join("?" for _ in chunk)
+            cur.execute(f"SELECT id FROM borrows WHERE id IN ({placeholders})", chunk)
+            found = [r["id"] for r in cur.fetchall()]
+            if found:
+                placeholders = ",".join("?" for _ in found)
+                cur.execute(f"UPDATE borrows SET lease_expires_at = ? WHERE id IN ({placeholders})", [expires, *found])
+                renewed.extend(found)
+        conn.commit()
+        return renewed
+
+
+def reclaim_expired_leases(now: Optional[float] = None) -> dict:
+    """Release every borrow whose lease has expired.
+
+    Returns a dict mapping each reclaimed borrow id to its tool.
+    """
+    ledger = _ledger()
+    if ledger is not None:
+        return ledger.reclaim(now)
+    now = time.time() if now is None else now
+    with get_connection(False) as conn:
+        cur = conn.cursor()
+        # One statement, so a renewal cannot slip in between check and delete
+        cur.execute(
+            "DELETE FROM borrows WHERE lease_expires_at IS NOT NULL AND lease_expires_at < ? RETURNING id, tool",
+            (now,),
+        )
+        reclaimed = {r["id"]: r["tool"] for r in cur.fetchall()}
+        if not reclaimed:
+            conn.commit()
+            return {}
+        per_tool: dict = {}
+        for tool in reclaimed.values():
+            per_tool[tool] = per_tool.get(tool, 0) + 1
+        cur.executemany(
+            "UPDATE licenses SET borrowed = borrowed - ? WHERE tool = ?",
+            [(n, tool) for tool, n in per_tool.items()],
+        )
+        conn.commit()
+        return reclaimed
+
+
 def get_status(tool: str) -> Optional[dict]:
+    ledger = _ledger()
+    if ledger is not None:
+        return ledger.status(tool)
     with get_connection(True) as conn:
         cur = conn.cursor()
         cur.execute("SELECT total, borrowed, commit_qty, max_overage, commit_price, overage_price_per_license FROM licenses WHERE tool = ?", (tool,))
@@ -367,6 +595,7 @@ def verify_user_credentials(username: str, password: str) -> bool:
         return get_password_context().verify(password, row["password_hash"])
 
 
+@_changes_limits
 def update_budget_config(tool: str, total: int, commit: int, max_overage: int, commit_price: float, overage_price_per_license: float) -> bool:
     """Update total, commit, max_overage, and prices for a tool"""
     with get_connection(False) as conn:
@@ -390,12 +619,14 @@ def get_all_tools() -> List[dict]:
         cur = conn.cursor()
         cur.execute("SELECT tool, total, borrowed, commit_qty, max_overage, commit_price, overage_price_per_license FROM licenses ORDER BY tool ASC")
         rows = cur.fetchall()
+        ledger = _ledger()
         result = []
         for r in rows:
+            borrowed = ledger.borrowed(r["tool"]) if ledger is not None else None
             result.append({
                 "tool": r["tool"],
                 "total": int(r["total"]),
-                "borrowed": int(r["borrowed"]),
+                "borrowed": int(r["borrowed"]) if borrowed is None else borrowed,
                 "commit": int(r["commit_qty"] or 0),
                 "max_overage": int(r["max_overage"] or 0),
                 "commit_price": float(r["commit_price"] or 0.0),
@@ -572,6 +803,7 @@ def get_tenant_licenses(tenant_id: str) -> List[dict]:
         return result
 
 
+@_changes_limits
 def provision_license_to_tenant(vendor_id: str, tenant_id: str, product_config: dict) -> str:
     """Provision a new license from vendor to tenant. Returns package_id"""
     from datetime import datetime
@@ -778,6 +1010,7 @@ def _ensure_vendor_customer_columns(conn) -> None:
         conn.commit()
 
 
+@_changes_limits
 def set_vendor_budget(tool: str, total: int, commit_qty: int, max_overage: int) -> bool:
     """
     Vendor sets the maximum budget for a tool.
@@ -829,6 +1062,7 @@ def set_vendor_budget(tool: str, total: int, commit_qty: int, max_overage: int)
             return cur.rowcount > 0
 
 
+@_changes_limits
 def set_customer_budget_restrictions(tool: str, total: int = None, commit_qty: int = None, max_overage: int = None) -> tuple[bool, str]:
     """
     Customer can ONLY restrict (lower) their budget, not exceed vendor limits.
@@ -998,16 +1232,25 @@ def get_customer_max_spend(tool: str) -> float | None:
         return row[0] if isinstance(row, tuple) else row["customer_max_spend"]
 
 
+def month_start() -> str:
+    """Start of the current UTC month, comparable with charged_at timestamps."""
+    now = datetime.utcnow()
+    return now.replace(day=1, hour=0, minute=0, second=0, microsecond=0).isoformat()
+
+
 def get_month_to_date_overage_cost(tool: str) -> float:
     """Approximate month-to-date overage cost using current overage price and count of overage borrows this month."""
-    from datetime import datetime
-    now = datetime.utcnow()
-    month_start = now.replace(day=1, hour=0, minute=0, second=0, microsecond=0).isoformat()
+    ledger = _ledger()
+    if ledger is not None:
+        # Counted as charges are made, so admission never waits on a flush
+        cost = ledger.month_to_date_overage_cost(tool)
+        if cost is not None:
+            return cost
     with get_connection(True) as conn:
         cur = conn.cursor()
         # Count overage charges this month
         try:
-            cur.execute("SELECT COUNT(*) as cnt FROM overage_charges WHERE tool = ? AND created_at >= ?", (tool, month_start))
+            cur.execute("SELECT COUNT(*) as cnt FROM overage_charges WHERE tool = ? AND charged_at >= ?", (tool, month_start()))
             cnt = int(cur.fetchone()[0])
         except Exception:
             cur.execute("SELECT COUNT(*) as cnt FROM overage_charges WHERE tool = ?", (tool,))
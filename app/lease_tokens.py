@@ -0,0 +1,164 @@
+"""
+Signed lease tokens for offline re-borrows.
+
+When a vendor signing key is configured, every single-seat borrow response
+carries a short-lived lease token: a compact JWT naming the borrow, tool and
+user, signed with the vendor's private key. A client holding the matching
+public key verifies it locally and may hand the same seat out again, to the
+same tool and user, until the token expires - without a round trip. The
+seat stays borrowed (and, with leases, renewed) on the server meanwhile, so
+no count ever goes wrong; the token only tells the client that it still holds
+the seat.
+
+Tokens never outlive the lease they were issued with, so a seat whose token
+is valid has not been reclaimed by the lease sweeper, even if the client could
+not renew it since.
+
+Configuration:
+- LICENSE_TOKEN_KEY: vendor private key, PEM (Ed25519, or RSA for RS256)
+- LICENSE_TOKEN_KEY_FILE: path to that PEM, if LICENSE_TOKEN_KEY is unset
+- LICENSE_TOKEN_SECONDS: token lifetime (default 300), capped at the lease
+"""
+
+import base64
+import json
+import logging
+import os
+import threading
+import time
+from typing import Optional
+
+logger = logging.getLogger(__name__)
+
+DEFAULT_TOKEN_SECONDS = 300
+# Key ID in the token header, as the vendor is named in security.VENDOR_SECRETS
+KEY_ID = "techvendor"
+
+_lock = threading.Lock()
+_loaded = False
+_key = None
+_alg = None
+
+
+def _b64url(data: bytes) -> str:
+    return base64.urlsafe_b64encode(data).rstrip(b"=").decode("ascii")
+
+
+def _compact_json(value: dict) -> bytes:
+    return json.dumps(value, separators=(",", ":")).encode("utf-8")
+
+
+def _read_key_pem() -> Optional[str]:
+    pem = os.getenv("LICENSE_TOKEN_KEY")
+    if pem:
+        return pem
+    path = os.getenv("LICENSE_TOKEN_KEY_FILE")
+    if not path:
+        return None
+    try:
+        with open(path, "r", encoding="ascii") as f:
+            return f.read()
+    except OSError as exc:
+        logger.error("lease tokens disabled: cannot read %s: %s", path, exc)
+        return None
+
+
+def _load_key():
+    """Return (private key, JWT alg), or (None, None) when tokens are off."""
+    pem = _read_key_pem()
+    if not pem:
+        return None, None
+    try:
+        from cryptography.hazmat.primitives.asymmetric import ed25519, rsa
+        from cryptography.hazmat.primitives.serialization import load_pem_private_key
+    except ImportError:
+        logger.error("lease tokens disabled: the cryptography package is not installed")
+        return None, None
+    try:
+        key = load_pem_private_key(pem.encode("ascii"), password=None)
+    except ValueError as exc:
+        logger.error("lease tokens disabled: invalid signing key: %s", exc)
+        return None, None
+    if isinstance(key, ed25519.Ed25519PrivateKey):
+        return key, "EdDSA"
+    if isinstance(key, rsa.RSAPrivateKey):
+        return key, "RS256"
+    logger.error("lease tokens disabled: signing key must be Ed25519 or RSA")
+    return None, None
+
+
+def _signing_key():
+    global _loaded, _key, _alg
+    if not _loaded:
+        with _lock:
+            if not _loaded:
+                _key, _alg = _load_key()
+                _loaded = True
+                if _key is not None:
+                    logger.info("lease tokens enabled alg=%s", _alg)
+    return _key, _alg
+
+
+def reset() -> None:
+    """Forget the loaded key, so the next token re-reads the environment (tests)."""
+    global _loaded, _key, _alg
+    with _lock:
+        _loaded, _key, _alg = False, None, None
+
+
+def enabled() -> bool:
+    return _signing_key()[0] is not None
+
+
+def token_seconds(lease_seconds: int) -> int:
+    """Token lifetime: LICENSE_TOKEN_SECONDS, never longer than the lease."""
+    try:
+        seconds = int(os.getenv("LICENSE_TOKEN_SECONDS", str(DEFAULT_TOKEN_SECONDS)))
+    except ValueError:
+        seconds = DEFAULT_TOKEN_SECONDS
+    if lease_seconds > 0:
+        seconds = min(seconds, lease_seconds)
+    return max(seconds, 0)
+
+
+def _sign(key, alg: str, data: bytes) -> bytes:
+    if alg == "EdDSA":
+        return key.sign(data)
+    from cryptography.hazmat.primitives import hashes
+    from cryptography.hazmat.primitives.asymmetric import padding
+    return key.sign(data, padding.PKCS1v15(), hashes.SHA256())
+
+
+def issue(borrow_id: str, tool: str, user: str, lease_seconds: int,
+          now: Optional[float] = None) -> Optional[str]:
+    """Sign a lease token for a new borrow; None when tokens are disabled."""
+    key, alg = _signing_key()
+    if key is None:
+        return None
+    seconds = token_seconds(lease_seconds)
+    if seconds <= 0:
+        return None
+    issued_at = int(time.time() if now is None else now)
+    header = {"alg": alg, "typ": "JWT", "kid": KEY_ID}
+    claims = {
+        "jti": borrow_id,
+        "tool": tool,
+        "sub": user,
+        "iat": issued_at,
+        "exp": issued_at + seconds,
+    }
+    signing_input = _b64url(_compact_json(header)) + "." + _b64url(_compact_json(claims))
+    signature = _sign(key, alg, signing_input.encode("ascii"))
+    return signing_input + "." + _b64url(signature)
+
+
+def public_key_pem() -> Optional[str]:
+    """The vendor public key clients verify tokens with, PEM; None when disabled."""
+    key, _ = _signing_key()
+    if key is None:
+        return None
+    from cryptography.hazmat.primitives import serialization
+    return key.public_key().public_bytes(
+        serialization.Encoding.PEM,
+        serialization.PublicFormat.SubjectPublicKeyInfo,
+    ).decode("ascii")
@@ -0,0 +1,559 @@
+"""
+In-memory seat ledger with write-behind persistence.
+
+By default every borrow and return is its own SQLite write transaction, so
+admission serializes on the database's single writer. With
+LICENSE_LEDGER=memory, admission is decided against per-tool seat counters
+held in memory instead: the ledger is the source of truth for who holds
+which seat, and the database trails it by at most one flush interval.
+
+Each change is appended to a write-ahead log before the request is
+answered. Requests that arrive together share one fsync (group commit), so
+a crash loses no acknowledged borrow or return. A background thread applies
+the logged changes to the database in one transaction per batch, then
+drops that log segment. On start, segments left by a crash are replayed
+into the database before the ledger loads its state from it; replay is
+idempotent.
+
+The ledger assumes it is the only writer of borrows and seat counts, i.e.
+one server process (the Dockerfile runs a single uvicorn worker) and all
+writes going through app/db.py. Readers that query the database directly,
+such as the /borrows listing, see changes up to one flush interval late.
+Limit changes made through app/db.py are picked up at once, others within
+LIMITS_REFRESH_SECONDS.
+
+Configuration:
+- LICENSE_LEDGER: "memory" enables the ledger (default: off)
+- LICENSE_LEDGER_FLUSH_MS: write-behind interval (default 50)
+- LICENSE_LEDGER_FSYNC: "always" (default) makes each change durable before
+  it is acknowledged; "off" leaves flushing the log to the OS, which
+  survives a process crash but not a power loss
+"""
+
+import atexit
+import glob
+import json
+import logging
+import os
+import sqlite3
+import threading
+import time
+import uuid
+from typing import Callable, Dict, List, Optional, Tuple
+
+from . import db
+
+logger = logging.getLogger(__name__)
+
+DEFAULT_FLUSH_MS = 50
+LIMITS_REFRESH_SECONDS = 1.0
+
+_lock = threading.Lock()
+_ledger: Optional["SeatLedger"] = None
+
+
+def enabled() -> bool:
+    return os.getenv("LICENSE_LEDGER", "").lower() == "memory"
+
+
+def active_ledger() -> Optional["SeatLedger"]:
+    """The ledger for the current database, opened on first use; None when disabled."""
+    global _ledger
+    if not enabled():
+        return None
+    path = db.get_db_path()
+    ledger = _ledger
+    if ledger is not None and ledger.db_path == path:
+        return ledger
+    with _lock:
+        if _ledger is None or _ledger.db_path != path:
+            if _ledger is not None:
+                _ledger.close()
+            _ledger = SeatLedger(path)
+        return _ledger
+
+
+def close() -> None:
+    """Flush and close the open ledger, if any (shutdown, tests)."""
+    global _ledger
+    with _lock:
+        if _ledger is not None:
+            _ledger.close()
+            _ledger = None
+
+
+atexit.register(close)
+
+
+class WriteAheadLog:
+    """
+    Append-only change log in numbered segments next to the database
+    (<db>.ledger.00000001, ...), one JSON record per line. Appends happen
+    under the ledger lock, so log order is ledger order; sync() then waits
+    for the record to reach disk, batching concurrent callers.
+    """
+
+    def __init__(self, db_path: str, fsync: bool):
+        self.prefix = db_path + ".ledger."
+        self.fsync = fsync
+        self._sync_lock = threading.Lock()
+        self._written = 0  # sequence number of the last append
+        self._synced = 0   # ... and of the last one known on disk
+        existing = self.segments()
+        self._number = int(existing[-1].rsplit(".", 1)[1]) if existing else 0
+        self._fd = self._open_next()
+
+    def segments(self) -> List[str]:
+        return sorted(glob.glob(glob.escape(self.prefix) + "[0-9]" * 8))
+
+    def _open_next(self) -> int:
+        self._number += 1
+        self.path = f"{self.prefix}{self._number:08d}"
+        return os.open(self.path, os.O_WRONLY | os.O_CREAT | os.O_APPEND, 0o600)
+
+    def append(self, record: dict) -> int:
+        """Write one record (caller holds the ledger lock); returns its sequence number."""
+        os.write(self._fd, json.dumps(record, separators=(",", ":")).encode("utf-8") + b"\n")
+        self._written += 1
+        return self._written
+
+    def sync(self, seq: int) -> None:
+        """Return once record @p seq is on disk (no-op with fsync off)."""
+        if not self.fsync or self._synced >= seq:
+            return
+        with self._sync_lock:
+            # Whoever held the lock may have synced our record with theirs
+            if self._synced >= seq:
+                return
+            target = self._written
+            os.fsync(self._fd)
+            self._synced = target
+
+    def rotate(self) -> str:
+        """Start a new segment (caller holds the ledger lock); returns the finished one."""
+        with self._sync_lock:
+            if self.fsync:
+                os.fsync(self._fd)
+            self._synced = self._written
+            os.close(self._fd)
+            finished = self.path
+            self._fd = self._open_next()
+            return finished
+
+    def close(self) -> None:
+        with self._sync_lock:
+            os.close(self._fd)
+        try:
+            if os.path.getsize(self.path) == 0:
+                os.unlink(self.path)
+        except OSError:
+            pass
+
+    @staticmethod
+    def read(path: str) -> List[dict]:
+        records = []
+        with open(path, "rb") as f:
+            for line in f:
+                try:
+                    records.append(json.loads(line))
+                except ValueError:
+                    # A write torn by a crash can only be the last one
+                    logger.warning("ledger log %s: skipping torn record", path)
+                    break
+        return records
+
+
+def apply_records(conn: sqlite3.Connection, records: List[dict]) -> set:
+    """
+    Apply logged changes to the database (no commit); returns the tools
+    touched. Idempotent, so a segment may be applied again after a crash.
+    A borrow returned within the same batch never reaches the database,
+    though its overage charge does.
+    """
+    borrows: Dict[str, list] = {}
+    charges = []
+    deleted: List[str] = []
+    renewed: Dict[str, Optional[float]] = {}
+    tools = set()
+    for r in records:
+        op = r["op"]
+        if op == "borrow":
+            borrows[r["id"]] = [r["id"], r["tool"], r["user"], r["at"], 1 if r["overage"] else 0, r["expires"]]
+            tools.add(r["tool"])
+            if r.get("charge"):
+                charges.append((r["charge"][0], r["tool"], r["id"], r["user"], r["at"], r["charge"][1]))
+        elif op == "return":
+            tools.update(r["tools"])
+            for borrow_id in r["ids"]:
+                if borrows.pop(borrow_id, None) is None:
+                    deleted.append(borrow_id)
+                    renewed.pop(borrow_id, None)
+        elif op == "renew":
+            for borrow_id in r["ids"]:
+                if borrow_id in borrows:
+                    borrows[borrow_id][5] = r["expires"]
+                else:
+                    renewed[borrow_id] = r["expires"]
+    cur = conn.cursor()
+    cur.executemany(
+        "INSERT OR IGNORE INTO borrows(id, tool, user, borrowed_at, is_overage, lease_expires_at) VALUES (?, ?, ?, ?, ?, ?)",
+        borrows.values(),
+    )
+    cur.executemany(
+        "INSERT OR IGNORE INTO overage_charges(id, tool, borrow_id, user, charged_at, amount) VALUES (?, ?, ?, ?, ?, ?)",
+        charges,
+    )
+    cur.executemany("DELETE FROM borrows WHERE id = ?", [(borrow_id,) for borrow_id in deleted])
+    cur.executemany(
+        "UPDATE borrows SET lease_expires_at = ? WHERE id = ?",
+        [(expires, borrow_id) for borrow_id, expires in renewed.items()],
+    )
+    return tools
+
+
+class _Tool:
+    __slots__ = ("total", "commit", "max_overage", "commit_price", "overage_price",
+                 "borrowed", "overage_borrows", "month_charges")
+
+    def __init__(self):
+        self.total = self.commit = self.max_overage = 0
+        self.commit_price = self.overage_price = 0.0
+        self.borrowed = 0
+        self.overage_borrows = 0
+        self.month_charges = 0  # overage charges since _month
+
+
+class SeatLedger:
+    """Seat counts and live borrows of one database, kept in memory."""
+
+    def __init__(self, db_path: str):
+        self.db_path = db_path
+        self._lock = threading.Lock()
+        self._flush_lock = threading.Lock()
+        self._tools: Dict[str, _Tool] = {}
+        # borrow id -> (tool, lease expiry or None)
+        self._borrows: Dict[str, Tuple[str, Optional[float]]] = {}
+        self._pending: List[dict] = []
+        # Start of the month the tools' month_charges count from
+        self._month = ""
+        # Finished log segments whose changes are not in the database yet
+        self._segments: List[str] = []
+        self._limits_loaded_at = 0.0
+        try:
+            flush_ms = int(os.getenv("LICENSE_LEDGER_FLUSH_MS", str(DEFAULT_FLUSH_MS)))
+        except ValueError:
+            flush_ms = DEFAULT_FLUSH_MS
+        self._flush_interval = max(flush_ms, 1) / 1000.0
+        fsync = os.getenv("LICENSE_LEDGER_FSYNC", "always").lower() != "off"
+        # An in-memory database does not outlive the process; nothing to log
+        self._wal = WriteAheadLog(db_path, fsync) if db_path != ":memory:" else None
+        self._recover()
+        self._load()
+        self._closed = threading.Event()
+        self._flusher = threading.Thread(target=self._run, daemon=True, name="ledger-flush")
+        self._flusher.start()
+        logger.info("seat ledger open db=%s tools=%d borrows=%d flush_ms=%d fsync=%s",
+                    db_path, len(self._tools), len(self._borrows), flush_ms, fsync)
+
+    # ---- startup ---------------------------------------------------------
+
+    def _recover(self) -> None:
+        if self._wal is None:
+            return
+        for path in self._wal.segments():
+            if path == self._wal.path:
+                continue
+            records = WriteAheadLog.read(path)
+            if records:
+                with db.get_connection(False) as conn:
+                    tools = apply_records(conn, records)
+                    self._recount(conn, tools)
+                    conn.commit()
+                logger.warning("ledger replayed %d records from %s", len(records), path)
+            os.unlink(path)
+
+    @staticmethod
+    def _recount(conn: sqlite3.Connection, tools) -> None:
+        conn.executemany(
+            "UPDATE licenses SET borrowed = (SELECT COUNT(*) FROM borrows WHERE borrows.tool = licenses.tool) WHERE tool = ?",
+            [(tool,) for tool in tools],
+        )
+
+    def _load(self) -> None:
+        try:
+            with db.get_connection(True) as conn:
+                cur = conn.cursor()
+                cur.execute("SELECT id, tool, lease_expires_at FROM borrows")
+                borrows = {r["id"]: (r["tool"], r["lease_expires_at"]) for r in cur.fetchall()}
+                cur.execute("SELECT tool, COUNT(*) AS cnt FROM overage_charges GROUP BY tool")
+                charged = {r["tool"]: int(r["cnt"]) for r in cur.fetchall()}
+                month = db.month_start()
+                cur.execute("SELECT tool, COUNT(*) AS cnt FROM overage_charges WHERE charged_at >= ? GROUP BY tool",
+                            (month,))
+                charged_this_month = {r["tool"]: int(r["cnt"]) for r in cur.fetchall()}
+        except sqlite3.OperationalError:
+            # Tables not created yet; initialize_database refreshes us
+            borrows, charged, charged_this_month, month = {}, {}, {}, db.month_start()
+        with self._lock:
+            self._borrows = borrows
+            for tool, _ in borrows.values():
+                self._tool(tool).borrowed += 1
+            for tool, count in charged.items():
+                self._tool(tool).overage_borrows = count
+            self._month = month
+            for tool, count in charged_this_month.items():
+                self._tool(tool).month_charges = count
+        self.refresh_limits()
+
+    def _tool(self, tool: str) -> _Tool:
+        t = self._tools.get(tool)
+        if t is None:
+            t = self._tools[tool] = _Tool()
+        return t
+
+    def refresh_limits(self) -> None:
+        """Re-read each tool's seat limits and prices from the database."""
+        try:
+            with db.get_connection(True) as conn:
+                cur = conn.cursor()
+                cur.execute("SELECT tool, total, commit_qty, max_overage, commit_price, overage_price_per_license FROM licenses")
+                rows = cur.fetchall()
+        except sqlite3.OperationalError:
+            return
+        with self._lock:
+            known = set()
+            for r in rows:
+                t = self._tool(r["tool"])
+                t.total = int(r["total"])
+                t.commit = int(r["commit_qty"] or 0)
+                t.max_overage = int(r["max_overage"] or 0)
+                t.commit_price = float(r["commit_price"] or 0.0)
+                t.overage_price = float(r["overage_price_per_license"] or 0.0)
+                known.add(r["tool"])
+            for tool in [tool for tool, t in self._tools.items() if tool not in known and t.borrowed == 0]:
+                del self._tools[tool]
+            self._limits_loaded_at = time.monotonic()
+
+    # ---- changes ---------------------------------------------------------
+
+    def _log(self, record: dict) -> int:
+        """Queue a change for the database (caller holds the lock); returns its log sequence."""
+        self._pending.append(record)
+        return self._wal.append(record) if self._wal is not None else 0
+
+    def _sync(self, seq: int) -> None:
+        if self._wal is not None and seq:
+            self._wal.sync(seq)
+
+    def _admit(self, t: _Tool) -> Tuple[Optional[str], bool]:
+        """(refusal reason or None, is_overage) for one more seat, as in db.borrow_license."""
+        if t.borrowed >= t.total:
+            return "exhausted", False
+        is_overage = t.borrowed >= t.commit
+        if is_overage and t.borrowed - t.commit >= t.max_overage:
+            return "max_overage", True
+        return None, is_overage
+
+    def _roll_month(self) -> None:
+        """Start the month's charge counts afresh once a new month begins (caller holds the lock)."""
+        month = db.month_start()
+        if month != self._month:
+            self._month = month
+            for t in self._tools.values():
+                t.month_charges = 0
+
+    def _grant(self, t: _Tool, tool: str, user: str, borrow_id: str, borrowed_at: str,
+               is_overage: bool, expires: Optional[float]) -> int:
+        t.borrowed += 1
+        self._borrows[borrow_id] = (tool, expires)
+        charge = None
+        if is_overage and t.overage_price > 0:
+            charge = [str(uuid.uuid4()), t.overage_price]
+            t.overage_borrows += 1
+            self._roll_month()
+            t.month_charges += 1
+        return self._log({"op": "borrow", "id": borrow_id, "tool": tool, "user": user, "at": borrowed_at,
+                          "overage": is_overage, "expires": expires, "charge": charge})
+
+    def borrow(self, tool: str, user: str, borrow_id: str, borrowed_at: str) -> Tuple[bool, bool]:
+        """Returns (success, is_overage), like db.borrow_license."""
+        expires = db._lease_expiry(db.get_lease_seconds())
+        with self._lock:
+            t = self._tools.get(tool)
+            if t is None:
+                return False, False
+            reason, is_overage = self._admit(t)
+            if reason is not None:
+                return False, False
+            seq = self._grant(t, tool, user, borrow_id, borrowed_at, is_overage, expires)
+        self._sync(seq)
+        return True, is_overage
+
+    def borrow_batch(self, tool: str, user: str, count: int, borrowed_at: str,
+                     max_overage_grants: Optional[int] = None,
+                     new_id: Optional[Callable[[], str]] = None) -> Tuple[List[Tuple[str, bool]], Optional[str]]:
+        """Same contract as db.borrow_licenses_batch."""
+        new_id = new_id or (lambda: str(uuid.uuid4()))
+        expires = db._lease_expiry(db.get_lease_seconds())
+        granted: List[Tuple[str, bool]] = []
+        reason = None
+        seq = 0
+        with self._lock:
+            t = self._tools.get(tool)
+            if t is None:
+                return [], "unknown_tool"
+            overage_granted = 0
+            for _ in range(count):
+                reason, is_overage = self._admit(t)
+                if reason is None and is_overage and max_overage_grants is not None and overage_granted >= max_overage_grants:
+                    reason = "max_spend"
+                if reason is not None:
+                    break
+                overage_granted += 1 if is_overage else 0
+                borrow_id = new_id()
+                seq = self._grant(t, tool, user, borrow_id, borrowed_at, is_overage, expires)
+                granted.append((borrow_id, is_overage))
+        self._sync(seq)
+        return granted, reason
+
+    def _release(self, borrow_ids) -> Tuple[Dict[str, str], int]:
+        """Drop borrows (caller holds the lock); returns (id -> tool, log sequence)."""
+        released: Dict[str, str] = {}
+        for borrow_id in borrow_ids:
+            entry = self._borrows.pop(borrow_id, None)
+            if entry is not None:
+                released[borrow_id] = entry[0]
+                self._tools[entry[0]].borrowed -= 1
+        if not released:
+            return released, 0
+        return released, self._log({"op": "return", "ids": list(released), "tools": sorted(set(released.values()))})
+
+    def return_many(self, borrow_ids: List[str]) -> Dict[str, str]:
+        """Same contract as db.return_licenses_batch."""
+        with self._lock:
+            released, seq = self._release(dict.fromkeys(borrow_ids))
+        self._sync(seq)
+        return released
+
+    def return_one(self, borrow_id: str) -> Optional[str]:
+        return self.return_many([borrow_id]).get(borrow_id)
+
+    def renew(self, borrow_ids: List[str], now: Optional[float] = None) -> List[str]:
+        """Same contract as db.renew_leases."""
+        expires = db._lease_expiry(db.get_lease_seconds(), now)
+        seq = 0
+        with self._lock:
+            renewed = []
+            for borrow_id in dict.fromkeys(borrow_ids):
+                entry = self._borrows.get(borrow_id)
+                if entry is not None:
+                    self._borrows[borrow_id] = (entry[0], expires)
+                    renewed.append(borrow_id)
+            if renewed:
+                seq = self._log({"op": "renew", "ids": renewed, "expires": expires})
+        self._sync(seq)
+        return renewed
+
+    def reclaim(self, now: Optional[float] = None) -> Dict[str, str]:
+        """Same contract as db.reclaim_expired_leases."""
+        now = time.time() if now is None else now
+        with self._lock:
+            expired = [borrow_id for borrow_id, (_, expires) in self._borrows.items()
+                       if expires is not None and expires < now]
+            released, seq = self._release(expired)
+        self._sync(seq)
+        return released
+
+    # ---- reads -----------------------------------------------------------
+
+    def tools(self) -> List[str]:
+        with self._lock:
+            return sorted(tool for tool, t in self._tools.items() if t.total or t.borrowed)
+
+    def borrowed(self, tool: str) -> Optional[int]:
+        t = self._tools.get(tool)
+        return t.borrowed if t is not None else None
+
+    def status(self, tool: str) -> Optional[dict]:
+        """Same shape as db.get_status, without touching the database."""
+        with self._lock:
+            t = self._tools.get(tool)
+            if t is None:
+                return None
+            total, borrowed, commit, max_overage = t.total, t.borrowed, t.commit, t.max_overage
+            commit_price, overage_price, overage_borrows = t.commit_price, t.overage_price, t.overage_borrows
+        current_overage_cost = overage_borrows * overage_price
+        return {
+            "tool": tool,
+            "total": total,
+            "borrowed": borrowed,
+            "available": max(total - borrowed, 0),
+            "commit": commit,
+            "max_overage": max_overage,
+            "overage": max(borrowed - commit, 0),
+            "overage_borrows": overage_borrows,
+            "in_commit": borrowed <= commit,
+            "commit_price": commit_price,
+            "overage_price_per_license": overage_price,
+            "current_overage_cost": current_overage_cost,
+            "total_cost": commit_price + current_overage_cost,
+        }
+
+    def month_to_date_overage_cost(self, tool: str) -> Optional[float]:
+        """This month's overage charges at the current price, as db.get_month_to_date_overage_cost."""
+        with self._lock:
+            t = self._tools.get(tool)
+            if t is None:
+                return None
+            self._roll_month()
+            return t.month_charges * t.overage_price
+
+    # ---- write-behind ----------------------------------------------------
+
+    def flush(self) -> int:
+        """Write queued changes to the database now; returns how many were written."""
+        with self._flush_lock:
+            with self._lock:
+                records, self._pending = self._pending, []
+                if not records:
+                    return 0
+                if self._wal is not None:
+                    self._segments.append(self._wal.rotate())
+            try:
+                with db.get_connection(False) as conn:
+                    tools = apply_records(conn, records)
+                    self._recount(conn, tools)
+                    conn.commit()
+            except Exception:
+                # Keep the changes (and their segments) for the next try
+                with self._lock:
+                    self._pending[:0] = records
+                raise
+            # Oldest first, so a crash part-way leaves a suffix to replay
+            for segment in self._segments:
+                os.unlink(segment)
+            self._segments = []
+            return len(records)
+
+    def _run(self) -> None:
+        while not self._closed.wait(self._flush_interval):
+            try:
+                written = self.flush()
+                if written:
+                    logger.debug("ledger flushed records=%d", written)
+                if time.monotonic() - self._limits_loaded_at >= LIMITS_REFRESH_SECONDS:
+                    self.refresh_limits()
+            except Exception:
+                logger.exception("ledger flush failed")
+
+    def close(self) -> None:
+        if self._closed.is_set():
+            return
+        self._closed.set()
+        self._flusher.join()
+        try:
+            self.flush()
+        except Exception:
+            logger.exception("ledger final flush failed")
+        if self._wal is not None:
+            self._wal.close()
@@ -2,6 +2,7 @@ import os
 import time
 import uuid
 import asyncio
+import threading
 import json
 import urllib.parse
 import sqlite3
@@ -15,10 +16,15 @@ from pydantic import BaseModel, Field
 from prometheus_client import Counter, Gauge, Histogram, generate_latest, CONTENT_TYPE_LATEST
 from fastapi.responses import Response, StreamingResponse
 from fastapi.staticfiles import StaticFiles
+from starlette.concurrency import run_in_threadpool
 from fastapi.responses import HTMLResponse
 from itsdangerous import URLSafeTimedSerializer, BadSignature, SignatureExpired
 
-from .db import initialize_database, borrow_license, return_license, get_status, update_budget_config, get_all_tools, get_overage_charges, get_all_tenants, get_vendor_customers, provision_license_to_tenant, create_tenant, create_vendor, get_all_vendors, delete_tenant, delete_vendor, get_connection, verify_user_credentials, get_password_context
+from .wire import MessagePackMiddleware
+from .borrow_queue import BorrowQueue
+from .status_versions import StatusVersions
+from . import lease_tokens, ledger, shards
+from .db import initialize_database, borrow_license, return_license, get_status, update_budget_config, get_all_tools, get_overage_charges, get_all_tenants, get_vendor_customers, provision_license_to_tenant, create_tenant, create_vendor, get_all_vendors, delete_tenant, delete_vendor, get_connection, verify_user_credentials, get_password_context, get_lease_seconds
 
 # App version for observability/journey (surfaced in logs & API)
 APP_VERSION = os.getenv("APP_VERSION", "dev")
@@ -88,6 +94,9 @@ app = FastAPI(title="License Server", version="0.1.0")
 # Instrument FastAPI app with OpenTelemetry
 FastAPIInstrumentor.instrument_app(app)
 
+# MessagePack for clients that ask for it (Accept / Content-Type); JSON otherwise
+app.add_middleware(MessagePackMiddleware)
+
 # Session management
 SECRET_KEY = os.getenv("SESSION_SECRET_KEY", "change-me-in-production-please-use-a-secure-random-key")
 SESSION_COOKIE_NAME = "permetrix_session"
@@ -178,6 +187,9 @@ borrow_attempts = Counter("license_borrow_attempts_total", "Total borrow attempt
 borrow_successes = Counter("license_borrow_success_total", "Total successful borrows", ["tool", "user"]) 
 borrow_failures = Counter("license_borrow_failure_total", "Total failed borrow attempts", ["tool", "reason"]) 
 borrow_duration = Histogram("license_borrow_duration_seconds", "Borrow operation duration", ["tool"]) 
+borrow_wait_duration = Histogram("license_borrow_wait_seconds", "Time blocking borrows spent queued for a seat", ["tool"], buckets=(0.01, 0.1, 0.5, 1, 5, 15, 30, 60, 120, 300, 600))
+shard_redirects = Counter("license_shard_redirects_total", "Requests redirected to the shard owning their tool", ["route"])
+borrow_waiters_gauge = Gauge("license_borrow_waiters", "Blocking borrows waiting for a seat per tool", ["tool"])
 borrowed_gauge = Gauge("licenses_borrowed", "Currently borrowed licenses per tool", ["tool"]) 
 total_licenses_gauge = Gauge("licenses_total", "Total licenses available per tool", ["tool"])
 overage_gauge = Gauge("licenses_overage", "Current overage count per tool", ["tool"])
@@ -446,17 +458,73 @@ class BorrowRequest(BaseModel):
     user: str = Field(..., min_length=1)
 
 
+class BorrowWaitRequest(BaseModel):
+    tool: str = Field(..., min_length=1)
+    user: str = Field(..., min_length=1)
+    # How long to wait for a seat; capped at MAX_BORROW_WAIT_MS
+    timeout_ms: int = Field(30_000, ge=0)
+
+
 class BorrowResponse(BaseModel):
     id: str
     tool: str
     user: str
     borrowed_at: str
+    # Seconds until the borrow is reclaimed unless renewed; 0 = never expires
+    lease_seconds: int = 0
+    # Signed token letting the client reuse the seat offline (see app/lease_tokens.py)
+    lease_token: Optional[str] = None
 
 
 class ReturnRequest(BaseModel):
     id: str = Field(..., min_length=1)
 
 
+# Upper bound on seats per batch request (one transaction, one signature)
+MAX_BATCH_SIZE = 500
+
+
+class BatchBorrowRequest(BaseModel):
+    tool: str = Field(..., min_length=1)
+    user: str = Field(..., min_length=1)
+    count: int = Field(..., ge=1, le=MAX_BATCH_SIZE)
+
+
+class BatchBorrowItem(BaseModel):
+    id: str
+    is_overage: bool
+
+
+class BatchBorrowResponse(BaseModel):
+    tool: str
+    user: str
+    borrowed_at: str
+    requested: int
+    granted: int
+    borrows: List[BatchBorrowItem]
+    reason: Optional[str] = None
+    lease_seconds: int = 0
+
+
+class BatchReturnRequest(BaseModel):
+    ids: List[str] = Field(..., min_length=1, max_length=MAX_BATCH_SIZE)
+
+
+class BatchReturnResponse(BaseModel):
+    returned: List[str]
+    not_found: List[str]
+
+
+class RenewRequest(BaseModel):
+    ids: List[str] = Field(..., min_length=1, max_length=MAX_BATCH_SIZE)
+
+
+class RenewResponse(BaseModel):
+    renewed: List[str]
+    not_found: List[str]
+    lease_seconds: int
+
+
 class StatusResponse(BaseModel):
     tool: str
     total: int
@@ -472,6 +540,13 @@ class StatusResponse(BaseModel):
     total_cost: float = 0.0
 
 
+class StatusDelta(BaseModel):
+    version: str
+    full: bool
+    changed: List[StatusResponse]
+    removed: List[str]
+
+
 class BorrowRecord(BaseModel):
     id: str
     tool: str
@@ -545,12 +620,20 @@ def startup_event() -> None:
     else:
         initialize_database()
         logger.info("database initialized without seed data")
+    lease_seconds = get_lease_seconds()
+    if lease_seconds > 0:
+        # Sweep often enough that a lapsed lease is freed within a quarter lease
+        interval = max(1.0, min(30.0, lease_seconds / 4))
+        threading.Thread(target=_lease_sweeper, args=(interval,), daemon=True, name="lease-sweeper").start()
+        logger.info("leases enabled lease_seconds=%d sweep_interval=%.1f", lease_seconds, interval)
     logger.info("app_version=%s", APP_VERSION)
 
 
-@app.post("/licenses/borrow", response_model=BorrowResponse)
-def borrow(req: BorrowRequest, request: Request):
-    # Validate HMAC signature
+def authorize_client_request(request: Request, tool: str, user: str) -> str:
+    """Validate API key and HMAC signature for a borrow-type request.
+
+    Raises HTTPException(403) on failure and returns the API key (may be empty).
+    """
     from app.security import validate_signature
     # Extract API key from Authorization header (Bearer <key>)
     auth_header = request.headers.get("Authorization", "")
@@ -586,7 +669,7 @@ def borrow(req: BorrowRequest, request: Request):
     
     if has_signature_headers:
         # API client with signature - validate it
-        is_valid, error_msg = validate_signature(request, req.tool, req.user, api_key=api_key, require=True)
+        is_valid, error_msg = validate_signature(request, tool, user, api_key=api_key, require=True)
         if not is_valid:
             logger.warning("Security check failed: %s", error_msg)
             raise HTTPException(status_code=403, detail=f"Security validation failed: {error_msg}")
@@ -595,40 +678,36 @@ def borrow(req: BorrowRequest, request: Request):
         logger.debug("Browser request detected, skipping signature validation")
     else:
         # Non-browser request without signature - require it
-        is_valid, error_msg = validate_signature(request, req.tool, req.user, api_key=api_key, require=True)
+        is_valid, error_msg = validate_signature(request, tool, user, api_key=api_key, require=True)
         if not is_valid:
             logger.warning("Security check failed: %s", error_msg)
             raise HTTPException(status_code=403, detail=f"Security validation failed: {error_msg}")
-    
-    start = time.perf_counter()
-    borrow_attempts.labels(req.tool, req.user).inc()
-    borrow_id = str(uuid.uuid4())
-    borrowed_at = datetime.now(timezone.utc).isoformat()
-    # Enforce spend protection before attempting overage borrows
-    # Check current status
-    status_snapshot = get_status(req.tool)
+    return api_key
+
+
+def check_spend_limit(tool: str, user: str) -> None:
+    """Enforce spend protection before attempting an overage borrow (403 when capped)."""
+    status_snapshot = get_status(tool)
     if status_snapshot:
         borrowed_now = int(status_snapshot["borrowed"])
         commit_now = int(status_snapshot["commit"])
-        overage_now = max(borrowed_now - commit_now, 0)
         will_be_overage = borrowed_now >= commit_now
         if will_be_overage:
             from .db import get_customer_max_spend, get_month_to_date_overage_cost
-            max_spend = get_customer_max_spend(req.tool)
+            max_spend = get_customer_max_spend(tool)
             if max_spend is not None:
-                current_cost = get_month_to_date_overage_cost(req.tool)
+                current_cost = get_month_to_date_overage_cost(tool)
                 # Estimated next overage cost
                 next_cost = float(status_snapshot.get("overage_price_per_license", 0.0))
                 if current_cost + next_cost > max_spend:
-                    logger.warning("borrow blocked by max spend tool=%s user=%s cost=%.2f next=%.2f cap=%.2f", req.tool, req.user, current_cost, next_cost, max_spend)
+                    logger.warning("borrow blocked by max spend tool=%s user=%s cost=%.2f next=%.2f cap=%.2f", tool, user, current_cost, next_cost, max_spend)
                     raise HTTPException(status_code=403, detail="Customer max spend reached for this period")
 
-    ok, is_overage = borrow_license(req.tool, req.user, borrow_id, borrowed_at)
-    duration = time.perf_counter() - start
-    borrow_duration.labels(req.tool).observe(duration)
-    if not ok:
-        # record failure reason
-        status = get_status(req.tool)
+
+def record_borrow_failure(tool: str, user: str, reason: Optional[str] = None) -> None:
+    """Count a refused borrow, deriving the reason from the tool's status unless given."""
+    if reason is None:
+        status = get_status(tool)
         reason = "unknown"
         if status is None:
             reason = "unknown_tool"
@@ -636,32 +715,241 @@ def borrow(req: BorrowRequest, request: Request):
             reason = "exhausted"
         elif status["overage"] >= status["max_overage"]:
             reason = "max_overage"
-        borrow_failures.labels(req.tool, reason).inc()
-        # Record failure in real-time buffer
-        realtime_buffer.add_failure(req.tool, req.user, reason)
-        logger.warning("borrow failed tool=%s user=%s reason=%s", req.tool, req.user, reason)
-        raise HTTPException(status_code=409, detail=f"No licenses available for {req.tool}")
-    # update gauges
-    status = get_status(req.tool)
+    borrow_failures.labels(tool, reason).inc()
+    # Record failure in real-time buffer
+    realtime_buffer.add_failure(tool, user, reason)
+    logger.warning("borrow failed tool=%s user=%s reason=%s", tool, user, reason)
+
+
+def complete_borrow(tool: str, user: str, borrow_id: str, borrowed_at: str, is_overage: bool) -> BorrowResponse:
+    """Record a granted borrow (gauges, counters, real-time buffer) and build its response."""
+    status = get_status(tool)
     if status:
-        borrowed_gauge.labels(req.tool).set(status["borrowed"])
-        total_licenses_gauge.labels(req.tool).set(status["total"])
-        overage_gauge.labels(req.tool).set(status["overage"])
-        commit_gauge.labels(req.tool).set(status["commit"])
-        max_overage_gauge.labels(req.tool).set(status["max_overage"])
-        at_max_overage_gauge.labels(req.tool).set(1 if status["overage"] >= status["max_overage"] else 0)
-    borrow_successes.labels(req.tool, req.user).inc()
+        update_tool_gauges(tool, status)
+    borrow_successes.labels(tool, user).inc()
     
     # Track overage checkouts
     if is_overage:
-        overage_checkouts.labels(req.tool, req.user).inc()
+        overage_checkouts.labels(tool, user).inc()
     
     # Record in real-time buffer
-    realtime_buffer.add_borrow(req.tool, req.user, is_overage, borrow_id)
+    realtime_buffer.add_borrow(tool, user, is_overage, borrow_id)
     
     overage_str = " (overage)" if is_overage else ""
-    logger.info("borrow success tool=%s user=%s id=%s borrowed=%d/%d%s", req.tool, req.user, borrow_id, status["borrowed"], status["total"] if status else -1, overage_str)
-    return BorrowResponse(id=borrow_id, tool=req.tool, user=req.user, borrowed_at=borrowed_at)
+    logger.info("borrow success tool=%s user=%s id=%s borrowed=%d/%d%s", tool, user, borrow_id, status["borrowed"] if status else -1, status["total"] if status else -1, overage_str)
+    lease_seconds = get_lease_seconds()
+    return BorrowResponse(
+        id=borrow_id,
+        tool=tool,
+        user=user,
+        borrowed_at=borrowed_at,
+        lease_seconds=lease_seconds,
+        lease_token=lease_tokens.issue(borrow_id, tool, user, lease_seconds),
+    )
+
+
+def redirect_to_shard(request: Request, node_id: str) -> None:
+    """Send the client to the node that owns what it asked for (307 keeps method and body)."""
+    url = shards.current().urls[node_id] + request.url.path
+    if request.url.query:
+        url += "?" + request.url.query
+    shard_redirects.labels(request.url.path).inc()
+    raise HTTPException(status_code=307, detail=f"Owned by shard {node_id}", headers={"Location": url})
+
+
+def route_tool(request: Request, tool: str) -> None:
+    """Redirect requests for a tool whose seats another shard owns (see app/shards.py)."""
+    shard_map = shards.current()
+    if shard_map is not None and not shard_map.owns(tool):
+        redirect_to_shard(request, shard_map.owner(tool))
+
+
+def check_borrows_owned(borrow_ids: List[str]) -> None:
+    """Refuse a batch naming borrows of other shards (421); its sender routes by /cluster/shards."""
+    shard_map = shards.current()
+    if shard_map is None:
+        return
+    foreign = [borrow_id for borrow_id in borrow_ids if shard_map.borrow_owner(borrow_id) != shard_map.self_id]
+    if foreign:
+        raise HTTPException(status_code=421, detail=f"{len(foreign)} borrows belong to other shards, e.g. {foreign[0]}")
+
+
+def owned_tools(statuses: list) -> list:
+    """Drop tools this shard does not own; their counts live on their owner."""
+    shard_map = shards.current()
+    if shard_map is None:
+        return statuses
+    return [s for s in statuses if shard_map.owns(s["tool"])]
+
+
+@app.get("/cluster/shards")
+def cluster_shards():
+    """The hash ring mapping tools to nodes, for clients that route by themselves."""
+    shard_map = shards.current()
+    if shard_map is None:
+        raise HTTPException(status_code=404, detail="Sharding is not enabled")
+    return shard_map.document()
+
+
+@app.post("/licenses/borrow", response_model=BorrowResponse)
+def borrow(req: BorrowRequest, request: Request):
+    route_tool(request, req.tool)
+    authorize_client_request(request, req.tool, req.user)
+    
+    start = time.perf_counter()
+    borrow_attempts.labels(req.tool, req.user).inc()
+    borrow_id = shards.new_borrow_id()
+    borrowed_at = datetime.now(timezone.utc).isoformat()
+    check_spend_limit(req.tool, req.user)
+
+    # Seats freed while others wait for this tool are theirs first
+    queued = borrow_queue.has_waiters(req.tool)
+    ok, is_overage = (False, False) if queued else borrow_license(req.tool, req.user, borrow_id, borrowed_at)
+    duration = time.perf_counter() - start
+    borrow_duration.labels(req.tool).observe(duration)
+    if not ok:
+        record_borrow_failure(req.tool, req.user, "queued" if queued else None)
+        raise HTTPException(status_code=409, detail=f"No licenses available for {req.tool}")
+    return complete_borrow(req.tool, req.user, borrow_id, borrowed_at, is_overage)
+
+
+def grant_waiting_borrow(tool: str, user: str) -> Optional[BorrowResponse]:
+    """Borrow a seat for a queued waiter; None while the tool has no free seat."""
+    check_spend_limit(tool, user)
+    borrow_id = shards.new_borrow_id()
+    borrowed_at = datetime.now(timezone.utc).isoformat()
+    ok, is_overage = borrow_license(tool, user, borrow_id, borrowed_at)
+    if not ok:
+        if get_status(tool) is None:
+            # Waiting will not make an unknown tool appear
+            raise HTTPException(status_code=409, detail=f"No licenses available for {tool}")
+        return None
+    return complete_borrow(tool, user, borrow_id, borrowed_at, is_overage)
+
+
+borrow_queue = BorrowQueue(grant_waiting_borrow)
+status_versions = StatusVersions()
+
+# Longest a single wait request may block, and how often a waiter re-checks
+# for seats freed by paths that do not dispatch the queue (e.g. admin edits)
+MAX_BORROW_WAIT_MS = 600_000
+BORROW_WAIT_RECHECK_SECONDS = 5.0
+
+
+@app.post("/licenses/borrow/wait", response_model=BorrowResponse)
+async def borrow_wait(req: BorrowWaitRequest, request: Request):
+    """Borrow a seat, waiting up to timeout_ms for one to be returned.
+
+    Waiters are served in arrival order as seats come back (see
+    app/borrow_queue.py); 409 when the wait runs out. Signed like a borrow.
+    """
+    route_tool(request, req.tool)
+    await run_in_threadpool(authorize_client_request, request, req.tool, req.user)
+    
+    start = time.perf_counter()
+    borrow_attempts.labels(req.tool, req.user).inc()
+    waiter = borrow_queue.enqueue(req.tool, req.user)
+    borrow_waiters_gauge.labels(req.tool).inc()
+    try:
+        # Seats may be free already; earlier waiters still go first
+        await run_in_threadpool(borrow_queue.dispatch, req.tool)
+        deadline = time.monotonic() + min(req.timeout_ms, MAX_BORROW_WAIT_MS) / 1000.0
+        while not waiter.done:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                break
+            try:
+                await asyncio.wait_for(waiter.event.wait(), min(remaining, BORROW_WAIT_RECHECK_SECONDS))
+            except asyncio.TimeoutError:
+                await run_in_threadpool(borrow_queue.dispatch, req.tool)
+    except BaseException:
+        if not borrow_queue.cancel(waiter) and waiter.result is not None:
+            # Granted as the request was torn down: give the seat back
+            release_borrow(waiter.result.id)
+        raise
+    finally:
+        borrow_waiters_gauge.labels(req.tool).dec()
+    
+    borrow_wait_duration.labels(req.tool).observe(time.perf_counter() - start)
+    if borrow_queue.cancel(waiter):
+        record_borrow_failure(req.tool, req.user, "wait_timeout")
+        raise HTTPException(status_code=409, detail=f"No licenses available for {req.tool}")
+    if waiter.error is not None:
+        raise waiter.error
+    return waiter.result
+
+
+@app.post("/licenses/borrow/batch", response_model=BatchBorrowResponse)
+def borrow_batch(req: BatchBorrowRequest, request: Request):
+    """Borrow up to `count` seats of one tool in a single signed request.
+
+    The batch is admitted in one DB transaction. Seats are granted until a
+    limit is hit; the response reports how many were granted and why the
+    rest were not (partial success is a 200, not a 409).
+    """
+    route_tool(request, req.tool)
+    authorize_client_request(request, req.tool, req.user)
+    
+    start = time.perf_counter()
+    borrow_attempts.labels(req.tool, req.user).inc(req.count)
+    borrowed_at = datetime.now(timezone.utc).isoformat()
+    
+    # Spend protection: cap how many overage seats this batch may take
+    max_overage_grants = None
+    status_snapshot = get_status(req.tool)
+    if status_snapshot:
+        from .db import get_customer_max_spend, get_month_to_date_overage_cost
+        max_spend = get_customer_max_spend(req.tool)
+        price = float(status_snapshot.get("overage_price_per_license", 0.0))
+        if max_spend is not None and price > 0:
+            remaining = max_spend - get_month_to_date_overage_cost(req.tool)
+            max_overage_grants = max(int(remaining // price), 0)
+    
+    from .db import borrow_licenses_batch
+    if borrow_queue.has_waiters(req.tool):
+        # As for single borrows: queued waiters get freed seats first
+        granted, reason = [], "queued"
+    else:
+        granted, reason = borrow_licenses_batch(req.tool, req.user, req.count, borrowed_at, max_overage_grants,
+                                                 shards.new_borrow_id)
+    duration = time.perf_counter() - start
+    borrow_duration.labels(req.tool).observe(duration)
+    
+    for borrow_id, is_overage in granted:
+        if is_overage:
+            overage_checkouts.labels(req.tool, req.user).inc()
+        realtime_buffer.add_borrow(req.tool, req.user, is_overage, borrow_id)
+    if granted:
+        borrow_successes.labels(req.tool, req.user).inc(len(granted))
+    denied = req.count - len(granted)
+    if denied:
+        borrow_failures.labels(req.tool, reason or "unknown").inc(denied)
+        realtime_buffer.add_failure(req.tool, req.user, reason or "unknown")
+    
+    status = get_status(req.tool)
+    if status:
+        update_tool_gauges(req.tool, status)
+    
+    logger.info("batch borrow tool=%s user=%s requested=%d granted=%d reason=%s", req.tool, req.user, req.count, len(granted), reason or "none")
+    return BatchBorrowResponse(
+        tool=req.tool,
+        user=req.user,
+        borrowed_at=borrowed_at,
+        requested=req.count,
+        granted=len(granted),
+        borrows=[BatchBorrowItem(id=borrow_id, is_overage=is_overage) for borrow_id, is_overage in granted],
+        reason=reason,
+        lease_seconds=get_lease_seconds(),
+    )
+
+
+def update_tool_gauges(tool: str, status: dict) -> None:
+    borrowed_gauge.labels(tool).set(status["borrowed"])
+    total_licenses_gauge.labels(tool).set(status["total"])
+    overage_gauge.labels(tool).set(status["overage"])
+    commit_gauge.labels(tool).set(status["commit"])
+    max_overage_gauge.labels(tool).set(status["max_overage"])
+    at_max_overage_gauge.labels(tool).set(1 if status["overage"] >= status["max_overage"] else 0)
 
 
 @app.get("/faulty")
@@ -672,44 +960,129 @@ def faulty() -> Dict[str, str]:
     raise HTTPException(status_code=500, detail="Simulated failure")
 
 
-@app.post("/licenses/return")
-def return_(req: ReturnRequest) -> Dict[str, str]:
-    tool = return_license(req.id)
+def release_borrow(borrow_id: str) -> Optional[str]:
+    """Return one borrow and hand its seat to the next waiter; the tool, or None if unknown."""
+    tool = return_license(borrow_id)
     if tool is None:
-        logger.warning("return failed id=%s not_found=1", req.id)
-        raise HTTPException(status_code=404, detail="Borrow record not found")
+        return None
     
     # Record in real-time buffer
-    realtime_buffer.add_return(req.id)
+    realtime_buffer.add_return(borrow_id)
+    borrow_queue.dispatch(tool)
     
     status = get_status(tool)
     if status:
-        borrowed_gauge.labels(tool).set(status["borrowed"])
-        total_licenses_gauge.labels(tool).set(status["total"])
-        overage_gauge.labels(tool).set(status["overage"])
-        commit_gauge.labels(tool).set(status["commit"])
-        max_overage_gauge.labels(tool).set(status["max_overage"])
-        at_max_overage_gauge.labels(tool).set(1 if status["overage"] >= status["max_overage"] else 0)
-    logger.info("return success id=%s tool=%s borrowed=%d/%d", req.id, tool, status["borrowed"] if status else -1, status["total"] if status else -1)
+        update_tool_gauges(tool, status)
+    logger.info("return success id=%s tool=%s borrowed=%d/%d", borrow_id, tool, status["borrowed"] if status else -1, status["total"] if status else -1)
+    return tool
+
+
+@app.post("/licenses/return")
+def return_(req: ReturnRequest, request: Request) -> Dict[str, str]:
+    shard_map = shards.current()
+    if shard_map is not None and shard_map.borrow_owner(req.id) != shard_map.self_id:
+        redirect_to_shard(request, shard_map.borrow_owner(req.id))
+    tool = release_borrow(req.id)
+    if tool is None:
+        logger.warning("return failed id=%s not_found=1", req.id)
+        raise HTTPException(status_code=404, detail="Borrow record not found")
     return {"status": "ok", "tool": tool}
 
 
+@app.post("/licenses/return/batch", response_model=BatchReturnResponse)
+def return_batch(req: BatchReturnRequest):
+    """Return many borrows in one DB transaction, reporting unknown ids."""
+    from .db import return_licenses_batch
+    check_borrows_owned(req.ids)
+    returned = return_licenses_batch(req.ids)
+    not_found = [borrow_id for borrow_id in dict.fromkeys(req.ids) if borrow_id not in returned]
+    
+    for borrow_id in returned:
+        realtime_buffer.add_return(borrow_id)
+    for tool in set(returned.values()):
+        borrow_queue.dispatch(tool)
+        status = get_status(tool)
+        if status:
+            update_tool_gauges(tool, status)
+    
+    if not_found:
+        logger.warning("batch return not_found=%d ids=%s", len(not_found), ",".join(not_found[:10]))
+    logger.info("batch return requested=%d returned=%d", len(req.ids), len(returned))
+    return BatchReturnResponse(returned=list(returned.keys()), not_found=not_found)
+
+
+@app.post("/licenses/renew", response_model=RenewResponse)
+def renew(req: RenewRequest):
+    """Extend the leases of many borrows in one DB transaction.
+
+    Clients holding seats for longer than LICENSE_LEASE_SECONDS call this
+    periodically; ids reported as not found were already reclaimed.
+    """
+    from .db import renew_leases
+    check_borrows_owned(req.ids)
+    renewed = set(renew_leases(req.ids))
+    not_found = [borrow_id for borrow_id in dict.fromkeys(req.ids) if borrow_id not in renewed]
+    if not_found:
+        logger.warning("renew not_found=%d ids=%s", len(not_found), ",".join(not_found[:10]))
+    logger.debug("renew requested=%d renewed=%d", len(req.ids), len(renewed))
+    return RenewResponse(renewed=list(renewed), not_found=not_found, lease_seconds=get_lease_seconds())
+
+
+def reclaim_expired_borrows() -> int:
+    """Release borrows whose lease ran out; returns how many were reclaimed."""
+    from .db import reclaim_expired_leases
+    reclaimed = reclaim_expired_leases()
+    for borrow_id in reclaimed:
+        realtime_buffer.add_return(borrow_id)
+    for tool in set(reclaimed.values()):
+        borrow_queue.dispatch(tool)
+        status = get_status(tool)
+        if status:
+            update_tool_gauges(tool, status)
+    if reclaimed:
+        logger.warning("lease expired reclaimed=%d ids=%s", len(reclaimed), ",".join(list(reclaimed)[:10]))
+    return len(reclaimed)
+
+
+def _lease_sweeper(interval: float) -> None:
+    while True:
+        time.sleep(interval)
+        try:
+            reclaim_expired_borrows()
+        except Exception:
+            logger.exception("lease sweep failed")
+
+
+@app.get("/licenses/token-key")
+def lease_token_key():
+    """Public key that verifies borrow lease tokens, for provisioning clients."""
+    pem = lease_tokens.public_key_pem()
+    if pem is None:
+        raise HTTPException(status_code=404, detail="Lease tokens are not enabled")
+    return {"kid": lease_tokens.KEY_ID, "public_key": pem}
+
+
 @app.get("/licenses/{tool}/status", response_model=StatusResponse)
-def status(tool: str):
+def status(tool: str, request: Request):
+    route_tool(request, tool)
     s = get_status(tool)
     if s is None:
         raise HTTPException(status_code=404, detail="Tool not found")
     return StatusResponse(**s)
 
 
-@app.get("/licenses/status", response_model=List[StatusResponse])
-def status_all():
+def current_statuses() -> List[dict]:
+    """Every tool's StatusResponse fields, ordered by tool."""
     from .db import get_connection
+    seat_ledger = ledger.active_ledger()
+    if seat_ledger is not None:
+        # Answered from memory; the database trails the ledger
+        return owned_tools([s for s in map(seat_ledger.status, seat_ledger.tools()) if s is not None])
     with get_connection(True) as conn:
         cur = conn.cursor()
         cur.execute("SELECT tool, total, borrowed, commit_qty, max_overage, commit_price, overage_price_per_license FROM licenses ORDER BY tool ASC")
         rows = cur.fetchall()
-        result: List[StatusResponse] = []
+        result: List[dict] = []
         for r in rows:
             total = int(r["total"])
             borrowed = int(r["borrowed"])
@@ -725,7 +1098,7 @@ def status_all():
             current_overage_cost = overage_charges_count * overage_price
             total_cost = commit_price + current_overage_cost
             
-            result.append(StatusResponse(
+            result.append(dict(
                 tool=r["tool"],
                 total=total,
                 borrowed=borrowed,
@@ -739,7 +1112,27 @@ def status_all():
                 current_overage_cost=current_overage_cost,
                 total_cost=total_cost
             ))
-        return result
+        return owned_tools(result)
+
+
+@app.get("/licenses/status", response_model=List[StatusResponse])
+def status_all(request: Request, response: Response):
+    """Every tool's status. The ETag is the list's version; If-None-Match with it answers 304 until a count moves."""
+    statuses = current_statuses()
+    etag = f'"{status_versions.observe(statuses)}"'
+    if request.headers.get("if-none-match") == etag:
+        return Response(status_code=304, headers={"ETag": etag})
+    response.headers["ETag"] = etag
+    return [StatusResponse(**s) for s in statuses]
+
+
+@app.get("/licenses/status/delta", response_model=StatusDelta)
+def status_delta(since: Optional[str] = None):
+    """
+    Tools whose status changed after version @p since (app/status_versions.py),
+    and tools removed since. Without a known since, the full list (full=true).
+    """
+    return status_versions.changes(current_statuses(), since)
 
 
 @app.get("/metrics")
@@ -788,8 +1181,14 @@ def realtime_stats(window: int = 60):
 
 
 @app.get("/realtime/stream")
-async def realtime_stream(request: Request):
-    """Server-Sent Events stream for real-time metrics"""
+async def realtime_stream(request: Request, view: str = "full"):
+    """Server-Sent Events stream for real-time metrics
+
+    `view=status` sends only the per-tool status list (what client status
+    caches consume) and skips the dashboard rates, events and history.
+    """
+    status_only = view == "status"
+    
     async def event_generator():
         last_sent = time.time()
         
@@ -805,7 +1204,7 @@ async def realtime_stream(request: Request):
                 # Get current status for all tools
                 status_all_tools = []
                 try:
-                    tools = get_all_tools()
+                    tools = owned_tools(get_all_tools())
                     for tool_data in tools:
                         s = get_status(tool_data["tool"])
                         if s:
@@ -813,6 +1212,16 @@ async def realtime_stream(request: Request):
                 except Exception as e:
                     logger.error(f"Error getting status in realtime stream: {e}")
                 
+                if status_only:
+                    data = {
+                        "timestamp": datetime.now(timezone.utc).isoformat(),
+                        "tools": status_all_tools,
+                    }
+                    yield f"data: {json.dumps(data)}\n\n"
+                    last_sent = now
+                    await asyncio.sleep(0.1)
+                    continue
+                
                 # Get recent events (last 60 seconds for rate calculation)
                 recent_60s = realtime_buffer.get_recent_events(60)
                 
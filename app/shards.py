@@ -0,0 +1,150 @@
+"""
+Consistent-hash sharding of seat admission across server instances.
+
+Every tool is owned by exactly one node of the cluster. Only the owner admits
+borrows of the tool and keeps them, in its own database (and ledger, see
+app/ledger.py), so nodes never coordinate and add capacity linearly. Owners
+are found on a hash ring: each node sits at VNODES points, and a tool belongs
+to the node at the first point at or after the tool's hash. Adding or removing
+a node therefore moves only about 1/N of the tools.
+
+Borrow IDs issued by a sharded node start with its node ID ("a.<uuid>"), so a
+return or renewal can be routed without knowing the tool, even after the tool
+has moved to another owner.
+
+A request for a tool (or borrow) owned elsewhere is redirected to the owner
+with 307, which keeps the method and body; batch returns and renewals naming
+borrows of other nodes are refused with 421. Clients that read the ring from
+GET /cluster/shards send each request to the owner directly.
+
+Seats borrowed on a node stay counted there only. When a tool moves to a new
+owner its outstanding borrows are still returned to the old one, but the new
+owner starts admitting from zero, so change the node list while the affected
+tools are quiet.
+
+Hash: the first 8 bytes of SHA-1, big-endian. Node n's points are the hashes
+of "n#0" ... "n#<VNODES-1>"; a tool's is the hash of its name.
+
+Configuration:
+- LICENSE_SHARD_NODES: every node as "id=url,id=url,...", the same on all nodes
+- LICENSE_SHARD_SELF: this node's id
+Sharding is off unless both are set. Node IDs are letters, digits, '-' and '_'.
+"""
+
+import bisect
+import hashlib
+import logging
+import os
+import re
+import threading
+import uuid
+from typing import Dict, List, Optional, Tuple
+
+logger = logging.getLogger(__name__)
+
+VNODES = 64
+_NODE_ID = re.compile(r"^[A-Za-z0-9_-]+$")
+
+
+def ring_hash(key: str) -> int:
+    return int.from_bytes(hashlib.sha1(key.encode("utf-8")).digest()[:8], "big")
+
+
+class ShardMap:
+    def __init__(self, nodes: List[Tuple[str, str]], self_id: str):
+        """@p nodes is [(id, base url)], in configuration order."""
+        self.nodes = nodes
+        self.self_id = self_id
+        self.urls: Dict[str, str] = dict(nodes)
+        points = sorted((ring_hash(f"{node_id}#{i}"), node_id) for node_id, _ in nodes for i in range(VNODES))
+        self._hashes = [h for h, _ in points]
+        self._owners = [node_id for _, node_id in points]
+        self.points = points
+        # Identifies the ring, so clients can tell when theirs is out of date
+        self.version = hashlib.sha1(",".join(f"{i}={u}" for i, u in nodes).encode("utf-8")).hexdigest()[:16]
+
+    def owner(self, tool: str) -> str:
+        i = bisect.bisect_left(self._hashes, ring_hash(tool))
+        return self._owners[i % len(self._owners)]
+
+    def owns(self, tool: str) -> bool:
+        return self.owner(tool) == self.self_id
+
+    def borrow_owner(self, borrow_id: str) -> str:
+        """Node that issued @p borrow_id; this one for IDs without a node prefix."""
+        prefix, sep, _ = borrow_id.partition(".")
+        return prefix if sep and prefix in self.urls else self.self_id
+
+    def new_borrow_id(self) -> str:
+        return f"{self.self_id}.{uuid.uuid4()}"
+
+    def document(self) -> dict:
+        """GET /cluster/shards body."""
+        return {
+            "version": self.version,
+            "self": self.self_id,
+            "hash": "sha1-64",
+            "vnodes": VNODES,
+            "nodes": [{"id": node_id, "url": url} for node_id, url in self.nodes],
+            "ring": [[h, node_id] for h, node_id in self.points],
+        }
+
+
+def parse_nodes(spec: str) -> List[Tuple[str, str]]:
+    nodes = []
+    for item in spec.split(","):
+        item = item.strip()
+        if not item:
+            continue
+        node_id, sep, url = item.partition("=")
+        node_id, url = node_id.strip(), url.strip().rstrip("/")
+        if not sep or not _NODE_ID.match(node_id) or not url:
+            raise ValueError(f"invalid shard node {item!r}; expected id=url")
+        nodes.append((node_id, url))
+    return nodes
+
+
+_lock = threading.Lock()
+_loaded = False
+_map: Optional[ShardMap] = None
+
+
+def _load() -> Optional[ShardMap]:
+    spec = os.getenv("LICENSE_SHARD_NODES", "")
+    self_id = os.getenv("LICENSE_SHARD_SELF", "")
+    if not spec or not self_id:
+        return None
+    try:
+        nodes = parse_nodes(spec)
+    except ValueError as exc:
+        logger.error("sharding disabled: %s", exc)
+        return None
+    if self_id not in dict(nodes):
+        logger.error("sharding disabled: LICENSE_SHARD_SELF=%s is not in LICENSE_SHARD_NODES", self_id)
+        return None
+    shard_map = ShardMap(nodes, self_id)
+    logger.info("sharding enabled self=%s nodes=%d version=%s", self_id, len(nodes), shard_map.version)
+    return shard_map
+
+
+def current() -> Optional[ShardMap]:
+    """The cluster's shard map; None when sharding is off."""
+    global _loaded, _map
+    if not _loaded:
+        with _lock:
+            if not _loaded:
+                _map = _load()
+                _loaded = True
+    return _map
+
+
+def reset() -> None:
+    """Forget the loaded map, so the next call re-reads the environment (tests)."""
+    global _loaded, _map
+    with _lock:
+        _loaded, _map = False, None
+
+
+def new_borrow_id() -> str:
+    shard_map = current()
+    return shard_map.new_borrow_id() if shard_map is not None else str(uuid.uuid4())
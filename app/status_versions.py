@@ -0,0 +1,83 @@
+"""
+Versions of the status list, for clients that poll it.
+
+GET /licenses/status is the whole list, hundreds of tools for a large
+tenant, though between two polls usually only a few counts move. Each time
+the list is read it is compared with the previous read; every tool that
+differs (or appeared, or vanished) gets the next version number. A client
+that knows version V then needs only the tools changed after V: that is
+GET /licenses/status/delta?since=V, and an If-None-Match of the list's
+ETag answers 304 while nothing changed.
+
+Versions are "<epoch>.<n>". The epoch is drawn at startup, so a version
+from before a restart (or from another node) is not mistaken for a current
+one; the answer is then the full list. Changes are found when the list is
+read, not when seats move, so nothing on the borrow path pays for this.
+"""
+
+import threading
+import uuid
+from typing import Dict, List, Optional, Tuple
+
+
+class StatusVersions:
+    def __init__(self):
+        self.epoch = uuid.uuid4().hex[:8]
+        self._lock = threading.Lock()
+        self._version = 0
+        # tool -> (status as last read, version it last changed at)
+        self._seen: Dict[str, Tuple[dict, int]] = {}
+        # tool -> version it vanished at
+        self._removed: Dict[str, int] = {}
+
+    def _token(self, n: int) -> str:
+        return f"{self.epoch}.{n}"
+
+    def _parse(self, version: Optional[str]) -> Optional[int]:
+        """The counter of one of our own versions; None for anything else."""
+        if not version:
+            return None
+        epoch, sep, n = version.partition(".")
+        if not sep or epoch != self.epoch or not n.isdigit() or int(n) > self._version:
+            return None
+        return int(n)
+
+    def observe(self, statuses: List[dict]) -> str:
+        """Record a fresh read of the list; returns its version."""
+        with self._lock:
+            self._record(statuses)
+            return self._token(self._version)
+
+    def _record(self, statuses: List[dict]) -> None:
+        current = {s["tool"]: s for s in statuses}
+        changed = [tool for tool, s in current.items()
+                   if tool not in self._seen or self._seen[tool][0] != s]
+        gone = [tool for tool in self._seen if tool not in current]
+        if not changed and not gone:
+            return
+        self._version += 1
+        for tool in changed:
+            self._seen[tool] = (current[tool], self._version)
+            self._removed.pop(tool, None)
+        for tool in gone:
+            del self._seen[tool]
+            self._removed[tool] = self._version
+
+    def changes(self, statuses: List[dict], since: Optional[str]) -> dict:
+        """
+        Record a fresh read and return what changed after @p since:
+        {version, full, changed, removed}. full is True (and changed is
+        the whole list) when @p since is not a version of this list.
+        """
+        with self._lock:
+            self._record(statuses)
+            base = self._parse(since)
+            if base is None:
+                return {"version": self._token(self._version), "full": True,
+                        "changed": list(statuses), "removed": []}
+            return {
+                "version": self._token(self._version),
+                "full": False,
+                "changed": [s for s in statuses if self._seen[s["tool"]][1] > base],
+                "removed": sorted(tool for tool, n in self._removed.items() if n > base),
+            }
@@ -0,0 +1,344 @@
+"""
+Compact wire encoding for the license API.
+
+Clients that send ``Accept: application/msgpack`` get MessagePack instead of
+JSON from every JSON endpoint, and may send MessagePack request bodies with
+``Content-Type: application/msgpack``. Endpoints keep speaking JSON; the
+middleware transcodes at the edge, so routes and response models are
+unchanged and JSON stays the default for everyone else.
+
+The codec covers the subset of MessagePack the API needs (nil, bool, int,
+float, str, bin, array, map) and has no third-party dependency.
+"""
+
+import json
+import struct
+from typing import Any, Tuple
+
+MSGPACK_MEDIA_TYPES = (b"application/msgpack", b"application/x-msgpack")
+MSGPACK_CONTENT_TYPE = b"application/msgpack"
+_MAX_DEPTH = 64
+
+
+class MessagePackError(ValueError):
+    """Raised for input that is not valid MessagePack."""
+
+
+def packb(obj: Any) -> bytes:
+    """Encode a JSON-compatible value as MessagePack."""
+    out = bytearray()
+    _pack(obj, out, 0)
+    return bytes(out)
+
+
+def _pack(obj: Any, out: bytearray, depth: int) -> None:
+    if depth > _MAX_DEPTH:
+        raise MessagePackError("nesting too deep")
+    if obj is None:
+        out.append(0xC0)
+    elif obj is True:
+        out.append(0xC3)
+    elif obj is False:
+        out.append(0xC2)
+    elif isinstance(obj, int):
+        _pack_int(obj, out)
+    elif isinstance(obj, float):
+        out.append(0xCB)
+        out += struct.pack(">d", obj)
+    elif isinstance(obj, str):
+        data = obj.encode("utf-8")
+        n = len(data)
+        if n < 32:
+            out.append(0xA0 | n)
+        elif n < 0x100:
+            out += struct.pack(">BB", 0xD9, n)
+        elif n < 0x10000:
+            out += struct.pack(">BH", 0xDA, n)
+        else:
+            out += struct.pack(">BI", 0xDB, n)
+        out += data
+    elif isinstance(obj, (bytes, bytearray)):
+        n = len(obj)
+        if n < 0x100:
+            out += struct.pack(">BB", 0xC4, n)
+        elif n < 0x10000:
+            out += struct.pack(">BH", 0xC5, n)
+        else:
+            out += struct.pack(">BI", 0xC6, n)
+        out += obj
+    elif isinstance(obj, (list, tuple)):
+        _pack_header(len(obj), out, 0x90, 0xDC, 0xDD)
+        for item in obj:
+            _pack(item, out, depth + 1)
+    elif isinstance(obj, dict):
+        _pack_header(len(obj), out, 0x80, 0xDE, 0xDF)
+        for key, value in obj.items():
+            _pack(key if isinstance(key, str) else str(key), out, depth + 1)
+            _pack(value, out, depth + 1)
+    else:
+        raise MessagePackError(f"cannot encode {type(obj).__name__}")
+
+
+def _pack_int(n: int, out: bytearray) -> None:
+    if 0 <= n < 0x80:
+        out.append(n)
+    elif -32 <= n < 0:
+        out.append(n & 0xFF)
+    elif 0 <= n < 0x100:
+        out += struct.pack(">BB", 0xCC, n)
+    elif 0 <= n < 0x10000:
+        out += struct.pack(">BH", 0xCD, n)
+    elif 0 <= n < 0x100000000:
+        out += struct.pack(">BI", 0xCE, n)
+    elif 0 <= n < 0x10000000000000000:
+        out += struct.pack(">BQ", 0xCF, n)
+    elif -0x80 <= n < 0:
+        out += struct.pack(">Bb", 0xD0, n)
+    elif -0x8000 <= n < 0:
+        out += struct.pack(">Bh", 0xD1, n)
+    elif -0x80000000 <= n < 0:
+        out += struct.pack(">Bi", 0xD2, n)
+    elif -0x8000000000000000 <= n < 0:
+        out += struct.pack(">Bq", 0xD3, n)
+    else:
+        raise MessagePackError("integer out of range")
+
+
+def _pack_header(n: int, out: bytearray, fix: int, marker16: int, marker32: int) -> None:
+    if n < 16:
+        out.append(fix | n)
+    elif n < 0x10000:
+        out += struct.pack(">BH", marker16, n)
+    else:
+        out += struct.pack(">BI", marker32, n)
+
+
+def unpackb(data: bytes) -> Any:
+    """Decode one MessagePack value; trailing bytes are an error."""
+    value, pos = _unpack(data, 0, 0)
+    if pos != len(data):
+        raise MessagePackError("trailing bytes")
+    return value
+
+
+def _take(data: bytes, pos: int, n: int) -> Tuple[bytes, int]:
+    end = pos + n
+    if end > len(data):
+        raise MessagePackError("unexpected end of input")
+    return data[pos:end], end
+
+
+def _unpack(data: bytes, pos: int, depth: int) -> Tuple[Any, int]:
+    if depth > _MAX_DEPTH:
+        raise MessagePackError("nesting too deep")
+    if pos >= len(data):
+        raise MessagePackError("unexpected end of input")
+    b = data[pos]
+    pos += 1
+    if b < 0x80:
+        return b, pos
+    if b >= 0xE0:
+        return b - 0x100, pos
+    if 0xA0 <= b <= 0xBF:
+        raw, pos = _take(data, pos, b & 0x1F)
+        return _decode_str(raw), pos
+    if 0x90 <= b <= 0x9F:
+        return _unpack_array(data, pos, b & 0x0F, depth)
+    if 0x80 <= b <= 0x8F:
+        return _unpack_map(data, pos, b & 0x0F, depth)
+    if b == 0xC0:
+        return None, pos
+    if b == 0xC2:
+        return False, pos
+    if b == 0xC3:
+        return True, pos
+    if b in _FIXED:
+        fmt, size = _FIXED[b]
+        raw, pos = _take(data, pos, size)
+        return struct.unpack(fmt, raw)[0], pos
+    if b in _SIZED:
+        kind, size = _SIZED[b]
+        raw, pos = _take(data, pos, size)
+        n = int.from_bytes(raw, "big")
+        if kind == "array":
+            return _unpack_array(data, pos, n, depth)
+        if kind == "map":
+            return _unpack_map(data, pos, n, depth)
+        raw, pos = _take(data, pos, n)
+        return (_decode_str(raw) if kind == "str" else raw), pos
+    raise MessagePackError(f"unsupported type byte 0x{b:02x}")
+
+
+_FIXED = {
+    0xCA: (">f", 4), 0xCB: (">d", 8),
+    0xCC: (">B", 1), 0xCD: (">H", 2), 0xCE: (">I", 4), 0xCF: (">Q", 8),
+    0xD0: (">b", 1), 0xD1: (">h", 2), 0xD2: (">i", 4), 0xD3: (">q", 8),
+}
+
+_SIZED = {
+    0xC4: ("bin", 1), 0xC5: ("bin", 2), 0xC6: ("bin", 4),
+    0xD9: ("str", 1), 0xDA: ("str", 2), 0xDB: ("str", 4),
+    0xDC: ("array", 2), 0xDD: ("array", 4),
+    0xDE: ("map", 2), 0xDF: ("map", 4),
+}
+
+
+def _decode_str(raw: bytes) -> str:
+    try:
+        return raw.decode("utf-8")
+    except UnicodeDecodeError:
+        raise MessagePackError("invalid UTF-8 in string") from None
+
+
+def _unpack_array(data: bytes, pos: int, n: int, depth: int) -> Tuple[list, int]:
+    items = []
+    for _ in range(n):
+        item, pos = _unpack(data, pos, depth + 1)
+        items.append(item)
+    return items, pos
+
+
+def _unpack_map(data: bytes, pos: int, n: int, depth: int) -> Tuple[dict, int]:
+    result = {}
+    for _ in range(n):
+        key, pos = _unpack(data, pos, depth + 1)
+        if not isinstance(key, str):
+            raise MessagePackError("map keys must be strings")
+        result[key], pos = _unpack(data, pos, depth + 1)
+    return result, pos
+
+
+def _media_type(value: bytes) -> bytes:
+    return value.split(b";", 1)[0].strip().lower()
+
+
+def accepts_msgpack(accept: bytes) -> bool:
+    """True if an Accept header lists MessagePack with a non-zero quality."""
+    for part in accept.split(b","):
+        media, _, params = part.partition(b";")
+        if media.strip().lower() not in MSGPACK_MEDIA_TYPES:
+            continue
+        for param in params.split(b";"):
+            name, _, value = param.partition(b"=")
+            if name.strip().lower() == b"q":
+                try:
+                    if float(value.strip()) == 0:
+                        break
+                except ValueError:
+                    break
+        else:
+            return True
+    return False
+
+
+def _replace_header(headers: list, name: bytes, value: bytes) -> list:
+    kept = [(k, v) for k, v in headers if k.lower() != name]
+    kept.append((name, value))
+    return kept
+
+
+class MessagePackMiddleware:
+    """
+    ASGI middleware that negotiates MessagePack for JSON endpoints.
+
+    Only complete ``application/json`` responses are re-encoded; streams
+    such as ``/realtime/stream`` and HTML pages pass through untouched.
+    """
+
+    def __init__(self, app):
+        self.app = app
+
+    async def __call__(self, scope, receive, send):
+        if scope["type"] != "http":
+            await self.app(scope, receive, send)
+            return
+
+        headers = scope.get("headers", [])
+        content_type = b""
+        accept = b""
+        for name, value in headers:
+            if name == b"content-type":
+                content_type = value
+            elif name == b"accept":
+                accept = value
+        encode_response = accepts_msgpack(accept)
+
+        if _media_type(content_type) in MSGPACK_MEDIA_TYPES:
+            chunks = []
+            while True:
+                message = await receive()
+                if message["type"] != "http.request":
+                    break
+                chunks.append(message.get("body", b""))
+                if not message.get("more_body", False):
+                    break
+            try:
+                body = json.dumps(unpackb(b"".join(chunks)), separators=(",", ":")).encode()
+            except (MessagePackError, ValueError) as e:
+                await self._send_error(send, 400, f"Invalid MessagePack body: {e}", encode_response)
+                return
+
+            headers = _replace_header(headers, b"content-type", b"application/json")
+            headers = _replace_header(headers, b"content-length", str(len(body)).encode())
+            scope = dict(scope, headers=headers)
+            delivered = False
+
+            async def receive_decoded():
+                nonlocal delivered
+                if not delivered:
+                    delivered = True
+                    return {"type": "http.request", "body": body, "more_body": False}
+                return await receive()
+
+            receive = receive_decoded
+
+        if not encode_response:
+            await self.app(scope, receive, send)
+            return
+
+        start = None
+        chunks = []
+
+        async def send_encoded(message):
+            nonlocal start
+            if message["type"] == "http.response.start":
+                response_type = b""
+                for name, value in message.get("headers", []):
+                    if name.lower() == b"content-type":
+                        response_type = value
+                if _media_type(response_type) == b"application/json":
+                    start = message
+                    return
+            elif message["type"] == "http.response.body" and start is not None:
+                chunks.append(message.get("body", b""))
+                if message.get("more_body", False):
+                    return
+                raw = b"".join(chunks)
+                try:
+                    body = packb(json.loads(raw)) if raw else raw
+                    content = MSGPACK_CONTENT_TYPE
+                except (MessagePackError, ValueError):
+                    body, content = raw, b"application/json"
+                response_headers = _replace_header(list(start.get("headers", [])), b"content-type", content)
+                response_headers = _replace_header(response_headers, b"content-length", str(len(body)).encode())
+                response_headers.append((b"vary", b"Accept"))
+                await send(dict(start, headers=response_headers))
+                await send({"type": "http.response.body", "body": body, "more_body": False})
+                return
+            await send(message)
+
+        await self.app(scope, receive, send_encoded)
+
+    @staticmethod
+    async def _send_error(send, status: int, detail: str, encode: bool):
+        payload = {"detail": detail}
+        if encode:
+            body, content = packb(payload), MSGPACK_CONTENT_TYPE
+        else:
+            body, content = json.dumps(payload).encode(), b"application/json"
+        await send({
+            "type": "http.response.start",
+            "status": status,
+            "headers": [(b"content-type", content), (b"content-length", str(len(body)).encode())],
+        })
+        await send({"type": "http.response.body", "body": body, "more_body": False})
@@ -4,195 +4,622 @@
  */
 
 #include "license_client.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <curl/curl.h>
+#include <pthread.h>
 
+/* Initial capacity of each context's response buffer; it grows as needed */
+#define RESPONSE_RESERVE 4096
+
+/* Configuration of the thread-default contexts, written in license_client_init */
 static char g_base_url[256] = {0};
-static char g_error_msg[512] = {0};
-static CURL *g_curl = NULL;
 static char g_api_key[256] = {0};
+static license_wire_format_t g_wire_format = LICENSE_WIRE_JSON;
+
+/* Errors and default contexts are per-thread so threads never share state */
+static _Thread_local char t_error_msg[512] = {0};
+static pthread_once_t g_init_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_client_key;
+static int g_init_status = -1;
 
+/* Growable byte buffer, kept for the life of its context */
 typedef struct {
     char *data;
     size_t size;
-} response_buffer_t;
+    size_t capacity;
+} buffer_t;
+
+/*
+ * One client context. Everything a request needs is kept between calls:
+ * the CURL handle (and its open connection), the request URLs, the
+ * header lists and the body and response buffers. Once the buffers have
+ * grown to fit, a request makes no allocation of its own.
+ */
+struct license_client {
+    CURL *curl;
+    license_wire_format_t wire_format;
+    char *base_url;
+    char *borrow_url;
+    char *return_url;
+    struct curl_slist *post_headers;
+    struct curl_slist *get_headers;
+    buffer_t url;
+    buffer_t body;
+    buffer_t response;
+    char error[512];
+};
+
+static void client_destructor(void *client) {
+    license_client_destroy((license_client_t *)client);
+}
+
+static void global_init_once(void) {
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+        return;
+    }
+    if (pthread_key_create(&g_client_key, client_destructor) != 0) {
+        return;
+    }
+    g_init_status = 0;
+}
+
+static int buffer_reserve(buffer_t *buf, size_t needed) {
+    if (needed <= buf->capacity) {
+        return 0;
+    }
+    size_t capacity = buf->capacity ? buf->capacity : 64;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    char *data = realloc(buf->data, capacity);
+    if (data == NULL) {
+        return -1;
+    }
+    buf->data = data;
+    buf->capacity = capacity;
+    return 0;
+}
+
+/* Append @p len bytes, keeping the contents NUL-terminated */
+static int buffer_append(buffer_t *buf, const char *bytes, size_t len) {
+    if (buffer_reserve(buf, buf->size + len + 1) != 0) {
+        return -1;
+    }
+    memcpy(buf->data + buf->size, bytes, len);
+    buf->size += len;
+    buf->data[buf->size] = '\0';
+    return 0;
+}
+
+static int buffer_append_str(buffer_t *buf, const char *str) {
+    return buffer_append(buf, str, strlen(str));
+}
+
+static void buffer_clear(buffer_t *buf) {
+    buf->size = 0;
+    if (buf->data) {
+        buf->data[0] = '\0';
+    }
+}
+
+/* Append @p value as a quoted JSON string */
+static int buffer_append_json(buffer_t *buf, const char *value) {
+    static const char hex[] = "0123456789abcdef";
+    int rc = buffer_append(buf, "\"", 1);
+    const char *run = value;
+    for (const char *p = value; rc == 0 && *p; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c != '"' && c != '\\' && c >= 0x20) {
+            continue;
+        }
+        rc = buffer_append(buf, run, (size_t)(p - run));
+        if (rc == 0 && (c == '"' || c == '\\')) {
+            char escaped[2] = {'\\', (char)c};
+            rc = buffer_append(buf, escaped, 2);
+        } else if (rc == 0) {
+            char escaped[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+            rc = buffer_append(buf, escaped, 6);
+        }
+        run = p + 1;
+    }
+    if (rc == 0) {
+        rc = buffer_append_str(buf, run);
+    }
+    return rc == 0 ? buffer_append(buf, "\"", 1) : -1;
+}
+
+/* Append @p value percent-encoded for use as one URL path segment */
+static int buffer_append_escaped(buffer_t *buf, const char *value) {
+    static const char hex[] = "0123456789ABCDEF";
+    for (const char *p = value; *p; p++) {
+        unsigned char c = (unsigned char)*p;
+        int unreserved = (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+                         (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' || c == '~';
+        char encoded[3] = {'%', hex[c >> 4], hex[c & 0xF]};
+        if ((unreserved ? buffer_append(buf, p, 1) : buffer_append(buf, encoded, 3)) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
 
 static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
     size_t realsize = size * nmemb;
-    response_buffer_t *buf = (response_buffer_t *)userp;
-    
-    char *ptr = realloc(buf->data, buf->size + realsize + 1);
-    if (ptr == NULL) {
+    if (buffer_append((buffer_t *)userp, (const char *)contents, realsize) != 0) {
         return 0;
     }
-    
-    buf->data = ptr;
-    memcpy(&(buf->data[buf->size]), contents, realsize);
-    buf->size += realsize;
-    buf->data[buf->size] = 0;
-    
     return realsize;
 }
 
-int license_client_init(const char *base_url) {
-    if (base_url == NULL) {
-        snprintf(g_error_msg, sizeof(g_error_msg), "Base URL cannot be NULL");
+static char *concat(const char *a, const char *b) {
+    size_t a_len = strlen(a);
+    size_t b_len = strlen(b);
+    char *out = malloc(a_len + b_len + 1);
+    if (out) {
+        memcpy(out, a, a_len);
+        memcpy(out + a_len, b, b_len + 1);
+    }
+    return out;
+}
+
+/*
+ * Headers for one kind of request: the JSON body type for POSTs, the
+ * Accept preference and the API key. NULL on allocation failure, or if
+ * there are none.
+ */
+static struct curl_slist *request_headers(int with_body, license_wire_format_t format,
+                                          const char *api_key, int *failed) {
+    struct curl_slist *headers = NULL;
+    struct curl_slist *next;
+    *failed = 0;
+#define ADD_HEADER(line)                              \
+    do {                                              \
+        next = curl_slist_append(headers, (line));    \
+        if (next == NULL) {                           \
+            curl_slist_free_all(headers);             \
+            *failed = 1;                              \
+            return NULL;                              \
+        }                                             \
+        headers = next;                               \
+    } while (0)
+    if (with_body) {
+        ADD_HEADER("Content-Type: application/json");
+    }
+    if (format == LICENSE_WIRE_MSGPACK) {
+        // JSON stays acceptable, so servers without MessagePack still answer
+        ADD_HEADER("Accept: application/msgpack, application/json;q=0.5");
+    }
+    if (api_key != NULL && api_key[0] != '\0') {
+        char auth_header[320];
+        snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", api_key);
+        ADD_HEADER(auth_header);
+    }
+#undef ADD_HEADER
+    return headers;
+}
+
+static int response_is_msgpack(CURL *curl) {
+    char *content_type = NULL;
+    curl_easy_getinfo(curl, CURLINFO_CONTENT_TYPE, &content_type);
+    return content_type != NULL &&
+           (strncmp(content_type, "application/msgpack", 19) == 0 ||
+            strncmp(content_type, "application/x-msgpack", 21) == 0);
+}
+
+/*
+ * Minimal MessagePack reader: enough to pick scalar fields out of the
+ * top-level map of a response. All functions return 0 on success and
+ * -1 on malformed or unexpected input.
+ */
+typedef struct {
+    const unsigned char *pos;
+    const unsigned char *end;
+} mp_cursor_t;
+
+#define MP_MAX_DEPTH 64
+
+static int mp_read_be(mp_cursor_t *c, size_t n, uint64_t *out) {
+    if ((size_t)(c->end - c->pos) < n) {
         return -1;
     }
-    
-    strncpy(g_base_url, base_url, sizeof(g_base_url) - 1);
-    const char *env_key = getenv("LICENSE_API_KEY");
-    if (env_key) {
-        strncpy(g_api_key, env_key, sizeof(g_api_key) - 1);
+    uint64_t value = 0;
+    for (size_t i = 0; i < n; i++) {
+        value = (value << 8) | c->pos[i];
     }
-    
-    curl_global_init(CURL_GLOBAL_DEFAULT);
-    g_curl = curl_easy_init();
-    
-    if (g_curl == NULL) {
-        snprintf(g_error_msg, sizeof(g_error_msg), "Failed to initialize CURL");
+    c->pos += n;
+    *out = value;
+    return 0;
+}
+
+static int mp_advance(mp_cursor_t *c, uint64_t n) {
+    if ((uint64_t)(c->end - c->pos) < n) {
         return -1;
     }
-    
+    c->pos += n;
     return 0;
 }
 
-void license_client_cleanup(void) {
-    if (g_curl) {
-        curl_easy_cleanup(g_curl);
-        g_curl = NULL;
+static int mp_skip(mp_cursor_t *c, int depth) {
+    if (depth > MP_MAX_DEPTH || c->pos >= c->end) {
+        return -1;
+    }
+    unsigned char b = *c->pos++;
+    uint64_t n = 0;
+    if (b < 0x80 || b >= 0xe0 || b == 0xc0 || b == 0xc2 || b == 0xc3) {
+        return 0;
+    }
+    if (b >= 0xa0 && b <= 0xbf) {
+        return mp_advance(c, b & 0x1f);
+    }
+    if ((b >= 0x80 && b <= 0x8f) || (b >= 0x90 && b <= 0x9f) ||
+        b == 0xdc || b == 0xdd || b == 0xde || b == 0xdf) {
+        if (b <= 0x9f) {
+            n = b & 0x0f;
+        } else if (mp_read_be(c, (b == 0xdc || b == 0xde) ? 2 : 4, &n) != 0) {
+            return -1;
+        }
+        if ((b >= 0x80 && b <= 0x8f) || b == 0xde || b == 0xdf) {
+            n *= 2;  // maps hold key/value pairs
+        }
+        if (n > (uint64_t)(c->end - c->pos)) {
+            return -1;  // every element takes at least one byte
+        }
+        for (uint64_t i = 0; i < n; i++) {
+            if (mp_skip(c, depth + 1) != 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+    switch (b) {
+    case 0xcc: case 0xd0: return mp_advance(c, 1);
+    case 0xcd: case 0xd1: return mp_advance(c, 2);
+    case 0xca: case 0xce: case 0xd2: return mp_advance(c, 4);
+    case 0xcb: case 0xcf: case 0xd3: return mp_advance(c, 8);
+    case 0xd4: return mp_advance(c, 2);
+    case 0xd5: return mp_advance(c, 3);
+    case 0xd6: return mp_advance(c, 5);
+    case 0xd7: return mp_advance(c, 9);
+    case 0xd8: return mp_advance(c, 17);
+    case 0xc4: case 0xd9:
+        return mp_read_be(c, 1, &n) == 0 ? mp_advance(c, n) : -1;
+    case 0xc5: case 0xda:
+        return mp_read_be(c, 2, &n) == 0 ? mp_advance(c, n) : -1;
+    case 0xc6: case 0xdb:
+        return mp_read_be(c, 4, &n) == 0 ? mp_advance(c, n) : -1;
+    case 0xc7:
+        return mp_read_be(c, 1, &n) == 0 ? mp_advance(c, n + 1) : -1;
+    case 0xc8:
+        return mp_read_be(c, 2, &n) == 0 ? mp_advance(c, n + 1) : -1;
+    case 0xc9:
+        return mp_read_be(c, 4, &n) == 0 ? mp_advance(c, n + 1) : -1;
+    default:
+        return -1;
     }
-    // Avoid curl_global_cleanup to prevent segfault due to destructor ordering
 }
 
-int license_borrow(const char *tool, const char *user, license_handle_t *handle) {
-    if (tool == NULL || user == NULL || handle == NULL) {
-        snprintf(g_error_msg, sizeof(g_error_msg), "Invalid parameters");
+static int mp_read_str(mp_cursor_t *c, const char **str, size_t *len) {
+    if (c->pos >= c->end) {
         return -1;
     }
-    
-    char url[512];
-    snprintf(url, sizeof(url), "%s/licenses/borrow", g_base_url);
-    
-    char post_data[256];
-    snprintf(post_data, sizeof(post_data), 
-             "{\"tool\":\"%s\",\"user\":\"%s\"}", tool, user);
-    
-    response_buffer_t response = {0};
-    
-    curl_easy_setopt(g_curl, CURLOPT_URL, url);
-    curl_easy_setopt(g_curl, CURLOPT_POSTFIELDS, post_data);
-    curl_easy_setopt(g_curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(g_curl, CURLOPT_WRITEDATA, (void *)&response);
-    
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    if (g_api_key[0] != '\0') {
-        char auth_header[320];
-        snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", g_api_key);
-        headers = curl_slist_append(headers, auth_header);
+    unsigned char b = *c->pos;
+    uint64_t n;
+    if (b >= 0xa0 && b <= 0xbf) {
+        c->pos++;
+        n = b & 0x1f;
+    } else if (b == 0xd9 || b == 0xda || b == 0xdb) {
+        c->pos++;
+        if (mp_read_be(c, b == 0xd9 ? 1 : b == 0xda ? 2 : 4, &n) != 0) {
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+    if ((uint64_t)(c->end - c->pos) < n) {
+        return -1;
+    }
+    *str = (const char *)c->pos;
+    *len = (size_t)n;
+    c->pos += n;
+    return 0;
+}
+
+static int mp_read_int(mp_cursor_t *c, int *out) {
+    if (c->pos >= c->end) {
+        return -1;
+    }
+    unsigned char b = *c->pos++;
+    uint64_t u;
+    int64_t value;
+    if (b < 0x80) {
+        value = b;
+    } else if (b >= 0xe0) {
+        value = (int64_t)b - 0x100;
+    } else if (b >= 0xcc && b <= 0xcf) {
+        if (mp_read_be(c, (size_t)1 << (b - 0xcc), &u) != 0 || u > INT32_MAX) {
+            return -1;
+        }
+        value = (int64_t)u;
+    } else if (b >= 0xd0 && b <= 0xd3) {
+        size_t n = (size_t)1 << (b - 0xd0);
+        if (mp_read_be(c, n, &u) != 0) {
+            return -1;
+        }
+        if (n < 8 && (u >> (8 * n - 1)) != 0) {
+            u |= ~(uint64_t)0 << (8 * n);  // sign-extend
+        }
+        value = (int64_t)u;
+    } else {
+        return -1;
+    }
+    if (value < INT32_MIN || value > INT32_MAX) {
+        return -1;
+    }
+    *out = (int)value;
+    return 0;
+}
+
+/* Position @p value at the value for @p key in the top-level map */
+static int mp_find(const buffer_t *response, const char *key, mp_cursor_t *value) {
+    if (response->data == NULL || response->size == 0) {
+        return -1;
+    }
+    mp_cursor_t c = {(const unsigned char *)response->data,
+                     (const unsigned char *)response->data + response->size};
+    unsigned char b = *c.pos++;
+    uint64_t n;
+    if (b >= 0x80 && b <= 0x8f) {
+        n = b & 0x0f;
+    } else if (b == 0xde || b == 0xdf) {
+        if (mp_read_be(&c, b == 0xde ? 2 : 4, &n) != 0) {
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+    size_t key_len = strlen(key);
+    for (uint64_t i = 0; i < n; i++) {
+        const char *name;
+        size_t name_len;
+        if (mp_read_str(&c, &name, &name_len) != 0) {
+            return -1;
+        }
+        if (name_len == key_len && memcmp(name, key, key_len) == 0) {
+            *value = c;
+            return 0;
+        }
+        if (mp_skip(&c, 1) != 0) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+static void mp_find_int(const buffer_t *response, const char *key, int *out) {
+    mp_cursor_t value;
+    if (mp_find(response, key, &value) == 0) {
+        mp_read_int(&value, out);
     }
-    curl_easy_setopt(g_curl, CURLOPT_HTTPHEADER, headers);
+}
+
+/* (Re)build the header lists for @p format */
+static int client_set_headers(license_client_t *client, license_wire_format_t format,
+                              const char *api_key) {
+    int failed_post, failed_get;
+    struct curl_slist *post = request_headers(1, format, api_key, &failed_post);
+    struct curl_slist *get = request_headers(0, format, api_key, &failed_get);
+    if (failed_post || failed_get) {
+        curl_slist_free_all(post);
+        curl_slist_free_all(get);
+        return -1;
+    }
+    curl_slist_free_all(client->post_headers);
+    curl_slist_free_all(client->get_headers);
+    client->post_headers = post;
+    client->get_headers = get;
+    client->wire_format = format;
+    return 0;
+}
+
+license_client_t *license_client_create(const char *base_url,
+                                        const license_client_options_t *options) {
+    if (base_url == NULL) {
+        snprintf(t_error_msg, sizeof(t_error_msg), "Base URL cannot be NULL");
+        return NULL;
+    }
+    license_wire_format_t format = options ? options->wire_format : LICENSE_WIRE_JSON;
+    if (format != LICENSE_WIRE_JSON && format != LICENSE_WIRE_MSGPACK) {
+        snprintf(t_error_msg, sizeof(t_error_msg), "Unknown wire format");
+        return NULL;
+    }
+    const char *api_key = options && options->api_key ? options->api_key : getenv("LICENSE_API_KEY");
     
-    CURLcode res = curl_easy_perform(g_curl);
-    curl_slist_free_all(headers);
+    pthread_once(&g_init_once, global_init_once);
+    if (g_init_status != 0) {
+        snprintf(t_error_msg, sizeof(t_error_msg), "Failed to initialize CURL");
+        return NULL;
+    }
     
+    license_client_t *client = calloc(1, sizeof(*client));
+    if (client == NULL) {
+        snprintf(t_error_msg, sizeof(t_error_msg), "Out of memory");
+        return NULL;
+    }
+    client->curl = curl_easy_init();
+    client->base_url = concat(base_url, "");
+    client->borrow_url = concat(base_url, "/licenses/borrow");
+    client->return_url = concat(base_url, "/licenses/return");
+    if (client->curl == NULL || client->base_url == NULL || client->borrow_url == NULL ||
+        client->return_url == NULL || client_set_headers(client, format, api_key) != 0 ||
+        buffer_reserve(&client->response, RESPONSE_RESERVE) != 0 ||
+        buffer_reserve(&client->body, 256) != 0 ||
+        buffer_reserve(&client->url, strlen(base_url) + 128) != 0) {
+        snprintf(t_error_msg, sizeof(t_error_msg),
+                 client->curl == NULL ? "Failed to initialize CURL" : "Out of memory");
+        license_client_destroy(client);
+        return NULL;
+    }
+    buffer_clear(&client->response);
+    
+    // Options that never change; per-request ones are set by each call
+    CURL *h = client->curl;
+    curl_easy_setopt(h, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(h, CURLOPT_WRITEDATA, (void *)&client->response);
+    return client;
+}
+
+void license_client_destroy(license_client_t *client) {
+    if (client == NULL) {
+        return;
+    }
+    if (client->curl) {
+        curl_easy_cleanup(client->curl);
+    }
+    curl_slist_free_all(client->post_headers);
+    curl_slist_free_all(client->get_headers);
+    free(client->base_url);
+    free(client->borrow_url);
+    free(client->return_url);
+    free(client->url.data);
+    free(client->body.data);
+    free(client->response.data);
+    free(client);
+}
+
+const char *license_client_error(const license_client_t *client) {
+    return client ? client->error : t_error_msg;
+}
+
+/* Run one request; on success returns the HTTP status, else -1 */
+static long client_perform(license_client_t *client) {
+    buffer_clear(&client->response);
+    CURLcode res = curl_easy_perform(client->curl);
     if (res != CURLE_OK) {
-        snprintf(g_error_msg, sizeof(g_error_msg), 
+        snprintf(client->error, sizeof(client->error),
                  "CURL error: %s", curl_easy_strerror(res));
-        free(response.data);
         return -1;
     }
-    
     long http_code = 0;
-    curl_easy_getinfo(g_curl, CURLINFO_RESPONSE_CODE, &http_code);
+    curl_easy_getinfo(client->curl, CURLINFO_RESPONSE_CODE, &http_code);
+    return http_code;
+}
+
+static void client_post(license_client_t *client, const char *url) {
+    CURL *h = client->curl;
+    curl_easy_setopt(h, CURLOPT_URL, url);
+    curl_easy_setopt(h, CURLOPT_POSTFIELDS, client->body.data);
+    curl_easy_setopt(h, CURLOPT_POSTFIELDSIZE, (long)client->body.size);
+    curl_easy_setopt(h, CURLOPT_HTTPHEADER, client->post_headers);
+}
+
+int license_client_borrow(license_client_t *client, const char *tool, const char *user,
+                          license_handle_t *handle) {
+    if (client == NULL) {
+        snprintf(t_error_msg, sizeof(t_error_msg), "Invalid parameters");
+        return -1;
+    }
+    if (tool == NULL || user == NULL || handle == NULL) {
+        snprintf(client->error, sizeof(client->error), "Invalid parameters");
+        return -1;
+    }
+    handle->valid = 0;
+    
+    buffer_t *body = &client->body;
+    buffer_clear(body);
+    if (buffer_append_str(body, "{\"tool\":") != 0 || buffer_append_json(body, tool) != 0 ||
+        buffer_append_str(body, ",\"user\":") != 0 || buffer_append_json(body, user) != 0 ||
+        buffer_append_str(body, "}") != 0) {
+        snprintf(client->error, sizeof(client->error), "Out of memory");
+        return -1;
+    }
+    client_post(client, client->borrow_url);
+    
+    long http_code = client_perform(client);
+    if (http_code < 0) {
+        return -1;
+    }
     
     if (http_code == 409) {
-        snprintf(g_error_msg, sizeof(g_error_msg), "No licenses available");
-        free(response.data);
+        snprintf(client->error, sizeof(client->error), "No licenses available");
         return -2;
     }
     
     if (http_code != 200) {
-        snprintf(g_error_msg, sizeof(g_error_msg), 
+        snprintf(client->error, sizeof(client->error), 
                  "HTTP error: %ld", http_code);
-        free(response.data);
-        return -1;
-    }
-    
-    // Parse JSON response (simple parsing for "id" field)
-    char *id_start = strstr(response.data, "\"id\":\"");
-    if (id_start) {
-        id_start += 6;
-        char *id_end = strchr(id_start, '\"');
-        if (id_end) {
-            size_t len = id_end - id_start;
-            if (len < sizeof(handle->id)) {
-                strncpy(handle->id, id_start, len);
-                handle->id[len] = '\0';
-                strncpy(handle->tool, tool, sizeof(handle->tool) - 1);
-                strncpy(handle->user, user, sizeof(handle->user) - 1);
-                handle->valid = 1;
+        return -1;
+    }
+    
+    const buffer_t *response = &client->response;
+    const char *id_start = NULL;
+    size_t len = 0;
+    if (response_is_msgpack(client->curl)) {
+        mp_cursor_t value;
+        if (mp_find(response, "id", &value) != 0 ||
+            mp_read_str(&value, &id_start, &len) != 0) {
+            id_start = NULL;
+        }
+    } else {
+        // Parse JSON response (simple parsing for "id" field)
+        id_start = strstr(response->data, "\"id\":\"");
+        if (id_start) {
+            id_start += 6;
+            const char *id_end = strchr(id_start, '\"');
+            if (id_end) {
+                len = id_end - id_start;
+            } else {
+                id_start = NULL;
             }
         }
     }
-    
-    free(response.data);
+    if (id_start && len < sizeof(handle->id)) {
+        memcpy(handle->id, id_start, len);
+        handle->id[len] = '\0';
+        strncpy(handle->tool, tool, sizeof(handle->tool) - 1);
+        handle->tool[sizeof(handle->tool) - 1] = '\0';
+        strncpy(handle->user, user, sizeof(handle->user) - 1);
+        handle->user[sizeof(handle->user) - 1] = '\0';
+        handle->valid = 1;
+    }
     
     if (!handle->valid) {
-        snprintf(g_error_msg, sizeof(g_error_msg), "Failed to parse response");
+        snprintf(client->error, sizeof(client->error), "Failed to parse response");
         return -1;
     }
     
     return 0;
 }
 
-int license_return(const license_handle_t *handle) {
+int license_client_return(license_client_t *client, const license_handle_t *handle) {
+    if (client == NULL) {
+        snprintf(t_error_msg, sizeof(t_error_msg), "Invalid handle");
+        return -1;
+    }
     if (handle == NULL || !handle->valid) {
-        snprintf(g_error_msg, sizeof(g_error_msg), "Invalid handle");
+        snprintf(client->error, sizeof(client->error), "Invalid handle");
         return -1;
     }
     
-    char url[512];
-    snprintf(url, sizeof(url), "%s/licenses/return", g_base_url);
-    
-    char post_data[256];
-    snprintf(post_data, sizeof(post_data), "{\"id\":\"%s\"}", handle->id);
-    
-    response_buffer_t response = {0};
-    
-    curl_easy_setopt(g_curl, CURLOPT_URL, url);
-    curl_easy_setopt(g_curl, CURLOPT_POSTFIELDS, post_data);
-    curl_easy_setopt(g_curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(g_curl, CURLOPT_WRITEDATA, (void *)&response);
-    
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    if (g_api_key[0] != '\0') {
-        char auth_header[320];
-        snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", g_api_key);
-        headers = curl_slist_append(headers, auth_header);
+    buffer_t *body = &client->body;
+    buffer_clear(body);
+    if (buffer_append_str(body, "{\"id\":") != 0 || buffer_append_json(body, handle->id) != 0 ||
+        buffer_append_str(body, "}") != 0) {
+        snprintf(client->error, sizeof(client->error), "Out of memory");
+        return -1;
     }
-    curl_easy_setopt(g_curl, CURLOPT_HTTPHEADER, headers);
-    
-    CURLcode res = curl_easy_perform(g_curl);
-    curl_slist_free_all(headers);
-    
-    free(response.data);
+    client_post(client, client->return_url);
     
-    if (res != CURLE_OK) {
-        snprintf(g_error_msg, sizeof(g_error_msg), 
-                 "CURL error: %s", curl_easy_strerror(res));
+    long http_code = client_perform(client);
+    if (http_code < 0) {
         return -1;
     }
     
-    long http_code = 0;
-    curl_easy_getinfo(g_curl, CURLINFO_RESPONSE_CODE, &http_code);
-    
     if (http_code != 200) {
-        snprintf(g_error_msg, sizeof(g_error_msg), 
+        snprintf(client->error, sizeof(client->error), 
                  "HTTP error: %ld", http_code);
         return -1;
     }
@@ -200,51 +627,166 @@ int license_return(const license_handle_t *handle) {
     return 0;
 }
 
-int license_get_status(const char *tool, license_status_t *status) {
+int license_client_get_status(license_client_t *client, const char *tool,
+                              license_status_t *status) {
+    if (client == NULL) {
+        snprintf(t_error_msg, sizeof(t_error_msg), "Invalid parameters");
+        return -1;
+    }
     if (tool == NULL || status == NULL) {
-        snprintf(g_error_msg, sizeof(g_error_msg), "Invalid parameters");
+        snprintf(client->error, sizeof(client->error), "Invalid parameters");
         return -1;
     }
     
-    char url[1024];
-    // URL-encode tool using curl
-    char *escaped = curl_easy_escape(g_curl, tool, (int)strlen(tool));
-    snprintf(url, sizeof(url), "%s/licenses/%s/status", g_base_url, escaped ? escaped : tool);
-    if (escaped) curl_free(escaped);
-    
-    response_buffer_t response = {0};
+    buffer_t *url = &client->url;
+    buffer_clear(url);
+    if (buffer_append_str(url, client->base_url) != 0 || buffer_append_str(url, "/licenses/") != 0 ||
+        buffer_append_escaped(url, tool) != 0 || buffer_append_str(url, "/status") != 0) {
+        snprintf(client->error, sizeof(client->error), "Out of memory");
+        return -1;
+    }
     
-    curl_easy_setopt(g_curl, CURLOPT_URL, url);
-    curl_easy_setopt(g_curl, CURLOPT_HTTPGET, 1L);
-    curl_easy_setopt(g_curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(g_curl, CURLOPT_WRITEDATA, (void *)&response);
+    CURL *h = client->curl;
+    curl_easy_setopt(h, CURLOPT_URL, url->data);
+    curl_easy_setopt(h, CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt(h, CURLOPT_HTTPHEADER, client->get_headers);
     
-    CURLcode res = curl_easy_perform(g_curl);
+    long http_code = client_perform(client);
+    if (http_code < 0) {
+        return -1;
+    }
     
-    if (res != CURLE_OK) {
-        snprintf(g_error_msg, sizeof(g_error_msg), 
-                 "CURL error: %s", curl_easy_strerror(res));
-        free(response.data);
+    if (http_code != 200) {
+        snprintf(client->error, sizeof(client->error), 
+                 "HTTP error: %ld", http_code);
         return -1;
     }
     
-    // Simple JSON parsing
     strncpy(status->tool, tool, sizeof(status->tool) - 1);
+    status->tool[sizeof(status->tool) - 1] = '\0';
+    
+    const buffer_t *response = &client->response;
+    if (response_is_msgpack(h)) {
+        mp_find_int(response, "total", &status->total);
+        mp_find_int(response, "borrowed", &status->borrowed);
+        mp_find_int(response, "available", &status->available);
+        return 0;
+    }
     
-    char *total_str = strstr(response.data, "\"total\":");
+    // Simple JSON parsing
+    char *total_str = strstr(response->data, "\"total\":");
     if (total_str) sscanf(total_str + 8, "%d", &status->total);
     
-    char *borrowed_str = strstr(response.data, "\"borrowed\":");
+    char *borrowed_str = strstr(response->data, "\"borrowed\":");
     if (borrowed_str) sscanf(borrowed_str + 11, "%d", &status->borrowed);
     
-    char *available_str = strstr(response.data, "\"available\":");
+    char *available_str = strstr(response->data, "\"available\":");
     if (available_str) sscanf(available_str + 12, "%d", &status->available);
     
-    free(response.data);
     return 0;
 }
 
-const char* license_get_error(void) {
-    return g_error_msg;
+/*
+ * The calling thread's default context for the global API, created on
+ * first use from the license_client_init() configuration and destroyed
+ * when the thread exits.
+ */
+static license_client_t *thread_client(void) {
+    if (g_init_status != 0) {
+        snprintf(t_error_msg, sizeof(t_error_msg), "Client not initialized");
+        return NULL;
+    }
+    
+    license_client_t *client = (license_client_t *)pthread_getspecific(g_client_key);
+    if (client == NULL) {
+        license_client_options_t options = {g_wire_format, g_api_key};
+        client = license_client_create(g_base_url, &options);
+        if (client == NULL) {
+            return NULL;
+        }
+        pthread_setspecific(g_client_key, client);
+    } else if (client->wire_format != g_wire_format &&
+               client_set_headers(client, g_wire_format, g_api_key) != 0) {
+        snprintf(t_error_msg, sizeof(t_error_msg), "Out of memory");
+        return NULL;
+    }
+    return client;
+}
+
+/* A global API call failed: make its error the thread's */
+static int thread_result(const license_client_t *client, int rc) {
+    if (rc != 0) {
+        snprintf(t_error_msg, sizeof(t_error_msg), "%s", client->error);
+    }
+    return rc;
+}
+
+int license_client_set_wire_format(license_wire_format_t format) {
+    if (format != LICENSE_WIRE_JSON && format != LICENSE_WIRE_MSGPACK) {
+        snprintf(t_error_msg, sizeof(t_error_msg), "Unknown wire format");
+        return -1;
+    }
+    g_wire_format = format;
+    return 0;
+}
+
+int license_client_init(const char *base_url) {
+    if (base_url == NULL) {
+        snprintf(t_error_msg, sizeof(t_error_msg), "Base URL cannot be NULL");
+        return -1;
+    }
+    
+    strncpy(g_base_url, base_url, sizeof(g_base_url) - 1);
+    const char *env_key = getenv("LICENSE_API_KEY");
+    if (env_key) {
+        strncpy(g_api_key, env_key, sizeof(g_api_key) - 1);
+    }
+    
+    pthread_once(&g_init_once, global_init_once);
+    
+    if (thread_client() == NULL) {
+        return -1;
+    }
+    
+    return 0;
+}
+
+void license_client_cleanup(void) {
+    if (g_init_status != 0) {
+        return;
+    }
+    license_client_t *client = (license_client_t *)pthread_getspecific(g_client_key);
+    if (client) {
+        license_client_destroy(client);
+        pthread_setspecific(g_client_key, NULL);
+    }
+    // Avoid curl_global_cleanup to prevent segfault due to destructor ordering
+}
+
+int license_borrow(const char *tool, const char *user, license_handle_t *handle) {
+    license_client_t *client = thread_client();
+    if (client == NULL) {
+        return -1;
+    }
+    return thread_result(client, license_client_borrow(client, tool, user, handle));
+}
+
+int license_return(const license_handle_t *handle) {
+    license_client_t *client = thread_client();
+    if (client == NULL) {
+        return -1;
+    }
+    return thread_result(client, license_client_return(client, handle));
+}
+
+int license_get_status(const char *tool, license_status_t *status) {
+    license_client_t *client = thread_client();
+    if (client == NULL) {
+        return -1;
+    }
+    return thread_result(client, license_client_get_status(client, tool, status));
 }
 
+const char* license_get_error(void) {
+    return t_error_msg;
+}
@@ -4,6 +4,17 @@
  * 
  * Simple HTTP client for borrowing and returning licenses from the
  * Mercedes-Benz license server.
+ *
+ * Two interfaces share one implementation:
+ *
+ * - Contexts: license_client_create() returns a license_client_t that
+ *   owns a CURL handle, its connection and reusable buffers. A context
+ *   is used by one thread at a time; create one per thread to run
+ *   requests in parallel.
+ * - The global API (license_client_init(), license_borrow(), ...). Call
+ *   license_client_init() once before starting worker threads. After
+ *   that every function may be called concurrently; each thread lazily
+ *   gets its own context and its own error message.
  */
 
 #ifndef LICENSE_CLIENT_H
@@ -31,6 +42,73 @@ typedef struct {
     int available;      /**< Available to borrow */
 } license_status_t;
 
+/**
+ * @brief Response encodings the client can request
+ */
+typedef enum {
+    LICENSE_WIRE_JSON = 0,      /**< JSON only (default) */
+    LICENSE_WIRE_MSGPACK = 1    /**< MessagePack when the server supports it, else JSON */
+} license_wire_format_t;
+
+/**
+ * @brief A client context (opaque)
+ */
+typedef struct license_client license_client_t;
+
+/**
+ * @brief Settings of a context; zero-initialized means the defaults
+ */
+typedef struct {
+    license_wire_format_t wire_format;  /**< Response encoding (JSON by default) */
+    const char *api_key;                /**< Bearer token; NULL reads LICENSE_API_KEY */
+} license_client_options_t;
+
+/**
+ * @brief Create a client context
+ *
+ * The CURL handle, request URLs and headers are set up here. The body
+ * and response buffers grow to fit and are kept, so once warm a request
+ * makes no allocation of its own.
+ *
+ * @param base_url Base URL of the license server (e.g., "http://localhost:8000")
+ * @param options Settings, or NULL for the defaults
+ * @return The context, or NULL on error (see license_get_error())
+ */
+license_client_t *license_client_create(const char *base_url,
+                                        const license_client_options_t *options);
+
+/**
+ * @brief Destroy a context and close its connection; NULL is ignored
+ */
+void license_client_destroy(license_client_t *client);
+
+/**
+ * @brief Borrow a license through @p client
+ * @return 0 on success, -1 on error, -2 if no licenses available
+ */
+int license_client_borrow(license_client_t *client, const char *tool, const char *user,
+                          license_handle_t *handle);
+
+/**
+ * @brief Return a license through @p client
+ * @return 0 on success, -1 on error
+ */
+int license_client_return(license_client_t *client, const license_handle_t *handle);
+
+/**
+ * @brief Get status for a tool through @p client
+ * @return 0 on success, -1 on error
+ */
+int license_client_get_status(license_client_t *client, const char *tool,
+                              license_status_t *status);
+
+/**
+ * @brief The last error of @p client
+ *
+ * With NULL, the calling thread's error, as license_get_error().
+ */
+const char *license_client_error(const license_client_t *client);
+
 /**
  * @brief Initialize the license client
  * 
@@ -39,8 +117,24 @@ typedef struct {
  */
 int license_client_init(const char *base_url);
 
+/**
+ * @brief Select the response encoding
+ * 
+ * MessagePack is negotiated with the Accept header; a server that does
+ * not offer it answers in JSON, which is always understood. Request
+ * bodies are always JSON. Like license_client_init(), call this before
+ * starting worker threads.
+ * 
+ * @param format LICENSE_WIRE_JSON or LICENSE_WIRE_MSGPACK
+ * @return 0 on success, -1 on an unknown format
+ */
+int license_client_set_wire_format(license_wire_format_t format);
+
 /**
  * @brief Cleanup the license client
+ *
+ * Releases the calling thread's context. Contexts of other threads are
+ * released automatically when those threads exit.
  */
 void license_client_cleanup(void);
 
@@ -74,7 +168,7 @@ int license_get_status(const char *tool, license_status_t *status);
 /**
  * @brief Get the last error message
  * 
- * @return Error message string
+ * @return Error message string for the calling thread
  */
 const char* license_get_error(void);
 
@@ -0,0 +1,530 @@
+/**
+ * @file license_client_bench.cpp
+ * @brief Microbenchmarks for the C++ client hot paths
+ *
+ * Covers each stage of a request on its own (request signing, body
+ * encoding, response decoding, transfer setup) and whole requests
+ * against an in-process HTTP/1.1 server on the loopback interface.
+ * Every benchmark reports allocs/op and bytes/op: heap allocations made
+ * by the benchmark thread, averaged over the iterations.
+ *
+ * The client's internals are file-local, so this translation unit
+ * compiles license_client.cpp (and license_status_table.cpp, which it
+ * calls) itself instead of linking the library.
+ *
+ * Usage: license_client_bench [--benchmark_filter=<regex>] ...
+ */
+
+#include "license_client.cpp"
+#include "license_status_table.cpp"
+
+#include <benchmark/benchmark.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Allocation counting
+// ---------------------------------------------------------------------------
+
+// Per thread, so the mock server's work is not charged to the client
+static thread_local std::uint64_t alloc_count = 0;
+static thread_local std::uint64_t alloc_bytes = 0;
+
+static void* counted_alloc(std::size_t size) {
+    ++alloc_count;
+    alloc_bytes += size;
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size) { return counted_alloc(size); }
+void* operator new[](std::size_t size) { return counted_alloc(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+// Counts from construction (after setup) to destruction, reported per iteration
+class AllocScope {
+public:
+    explicit AllocScope(benchmark::State& state)
+        : state_(state), count_(alloc_count), bytes_(alloc_bytes) {}
+
+    ~AllocScope() {
+        state_.counters["allocs/op"] = benchmark::Counter(
+            static_cast<double>(alloc_count - count_), benchmark::Counter::kAvgIterations);
+        state_.counters["bytes/op"] = benchmark::Counter(
+            static_cast<double>(alloc_bytes - bytes_), benchmark::Counter::kAvgIterations);
+    }
+
+private:
+    benchmark::State& state_;
+    std::uint64_t count_;
+    std::uint64_t bytes_;
+};
+
+// ---------------------------------------------------------------------------
+// Canned response bodies
+// ---------------------------------------------------------------------------
+
+const char BORROW_ID[] = "3f2b8c1e-6a4d-4e0b-9c7a-2d5e8f1a0b3c";
+const char TOOL[] = "ECU-Development-Suite";
+const char USER[] = "bench-user";
+
+// Just enough of a MessagePack encoder for the bodies below
+void mp_map(std::string& out, std::size_t n) { out.push_back(static_cast<char>(0x80 | n)); }
+void mp_array(std::string& out, std::size_t n) {
+    out.push_back(static_cast<char>(0xdc));
+    out.push_back(static_cast<char>(n >> 8));
+    out.push_back(static_cast<char>(n & 0xFF));
+}
+void mp_str(std::string& out, std::string_view s) {
+    out.push_back(static_cast<char>(0xd9));
+    out.push_back(static_cast<char>(s.size()));
+    out.append(s);
+}
+void mp_int(std::string& out, int value) {
+    out.push_back(static_cast<char>(0xcd));
+    out.push_back(static_cast<char>((value >> 8) & 0xFF));
+    out.push_back(static_cast<char>(value & 0xFF));
+}
+void mp_bool(std::string& out, bool value) { out.push_back(static_cast<char>(value ? 0xc3 : 0xc2)); }
+
+std::string tool_name(std::size_t i) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "tool-%03zu", i);
+    return name;
+}
+
+std::string borrow_body(bool msgpack) {
+    std::string out;
+    if (msgpack) {
+        mp_map(out, 2);
+        mp_str(out, "id");
+        mp_str(out, BORROW_ID);
+        mp_str(out, "tool");
+        mp_str(out, TOOL);
+    } else {
+        out.append("{\"id\":\"").append(BORROW_ID).append("\",\"tool\":\"").append(TOOL).append("\"}");
+    }
+    return out;
+}
+
+std::string ok_body(bool msgpack) {
+    std::string out;
+    if (msgpack) {
+        mp_map(out, 1);
+        mp_str(out, "status");
+        mp_str(out, "returned");
+    } else {
+        out = "{\"status\":\"returned\"}";
+    }
+    return out;
+}
+
+std::string statuses_body(std::size_t tools, bool msgpack) {
+    std::string out;
+    if (msgpack) {
+        mp_array(out, tools);
+    } else {
+        out.push_back('[');
+    }
+    for (std::size_t i = 0; i < tools; ++i) {
+        std::string name = tool_name(i);
+        if (msgpack) {
+            mp_map(out, 8);
+            mp_str(out, "tool"); mp_str(out, name);
+            mp_str(out, "total"); mp_int(out, 100);
+            mp_str(out, "borrowed"); mp_int(out, 42);
+            mp_str(out, "available"); mp_int(out, 58);
+            mp_str(out, "commit"); mp_int(out, 80);
+            mp_str(out, "max_overage"); mp_int(out, 20);
+            mp_str(out, "overage"); mp_int(out, 0);
+            mp_str(out, "in_commit"); mp_bool(out, true);
+        } else {
+            if (i > 0) {
+                out.push_back(',');
+            }
+            out.append("{\"tool\":\"").append(name).append(
+                "\",\"total\":100,\"borrowed\":42,\"available\":58,\"commit\":80,"
+                "\"max_overage\":20,\"overage\":0,\"in_commit\":true}");
+        }
+    }
+    if (!msgpack) {
+        out.push_back(']');
+    }
+    return out;
+}
+
+license::Response canned(std::string body, bool msgpack) {
+    license::Response response;
+    response.data = std::move(body);
+    response.http_code = 200;
+    response.msgpack = msgpack;
+    return response;
+}
+
+// ---------------------------------------------------------------------------
+// In-process mock server
+// ---------------------------------------------------------------------------
+
+/**
+ * Keep-alive HTTP/1.1 server on 127.0.0.1 with one thread per
+ * connection and fixed answers for borrow, return and status. Lives
+ * for the whole process.
+ */
+class MockServer {
+public:
+    static constexpr std::size_t TOOLS = 16;
+
+    static MockServer& instance() {
+        static MockServer* server = new MockServer();
+        return *server;
+    }
+
+    const std::string& url() const { return url_; }
+
+private:
+    MockServer() {
+        for (int format = 0; format < 2; ++format) {
+            bool msgpack = format == 1;
+            borrow_[format] = borrow_body(msgpack);
+            ok_[format] = ok_body(msgpack);
+            statuses_[format] = statuses_body(TOOLS, msgpack);
+        }
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (listen_fd_ < 0 || bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), len) != 0 ||
+            listen(listen_fd_, 64) != 0 ||
+            getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+            std::perror("mock server");
+            std::exit(1);
+        }
+        url_ = "http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+        std::thread([this] { accept_loop(); }).detach();
+    }
+
+    void accept_loop() {
+        for (;;) {
+            int fd = accept(listen_fd_, nullptr, nullptr);
+            if (fd < 0) {
+                continue;
+            }
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            std::thread([this, fd] { serve(fd); }).detach();
+        }
+    }
+
+    static std::size_t content_length(std::string_view head) {
+        static const std::string_view name = "content-length:";
+        for (std::size_t pos = 0; pos < head.size();) {
+            std::size_t end = head.find("\r\n", pos);
+            if (end == std::string_view::npos) end = head.size();
+            std::string_view line = head.substr(pos, end - pos);
+            if (line.size() > name.size() &&
+                strncasecmp(line.data(), name.data(), name.size()) == 0) {
+                return std::strtoul(std::string(line.substr(name.size())).c_str(), nullptr, 10);
+            }
+            pos = end + 2;
+        }
+        return 0;
+    }
+
+    void serve(int fd) {
+        std::string in;
+        std::string out;
+        char buf[16 * 1024];
+        for (;;) {
+            std::size_t head_end;
+            while ((head_end = in.find("\r\n\r\n")) == std::string::npos) {
+                ssize_t n = recv(fd, buf, sizeof(buf), 0);
+                if (n <= 0) {
+                    close(fd);
+                    return;
+                }
+                in.append(buf, static_cast<std::size_t>(n));
+            }
+            std::string_view head(in.data(), head_end);
+            std::size_t total = head_end + 4 + content_length(head);
+            while (in.size() < total) {
+                ssize_t n = recv(fd, buf, sizeof(buf), 0);
+                if (n <= 0) {
+                    close(fd);
+                    return;
+                }
+                in.append(buf, static_cast<std::size_t>(n));
+            }
+
+            int format = head.find("application/msgpack") != std::string_view::npos ? 1 : 0;
+            const std::string* body = nullptr;
+            if (head.compare(0, 21, "POST /licenses/borrow") == 0) {
+                body = &borrow_[format];
+            } else if (head.compare(0, 21, "POST /licenses/return") == 0) {
+                body = &ok_[format];
+            } else if (head.compare(0, 21, "GET /licenses/status ") == 0) {
+                body = &statuses_[format];
+            }
+
+            out.clear();
+            if (body) {
+                out.append("HTTP/1.1 200 OK\r\nContent-Type: ")
+                   .append(format ? "application/msgpack" : "application/json")
+                   .append("\r\nContent-Length: ").append(std::to_string(body->size()))
+                   .append("\r\n\r\n").append(*body);
+            } else {
+                out.append("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+            }
+            for (std::size_t sent = 0; sent < out.size();) {
+                ssize_t n = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0) {
+                    close(fd);
+                    return;
+                }
+                sent += static_cast<std::size_t>(n);
+            }
+            in.erase(0, total);
+        }
+    }
+
+    int listen_fd_ = -1;
+    std::string url_;
+    std::string borrow_[2];
+    std::string ok_[2];
+    std::string statuses_[2];
+};
+
+license::ClientOptions bench_options(bool msgpack, bool security = true) {
+    license::ClientOptions options;
+    options.enable_security = security;
+    options.wire_format = msgpack ? license::WireFormat::MessagePack : license::WireFormat::Json;
+    return options;
+}
+
+} // namespace
+
+namespace license {
+namespace detail {
+
+struct BenchAccess {
+    static auto& impl(LicenseClient& client) { return *client.pimpl_; }
+};
+
+} // namespace detail
+} // namespace license
+
+using license::detail::BenchAccess;
+
+// ---------------------------------------------------------------------------
+// Stages
+// ---------------------------------------------------------------------------
+
+// HMAC-SHA256 over tool|user|timestamp and hex encoding, on a warm transfer
+static void BM_Signature(benchmark::State& state) {
+    license::LicenseClient client(MockServer::instance().url(), bench_options(false));
+    auto& impl = BenchAccess::impl(client);
+    auto t = impl.take_transfer();
+    const std::string tool = TOOL;
+    const std::string user = USER;
+    char signature[license::SIGNATURE_HEX_LENGTH];
+    impl.generate_signature(*t, tool, user, "1760000000", signature);
+
+    AllocScope allocs(state);
+    for (auto _ : state) {
+        impl.generate_signature(*t, tool, user, "1760000000", signature);
+        benchmark::DoNotOptimize(signature);
+    }
+}
+BENCHMARK(BM_Signature);
+
+// JSON request body for POST /licenses/borrow into a reused buffer
+static void BM_EncodeBorrow(benchmark::State& state) {
+    const std::string tool = TOOL;
+    const std::string user = USER;
+    std::string body;
+    license::write_borrow_body(body, tool, user);
+
+    AllocScope allocs(state);
+    for (auto _ : state) {
+        body.clear();
+        license::write_borrow_body(body, tool, user);
+        benchmark::DoNotOptimize(body.data());
+    }
+}
+BENCHMARK(BM_EncodeBorrow);
+
+// Borrow response to LicenseHandle; arg 0 = JSON, 1 = MessagePack
+static void BM_DecodeBorrow(benchmark::State& state) {
+    bool msgpack = state.range(0) != 0;
+    license::Response response = canned(borrow_body(msgpack), msgpack);
+    const std::string tool = TOOL;
+    const std::string user = USER;
+
+    AllocScope allocs(state);
+    for (auto _ : state) {
+        int lease_seconds = 0;
+        license::LicenseHandle handle =
+            license::handle_from_borrow_response(response, tool, user, lease_seconds);
+        benchmark::DoNotOptimize(handle.id().data());
+    }
+}
+BENCHMARK(BM_DecodeBorrow)->ArgName("msgpack")->Arg(0)->Arg(1);
+
+// GET /licenses/status body to vector<LicenseStatus>; args are
+// (msgpack, tools)
+static void BM_DecodeAllStatuses(benchmark::State& state) {
+    bool msgpack = state.range(0) != 0;
+    auto tools = static_cast<std::size_t>(state.range(1));
+    license::Response response = canned(statuses_body(tools, msgpack), msgpack);
+
+    AllocScope allocs(state);
+    for (auto _ : state) {
+        std::vector<license::LicenseStatus> statuses;
+        license::statuses_from_response(response, statuses);
+        benchmark::DoNotOptimize(statuses.data());
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * response.data.size()));
+}
+BENCHMARK(BM_DecodeAllStatuses)
+    ->ArgNames({"msgpack", "tools"})
+    ->ArgsProduct({{0, 1}, {1, 16, 256}});
+
+// The same body refilling a StatusTable, as get_all_statuses(StatusTable&)
+// does without a status cache; args are (msgpack, tools)
+static void BM_DecodeAllStatusesTable(benchmark::State& state) {
+    bool msgpack = state.range(0) != 0;
+    auto tools = static_cast<std::size_t>(state.range(1));
+    license::Response response = canned(statuses_body(tools, msgpack), msgpack);
+    license::StatusTable table;
+
+    AllocScope allocs(state);
+    for (auto _ : state) {
+        table.clear();
+        license::statuses_from_response(response, table);
+        benchmark::DoNotOptimize(table);
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * response.data.size()));
+}
+BENCHMARK(BM_DecodeAllStatusesTable)
+    ->ArgNames({"msgpack", "tools"})
+    ->ArgsProduct({{0, 1}, {1, 16, 256}});
+
+// A scheduler's "can this tool run?" check over a status list of arg
+// tools, for the last tool: a name walk over std::vector<LicenseStatus>
+// (arg 0), StatusTable::find by name (1), or by a pre-interned ID (2)
+static void BM_StatusLookup(benchmark::State& state) {
+    auto tools = static_cast<std::size_t>(state.range(1));
+    license::Response response = canned(statuses_body(tools, false), false);
+    std::vector<license::LicenseStatus> statuses;
+    license::statuses_from_response(response, statuses);
+    license::StatusTable table(statuses);
+    const std::string wanted = tool_name(tools - 1);
+    license::StatusTable::ToolId id = table.find(wanted);
+
+    AllocScope allocs(state);
+    for (auto _ : state) {
+        bool runnable;
+        switch (state.range(0)) {
+        case 0: {
+            auto it = std::find_if(statuses.begin(), statuses.end(),
+                                   [&](const license::LicenseStatus& s) { return s.tool == wanted; });
+            runnable = it != statuses.end() && it->available > 0;
+            break;
+        }
+        case 1:
+            runnable = table.can_borrow(table.find(wanted));
+            break;
+        default:
+            runnable = table.can_borrow(id);
+        }
+        benchmark::DoNotOptimize(runnable);
+    }
+}
+BENCHMARK(BM_StatusLookup)
+    ->ArgNames({"by", "tools"})
+    ->ArgsProduct({{0, 1, 2}, {16, 400}});
+
+// Pooled transfer checkout, URL, body, headers and (arg 1) signing for
+// POST /licenses/borrow, then recycling; no network
+static void BM_MakePost(benchmark::State& state) {
+    bool security = state.range(0) != 0;
+    license::LicenseClient client(MockServer::instance().url(), bench_options(false, security));
+    auto& impl = BenchAccess::impl(client);
+    const std::string tool = TOOL;
+    const std::string user = USER;
+    auto post = [&] {
+        return impl.make_post("/licenses/borrow", [&](std::string& body) {
+            license::write_borrow_body(body, tool, user);
+        }, tool, user);
+    };
+    post();  // warm the pool and the transfer's signing context
+
+    AllocScope allocs(state);
+    for (auto _ : state) {
+        auto t = post();
+        benchmark::DoNotOptimize(t.get());
+    }
+}
+BENCHMARK(BM_MakePost)->ArgName("security")->Arg(0)->Arg(1);
+
+// ---------------------------------------------------------------------------
+// End to end
+// ---------------------------------------------------------------------------
+
+// Blocking borrow and return over a kept-alive loopback connection;
+// arg 0 = JSON, 1 = MessagePack
+static void BM_BorrowReturn(benchmark::State& state) {
+    bool msgpack = state.range(0) != 0;
+    license::LicenseClient client(MockServer::instance().url(), bench_options(msgpack));
+    const std::string tool = TOOL;
+    const std::string user = USER;
+    {
+        auto handle = client.borrow(tool, user);
+        client.return_license(handle);
+    }
+
+    AllocScope allocs(state);
+    for (auto _ : state) {
+        auto handle = client.borrow(tool, user);
+        client.return_license(handle);
+    }
+}
+BENCHMARK(BM_BorrowReturn)->ArgName("msgpack")->Arg(0)->Arg(1)->UseRealTime();
+
+// get_all_statuses for MockServer::TOOLS tools; arg 0 = JSON, 1 = MessagePack
+static void BM_GetAllStatuses(benchmark::State& state) {
+    bool msgpack = state.range(0) != 0;
+    license::LicenseClient client(MockServer::instance().url(), bench_options(msgpack));
+    client.get_all_statuses();
+
+    AllocScope allocs(state);
+    for (auto _ : state) {
+        auto statuses = client.get_all_statuses();
+        benchmark::DoNotOptimize(statuses.data());
+    }
+}
+BENCHMARK(BM_GetAllStatuses)->ArgName("msgpack")->Arg(0)->Arg(1)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -50,6 +50,8 @@ int main(int argc, char* argv[]) {
             // handle automatically returns license when destroyed
         }
         
+        // Handle returns are sent in the background; wait for them
+        client.flush_returns();
         std::cout << "✅ License returned (RAII)" << std::endl << std::endl;
         
         // Get status after returning
@@ -0,0 +1,168 @@
+/**
+ * @file license_agent_protocol.hpp
+ * @brief Wire protocol between LicenseClient and license_agentd (internal)
+ *
+ * One request per line over a Unix stream socket, fields separated by
+ * tabs. Replies are one line ("OK..." or an error word), except
+ * STATUSALL, whose OK line carries a count of status lines that follow.
+ *
+ *   BORROW\t<tool>\t<user>   ->  OK\t<id> | NOLICENSE
+ *   RETURN\t<id>             ->  OK | NOTFOUND
+ *   STATUS\t<tool>           ->  OK\t<status fields> | NOTFOUND
+ *   STATUSALL                ->  OK\t<n>, then n lines of status fields
+ *   any                      ->  ERR\t<message>
+ *
+ * RETURN only finds leases borrowed by the same process, over any of its
+ * connections.
+ *
+ * Status fields: tool, total, borrowed, available, commit, max_overage,
+ * overage, in_commit (0/1).
+ *
+ * Not installed; shared by license_client.cpp and license_agentd.cpp.
+ */
+
+#ifndef LICENSE_AGENT_PROTOCOL_HPP
+#define LICENSE_AGENT_PROTOCOL_HPP
+
+#include "license_client.hpp"
+
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0  // macOS: suppress_sigpipe() sets SO_NOSIGPIPE instead
+#endif
+
+namespace license {
+namespace agent {
+
+/** Socket used when neither the caller nor LICENSE_AGENT_SOCKET names one */
+constexpr const char* DEFAULT_SOCKET_PATH = "/tmp/license_agentd.sock";
+
+/** Longest line either side accepts */
+constexpr std::size_t MAX_LINE = 64 * 1024;
+
+/** Split @p line on tabs into views */
+inline void split_fields(std::string_view line, std::vector<std::string_view>& fields) {
+    fields.clear();
+    std::size_t start = 0;
+    for (;;) {
+        std::size_t tab = line.find('\t', start);
+        if (tab == std::string_view::npos) {
+            fields.push_back(line.substr(start));
+            return;
+        }
+        fields.push_back(line.substr(start, tab - start));
+        start = tab + 1;
+    }
+}
+
+/** Field values may not contain the separators */
+inline bool valid_field(std::string_view value) {
+    return !value.empty() && value.find_first_of("\t\n\r") == std::string_view::npos;
+}
+
+inline void append_status_fields(std::string& out, const LicenseStatus& s) {
+    const int numbers[] = {s.total, s.borrowed, s.available, s.commit, s.max_overage, s.overage};
+    out.append(s.tool);
+    char buf[16];
+    for (int n : numbers) {
+        out.push_back('\t');
+        out.append(buf, std::to_chars(buf, buf + sizeof(buf), n).ptr);
+    }
+    out.append(s.in_commit ? "\t1" : "\t0");
+}
+
+/** Parse status fields starting at fields[first]; false if malformed */
+inline bool parse_status_fields(const std::vector<std::string_view>& fields, std::size_t first,
+                                LicenseStatus& s) {
+    if (fields.size() != first + 8) return false;
+    int* numbers[] = {&s.total, &s.borrowed, &s.available, &s.commit, &s.max_overage, &s.overage};
+    s.tool.assign(fields[first].data(), fields[first].size());
+    for (std::size_t i = 0; i < 6; ++i) {
+        std::string_view f = fields[first + 1 + i];
+        auto result = std::from_chars(f.data(), f.data() + f.size(), *numbers[i]);
+        if (result.ec != std::errc() || result.ptr != f.data() + f.size()) return false;
+    }
+    s.in_commit = fields[first + 7] == "1";
+    return true;
+}
+
+/**
+ * @brief Buffered line I/O on a connected stream socket
+ *
+ * Does not own the descriptor.
+ */
+class LineChannel {
+public:
+    explicit LineChannel(int fd) : fd_(fd) {}
+
+    /** Read one line without its newline; false on EOF, error or overlong line */
+    bool read_line(std::string& line) {
+        for (;;) {
+            std::size_t nl = buffer_.find('\n', scanned_);
+            if (nl != std::string::npos) {
+                line.assign(buffer_, 0, nl);
+                buffer_.erase(0, nl + 1);
+                scanned_ = 0;
+                return true;
+            }
+            scanned_ = buffer_.size();
+            if (buffer_.size() > MAX_LINE) return false;
+            char chunk[4096];
+            ssize_t n = ::read(fd_, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            buffer_.append(chunk, static_cast<std::size_t>(n));
+        }
+    }
+
+    /** Write all of @p data; false on error */
+    bool write_all(std::string_view data) {
+        while (!data.empty()) {
+            ssize_t n = ::send(fd_, data.data(), data.size(), MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data.remove_prefix(static_cast<std::size_t>(n));
+        }
+        return true;
+    }
+
+private:
+    int fd_;
+    std::string buffer_;
+    std::size_t scanned_ = 0;
+};
+
+/** Make writes to a closed peer fail with EPIPE instead of raising SIGPIPE */
+inline void suppress_sigpipe(int fd) {
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#else
+    (void)fd;
+#endif
+}
+
+/** Fill a sockaddr_un for @p path; false if the path is too long */
+inline bool make_address(const std::string& path, sockaddr_un& addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+} // namespace agent
+} // namespace license
+
+#endif // LICENSE_AGENT_PROTOCOL_HPP
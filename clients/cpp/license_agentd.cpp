@@ -0,0 +1,499 @@
+/**
+ * @file license_agentd.cpp
+ * @brief Host-local license agent
+ *
+ * Holds a few pre-borrowed seats per tool and lends them to processes on
+ * the same host over a Unix socket (protocol in license_agent_protocol.hpp),
+ * so a tool launch costs a local round trip instead of a WAN request, and
+ * the server sees one client per host. Seats are borrowed from the server
+ * in the name of the user who asked, from one pool per user. A seat
+ * belongs to the process that borrowed it: only that process can return
+ * it, and it goes back to the pool when the process closes its last
+ * connection (including when it crashes).
+ *
+ * Processes opt in with ClientOptions::agent_socket or by setting
+ * LICENSE_AGENT_SOCKET.
+ */
+
+#include "license_agent_protocol.hpp"
+#include "license_client.hpp"
+#include "license_seat_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace license;
+
+namespace {
+
+// How often the accept loop looks for idle user pools
+constexpr int POOL_SWEEP_MS = 1000;
+
+struct AgentOptions {
+    std::string server_url = "http://localhost:8000";
+    std::string socket_path = agent::DEFAULT_SOCKET_PATH;
+    std::string user;                 // upstream user for every seat; default: whoever asked
+    int prefetch = 1;                 // idle seats topped up per active tool
+    long idle_secs = 60;              // drop a tool's seats after this long unused
+    long status_ttl_ms = 2000;        // upstream status cache
+    mode_t socket_mode = 0660;
+    bool enable_security = true;
+    bool allow_overage = false;       // let spares be borrowed beyond commit
+};
+
+void usage(const char* argv0) {
+    std::cerr << "Usage: " << argv0 << " [options]\n"
+              << "  --server URL        License server (default http://localhost:8000)\n"
+              << "  --socket PATH       Listening socket (default " << agent::DEFAULT_SOCKET_PATH << ")\n"
+              << "  --prefetch N        Spare seats held per tool in use (default 1)\n"
+              << "  --idle-secs S       Return a tool's idle seats after S s unused (default 60)\n"
+              << "  --status-ttl-ms MS  Cache status reads for MS ms (default 2000)\n"
+              << "  --user NAME         Borrow every seat as NAME, in one shared pool\n"
+              << "  --mode OCTAL        Socket permissions (default 0660)\n"
+              << "  --allow-overage     Let spare seats be borrowed beyond commit\n"
+              << "  --no-security       Disable HMAC request signing\n";
+}
+
+bool parse_args(int argc, char** argv, AgentOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << "\n";
+                return nullptr;
+            }
+            return argv[++i];
+        };
+        const char* v = nullptr;
+        if (arg == "--no-security") {
+            options.enable_security = false;
+        } else if (arg == "--allow-overage") {
+            options.allow_overage = true;
+        } else if (arg == "--help" || arg == "-h") {
+            return false;
+        } else if ((v = value()) == nullptr) {
+            return false;
+        } else if (arg == "--server") {
+            options.server_url = v;
+        } else if (arg == "--socket") {
+            options.socket_path = v;
+        } else if (arg == "--prefetch") {
+            options.prefetch = std::max(0, std::atoi(v));
+        } else if (arg == "--idle-secs") {
+            options.idle_secs = std::max(1L, std::atol(v));
+        } else if (arg == "--status-ttl-ms") {
+            options.status_ttl_ms = std::max(0L, std::atol(v));
+        } else if (arg == "--user") {
+            options.user = v;
+        } else if (arg == "--mode") {
+            options.socket_mode = static_cast<mode_t>(std::strtol(v, nullptr, 8));
+        } else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Leases on top of one SeatPool per upstream user. Connection threads
+ * borrow and return through it; each pool tops itself up and returns
+ * seats of tools that went unused, and a user's pool is dropped once
+ * nothing has been borrowed from it for --idle-secs. Leases are keyed
+ * by owner, the peer process (see peer_owner()), so a client may use
+ * several connections.
+ */
+class SeatAgent {
+public:
+    enum class BorrowResult { Ok, NoLicense };
+
+    SeatAgent(const AgentOptions& options, const ClientOptions& client_options)
+        : upstream_(options.server_url, client_options),
+          shared_user_(options.user),
+          pool_options_(pool_options(options)),
+          pool_idle_after_(std::chrono::seconds(options.idle_secs)) {}
+
+    ~SeatAgent() {
+        // Leases go back to the pools, the pools return their seats, and
+        // the upstream client sends the returns before it is destroyed
+        leases_.clear();
+        pools_.clear();
+    }
+
+    SeatAgent(const SeatAgent&) = delete;
+    SeatAgent& operator=(const SeatAgent&) = delete;
+
+    BorrowResult borrow(const std::string& tool, const std::string& user, long owner,
+                        std::string& id) {
+        const std::string& pool_user = shared_user_.empty() ? user : shared_user_;
+        SeatPool::Seat seat;
+        try {
+            seat = use_pool(pool_user).acquire(tool);
+        } catch (const NoLicensesAvailableException&) {
+            done_with_pool(pool_user);
+            return BorrowResult::NoLicense;
+        } catch (...) {
+            done_with_pool(pool_user);
+            throw;
+        }
+        id = seat.id();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!leases_.emplace(id, Lease{std::move(seat), owner, user}).second) {
+            done_with_pool(pool_user);
+        }
+        return BorrowResult::Ok;
+    }
+
+    // False if @p owner holds no lease with this ID
+    bool give_back(const std::string& id, long owner) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = leases_.find(id);
+        if (it == leases_.end() || it->second.owner != owner) {
+            return false;
+        }
+        end_lease(it);
+        return true;
+    }
+
+    void connected(long owner) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++connections_[owner];
+    }
+
+    // A connection closed: if it was the owner's last, take back
+    // everything the owner still holds
+    std::size_t disconnected(long owner) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto open = connections_.find(owner);
+        if (open != connections_.end()) {
+            if (--open->second > 0) {
+                return 0;
+            }
+            connections_.erase(open);
+        }
+        std::size_t released = 0;
+        for (auto it = leases_.begin(); it != leases_.end();) {
+            if (it->second.owner == owner) {
+                it = end_lease(it);
+                ++released;
+            } else {
+                ++it;
+            }
+        }
+        return released;
+    }
+
+    // Drop the pools, and their maintainer threads, of users that have
+    // borrowed nothing for --idle-secs; the accept loop calls this
+    void drop_idle_pools() {
+        std::vector<std::unique_ptr<SeatPool>> idle;
+        {
+            std::lock_guard<std::mutex> lock(pools_mutex_);
+            auto now = std::chrono::steady_clock::now();
+            for (auto it = pools_.begin(); it != pools_.end();) {
+                if (it->second.in_use == 0 && now - it->second.idle_since >= pool_idle_after_) {
+                    idle.push_back(std::move(it->second.pool));
+                    it = pools_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        // Destroyed unlocked, as they return any spares left
+    }
+
+    LicenseClient& upstream() { return upstream_; }
+
+private:
+    struct Lease {
+        SeatPool::Seat seat;  // back to its pool when the lease is erased
+        long owner;
+        std::string user;     // the local user, for diagnostics
+    };
+
+    struct UserPool {
+        std::unique_ptr<SeatPool> pool;
+        std::size_t in_use = 0;  // leases, and borrows under way
+        std::chrono::steady_clock::time_point idle_since;
+    };
+
+    // @p user's pool, created on first use; it is kept until each
+    // use_pool is matched by a done_with_pool
+    SeatPool& use_pool(const std::string& user) {
+        std::lock_guard<std::mutex> lock(pools_mutex_);
+        UserPool& entry = pools_[user];
+        if (!entry.pool) {
+            entry.pool = std::make_unique<SeatPool>(upstream_, user, pool_options_);
+        }
+        ++entry.in_use;
+        return *entry.pool;
+    }
+
+    void done_with_pool(const std::string& user) {
+        std::lock_guard<std::mutex> lock(pools_mutex_);
+        auto it = pools_.find(user);
+        if (it != pools_.end() && --it->second.in_use == 0) {
+            it->second.idle_since = std::chrono::steady_clock::now();
+        }
+    }
+
+    // With mutex_ held
+    std::unordered_map<std::string, Lease>::iterator
+    end_lease(std::unordered_map<std::string, Lease>::iterator it) {
+        std::string pool_user = shared_user_.empty() ? it->second.user : shared_user_;
+        it = leases_.erase(it);
+        done_with_pool(pool_user);
+        return it;
+    }
+
+    static SeatPoolOptions pool_options(const AgentOptions& options) {
+        SeatPoolOptions pool;
+        pool.target_spares = options.prefetch;
+        pool.low_water = options.prefetch;
+        pool.idle_timeout_ms = options.idle_secs * 1000;
+        pool.allow_overage = options.allow_overage;
+        return pool;
+    }
+
+    LicenseClient upstream_;
+    const std::string shared_user_;
+    const SeatPoolOptions pool_options_;
+    const std::chrono::steady_clock::duration pool_idle_after_;
+    std::mutex pools_mutex_;  // taken after mutex_ when both are held
+    std::unordered_map<std::string, UserPool> pools_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, Lease> leases_;
+    std::unordered_map<long, int> connections_;  // open connections per owner
+};
+
+// Error text must stay on one line
+std::string error_reply(const std::string& message) {
+    std::string reply = "ERR\t" + message;
+    std::replace_if(reply.begin() + 4, reply.end(),
+                    [](char c) { return c == '\t' || c == '\n' || c == '\r'; }, ' ');
+    return reply + "\n";
+}
+
+bool is_not_found(const LicenseException& e) {
+    return std::strcmp(e.what(), "HTTP error: 404") == 0;
+}
+
+/**
+ * Owner of the leases borrowed over @p fd: the peer process, where the
+ * platform reports it, so that any of its pooled connections may return
+ * them; otherwise the connection itself (-1 - @p connection).
+ */
+long peer_owner(int fd, long connection) {
+#if defined(SO_PEERCRED)
+    ucred peer{};
+    socklen_t length = sizeof(peer);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) == 0 && peer.pid > 0) {
+        return peer.pid;
+    }
+#elif defined(LOCAL_PEERPID)
+    pid_t pid = 0;
+    socklen_t length = sizeof(pid);
+    if (getsockopt(fd, SOL_LOCAL, LOCAL_PEERPID, &pid, &length) == 0 && pid > 0) {
+        return pid;
+    }
+#endif
+    return -1 - connection;
+}
+
+void serve(SeatAgent& agent, int fd, long owner) {
+    agent::LineChannel channel(fd);
+    std::string line;
+    std::string reply;
+    std::vector<std::string_view> fields;
+    while (channel.read_line(line)) {
+        agent::split_fields(line, fields);
+        const std::string_view verb = fields[0];
+        try {
+            if (verb == "BORROW" && fields.size() == 3) {
+                std::string id;
+                auto result = agent.borrow(std::string(fields[1]), std::string(fields[2]), owner, id);
+                reply = result == SeatAgent::BorrowResult::Ok ? "OK\t" + id + "\n" : "NOLICENSE\n";
+            } else if (verb == "RETURN" && fields.size() == 2) {
+                reply = agent.give_back(std::string(fields[1]), owner) ? "OK\n" : "NOTFOUND\n";
+            } else if (verb == "STATUS" && fields.size() == 2) {
+                LicenseStatus status = agent.upstream().get_status(std::string(fields[1]));
+                reply = "OK\t";
+                agent::append_status_fields(reply, status);
+                reply.push_back('\n');
+            } else if (verb == "STATUSALL" && fields.size() == 1) {
+                std::vector<LicenseStatus> statuses = agent.upstream().get_all_statuses();
+                reply = "OK\t" + std::to_string(statuses.size()) + "\n";
+                for (const auto& status : statuses) {
+                    agent::append_status_fields(reply, status);
+                    reply.push_back('\n');
+                }
+            } else {
+                reply = error_reply("unknown request");
+            }
+        } catch (const LicenseException& e) {
+            reply = is_not_found(e) ? "NOTFOUND\n" : error_reply(e.what());
+        }
+        if (!channel.write_all(reply)) {
+            break;
+        }
+    }
+    std::size_t released = agent.disconnected(owner);
+    if (released > 0) {
+        std::cerr << "license_agentd: last connection of " << owner << " closed holding "
+                  << released << " seat(s); taken back\n";
+    }
+}
+
+// Self-pipe: the signal handler only writes a byte
+int g_signal_pipe[2] = {-1, -1};
+
+void on_signal(int) {
+    char byte = 1;
+    ssize_t ignored = write(g_signal_pipe[1], &byte, 1);
+    (void)ignored;
+}
+
+// Bind the socket, replacing a stale one; -1 if another agent owns it
+int open_listener(const AgentOptions& options) {
+    sockaddr_un addr;
+    if (!agent::make_address(options.socket_path, addr)) {
+        std::cerr << "license_agentd: invalid socket path " << options.socket_path << "\n";
+        return -1;
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe >= 0 && connect(probe, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+        close(probe);
+        std::cerr << "license_agentd: another agent is listening on " << options.socket_path << "\n";
+        return -1;
+    }
+    if (probe >= 0) close(probe);
+    unlink(options.socket_path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        chmod(options.socket_path.c_str(), options.socket_mode) != 0 || listen(fd, 128) != 0) {
+        std::cerr << "license_agentd: cannot listen on " << options.socket_path << ": "
+                  << std::strerror(errno) << "\n";
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+struct Worker {
+    int fd;
+    std::thread thread;
+    std::atomic<bool> done{false};
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+    AgentOptions options;
+    if (!parse_args(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+    // The agent talks to the server itself, never to another agent
+    unsetenv("LICENSE_AGENT_SOCKET");
+
+    ClientOptions client_options;
+    client_options.enable_security = options.enable_security;
+    client_options.status_cache_ttl_ms = options.status_ttl_ms;
+
+    if (pipe(g_signal_pipe) != 0) {
+        std::perror("license_agentd: pipe");
+        return 1;
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    int listener = open_listener(options);
+    if (listener < 0) {
+        return 1;
+    }
+
+    std::list<Worker> workers;
+    {
+        SeatAgent seats(options, client_options);
+        std::cerr << "license_agentd: serving " << options.server_url << " on "
+                  << options.socket_path << "\n";
+
+        long connections = 0;
+        for (;;) {
+            pollfd fds[2] = {{listener, POLLIN, 0}, {g_signal_pipe[0], POLLIN, 0}};
+            if (poll(fds, 2, POOL_SWEEP_MS) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (fds[1].revents) {
+                break;
+            }
+            seats.drop_idle_pools();
+            if (!(fds[0].revents & POLLIN)) {
+                continue;
+            }
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) {
+                continue;
+            }
+            agent::suppress_sigpipe(fd);
+
+            // Reap finished connections
+            for (auto it = workers.begin(); it != workers.end();) {
+                if (it->done.load()) {
+                    it->thread.join();
+                    close(it->fd);
+                    it = workers.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+
+            Worker& worker = workers.emplace_back();
+            worker.fd = fd;
+            long owner = peer_owner(fd, connections++);
+            seats.connected(owner);
+            // The descriptor is closed only after the join, so shutdown()
+            // below never hits a reused number
+            worker.thread = std::thread([&seats, &worker, fd, owner] {
+                serve(seats, fd, owner);
+                worker.done.store(true);
+            });
+        }
+
+        std::cerr << "license_agentd: shutting down\n";
+        close(listener);
+        unlink(options.socket_path.c_str());
+        for (auto& worker : workers) {
+            shutdown(worker.fd, SHUT_RDWR);
+        }
+        for (auto& worker : workers) {
+            worker.thread.join();
+            close(worker.fd);
+        }
+        // ~SeatAgent returns every seat to the server
+    }
+    return 0;
+}
@@ -4,13 +4,56 @@
  */
 
 #include "license_client.hpp"
+#include "license_status_table.hpp"
+#include "license_json.hpp"
+#include "license_msgpack.hpp"
+#include "license_agent_protocol.hpp"
+#include "license_timer_wheel.hpp"
+#include "license_histogram.hpp"
 #include <curl/curl.h>
-#include <json/json.h>
+#include <charconv>
+#include <cstring>
 #include <sstream>
-#include <iomanip>
 #include <chrono>
-#include <openssl/hmac.h>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <iterator>
+#include <random>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <shared_mutex>
+#include <condition_variable>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef LICENSE_CLIENT_PHASE_TRACE
+#define LICENSE_CLIENT_PHASE_TRACE 0
+#endif
+#if LICENSE_CLIENT_PHASE_TRACE && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define LICENSE_CLIENT_USDT 1
+#endif
+#endif
+#include <openssl/opensslv.h>
 #include <openssl/sha.h>
+#include <openssl/bio.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#else
+#include <openssl/hmac.h>
+#endif
 
 namespace license {
 
@@ -18,6 +61,8 @@ namespace license {
 struct Response {
     std::string data;
     long http_code = 0;
+    bool msgpack = false;  // body is MessagePack rather than JSON
+    bool redirected = false;  // sent on to another shard after a 307
 };
 
 static size_t write_callback(void* contents, size_t size, size_t nmemb, void* userp) {
@@ -29,138 +74,4153 @@ static size_t write_callback(void* contents, size_t size, size_t nmemb, void* us
 // In production, this would be obfuscated/encrypted
 static const std::string VENDOR_SECRET = "techvendor_secret_ecu_2025_demo_xyz789abc123def456";
 static const std::string VENDOR_ID = "techvendor";
+static const std::string VENDOR_HEADER = "X-Vendor-ID: " + VENDOR_ID;
+static const char CONTENT_TYPE_HEADER[] = "Content-Type: application/json";
+// JSON stays acceptable, so servers without MessagePack still answer
+static const char ACCEPT_MSGPACK_HEADER[] = "Accept: application/msgpack, application/json;q=0.5";
 
-// PIMPL implementation
-class LicenseClient::Impl {
+// Pooled transfers start with this much response buffer, and drop
+// buffers that grew past the cap (e.g. after a large status listing)
+static constexpr std::size_t RESPONSE_RESERVE = 4096;
+static constexpr std::size_t MAX_POOLED_BUFFER = 256 * 1024;
+
+// curl_global_init is not thread-safe; run it exactly once per process
+static void ensure_curl_global_init() {
+    static std::once_flag once;
+    std::call_once(once, [] { curl_global_init(CURL_GLOBAL_DEFAULT); });
+}
+
+// Index of the pool shard owned by the calling thread. Threads are
+// assigned round-robin, so with enough shards every thread reuses its
+// own handles and never contends on a shard lock.
+static std::size_t thread_shard_index() {
+    static std::atomic<std::size_t> next_index{0};
+    thread_local std::size_t index = next_index.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+static bool is_msgpack_type(const char* content_type) {
+    static const char* const types[] = {"application/msgpack", "application/x-msgpack"};
+    if (!content_type) return false;
+    for (const char* type : types) {
+        std::size_t n = std::strlen(type);
+        if (std::strncmp(content_type, type, n) == 0 &&
+            (content_type[n] == '\0' || content_type[n] == ';' || content_type[n] == ' ')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Status code and body encoding of a completed transfer
+static void read_response_info(CURL* easy, Response& response) {
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &response.http_code);
+    char* content_type = nullptr;
+    curl_easy_getinfo(easy, CURLINFO_CONTENT_TYPE, &content_type);
+    response.msgpack = is_msgpack_type(content_type);
+}
+
+// Response decoding shared by the blocking and async paths. Bodies are
+// decoded in place by json::Reader or msgpack::Reader, whichever the
+// server answered with; the readers share one interface, so each
+// decoder is a template. Only the fields we use are read.
+
+// Run read(reader) over the whole body, then require its end
+template <typename F>
+static void decode(const Response& response, F&& read) {
+    if (response.msgpack) {
+        msgpack::Reader reader(response.data);
+        read(reader);
+        reader.finish();
+    } else {
+        json::Reader reader(response.data);
+        read(reader);
+        reader.finish();
+    }
+}
+
+// Overwrites every field, keeping status.tool's capacity for reuse
+template <typename Reader>
+static void read_status(Reader& reader, LicenseStatus& status) {
+    status.tool.clear();
+    status.total = status.borrowed = status.available = 0;
+    status.commit = status.max_overage = status.overage = 0;
+    status.in_commit = true;
+    reader.object([&](std::string_view key) {
+        if (key == "tool") {
+            reader.string(status.tool);
+        } else if (key == "total") {
+            status.total = reader.integer();
+        } else if (key == "borrowed") {
+            status.borrowed = reader.integer();
+        } else if (key == "available") {
+            status.available = reader.integer();
+        } else if (key == "commit") {
+            status.commit = reader.integer();
+        } else if (key == "max_overage") {
+            status.max_overage = reader.integer();
+        } else if (key == "overage") {
+            status.overage = reader.integer();
+        } else if (key == "in_commit") {
+            status.in_commit = reader.boolean();
+        } else {
+            reader.skip();
+        }
+    });
+}
+
+// Decode a status array into @p statuses from index @p first on,
+// reusing its elements
+template <typename Reader>
+static void read_statuses(Reader& reader, std::vector<LicenseStatus>& statuses, std::size_t first = 0) {
+    std::size_t n = first;
+    reader.array([&] {
+        if (n == statuses.size()) {
+            statuses.emplace_back();
+        }
+        read_status(reader, statuses[n++]);
+    });
+    statuses.resize(n);
+}
+
+// Decode a status array into @p table, marking each tool present
+template <typename Reader>
+static void read_statuses(Reader& reader, StatusTable& table) {
+    LicenseStatus status;
+    reader.array([&] {
+        read_status(reader, status);
+        table.set(status);
+    });
+}
+
+// Add statuses to a list, or set them in a table
+static void add_statuses(std::vector<LicenseStatus>& out, const std::vector<LicenseStatus>& statuses) {
+    out.insert(out.end(), statuses.begin(), statuses.end());
+}
+
+static void add_statuses(StatusTable& out, const std::vector<LicenseStatus>& statuses) {
+    for (const LicenseStatus& status : statuses) {
+        out.set(status);
+    }
+}
+
+/**
+ * Cluster hash ring from GET /cluster/shards (see app/shards.py). Each
+ * node sits at `vnodes` points, the first 8 bytes (big-endian) of SHA-1
+ * over "<id>#<i>", and a tool belongs to the node at the first point at
+ * or after the hash of its name. The points are recomputed here rather
+ * than read, as a JSON number cannot carry all 64 bits.
+ */
+struct ShardRing {
+    std::vector<std::string> ids;
+    std::vector<std::string> urls;
+    std::vector<std::pair<std::uint64_t, std::size_t>> points;  // sorted; second indexes urls
+    
+    static std::uint64_t hash(std::string_view key) {
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int length = 0;
+        EVP_Digest(key.data(), key.size(), digest, &length, EVP_sha1(), nullptr);
+        std::uint64_t h = 0;
+        for (int i = 0; i < 8; ++i) {
+            h = (h << 8) | digest[i];
+        }
+        return h;
+    }
+    
+    void build(int vnodes) {
+        points.clear();
+        points.reserve(ids.size() * static_cast<std::size_t>(vnodes));
+        for (std::size_t n = 0; n < ids.size(); ++n) {
+            for (int i = 0; i < vnodes; ++i) {
+                points.emplace_back(hash(ids[n] + "#" + std::to_string(i)), n);
+            }
+        }
+        std::sort(points.begin(), points.end());
+    }
+    
+    const std::string& owner_url(std::string_view tool) const {
+        auto it = std::lower_bound(points.begin(), points.end(), std::make_pair(hash(tool), std::size_t{0}));
+        return urls[(it == points.end() ? points.front() : *it).second];
+    }
+    
+    // Node that issued a "<node>.<uuid>" borrow ID; null for IDs without one
+    const std::string* issuer_url(std::string_view borrow_id) const {
+        std::size_t dot = borrow_id.find('.');
+        if (dot == std::string_view::npos) return nullptr;
+        std::string_view prefix = borrow_id.substr(0, dot);
+        for (std::size_t n = 0; n < ids.size(); ++n) {
+            if (ids[n] == prefix) return &urls[n];
+        }
+        return nullptr;
+    }
+    
+    // Whether @p url is on one of the nodes, by their base URLs
+    bool has_node(std::string_view url) const {
+        for (const std::string& node : urls) {
+            if (!node.empty() && url.size() > node.size() && url.compare(0, node.size(), node) == 0 &&
+                (node.back() == '/' || url[node.size()] == '/' || url[node.size()] == '?')) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Decode /cluster/shards into @p ring's nodes; returns false for a ring
+// this client cannot reproduce
+template <typename Reader>
+static bool read_shard_ring(Reader& reader, ShardRing& ring) {
+    std::string hash;
+    int vnodes = 0;
+    reader.object([&](std::string_view key) {
+        if (key == "hash") {
+            reader.string(hash);
+        } else if (key == "vnodes") {
+            vnodes = reader.integer();
+        } else if (key == "nodes") {
+            reader.array([&] {
+                std::string id, url;
+                reader.object([&](std::string_view member) {
+                    if (member == "id") {
+                        reader.string(id);
+                    } else if (member == "url") {
+                        reader.string(url);
+                    } else {
+                        reader.skip();
+                    }
+                });
+                ring.ids.push_back(std::move(id));
+                ring.urls.push_back(std::move(url));
+            });
+        } else {
+            reader.skip();
+        }
+    });
+    if (hash != "sha1-64" || vnodes <= 0 || ring.ids.empty()) {
+        return false;
+    }
+    ring.build(vnodes);
+    return true;
+}
+
+// Request bodies are rendered straight into a transfer's reusable
+// body buffer
+
+static void append_json_string(std::string& out, const std::string& value) {
+    static const char hex[] = "0123456789abcdef";
+    out.push_back('"');
+    for (char c : value) {
+        auto u = static_cast<unsigned char>(c);
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (u < 0x20) {
+            out.append("\\u00");
+            out.push_back(hex[u >> 4]);
+            out.push_back(hex[u & 0xF]);
+        } else {
+            out.push_back(c);
+        }
+    }
+    out.push_back('"');
+}
+
+static void append_int(std::string& out, int value) {
+    char buf[16];
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, result.ptr);
+}
+
+static void write_borrow_body(std::string& out, const std::string& tool, const std::string& user) {
+    out.append("{\"tool\":");
+    append_json_string(out, tool);
+    out.append(",\"user\":");
+    append_json_string(out, user);
+    out.push_back('}');
+}
+
+static void write_borrow_wait_body(std::string& out, const std::string& tool,
+                                   const std::string& user, long timeout_ms) {
+    out.append("{\"tool\":");
+    append_json_string(out, tool);
+    out.append(",\"user\":");
+    append_json_string(out, user);
+    out.append(",\"timeout_ms\":");
+    out.append(std::to_string(timeout_ms));
+    out.push_back('}');
+}
+
+static void write_return_body(std::string& out, const std::string& id) {
+    out.append("{\"id\":");
+    append_json_string(out, id);
+    out.push_back('}');
+}
+
+// @p lease_seconds is 0 when the server does not expire borrows. The
+// lease token is only read when @p lease_token is given.
+static LicenseHandle handle_from_borrow_response(const Response& response,
+                                                 const std::string& tool,
+                                                 const std::string& user,
+                                                 int& lease_seconds,
+                                                 std::string* lease_token = nullptr) {
+    if (response.http_code == 409) {
+        throw NoLicensesAvailableException(tool);
+    }
+    
+    if (response.http_code != 200) {
+        throw LicenseException("HTTP error: " + std::to_string(response.http_code));
+    }
+    
+    std::string id;
+    lease_seconds = 0;
+    decode(response, [&](auto& reader) {
+        reader.object([&](std::string_view key) {
+            if (key == "id") {
+                reader.string(id);
+            } else if (key == "lease_seconds") {
+                lease_seconds = reader.integer();
+            } else if (key == "lease_token" && lease_token) {
+                reader.string(*lease_token);
+            } else {
+                reader.skip();
+            }
+        });
+    });
+    return LicenseHandle(std::move(id), tool, user);
+}
+
+static void check_return_response(const Response& response) {
+    if (response.http_code != 200) {
+        throw LicenseException("HTTP error: " + std::to_string(response.http_code));
+    }
+}
+
+static LicenseStatus status_from_response(const Response& response) {
+    if (response.http_code != 200) {
+        throw LicenseException("HTTP error: " + std::to_string(response.http_code));
+    }
+    LicenseStatus status;
+    decode(response, [&](auto& reader) { read_status(reader, status); });
+    return status;
+}
+
+// Decode a status listing after what @p out (a list or a StatusTable) holds
+template <typename Out>
+static void statuses_from_response(const Response& response, Out& out) {
+    if (response.http_code != 200) {
+        throw LicenseException("HTTP error: " + std::to_string(response.http_code));
+    }
+    
+    decode(response, [&](auto& reader) {
+        if constexpr (std::is_same_v<Out, StatusTable>) {
+            read_statuses(reader, out);
+        } else {
+            read_statuses(reader, out, out.size());
+        }
+    });
+}
+
+// GET /licenses/status/delta: the tools changed (or removed) after a version
+struct StatusDelta {
+    std::string version;
+    bool full = false;  // changed is the whole list
+    std::vector<LicenseStatus> changed;
+    std::vector<std::string> removed;
+};
+
+static StatusDelta status_delta_from_response(const Response& response) {
+    if (response.http_code != 200) {
+        throw LicenseException("HTTP error: " + std::to_string(response.http_code));
+    }
+    StatusDelta delta;
+    decode(response, [&](auto& reader) {
+        reader.object([&](std::string_view key) {
+            if (key == "version") {
+                reader.string(delta.version);
+            } else if (key == "full") {
+                delta.full = reader.boolean();
+            } else if (key == "changed") {
+                read_statuses(reader, delta.changed);
+            } else if (key == "removed") {
+                reader.array([&] {
+                    delta.removed.emplace_back();
+                    reader.string(delta.removed.back());
+                });
+            } else {
+                reader.skip();
+            }
+        });
+    });
+    return delta;
+}
+
+// Apply @p delta to @p statuses, a list ordered by tool
+static void merge_status_delta(std::vector<LicenseStatus>& statuses, StatusDelta&& delta) {
+    if (delta.full) {
+        statuses = std::move(delta.changed);
+        return;
+    }
+    auto by_tool = [](const LicenseStatus& status, const std::string& tool) { return status.tool < tool; };
+    for (LicenseStatus& status : delta.changed) {
+        auto it = std::lower_bound(statuses.begin(), statuses.end(), status.tool, by_tool);
+        if (it != statuses.end() && it->tool == status.tool) {
+            *it = std::move(status);
+        } else {
+            statuses.insert(it, std::move(status));
+        }
+    }
+    for (const std::string& tool : delta.removed) {
+        auto it = std::lower_bound(statuses.begin(), statuses.end(), tool, by_tool);
+        if (it != statuses.end() && it->tool == tool) {
+            statuses.erase(it);
+        }
+    }
+}
+
+// Server-side limit on seats per batch request
+static constexpr int MAX_BATCH_SIZE = 500;
+
+// Least time between fetches of a sharded cluster's ring
+static constexpr long SHARD_REFRESH_MS = 1000;
+
+// Most 307s one request follows from node to node
+static constexpr int MAX_SHARD_REDIRECTS = 2;
+
+static void write_batch_borrow_body(std::string& out, const std::string& tool,
+                                    const std::string& user, int count) {
+    out.append("{\"tool\":");
+    append_json_string(out, tool);
+    out.append(",\"user\":");
+    append_json_string(out, user);
+    out.append(",\"count\":");
+    append_int(out, count);
+    out.push_back('}');
+}
+
+// {"ids": [...]} from a range, with id_of(element) giving each ID
+template <typename It, typename IdOf>
+static void write_batch_return_body(std::string& out, It first, It last, IdOf id_of) {
+    out.append("{\"ids\":[");
+    for (It it = first; it != last; ++it) {
+        if (it != first) out.push_back(',');
+        append_json_string(out, id_of(*it));
+    }
+    out.append("]}");
+}
+
+// Body of a 200 from /licenses/renew
+static void read_renew(const Response& response, std::vector<std::string>& not_found,
+                       int& lease_seconds) {
+    not_found.clear();
+    lease_seconds = 0;
+    decode(response, [&](auto& reader) {
+        reader.object([&](std::string_view key) {
+            if (key == "not_found") {
+                reader.array([&] {
+                    not_found.emplace_back();
+                    reader.string(not_found.back());
+                });
+            } else if (key == "lease_seconds") {
+                lease_seconds = reader.integer();
+            } else {
+                reader.skip();
+            }
+        });
+    });
+}
+
+// Percent-encode a URL path segment (RFC 3986 unreserved pass through)
+static void append_escaped(std::string& out, const std::string& value) {
+    static const char hex[] = "0123456789ABCDEF";
+    for (char c : value) {
+        auto u = static_cast<unsigned char>(c);
+        if ((u >= 'A' && u <= 'Z') || (u >= 'a' && u <= 'z') || (u >= '0' && u <= '9') ||
+            c == '-' || c == '.' || c == '_' || c == '~') {
+            out.push_back(c);
+        } else {
+            out.push_back('%');
+            out.push_back(hex[u >> 4]);
+            out.push_back(hex[u & 0xF]);
+        }
+    }
+}
+
+// Body of a 200 from /licenses/return/batch
+static void read_batch_return(const Response& response, std::size_t& returned,
+                              std::vector<std::string>& not_found) {
+    returned = 0;
+    not_found.clear();
+    decode(response, [&](auto& reader) {
+        reader.object([&](std::string_view key) {
+            if (key == "returned") {
+                returned = reader.count();
+            } else if (key == "not_found") {
+                reader.array([&] {
+                    not_found.emplace_back();
+                    reader.string(not_found.back());
+                });
+            } else {
+                reader.skip();
+            }
+        });
+    });
+}
+
+static void check_transfer(CURLcode res) {
+    if (res == CURLE_ABORTED_BY_CALLBACK) {
+        // Only the event loop aborts transfers, and only on shutdown
+        throw LicenseException("Request aborted: client shut down");
+    }
+    if (res != CURLE_OK) {
+        throw LicenseException(std::string("CURL error: ") + curl_easy_strerror(res));
+    }
+}
+
+/**
+ * Keyed HMAC-SHA256 context. The key schedule (inner and outer pads) is
+ * computed once; begin() restarts a message on the same key, so signing
+ * a request costs only the hash of the payload. Copies start from the
+ * source's keyed state. Not thread-safe: one instance per transfer.
+ */
+class HmacSha256 {
 public:
-    std::string base_url;
-    bool enable_security;
-    std::string api_key;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    explicit HmacSha256(const std::string& key) {
+        EVP_MAC* mac = EVP_MAC_fetch(nullptr, "HMAC", nullptr);
+        // The context holds its own reference to the algorithm
+        ctx_ = mac ? EVP_MAC_CTX_new(mac) : nullptr;
+        EVP_MAC_free(mac);
+        char digest[] = "SHA256";
+        OSSL_PARAM params[] = {
+            OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+            OSSL_PARAM_construct_end(),
+        };
+        if (!ctx_ || !EVP_MAC_init(ctx_, reinterpret_cast<const unsigned char*>(key.data()),
+                                   key.size(), params)) {
+            EVP_MAC_CTX_free(ctx_);
+            throw LicenseException("Failed to initialize HMAC-SHA256");
+        }
+    }
     
-    Impl(const std::string& url, bool security = true) 
-        : base_url(url), enable_security(security) {
-        curl_global_init(CURL_GLOBAL_DEFAULT);
-        const char* env_key = std::getenv("LICENSE_API_KEY");
-        if (env_key) {
-            api_key = env_key;
+    HmacSha256(const HmacSha256& other) : ctx_(EVP_MAC_CTX_dup(other.ctx_)) {
+        if (!ctx_) {
+            throw LicenseException("Failed to copy HMAC-SHA256 context");
         }
     }
     
-    ~Impl() {
-        // Note: avoid curl_global_cleanup to prevent segfaults due to
-        // static destructor ordering in some environments
+    ~HmacSha256() {
+        EVP_MAC_CTX_free(ctx_);
+    }
+    
+    // A null key reuses the key schedule from construction
+    void begin() {
+        EVP_MAC_init(ctx_, nullptr, 0, nullptr);
+    }
+    
+    void update(std::string_view data) {
+        EVP_MAC_update(ctx_, reinterpret_cast<const unsigned char*>(data.data()), data.size());
+    }
+    
+    void finish(unsigned char (&digest)[SHA256_DIGEST_LENGTH]) {
+        std::size_t len = 0;
+        EVP_MAC_final(ctx_, digest, &len, sizeof(digest));
+    }
+
+private:
+    EVP_MAC_CTX* ctx_;
+#else
+    explicit HmacSha256(const std::string& key) : ctx_(HMAC_CTX_new()) {
+        if (!ctx_ || !HMAC_Init_ex(ctx_, key.data(), static_cast<int>(key.size()),
+                                   EVP_sha256(), nullptr)) {
+            HMAC_CTX_free(ctx_);
+            throw LicenseException("Failed to initialize HMAC-SHA256");
+        }
+    }
+    
+    HmacSha256(const HmacSha256& other) : ctx_(HMAC_CTX_new()) {
+        if (!ctx_ || !HMAC_CTX_copy(ctx_, other.ctx_)) {
+            HMAC_CTX_free(ctx_);
+            throw LicenseException("Failed to copy HMAC-SHA256 context");
+        }
+    }
+    
+    ~HmacSha256() {
+        HMAC_CTX_free(ctx_);
+    }
+    
+    // A null key and digest reuse the key schedule from construction
+    void begin() {
+        HMAC_Init_ex(ctx_, nullptr, 0, nullptr, nullptr);
+    }
+    
+    void update(std::string_view data) {
+        HMAC_Update(ctx_, reinterpret_cast<const unsigned char*>(data.data()), data.size());
+    }
+    
+    void finish(unsigned char (&digest)[SHA256_DIGEST_LENGTH]) {
+        unsigned int len = 0;
+        HMAC_Final(ctx_, digest, &len);
+    }
+
+private:
+    HMAC_CTX* ctx_;
+#endif
+    
+    HmacSha256& operator=(const HmacSha256&) = delete;
+};
+
+// Hex length of an HMAC-SHA256 signature
+static constexpr std::size_t SIGNATURE_HEX_LENGTH = 2 * SHA256_DIGEST_LENGTH;
+
+static void hex_encode(const unsigned char (&digest)[SHA256_DIGEST_LENGTH],
+                       char (&out)[SIGNATURE_HEX_LENGTH]) {
+    static const char digits[] = "0123456789abcdef";
+    for (std::size_t i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
+        out[2 * i] = digits[digest[i] >> 4];
+        out[2 * i + 1] = digits[digest[i] & 0xF];
+    }
+}
+
+// Unpadded base64url (RFC 4648 section 5), as in JWTs
+static bool base64url_decode(std::string_view in, std::string& out) {
+    out.clear();
+    out.reserve(in.size() / 4 * 3 + 2);
+    std::uint32_t bits = 0;
+    int pending = 0;
+    for (char c : in) {
+        std::uint32_t value;
+        if (c >= 'A' && c <= 'Z') value = static_cast<std::uint32_t>(c - 'A');
+        else if (c >= 'a' && c <= 'z') value = static_cast<std::uint32_t>(c - 'a' + 26);
+        else if (c >= '0' && c <= '9') value = static_cast<std::uint32_t>(c - '0' + 52);
+        else if (c == '-') value = 62;
+        else if (c == '_') value = 63;
+        else return false;
+        bits = bits << 6 | value;
+        pending += 6;
+        if (pending >= 8) {
+            pending -= 8;
+            out.push_back(static_cast<char>((bits >> pending) & 0xFF));
+        }
+    }
+    // One leftover character cannot encode a byte
+    return pending < 6;
+}
+
+/**
+ * Claims of a verified lease token (OfflineLeasePolicy). Times are Unix
+ * seconds on the server's clock.
+ */
+struct LeaseToken {
+    std::string id;    // jti: the borrow ID
+    std::string tool;
+    std::string user;  // sub
+    long long issued_at = 0;
+    long long expires_at = 0;
+};
+
+/**
+ * Checks lease tokens against the vendor public key: compact JWTs signed
+ * with EdDSA (Ed25519 keys) or RS256 (RSA keys). The header must name the
+ * key's own algorithm, so a token cannot choose how it is checked.
+ * Thread-safe: each verify() runs in its own digest context.
+ */
+class LeaseTokenVerifier {
+public:
+    explicit LeaseTokenVerifier(const std::string& public_key_pem) {
+        BIO* bio = BIO_new_mem_buf(public_key_pem.data(), static_cast<int>(public_key_pem.size()));
+        key_ = bio ? PEM_read_bio_PUBKEY(bio, nullptr, nullptr, nullptr) : nullptr;
+        BIO_free(bio);
+        if (!key_) {
+            throw LicenseException("Invalid lease token public key");
+        }
+        switch (EVP_PKEY_base_id(key_)) {
+#ifdef EVP_PKEY_ED25519
+        case EVP_PKEY_ED25519:
+            alg_ = "EdDSA";  // hashes internally: no digest
+            break;
+#endif
+        case EVP_PKEY_RSA:
+            alg_ = "RS256";
+            digest_ = EVP_sha256();
+            break;
+        default:
+            EVP_PKEY_free(key_);
+            throw LicenseException("Lease token public key must be Ed25519 or RSA");
+        }
+    }
+    
+    ~LeaseTokenVerifier() {
+        EVP_PKEY_free(key_);
+    }
+    
+    LeaseTokenVerifier(const LeaseTokenVerifier&) = delete;
+    LeaseTokenVerifier& operator=(const LeaseTokenVerifier&) = delete;
+    
+    /** Decode @p token into @p out if it is well formed and signed by the key */
+    bool verify(std::string_view token, LeaseToken& out) const {
+        std::size_t header_end = token.find('.');
+        if (header_end == std::string_view::npos) return false;
+        std::size_t claims_end = token.find('.', header_end + 1);
+        if (claims_end == std::string_view::npos) return false;
+        std::string header;
+        std::string claims;
+        std::string signature;
+        if (!base64url_decode(token.substr(0, header_end), header) ||
+            !base64url_decode(token.substr(header_end + 1, claims_end - header_end - 1), claims) ||
+            !base64url_decode(token.substr(claims_end + 1), signature)) {
+            return false;
+        }
+        try {
+            std::string alg;
+            json::Reader header_reader(header);
+            header_reader.object([&](std::string_view key) {
+                if (key == "alg") {
+                    header_reader.string(alg);
+                } else {
+                    header_reader.skip();
+                }
+            });
+            header_reader.finish();
+            if (alg != alg_ || !check_signature(token.substr(0, claims_end), signature)) {
+                return false;
+            }
+            
+            out = LeaseToken();
+            json::Reader reader(claims);
+            reader.object([&](std::string_view key) {
+                if (key == "jti") {
+                    reader.string(out.id);
+                } else if (key == "tool") {
+                    reader.string(out.tool);
+                } else if (key == "sub") {
+                    reader.string(out.user);
+                } else if (key == "iat") {
+                    out.issued_at = reader.integer64();
+                } else if (key == "exp") {
+                    out.expires_at = reader.integer64();
+                } else {
+                    reader.skip();
+                }
+            });
+            reader.finish();
+        } catch (const LicenseException&) {
+            return false;
+        }
+        return !out.id.empty() && out.expires_at > out.issued_at;
+    }
+
+private:
+    bool check_signature(std::string_view data, const std::string& signature) const {
+        EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+        const auto* sig = reinterpret_cast<const unsigned char*>(signature.data());
+        const auto* msg = reinterpret_cast<const unsigned char*>(data.data());
+        bool ok = ctx && EVP_DigestVerifyInit(ctx, nullptr, digest_, nullptr, key_) == 1 &&
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+                  EVP_DigestVerify(ctx, sig, signature.size(), msg, data.size()) == 1;
+#else
+                  EVP_DigestVerifyUpdate(ctx, msg, data.size()) == 1 &&
+                  EVP_DigestVerifyFinal(ctx, sig, signature.size()) == 1;
+#endif
+        EVP_MD_CTX_free(ctx);
+        return ok;
+    }
+    
+    EVP_PKEY* key_ = nullptr;
+    const EVP_MD* digest_ = nullptr;
+    const char* alg_ = nullptr;
+};
+
+/**
+ * The offline lease cache (OfflineLeasePolicy::cache_path), opened and
+ * held under an exclusive flock for the object's lifetime, so processes
+ * sharing the file never take the same seat. Each line is
+ * "<lease_seconds> <token>"; lines that fail to parse are dropped.
+ */
+class LeaseCacheFile {
+public:
+    explicit LeaseCacheFile(const std::string& path)
+        : fd_(::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600)) {
+        while (fd_ >= 0 && ::flock(fd_, LOCK_EX) != 0) {
+            if (errno != EINTR) {
+                ::close(fd_);
+                fd_ = -1;
+            }
+        }
+    }
+    
+    // Closing the descriptor releases the lock
+    ~LeaseCacheFile() {
+        if (fd_ >= 0) ::close(fd_);
+    }
+    
+    LeaseCacheFile(const LeaseCacheFile&) = delete;
+    LeaseCacheFile& operator=(const LeaseCacheFile&) = delete;
+    
+    bool is_open() const { return fd_ >= 0; }
+    
+    bool read(std::string& out) const {
+        out.clear();
+        char buffer[4096];
+        for (;;) {
+            ssize_t n = ::pread(fd_, buffer, sizeof(buffer), static_cast<off_t>(out.size()));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return false;
+            if (n == 0) return true;
+            out.append(buffer, static_cast<std::size_t>(n));
+        }
+    }
+    
+    bool replace(std::string_view contents) {
+        return ::ftruncate(fd_, 0) == 0 && write_at(0, contents);
+    }
+    
+    bool append(std::string_view contents) {
+        off_t end = ::lseek(fd_, 0, SEEK_END);
+        return end >= 0 && write_at(end, contents);
+    }
+
+private:
+    bool write_at(off_t offset, std::string_view contents) {
+        while (!contents.empty()) {
+            ssize_t n = ::pwrite(fd_, contents.data(), contents.size(), offset);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            contents.remove_prefix(static_cast<std::size_t>(n));
+            offset += n;
+        }
+        return true;
+    }
+    
+    int fd_;
+};
+
+/**
+ * What a process learned about reaching the server, kept for the next
+ * one (ClientOptions::startup_cache_path): resolved addresses and, where
+ * libcurl can export them, TLS sessions. One entry per line:
+ *   addr <saved unix time> <host:port> <address>
+ *   tls <saved unix time> <hex key or -> <hex hmac> <hex session>
+ * Unknown or malformed lines are dropped. The file is replaced by
+ * rename, so a reader sees the old or the new contents, never a mix.
+ */
+class StartupCache {
+public:
+    struct Address {
+        long long saved = 0;
+        std::string host_port;
+        std::string address;
+    };
+    struct Session {
+        long long saved = 0;
+        std::string key;  // empty when libcurl exported only the hmac
+        std::string hmac;
+        std::string data;
+    };
+    
+    std::vector<Address> addresses;
+    std::vector<Session> sessions;
+    
+    // Entries of @p path saved within @p ttl_secs of @p now
+    void load(const std::string& path, long long now, long ttl_secs) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return;
+        std::string contents;
+        char buffer[4096];
+        for (;;) {
+            ssize_t n = ::read(fd, buffer, sizeof(buffer));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            contents.append(buffer, static_cast<std::size_t>(n));
+        }
+        ::close(fd);
+        
+        std::string_view rest = contents;
+        while (!rest.empty()) {
+            std::size_t end = std::min(rest.find('\n'), rest.size());
+            std::string_view line = rest.substr(0, end);
+            rest.remove_prefix(std::min(end + 1, rest.size()));
+            std::string_view fields[5];
+            std::size_t count = split(line, fields);
+            long long saved = 0;
+            if (count < 4 || !parse_time(fields[1], saved) || saved > now || now - saved > ttl_secs) {
+                continue;
+            }
+            if (fields[0] == "addr" && count == 4) {
+                addresses.push_back({saved, std::string(fields[2]), std::string(fields[3])});
+            } else if (fields[0] == "tls" && count == 5) {
+                Session session;
+                session.saved = saved;
+                if ((fields[2] == "-" || hex_decode(fields[2], session.key)) &&
+                    hex_decode(fields[3], session.hmac) && hex_decode(fields[4], session.data)) {
+                    sessions.push_back(std::move(session));
+                }
+            }
+        }
+    }
+    
+    // Write to @p path, creating its directory (0700) and the file (0600)
+    bool store(const std::string& path) const {
+        std::string contents;
+        for (const Address& a : addresses) {
+            contents.append("addr ").append(std::to_string(a.saved)).push_back(' ');
+            contents.append(a.host_port).push_back(' ');
+            contents.append(a.address).push_back('\n');
+        }
+        for (const Session& session : sessions) {
+            contents.append("tls ").append(std::to_string(session.saved)).push_back(' ');
+            if (session.key.empty()) {
+                contents.push_back('-');
+            } else {
+                append_hex(contents, session.key);
+            }
+            contents.push_back(' ');
+            append_hex(contents, session.hmac);
+            contents.push_back(' ');
+            append_hex(contents, session.data);
+            contents.push_back('\n');
+        }
+        
+        for (std::size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+            ::mkdir(path.substr(0, slash).c_str(), 0700);
+        }
+        std::string temp = path + ".tmp." + std::to_string(::getpid());
+        int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) return false;
+        std::string_view left = contents;
+        bool ok = true;
+        while (ok && !left.empty()) {
+            ssize_t n = ::write(fd, left.data(), left.size());
+            if (n < 0 && errno == EINTR) continue;
+            ok = n > 0;
+            if (ok) left.remove_prefix(static_cast<std::size_t>(n));
+        }
+        ok = ::close(fd) == 0 && ok && ::rename(temp.c_str(), path.c_str()) == 0;
+        if (!ok) ::unlink(temp.c_str());
+        return ok;
+    }
+    
+private:
+    static std::size_t split(std::string_view line, std::string_view (&fields)[5]) {
+        std::size_t count = 0;
+        while (!line.empty()) {
+            std::size_t end = std::min(line.find(' '), line.size());
+            if (count == 5) return 0;  // too many fields
+            fields[count++] = line.substr(0, end);
+            line.remove_prefix(std::min(end + 1, line.size()));
+        }
+        return count;
+    }
+    
+    static bool parse_time(std::string_view text, long long& out) {
+        auto parsed = std::from_chars(text.data(), text.data() + text.size(), out);
+        return parsed.ec == std::errc() && parsed.ptr == text.data() + text.size();
+    }
+    
+    static void append_hex(std::string& out, std::string_view bytes) {
+        static const char digits[] = "0123456789abcdef";
+        for (char c : bytes) {
+            auto u = static_cast<unsigned char>(c);
+            out.push_back(digits[u >> 4]);
+            out.push_back(digits[u & 0xF]);
+        }
+    }
+    
+    static bool hex_decode(std::string_view hex, std::string& out) {
+        auto nibble = [](char c) {
+            return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        };
+        if (hex.size() % 2 != 0) return false;
+        out.clear();
+        out.reserve(hex.size() / 2);
+        for (std::size_t i = 0; i < hex.size(); i += 2) {
+            int high = nibble(hex[i]), low = nibble(hex[i + 1]);
+            if (high < 0 || low < 0) return false;
+            out.push_back(static_cast<char>(high << 4 | low));
+        }
+        return true;
+    }
+};
+
+// Deferred returns that fail in transport are retried this many times
+static constexpr int MAX_RETURN_ATTEMPTS = 3;
+
+// Transport errors after which the request cannot have reached the server
+static bool request_not_sent(CURLcode res) {
+    return res == CURLE_COULDNT_RESOLVE_HOST || res == CURLE_COULDNT_RESOLVE_PROXY ||
+           res == CURLE_COULDNT_CONNECT || res == CURLE_SSL_CONNECT_ERROR;
+}
+
+// Status stream reconnect backoff, and the most unparsed event data kept
+static constexpr long STREAM_RETRY_MIN_MS = 1000;
+static constexpr long STREAM_RETRY_MAX_MS = 30000;
+static constexpr std::size_t STREAM_MAX_BUFFER = 16 * 1024 * 1024;
+
+// Lease renewal: timer wheel resolution, and when a lease is renewed and
+// retried after a failed attempt, as fractions of its length
+static constexpr long LEASE_TICK_MS = 100;
+static constexpr int LEASE_RENEW_DIVISOR = 3;
+static constexpr int LEASE_RETRY_DIVISOR = 10;
+
+// Request kinds tracked by the client metrics
+enum class Operation : std::uint8_t {
+    None, Borrow, BorrowBatch, Return, ReturnBatch, Status, StatusAll, Renew, BorrowWait
+};
+static constexpr std::size_t OPERATION_COUNT = 9;
+static const char* const OPERATION_NAMES[OPERATION_COUNT] = {
+    "", "borrow", "borrow_batch", "return", "return_batch", "status", "status_all", "renew",
+    "borrow_wait"
+};
+
+static Operation operation_of(std::string_view endpoint) {
+    if (endpoint == "/licenses/borrow") return Operation::Borrow;
+    if (endpoint == "/licenses/borrow/batch") return Operation::BorrowBatch;
+    if (endpoint == "/licenses/borrow/wait") return Operation::BorrowWait;
+    if (endpoint == "/licenses/return") return Operation::Return;
+    if (endpoint == "/licenses/return/batch") return Operation::ReturnBatch;
+    if (endpoint == "/licenses/status") return Operation::StatusAll;
+    if (endpoint == "/licenses/status/delta") return Operation::StatusAll;
+    if (endpoint == "/licenses/renew") return Operation::Renew;
+    return Operation::None;  // e.g. the status stream
+}
+
+// Request phases, in OperationMetrics order
+enum Phase { PHASE_TOTAL, PHASE_DNS, PHASE_CONNECT, PHASE_TLS, PHASE_TTFB, PHASE_TRANSFER, PHASE_PARSE, PHASE_COUNT };
+
+// Metrics histograms hold nanoseconds up to a minute at 1/32 resolution
+static constexpr std::uint64_t METRICS_HIGHEST_NS = 60ull * 1000 * 1000 * 1000;
+static constexpr int METRICS_PRECISION_BITS = 6;
+
+/**
+ * Phase event trace (LICENSE_CLIENT_PHASE_TRACE builds): each thread
+ * records timestamped request phases into its own ring, which a dump
+ * reads without stopping the writers. A writer stores the slot, then
+ * publishes it by advancing head; a reader copies the published slots
+ * and drops the ones the writer may have overwritten meanwhile. Rings
+ * are never freed, so events of exited threads stay readable.
+ */
+enum TracePhase : std::uint8_t {
+    TRACE_REQUEST, TRACE_PREPARE, TRACE_SIGN, TRACE_DNS, TRACE_CONNECT, TRACE_TLS,
+    TRACE_SERVER, TRACE_RECEIVE, TRACE_PARSE, TRACE_PHASE_COUNT
+};
+static const char* const TRACE_PHASE_NAMES[TRACE_PHASE_COUNT] = {
+    "request", "prepare", "sign", "dns", "connect", "tls", "server", "receive", "parse"
+};
+
+#if LICENSE_CLIENT_PHASE_TRACE
+class PhaseTrace {
+public:
+    static constexpr std::size_t RING_EVENTS = 4096;  // per thread, a power of two
+    
+    static bool on() {
+        return enabled().load(std::memory_order_relaxed);
+    }
+    
+    static void set(bool on) {
+        enabled().store(on, std::memory_order_relaxed);
+    }
+    
+    // Steady clock nanoseconds, or 0 while tracing is off
+    static std::uint64_t now() {
+        if (!on()) return 0;
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+    
+    static std::uint64_t next_request() {
+        static std::atomic<std::uint64_t> next{1};
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    static void record(TracePhase phase, Operation op, std::uint64_t request,
+                       std::uint64_t start_ns, std::uint64_t end_ns) noexcept {
+        if (start_ns == 0 || end_ns < start_ns) return;
+#ifdef LICENSE_CLIENT_USDT
+        DTRACE_PROBE5(license_client, phase, TRACE_PHASE_NAMES[phase],
+                      OPERATION_NAMES[static_cast<std::size_t>(op)], request, start_ns, end_ns - start_ns);
+#endif
+        Ring* ring = local();
+        if (!ring) return;
+        std::uint64_t head = ring->head.load(std::memory_order_relaxed);
+        Slot& slot = ring->slots[head & (RING_EVENTS - 1)];
+        slot.start_ns.store(start_ns, std::memory_order_relaxed);
+        slot.duration_ns.store(end_ns - start_ns, std::memory_order_relaxed);
+        slot.request.store(request, std::memory_order_relaxed);
+        slot.tag.store(static_cast<std::uint64_t>(phase) | static_cast<std::uint64_t>(op) << 8,
+                       std::memory_order_relaxed);
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+    
+    // Every ring's retained events, in Chrome trace event format
+    static std::string chrome_json() {
+        std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        char line[256];
+        long pid = static_cast<long>(::getpid());
+        std::snprintf(line, sizeof(line),
+                      "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%ld,\"args\":{\"name\":\"license_client\"}}", pid);
+        out.append(line);
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        for (const auto& ring : registry().rings) {
+            std::uint64_t head = ring->head.load(std::memory_order_acquire);
+            std::uint64_t first = head > RING_EVENTS ? head - RING_EVENTS : 0;
+            std::vector<Event> events;
+            events.reserve(static_cast<std::size_t>(head - first));
+            for (std::uint64_t i = first; i < head; ++i) {
+                const Slot& slot = ring->slots[i & (RING_EVENTS - 1)];
+                events.push_back({i, slot.start_ns.load(std::memory_order_relaxed),
+                                  slot.duration_ns.load(std::memory_order_relaxed),
+                                  slot.request.load(std::memory_order_relaxed),
+                                  slot.tag.load(std::memory_order_relaxed)});
+            }
+            // Slots at or below the writer's position minus a ring were reused
+            std::uint64_t reused = ring->head.load(std::memory_order_acquire);
+            for (const Event& e : events) {
+                if (e.index + RING_EVENTS <= reused) continue;
+                std::size_t op = static_cast<std::size_t>(e.tag >> 8);
+                std::size_t phase = static_cast<std::size_t>(e.tag & 0xFF);
+                if (op >= OPERATION_COUNT || phase >= TRACE_PHASE_COUNT) continue;
+                std::snprintf(line, sizeof(line),
+                              ",{\"ph\":\"X\",\"name\":\"%s\",\"cat\":\"%s\",\"pid\":%ld,\"tid\":%u,"
+                              "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"request\":%llu}}",
+                              TRACE_PHASE_NAMES[phase], op == 0 ? "other" : OPERATION_NAMES[op], pid, ring->tid,
+                              static_cast<double>(e.start_ns) / 1000.0, static_cast<double>(e.duration_ns) / 1000.0,
+                              static_cast<unsigned long long>(e.request));
+                out.append(line);
+            }
+        }
+        out.append("]}\n");
+        return out;
+    }
+    
+private:
+    struct Slot {
+        std::atomic<std::uint64_t> start_ns{0};
+        std::atomic<std::uint64_t> duration_ns{0};
+        std::atomic<std::uint64_t> request{0};
+        std::atomic<std::uint64_t> tag{0};
+    };
+    struct Ring {
+        unsigned tid = 0;
+        std::atomic<std::uint64_t> head{0};
+        Slot slots[RING_EVENTS];
+    };
+    struct Event {
+        std::uint64_t index, start_ns, duration_ns, request, tag;
+    };
+    struct Registry {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Ring>> rings;
+    };
+    
+    // On from the start when LICENSE_PHASE_TRACE names a file
+    static std::atomic<bool>& enabled() {
+        static std::atomic<bool> flag{std::getenv("LICENSE_PHASE_TRACE") != nullptr};
+        return flag;
+    }
+    
+    // Leaked, so threads still running at exit never write to a freed ring
+    static Registry& registry() {
+        static Registry* r = new Registry;
+        return *r;
+    }
+    
+    static Ring* local() noexcept {
+        thread_local Ring* ring = nullptr;
+        if (!ring) {
+            try {
+                auto fresh = std::make_unique<Ring>();
+                std::lock_guard<std::mutex> lock(registry().mutex);
+                fresh->tid = static_cast<unsigned>(registry().rings.size() + 1);
+                ring = fresh.get();
+                registry().rings.push_back(std::move(fresh));
+            } catch (...) {
+                return nullptr;
+            }
+        }
+        return ring;
+    }
+};
+#else
+// Compiled out: every call site folds away
+class PhaseTrace {
+public:
+    static constexpr bool on() { return false; }
+    static void set(bool) {}
+    static constexpr std::uint64_t now() { return 0; }
+    static constexpr std::uint64_t next_request() { return 0; }
+    static void record(TracePhase, Operation, std::uint64_t, std::uint64_t, std::uint64_t) noexcept {}
+    static std::string chrome_json() { return std::string(); }
+};
+#endif
+
+// W3C traceparent, version 00: "00-" 32 hex trace-id "-" 16 hex span-id "-" 2 hex flags
+static constexpr std::size_t TRACEPARENT_LENGTH = 55;
+static constexpr char TRACEPARENT_HEADER[] = "traceparent: ";
+
+static void write_hex64(char* out, std::uint64_t value) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 15; i >= 0; --i) {
+        out[i] = digits[value & 0xF];
+        value >>= 4;
+    }
+}
+
+static bool parse_hex(std::string_view text, std::uint64_t& value) {
+    value = 0;
+    for (char c : text) {
+        int digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else return false;  // the spec allows lowercase only
+        value = value << 4 | static_cast<std::uint64_t>(digit);
+    }
+    return true;
+}
+
+// Writes TRACEPARENT_LENGTH characters, no terminator
+static void write_traceparent(char* out, const TraceContext& context) {
+    std::memcpy(out, "00-", 3);
+    write_hex64(out + 3, context.trace_id_high);
+    write_hex64(out + 19, context.trace_id_low);
+    out[35] = '-';
+    write_hex64(out + 36, context.span_id);
+    std::memcpy(out + 52, context.sampled ? "-01" : "-00", 3);
+}
+
+// Span and trace IDs, and retry jitter: a per-thread splitmix64 stream.
+// Never zero, which the trace context spec reserves for "invalid".
+static std::uint64_t random_id() {
+    thread_local std::uint64_t state = [] {
+        std::random_device device;
+        std::uint64_t seed = static_cast<std::uint64_t>(device()) << 32 | device();
+        return seed ^ static_cast<std::uint64_t>(
+            std::chrono::steady_clock::now().time_since_epoch().count());
+    }();
+    std::uint64_t z;
+    do {
+        z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        z ^= z >> 31;
+    } while (z == 0);
+    return z;
+}
+
+static std::uint64_t unix_nanos() {
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+// Innermost TraceScope on this thread
+static thread_local const TraceContext* trace_parent = nullptr;
+
+/**
+ * Connections to a local license_agentd. Each call takes an idle
+ * connection or opens one, so concurrent threads never interleave
+ * requests. Connections stay open for the client's lifetime: the agent
+ * takes back a connection's seats when it closes, which is how the
+ * seats of a crashed process are recovered.
+ */
+class AgentLink {
+public:
+    explicit AgentLink(std::string path) : path_(std::move(path)) {}
+    
+    ~AgentLink() {
+        for (Connection* c : idle_) {
+            ::close(c->fd);
+            delete c;
+        }
+    }
+    
+    AgentLink(const AgentLink&) = delete;
+    AgentLink& operator=(const AgentLink&) = delete;
+    
+    /**
+     * Send @p request (one line, newline included), then let
+     * read_reply(LineChannel&) consume the reply; it returns false if
+     * the connection failed. Throws LicenseException on I/O errors.
+     */
+    template <typename F>
+    void call(std::string_view request, F&& read_reply) {
+        Connection* c = take();
+        bool ok = c->channel.write_all(request);
+        if (ok) {
+            try {
+                ok = read_reply(c->channel);
+            } catch (...) {
+                give_back(c);
+                throw;
+            }
+        }
+        if (!ok) {
+            ::close(c->fd);
+            delete c;
+            throw LicenseException("License agent connection lost: " + path_);
+        }
+        give_back(c);
+    }
+
+private:
+    struct Connection {
+        explicit Connection(int fd) : fd(fd), channel(fd) {}
+        int fd;
+        agent::LineChannel channel;
+    };
+    
+    Connection* take() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!idle_.empty()) {
+                Connection* c = idle_.back();
+                idle_.pop_back();
+                return c;
+            }
+        }
+        sockaddr_un addr;
+        if (!agent::make_address(path_, addr)) {
+            throw LicenseException("Invalid license agent socket path: " + path_);
+        }
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            std::string reason = std::strerror(errno);
+            if (fd >= 0) ::close(fd);
+            throw LicenseException("License agent unavailable at " + path_ + ": " + reason);
+        }
+        agent::suppress_sigpipe(fd);
+        return new Connection(fd);
+    }
+    
+    void give_back(Connection* c) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        idle_.push_back(c);
+    }
+    
+    std::string path_;
+    std::mutex mutex_;
+    std::vector<Connection*> idle_;
+};
+
+// Turn an agent error reply into the exception the HTTP path would throw
+[[noreturn]] static void throw_agent_reply(std::string_view reply, const std::string& tool) {
+    if (reply == "NOLICENSE") {
+        throw NoLicensesAvailableException(tool);
+    }
+    if (reply == "NOTFOUND") {
+        throw LicenseException("HTTP error: 404");
+    }
+    if (reply.compare(0, 4, "ERR\t") == 0) {
+        throw LicenseException("License agent error: " + std::string(reply.substr(4)));
+    }
+    throw LicenseException("Unexpected license agent reply: " + std::string(reply));
+}
+
+struct ProtocolChoice {
+    long curl_version;  // CURLOPT_HTTP_VERSION value
+    bool multiplex;     // route every request through the event loop
+};
+
+// Map the requested HTTP version onto what this libcurl build supports:
+// HTTP/3 degrades to HTTP/2, and HTTP/2 to HTTP/1.1
+static ProtocolChoice choose_protocol(HttpVersion requested, const std::string& base_url) {
+    const curl_version_info_data* info = curl_version_info(CURLVERSION_NOW);
+    bool tls = base_url.compare(0, 8, "https://") == 0 || base_url.compare(0, 8, "HTTPS://") == 0;
+    bool have_http2 = info && (info->features & CURL_VERSION_HTTP2);
+    switch (requested) {
+    case HttpVersion::Default:
+        return {CURL_HTTP_VERSION_NONE, false};
+    case HttpVersion::Http1_1:
+        return {CURL_HTTP_VERSION_1_1, false};
+    case HttpVersion::Http3:
+#if LIBCURL_VERSION_NUM >= 0x074200  // 7.66.0
+        if (tls && info && (info->features & CURL_VERSION_HTTP3)) {
+            return {CURL_HTTP_VERSION_3, true};
+        }
+#endif
+        // fall through
+    case HttpVersion::Http2:
+        if (!have_http2) {
+            return {CURL_HTTP_VERSION_1_1, false};
+        }
+        // Without TLS there is no ALPN to negotiate with
+        return {tls ? CURL_HTTP_VERSION_2TLS : CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE, true};
+    }
+    return {CURL_HTTP_VERSION_NONE, false};
+}
+
+// PIMPL implementation
+class LicenseClient::Impl : public detail::ReturnSink {
+public:
+    std::string base_url;
+    bool enable_security;
+    std::string api_key;
+    std::string auth_header;
+    ClientOptions options;
+    // Keyed once; each pooled transfer signs with its own copy
+    std::unique_ptr<HmacSha256> signing_key;
+    ProtocolChoice protocol;
+    
+    Impl(const std::string& url, const ClientOptions& opts = ClientOptions()) 
+        : base_url(url), enable_security(opts.enable_security), options(opts),
+          protocol(choose_protocol(opts.http_version, url)) {
+        const char* env_key = std::getenv("LICENSE_API_KEY");
+        if (env_key) {
+            api_key = env_key;
+            auth_header = "Authorization: Bearer " + api_key;
+        }
+        // Unused with an agent, which keeps seats for the host itself
+        if (!options.offline.public_key_pem.empty()) {
+            token_verifier = std::make_unique<LeaseTokenVerifier>(options.offline.public_key_pem);
+        }
+        
+        std::size_t shard_count = options.pool_shards;
+        if (shard_count == 0) {
+            shard_count = std::max(1u, std::thread::hardware_concurrency());
+        }
+        shards = std::vector<PoolShard>(shard_count);
+        for (auto& shard : shards) {
+            shard.idle.reserve(options.pool_size);
+        }
+        
+        if (options.status_cache_ttl_ms > 0) {
+            status_cache = std::make_unique<StatusCache>(
+                std::chrono::milliseconds(options.status_cache_ttl_ms));
+        }
+        
+        std::string agent_path = options.agent_socket;
+        if (agent_path.empty()) {
+            const char* env_socket = std::getenv("LICENSE_AGENT_SOCKET");
+            if (env_socket) {
+                agent_path = env_socket;
+            }
+        }
+        if (!agent_path.empty()) {
+            agent = std::make_unique<AgentLink>(agent_path);
+        } else if (options.collect_metrics) {
+            metrics = std::make_unique<Metrics>(shards.size());
+        }
+        
+        tracing = static_cast<bool>(options.on_span);
+        double ratio = std::min(1.0, std::max(0.0, options.trace_sample_ratio));
+        trace_sample_all = ratio >= 1.0;
+        trace_sample_below = static_cast<std::uint64_t>(ratio * 18446744073709551616.0);
+    }
+    
+    ~Impl() override {
+        shutdown();
+        save_startup_cache();
+        write_phase_trace();
+        for (auto& shard : shards) {
+            for (Transfer* t : shard.idle) {
+                delete t;
+            }
+            shard.idle.clear();
+        }
+        curl_slist_free_all(cached_resolve);
+        curl_slist_free_all(purge_resolve);
+        if (share) {
+            curl_share_cleanup(share);
+        }
+        // Note: avoid curl_global_cleanup to prevent segfaults due to
+        // static destructor ordering in some environments
+    }
+    
+    struct SyncWaiter;
+    
+    /**
+     * One HTTP exchange and the easy handle that runs it. Transfers are
+     * pooled with their handle, so the URL, body, header and response
+     * buffers keep their capacity and a warm request allocates nothing
+     * here. A transfer is owned by the caller (blocking path) or the
+     * event loop (async path) until it completes.
+     */
+    struct Transfer {
+        static constexpr std::size_t MAX_HEADERS = 7;
+        
+        Transfer(Impl& owner, CURL* easy) : owner(owner), easy(easy) {
+            response.data.reserve(RESPONSE_RESERVE);
+        }
+        ~Transfer() {
+            curl_easy_cleanup(easy);
+        }
+        Transfer(const Transfer&) = delete;
+        Transfer& operator=(const Transfer&) = delete;
+        
+        // Append to the request header list. libcurl only reads the
+        // list, so it is linked from fixed nodes instead of
+        // curl_slist_append's allocations; @p line must outlive the
+        // transfer.
+        void add_header(const char* line) {
+            curl_slist& node = header_nodes[header_count];
+            node.data = const_cast<char*>(line);
+            node.next = nullptr;
+            if (header_count > 0) {
+                header_nodes[header_count - 1].next = &node;
+            }
+            ++header_count;
+        }
+        
+        curl_slist* headers() {
+            return header_count > 0 ? header_nodes : nullptr;
+        }
+        
+        // Back to a blank request; keeps the handle's connection, DNS
+        // and TLS session caches
+        void reset() {
+            curl_easy_reset(easy);
+            url.clear();
+            body.clear();
+            if (response.data.capacity() > MAX_POOLED_BUFFER) {
+                std::string().swap(response.data);
+                response.data.reserve(RESPONSE_RESERVE);
+            }
+            response.data.clear();
+            response.http_code = 0;
+            response.msgpack = false;
+            response.redirected = false;
+            shard_hops = 0;
+            header_count = 0;
+            on_done = nullptr;
+            persistent = false;
+            waiter = nullptr;
+            op = Operation::None;
+            tool.clear();
+            completed_at = {};
+            trace_started = 0;
+            trace_request = 0;
+        }
+        
+        // The exchange is over; the response (if any) is in place
+        void finish(CURLcode res) {
+            result = res;
+            completed_at = std::chrono::steady_clock::now();
+        }
+        
+        Impl& owner;
+        CURL* easy;
+        std::string url;
+        std::string body;
+        Response response;
+        curl_slist header_nodes[MAX_HEADERS] = {};
+        std::size_t header_count = 0;
+        char timestamp_header[32] = {};
+        char signature_header[sizeof("X-Signature: ") + SIGNATURE_HEX_LENGTH] = {};
+        char trace_header[sizeof(TRACEPARENT_HEADER) + TRACEPARENT_LENGTH] = {};
+        // Keyed signing context, copied from the client's on first use
+        std::unique_ptr<HmacSha256> mac;
+        std::function<void(Transfer&, CURLcode)> on_done;
+        // Long-lived (e.g. a stream); shutdown does not wait for it
+        bool persistent = false;
+        // 307s followed to other nodes (see take_shard_redirect)
+        int shard_hops = 0;
+        // Set while a blocked caller waits for this transfer
+        SyncWaiter* waiter = nullptr;
+        // For metrics, recorded when the transfer is recycled
+        Operation op = Operation::None;
+        std::string tool;
+        CURLcode result = CURLE_OK;
+        std::chrono::steady_clock::time_point completed_at;
+        // PhaseTrace: when the request began, 0 if not traced, and its ID
+        std::uint64_t trace_started = 0;
+        std::uint64_t trace_request = 0;
+    };
+    
+    // Deleter that returns a finished transfer to its client's pool
+    struct TransferRecycler {
+        void operator()(Transfer* t) const noexcept {
+            t->owner.recycle(t);
+        }
+    };
+    using TransferPtr = std::unique_ptr<Transfer, TransferRecycler>;
+    
+    // A blocked caller waiting for a transfer the event loop runs
+    struct SyncWaiter {
+        std::mutex mutex;
+        std::condition_variable cv;
+        CURLcode result = CURLE_OK;
+        TransferPtr transfer;
+    };
+    
+    /**
+     * Setup deferred from the constructor to the first request, so a
+     * client that never talks to the server (one behind an agent, or a
+     * tool that exits early) costs no curl or OpenSSL initialization:
+     * process-wide curl init, the share object, the signing key and the
+     * startup cache.
+     */
+    void ensure_started() {
+        if (started.load(std::memory_order_acquire)) {
+            return;
+        }
+        std::call_once(started_once, [this] {
+            ensure_curl_global_init();
+            // One share object for all pooled handles: DNS results, TLS
+            // sessions and open connections survive across requests
+            share = curl_share_init();
+            if (share) {
+                curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+                curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+                curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+                curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+                curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+                curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+            }
+            // Behind a proxy the connected address is the proxy's
+            for (const char* name : {"http_proxy", "https_proxy", "HTTPS_PROXY", "all_proxy", "ALL_PROXY"}) {
+                const char* value = std::getenv(name);
+                via_proxy = via_proxy || (value && *value);
+            }
+            if (enable_security) {
+                // Keying the MAC is the client's first OpenSSL call
+                signing_key = std::make_unique<HmacSha256>(VENDOR_SECRET);
+            }
+            load_startup_cache();
+            started.store(true, std::memory_order_release);
+        });
+    }
+    
+    static long long unix_seconds() {
+        return static_cast<long long>(unix_nanos() / 1000000000ull);
+    }
+    
+    // Seed the first requests with what the last process learned
+    void load_startup_cache() {
+        if (options.startup_cache_path.empty()) {
+            return;
+        }
+        StartupCache cache;
+        cache.load(options.startup_cache_path, unix_seconds(), options.startup_cache_ttl_secs);
+#if LIBCURL_VERSION_NUM >= 0x074b00
+        // "+" entries time out of the DNS cache like resolved ones
+        // (libcurl 7.75); the purge list drops them again if they fail
+        for (const StartupCache::Address& a : cache.addresses) {
+            std::string address = a.address.find(':') != std::string::npos ? "[" + a.address + "]" : a.address;
+            cached_resolve = curl_slist_append(cached_resolve, ("+" + a.host_port + ":" + address).c_str());
+            purge_resolve = curl_slist_append(purge_resolve, ("-" + a.host_port).c_str());
+            seeded_hosts.insert(a.host_port);
+        }
+        if (cached_resolve) {
+            resolve_state.store(RESOLVE_CACHED, std::memory_order_relaxed);
+        }
+#endif
+#ifdef CURL_VERSION_SSLS_EXPORT
+        if (share && !cache.sessions.empty()) {
+            // Imported sessions land in the share's TLS session cache
+            if (CURL* h = curl_easy_init()) {
+                curl_easy_setopt(h, CURLOPT_SHARE, share);
+                for (const StartupCache::Session& session : cache.sessions) {
+                    curl_easy_ssls_import(h, session.key.empty() ? nullptr : session.key.c_str(),
+                                          reinterpret_cast<const unsigned char*>(session.hmac.data()), session.hmac.size(),
+                                          reinterpret_cast<const unsigned char*>(session.data.data()), session.data.size());
+                }
+                curl_easy_cleanup(h);
+            }
+        }
+#endif
+    }
+    
+#ifdef CURL_VERSION_SSLS_EXPORT
+    static CURLcode export_session(CURL*, void* userp, const char* session_key,
+                                   const unsigned char* shmac, size_t shmac_len,
+                                   const unsigned char* sdata, size_t sdata_len,
+                                   curl_off_t, int, const char*, size_t) {
+        auto* sessions = static_cast<std::vector<StartupCache::Session>*>(userp);
+        StartupCache::Session session;
+        session.saved = unix_seconds();
+        session.key = session_key ? session_key : "";
+        session.hmac.assign(reinterpret_cast<const char*>(shmac), shmac_len);
+        session.data.assign(reinterpret_cast<const char*>(sdata), sdata_len);
+        sessions->push_back(std::move(session));
+        return CURLE_OK;
+    }
+#endif
+    
+    // Record the address a live connection used, for the next process
+    void note_startup(const Transfer& t) {
+        int state = resolve_state.load(std::memory_order_relaxed);
+        if (state == RESOLVE_CACHED && (t.response.http_code > 0 || t.result != CURLE_OK)) {
+            // One answered request proves the cached addresses; a failed
+            // one drops them before the next request resolves afresh
+            int next = t.response.http_code > 0 ? RESOLVE_OFF : RESOLVE_PURGE;
+            if (resolve_state.compare_exchange_strong(state, next, std::memory_order_relaxed) &&
+                next == RESOLVE_PURGE) {
+                std::lock_guard<std::mutex> lock(startup_mutex);
+                seeded_stale = true;
+            }
+        }
+        if (t.response.http_code <= 0 || via_proxy) {
+            return;
+        }
+        long connects = 0;
+        char* ip = nullptr;
+        char* url = nullptr;
+        if (curl_easy_getinfo(t.easy, CURLINFO_NUM_CONNECTS, &connects) != CURLE_OK || connects == 0 ||
+            curl_easy_getinfo(t.easy, CURLINFO_PRIMARY_IP, &ip) != CURLE_OK || !ip || !*ip ||
+            curl_easy_getinfo(t.easy, CURLINFO_EFFECTIVE_URL, &url) != CURLE_OK || !url) {
+            return;
+        }
+        std::string host_port;
+        if (CURLU* u = curl_url()) {
+            char* host = nullptr;
+            char* port = nullptr;
+            if (curl_url_set(u, CURLUPART_URL, url, 0) == CURLUE_OK &&
+                curl_url_get(u, CURLUPART_HOST, &host, 0) == CURLUE_OK &&
+                curl_url_get(u, CURLUPART_PORT, &port, CURLU_DEFAULT_PORT) == CURLUE_OK &&
+                host[0] != '[' && std::strcmp(host, ip) != 0) {
+                // Literal addresses need no lookup
+                host_port = std::string(host) + ":" + port;
+            }
+            curl_free(host);
+            curl_free(port);
+            curl_url_cleanup(u);
+        }
+        if (host_port.empty()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(startup_mutex);
+        learned_addresses[host_port] = ip;
+    }
+    
+    // LICENSE_PHASE_TRACE=<file>: leave the trace there for inspection
+    static void write_phase_trace() {
+        const char* path = std::getenv("LICENSE_PHASE_TRACE");
+        if (!PhaseTrace::on() || !path || !*path) {
+            return;
+        }
+        std::string json = PhaseTrace::chrome_json();
+        if (std::FILE* f = std::fopen(path, "w")) {
+            std::fwrite(json.data(), 1, json.size(), f);
+            std::fclose(f);
+        }
+    }
+    
+    // Merge what this process learned into the startup cache file
+    void save_startup_cache() {
+        if (options.startup_cache_path.empty() || !started.load(std::memory_order_acquire)) {
+            return;
+        }
+        long long now = unix_seconds();
+        std::vector<StartupCache::Session> exported;
+#ifdef CURL_VERSION_SSLS_EXPORT
+        if (share) {
+            if (CURL* h = curl_easy_init()) {
+                curl_easy_setopt(h, CURLOPT_SHARE, share);
+                curl_easy_ssls_export(h, export_session, &exported);
+                curl_easy_cleanup(h);
+            }
+        }
+#endif
+        std::lock_guard<std::mutex> lock(startup_mutex);
+        if (learned_addresses.empty() && exported.empty() && !seeded_stale) {
+            return;
+        }
+        // Other clients may have written entries for other servers since
+        StartupCache cache;
+        cache.load(options.startup_cache_path, now, options.startup_cache_ttl_secs);
+        auto& addresses = cache.addresses;
+        addresses.erase(std::remove_if(addresses.begin(), addresses.end(), [&](const StartupCache::Address& a) {
+            return learned_addresses.count(a.host_port) || (seeded_stale && seeded_hosts.count(a.host_port));
+        }), addresses.end());
+        for (const auto& [host_port, address] : learned_addresses) {
+            addresses.push_back({now, host_port, address});
+        }
+        if (!exported.empty()) {
+            cache.sessions = std::move(exported);
+        }
+        cache.store(options.startup_cache_path);
+    }
+    
+    /**
+     * Phase events of a finished, traced transfer. libcurl's timings are
+     * offsets from the start of the transfer, placed on the steady clock
+     * by its completion time; parse runs from completion to recycling,
+     * so for async calls it includes the callback.
+     */
+    static void trace_transfer(const Transfer& t) noexcept {
+        std::uint64_t end = PhaseTrace::now();
+        if (end == 0 || t.completed_at == std::chrono::steady_clock::time_point()) {
+            PhaseTrace::record(TRACE_REQUEST, t.op, t.trace_request, t.trace_started, end);
+            return;
+        }
+        curl_off_t dns = 0, connect = 0, tls = 0, sent = 0, first_byte = 0, total = 0;
+        long connects = 0;
+        curl_easy_getinfo(t.easy, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+        curl_easy_getinfo(t.easy, CURLINFO_CONNECT_TIME_T, &connect);
+        curl_easy_getinfo(t.easy, CURLINFO_APPCONNECT_TIME_T, &tls);
+        curl_easy_getinfo(t.easy, CURLINFO_PRETRANSFER_TIME_T, &sent);
+        curl_easy_getinfo(t.easy, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+        curl_easy_getinfo(t.easy, CURLINFO_TOTAL_TIME_T, &total);
+        curl_easy_getinfo(t.easy, CURLINFO_NUM_CONNECTS, &connects);
+        auto done = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            t.completed_at.time_since_epoch()).count());
+        std::uint64_t begin = done - static_cast<std::uint64_t>(std::max<curl_off_t>(0, total)) * 1000;
+        auto at = [begin](curl_off_t us) { return begin + static_cast<std::uint64_t>(std::max<curl_off_t>(0, us)) * 1000; };
+        
+        Operation op = t.op;
+        std::uint64_t id = t.trace_request;
+        PhaseTrace::record(TRACE_REQUEST, op, id, t.trace_started, end);
+        if (connects > 0) {
+            if (dns > 0) PhaseTrace::record(TRACE_DNS, op, id, begin, at(dns));
+            PhaseTrace::record(TRACE_CONNECT, op, id, at(dns), at(connect));
+            if (tls > 0) PhaseTrace::record(TRACE_TLS, op, id, at(connect), at(tls));
+        }
+        if (t.result == CURLE_OK && first_byte > 0) {
+            PhaseTrace::record(TRACE_SERVER, op, id, at(sent), at(first_byte));
+            PhaseTrace::record(TRACE_RECEIVE, op, id, at(first_byte), at(total));
+        }
+        PhaseTrace::record(TRACE_PARSE, op, id, done, end);
+    }
+    
+    // Take a transfer from the calling thread's pool shard, or create
+    // one, with the client-wide options applied
+    TransferPtr take_transfer() {
+        std::uint64_t trace_started = PhaseTrace::now();
+        ensure_started();
+        Transfer* t = nullptr;
+        {
+            PoolShard& shard = local_shard();
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (!shard.idle.empty()) {
+                t = shard.idle.back();
+                shard.idle.pop_back();
+            }
+        }
+        if (!t) {
+            CURL* h = curl_easy_init();
+            if (!h) {
+                throw LicenseException("Failed to initialize CURL handle");
+            }
+            t = new Transfer(*this, h);
+        }
+        apply_common_options(*t);
+        if (trace_started != 0) {
+            t->trace_started = trace_started;
+            t->trace_request = PhaseTrace::next_request();
+        }
+        return TransferPtr(t);
+    }
+    
+    void recycle(Transfer* t) noexcept {
+        if (metrics) {
+            metrics->record(*t);
+        }
+        if (options.shard_routing && (t->response.redirected || t->response.http_code == 307 ||
+                                      t->response.http_code == 421)) {
+            // Sent to a node that no longer owns the tool or borrow
+            shard_ring_stale.store(true, std::memory_order_relaxed);
+        }
+        if (!options.startup_cache_path.empty()) {
+            note_startup(*t);
+        }
+        if (t->trace_started != 0) {
+            trace_transfer(*t);
+        }
+        t->reset();
+        {
+            PoolShard& shard = local_shard();
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            // idle has pool_size reserved, so this never reallocates
+            if (shard.idle.size() < options.pool_size) {
+                shard.idle.push_back(t);
+                return;
+            }
+        }
+        delete t;
+    }
+    
+    void apply_common_options(Transfer& t) {
+        CURL* h = t.easy;
+        if (share) {
+            curl_easy_setopt(h, CURLOPT_SHARE, share);
+        }
+        curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, write_callback);
+        curl_easy_setopt(h, CURLOPT_WRITEDATA, &t.response.data);
+        int resolve = resolve_state.load(std::memory_order_relaxed);
+        if (resolve == RESOLVE_CACHED) {
+            curl_easy_setopt(h, CURLOPT_RESOLVE, cached_resolve);
+        } else if (resolve == RESOLVE_PURGE &&
+                   resolve_state.compare_exchange_strong(resolve, RESOLVE_OFF, std::memory_order_relaxed)) {
+            curl_easy_setopt(h, CURLOPT_RESOLVE, purge_resolve);
+        }
+        // Signals are process-wide; timeouts must not use them when
+        // several threads run transfers
+        curl_easy_setopt(h, CURLOPT_NOSIGNAL, 1L);
+        if (protocol.curl_version != CURL_HTTP_VERSION_NONE) {
+            curl_easy_setopt(h, CURLOPT_HTTP_VERSION, protocol.curl_version);
+        }
+        if (protocol.multiplex) {
+            // Queue behind a connection that is still being set up
+            // rather than opening a second one, so a burst of requests
+            // shares a single multiplexed connection
+            curl_easy_setopt(h, CURLOPT_PIPEWAIT, 1L);
+        }
+        if (options.tcp_keepalive) {
+            curl_easy_setopt(h, CURLOPT_TCP_KEEPALIVE, 1L);
+            curl_easy_setopt(h, CURLOPT_TCP_KEEPIDLE, options.keepalive_idle_secs);
+            curl_easy_setopt(h, CURLOPT_TCP_KEEPINTVL, options.keepalive_interval_secs);
+        }
+    }
+    
+    // HMAC-SHA256 of tool|user|timestamp[|api_key], hex-encoded into out
+    void generate_signature(Transfer& t, const std::string& tool, const std::string& user,
+                            std::string_view timestamp, char (&out)[SIGNATURE_HEX_LENGTH]) {
+        if (!t.mac) {
+            t.mac = std::make_unique<HmacSha256>(*signing_key);
+        }
+        HmacSha256& mac = *t.mac;
+        mac.begin();
+        mac.update(tool);
+        mac.update("|");
+        mac.update(user);
+        mac.update("|");
+        mac.update(timestamp);
+        if (!api_key.empty()) {
+            mac.update("|");
+            mac.update(api_key);
+        }
+        
+        unsigned char digest[SHA256_DIGEST_LENGTH];
+        mac.finish(digest);
+        hex_encode(digest, out);
+    }
+    
+    // Current Unix timestamp as decimal digits into @p buf; returns the length
+    static std::size_t format_timestamp(char* buf, std::size_t size) {
+        auto now = std::chrono::system_clock::now();
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(
+            now.time_since_epoch()
+        ).count();
+        return static_cast<std::size_t>(std::to_chars(buf, buf + size, seconds).ptr - buf);
+    }
+    
+    // Deadline for one request of kind @p op; 0 (none) for streams
+    long request_timeout(Operation op) const {
+        switch (op) {
+        case Operation::Borrow:
+        case Operation::BorrowBatch:
+        case Operation::BorrowWait:  // perform_call adds the wait itself
+            return options.retry.borrow_timeout_ms;
+        case Operation::Return:
+        case Operation::ReturnBatch:
+        case Operation::Renew:
+            return options.retry.return_timeout_ms;
+        case Operation::Status:
+        case Operation::StatusAll:
+            return options.retry.status_timeout_ms;
+        default:
+            return 0;
+        }
+    }
+    
+    void set_timeouts(Transfer& t, long timeout_ms) {
+        long connect_ms = options.retry.connect_timeout_ms;
+        if (timeout_ms > 0 && (connect_ms <= 0 || connect_ms > timeout_ms)) {
+            connect_ms = timeout_ms;
+        }
+        curl_easy_setopt(t.easy, CURLOPT_TIMEOUT_MS, std::max(0L, timeout_ms));
+        if (connect_ms > 0) {
+            curl_easy_setopt(t.easy, CURLOPT_CONNECTTIMEOUT_MS, connect_ms);
+        }
+    }
+    
+    // Ask for MessagePack responses when configured; the server's
+    // Content-Type says what it actually sent
+    void add_accept_header(Transfer& t) {
+        if (options.wire_format == WireFormat::MessagePack) {
+            t.add_header(ACCEPT_MSGPACK_HEADER);
+        }
+    }
+    
+    /**
+     * POST to @p endpoint. write_body(std::string&) renders the JSON body
+     * into the transfer's buffer. Requests naming a tool and user are
+     * signed when security is enabled.
+     */
+    template <typename WriteBody>
+    TransferPtr make_post(std::string_view endpoint, WriteBody&& write_body,
+                          const std::string& tool = "", const std::string& user = "") {
+        TransferPtr t = take_transfer();
+        append_base_url(t->url, tool);
+        t->url.append(endpoint);
+        t->op = operation_of(endpoint);
+        set_timeouts(*t, request_timeout(t->op));
+        if (metrics) {
+            t->tool = tool;
+        }
+        write_body(t->body);
+        
+        CURL* h = t->easy;
+        curl_easy_setopt(h, CURLOPT_URL, t->url.c_str());
+        curl_easy_setopt(h, CURLOPT_POSTFIELDS, t->body.c_str());
+        curl_easy_setopt(h, CURLOPT_POSTFIELDSIZE, static_cast<long>(t->body.size()));
+        
+        t->add_header(CONTENT_TYPE_HEADER);
+        add_accept_header(*t);
+        std::uint64_t prepared = PhaseTrace::now();
+        PhaseTrace::record(TRACE_PREPARE, t->op, t->trace_request, t->trace_started, prepared);
+        
+        // Add security headers if enabled and tool/user provided
+        if (enable_security && !tool.empty() && !user.empty()) {
+            static const char ts_prefix[] = "X-Timestamp: ";
+            static const char sig_prefix[] = "X-Signature: ";
+            
+            char* ts = t->timestamp_header + sizeof(ts_prefix) - 1;
+            std::memcpy(t->timestamp_header, ts_prefix, sizeof(ts_prefix) - 1);
+            std::size_t ts_len = format_timestamp(ts, sizeof(t->timestamp_header) - sizeof(ts_prefix));
+            ts[ts_len] = '\0';
+            
+            char signature[SIGNATURE_HEX_LENGTH];
+            generate_signature(*t, tool, user, std::string_view(ts, ts_len), signature);
+            PhaseTrace::record(TRACE_SIGN, t->op, t->trace_request, prepared, PhaseTrace::now());
+            std::memcpy(t->signature_header, sig_prefix, sizeof(sig_prefix) - 1);
+            std::memcpy(t->signature_header + sizeof(sig_prefix) - 1, signature, sizeof(signature));
+            t->signature_header[sizeof(sig_prefix) - 1 + sizeof(signature)] = '\0';
+            
+            t->add_header(t->signature_header);
+            t->add_header(t->timestamp_header);
+            t->add_header(VENDOR_HEADER.c_str());
+            if (!auth_header.empty()) {
+                t->add_header(auth_header.c_str());
+            }
+        }
+        
+        curl_easy_setopt(h, CURLOPT_HTTPHEADER, t->headers());
+        return t;
+    }
+    
+    TransferPtr make_get(std::string_view endpoint) {
+        TransferPtr t = take_transfer();
+        t->url.append(base_url).append(endpoint);
+        t->op = operation_of(endpoint);
+        set_timeouts(*t, request_timeout(t->op));
+        curl_easy_setopt(t->easy, CURLOPT_URL, t->url.c_str());
+        curl_easy_setopt(t->easy, CURLOPT_HTTPGET, 1L);
+        add_accept_header(*t);
+        curl_easy_setopt(t->easy, CURLOPT_HTTPHEADER, t->headers());
+        return t;
+    }
+    
+    // GET /licenses/{tool}/status
+    TransferPtr make_status_get(const std::string& tool) {
+        TransferPtr t = take_transfer();
+        append_base_url(t->url, tool);
+        t->url.append("/licenses/");
+        append_escaped(t->url, tool);
+        t->url.append("/status");
+        t->op = Operation::Status;
+        set_timeouts(*t, request_timeout(t->op));
+        curl_easy_setopt(t->easy, CURLOPT_URL, t->url.c_str());
+        curl_easy_setopt(t->easy, CURLOPT_HTTPGET, 1L);
+        add_accept_header(*t);
+        curl_easy_setopt(t->easy, CURLOPT_HTTPHEADER, t->headers());
+        return t;
+    }
+    
+    // Base URL of the node owning @p tool; base_url without a ring or tool
+    void append_base_url(std::string& url, const std::string& tool) {
+        std::shared_ptr<const ShardRing> ring;
+        if (!tool.empty()) {
+            ring = shard_ring();
+        }
+        url.append(ring ? ring->owner_url(tool) : base_url);
+    }
+    
+    // Send @p t, built for base_url, to the node at @p url instead
+    void reroute(Transfer& t, const std::string& url) {
+        if (url == base_url) return;
+        t.url.replace(0, base_url.size(), url);
+        curl_easy_setopt(t.easy, CURLOPT_URL, t.url.c_str());
+    }
+    
+    /**
+     * After a finished exchange: if a node answered 307 with a Location
+     * on another node of the ring, point @p t there and return true, and
+     * the caller sends it again. libcurl does not follow redirects
+     * itself, as it would carry the API key and signature headers to
+     * whatever host, or scheme, the Location names.
+     */
+    bool take_shard_redirect(Transfer& t) {
+        if (!options.shard_routing || t.shard_hops >= MAX_SHARD_REDIRECTS) return false;
+        long code = 0;
+        curl_easy_getinfo(t.easy, CURLINFO_RESPONSE_CODE, &code);
+        if (code != 307) return false;
+        char* location = nullptr;
+        curl_easy_getinfo(t.easy, CURLINFO_REDIRECT_URL, &location);
+        std::shared_ptr<const ShardRing> ring = shard_ring(false);
+        if (!location || !ring || !ring->has_node(location)) return false;
+        t.url.assign(location);
+        curl_easy_setopt(t.easy, CURLOPT_URL, t.url.c_str());
+        t.response.data.clear();
+        t.response.redirected = true;
+        ++t.shard_hops;
+        return true;
+    }
+    
+    // Address a transfer about one borrow to the node that issued it
+    TransferPtr route_borrow(TransferPtr t, const std::string& borrow_id) {
+        if (auto ring = shard_ring()) {
+            if (const std::string* url = ring->issuer_url(borrow_id)) {
+                reroute(*t, *url);
+            }
+        }
+        return t;
+    }
+    
+    // The cluster's ring when shard_routing is on and the server is
+    // sharded, refetched (at most once per SHARD_REFRESH_MS) after a
+    // node redirected or refused a request. The loop thread passes
+    // may_fetch = false; it must not block on a fetch.
+    std::shared_ptr<const ShardRing> shard_ring(bool may_fetch = true) {
+        if (!options.shard_routing) return nullptr;
+        if (may_fetch && shard_ring_stale.load(std::memory_order_relaxed)) {
+            refresh_shard_ring();
+        }
+        std::lock_guard<std::mutex> lock(shard_mutex);
+        return ring_;
+    }
+    
+    void refresh_shard_ring() {
+        // Callers meanwhile route with the ring being replaced
+        std::unique_lock<std::mutex> fetching(shard_fetch_mutex, std::try_to_lock);
+        if (!fetching) return;
+        auto now = std::chrono::steady_clock::now();
+        if (now - shard_fetched_at < std::chrono::milliseconds(SHARD_REFRESH_MS)) return;
+        shard_fetched_at = now;
+        
+        std::shared_ptr<ShardRing> ring;
+        try {
+            TransferPtr t = make_get("/cluster/shards");
+            set_timeouts(*t, options.retry.status_timeout_ms);
+            t = run(std::move(t));
+            if (t->result != CURLE_OK) return;
+            if (t->response.http_code == 200) {
+                ring = std::make_shared<ShardRing>();
+                bool usable = false;
+                decode(t->response, [&](auto& reader) { usable = read_shard_ring(reader, *ring); });
+                if (!usable) ring.reset();
+            } else if (t->response.http_code != 404) {
+                return;  // try again later
+            }
+        } catch (const std::exception&) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(shard_mutex);
+            ring_ = std::move(ring);
+        }
+        shard_ring_stale.store(false, std::memory_order_relaxed);
+    }
+    
+    /**
+     * Order @p items by the node that issued id(item), keeping their
+     * order within a node, and return each item's node URL (base_url
+     * without a ring or node prefix) in the new order. The URLs point
+     * into @p ring.
+     */
+    template <typename T, typename Id>
+    std::vector<const std::string*> sort_by_issuer(const ShardRing* ring, std::vector<T>& items, Id&& id) {
+        std::vector<const std::string*> urls(items.size(), &base_url);
+        if (!ring) return urls;
+        std::vector<std::pair<const std::string*, T>> keyed;
+        keyed.reserve(items.size());
+        for (T& item : items) {
+            const std::string* url = ring->issuer_url(id(item));
+            keyed.emplace_back(url ? url : &base_url, std::move(item));
+        }
+        std::stable_sort(keyed.begin(), keyed.end(), [](const auto& a, const auto& b) {
+            return std::less<const std::string*>()(a.first, b.first);
+        });
+        for (std::size_t i = 0; i < keyed.size(); ++i) {
+            urls[i] = keyed[i].first;
+            items[i] = std::move(keyed[i].second);
+        }
+        return urls;
+    }
+    
+    // End of the batch from @p start: up to MAX_BATCH_SIZE items of one node
+    static std::size_t batch_end(const std::vector<const std::string*>& urls, std::size_t start) {
+        std::size_t end = start + 1;
+        while (end < urls.size() && end - start < static_cast<std::size_t>(MAX_BATCH_SIZE) &&
+               urls[end] == urls[start]) {
+            ++end;
+        }
+        return end;
+    }
+    
+    // Run a transfer to completion, following shard redirects;
+    // t->result has the outcome. Multiplexed transfers run on the event
+    // loop, which owns the shared connection, while the calling thread
+    // waits.
+    TransferPtr run(TransferPtr t) {
+        if (protocol.multiplex) {
+            AsyncEngine& loop = async_engine();
+            // A callback on the loop thread must not wait for the loop
+            if (!loop.on_loop_thread()) {
+                return loop.run(std::move(t));
+            }
+        }
+        for (;;) {
+            CURLcode res = curl_easy_perform(t->easy);
+            if (res == CURLE_OK && take_shard_redirect(*t)) continue;
+            t->finish(res);
+            if (res == CURLE_OK) {
+                read_response_info(t->easy, t->response);
+            }
+            return t;
+        }
+    }
+    
+    // As run(), throwing on a transport error
+    TransferPtr perform(TransferPtr t) {
+        t = run(std::move(t));
+        check_transfer(t->result);
+        return t;
+    }
+    
+    /**
+     * Run a status read on a per-thread curl_multi handle, adding a
+     * second copy if the first has not finished after @p hedge_after_ms.
+     * The first good response wins. A copy still in flight is abandoned:
+     * its connection is closed and it is not counted in the metrics.
+     */
+    template <typename Start>
+    TransferPtr run_hedged(Start& start, long hedge_after_ms) {
+        struct Multi {
+            CURLM* handle = curl_multi_init();
+            ~Multi() {
+                if (handle) curl_multi_cleanup(handle);
+            }
+        };
+        thread_local Multi multi;
+        if (!multi.handle) {
+            return run(start());
+        }
+        
+        struct Copies {
+            explicit Copies(CURLM* multi) : multi(multi) {}
+            CURLM* multi;
+            TransferPtr transfers[2];
+            bool attached[2] = {false, false};
+            int count = 0;
+            
+            void detach(int i) {
+                if (attached[i]) {
+                    curl_multi_remove_handle(multi, transfers[i]->easy);
+                    attached[i] = false;
+                }
+            }
+            ~Copies() {
+                detach(0);
+                detach(1);
+            }
+        } copies(multi.handle);
+        auto add_copy = [&] {
+            int i = copies.count;
+            copies.transfers[i] = start();
+            curl_multi_add_handle(copies.multi, copies.transfers[i]->easy);
+            copies.attached[i] = true;
+            ++copies.count;
+        };
+        
+        auto hedge_at = std::chrono::steady_clock::now() + std::chrono::milliseconds(hedge_after_ms);
+        add_copy();
+        int last = -1;
+        for (;;) {
+            int running = 0;
+            curl_multi_perform(copies.multi, &running);
+            int queued = 0;
+            while (CURLMsg* msg = curl_multi_info_read(copies.multi, &queued)) {
+                if (msg->msg != CURLMSG_DONE) continue;
+                int i = copies.count > 1 && msg->easy_handle == copies.transfers[1]->easy ? 1 : 0;
+                Transfer& t = *copies.transfers[i];
+                copies.detach(i);
+                t.finish(msg->data.result);
+                if (t.result == CURLE_OK) {
+                    read_response_info(t.easy, t.response);
+                }
+                last = i;
+                if (t.result == CURLE_OK && t.response.http_code < 500) {
+                    return std::move(copies.transfers[i]);
+                }
+            }
+            bool in_flight = copies.attached[0] || copies.attached[1];
+            if (!in_flight && (copies.count == 2 || last >= 0)) {
+                // All copies failed; the retry loop decides what next
+                return std::move(copies.transfers[last]);
+            }
+            long wait_ms = 1000;
+            if (copies.count == 1) {
+                auto until = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    hedge_at - std::chrono::steady_clock::now()).count();
+                if (until <= 0) {
+                    add_copy();
+                    continue;
+                }
+                wait_ms = std::min<long>(wait_ms, static_cast<long>(until));
+            }
+            curl_multi_poll(copies.multi, nullptr, 0, static_cast<int>(wait_ms), nullptr);
+        }
+    }
+    
+    // Retry classes of the blocking calls under ClientOptions::retry
+    enum class Call { Borrow, Return, Status };
+    
+    /**
+     * Run a blocking call under ClientOptions::retry. @p make builds a
+     * fresh request for each attempt; each gets what is left of the
+     * call's deadline. Returns the last attempt's transfer, whose
+     * response the caller checks as usual, and sets @p attempts to the
+     * number of attempts. Throws on a transport error, and without a
+     * request while the circuit is open. @p hold_ms extends the deadline
+     * for requests the server holds open on purpose (borrow_wait).
+     */
+    template <typename Make>
+    TransferPtr perform_call(Call call, const std::string& tool, Make&& make, int& attempts,
+                             long hold_ms = 0) {
+        using Clock = std::chrono::steady_clock;
+        const RetryPolicy& policy = options.retry;
+        long timeout_ms = call == Call::Borrow ? policy.borrow_timeout_ms
+                        : call == Call::Return ? policy.return_timeout_ms
+                        : policy.status_timeout_ms;
+        if (timeout_ms > 0) {
+            timeout_ms += std::max(0L, hold_ms);
+        }
+        auto deadline = timeout_ms > 0 ? Clock::now() + std::chrono::milliseconds(timeout_ms)
+                                       : Clock::time_point::max();
+        auto start = [&] {
+            TransferPtr t = make();
+            if (timeout_ms > 0) {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+                set_timeouts(*t, std::max<long>(1, static_cast<long>(left.count())));
+            }
+            return t;
+        };
+        bool hedge = call == Call::Status && policy.hedge_after_ms > 0 && !protocol.multiplex;
+        int max_attempts = std::max(1, policy.max_attempts);
+        
+        for (attempts = 1;; ++attempts) {
+            if (!breaker.allow()) {
+                throw ServerUnavailableException();
+            }
+            TransferPtr t = hedge ? run_hedged(start, policy.hedge_after_ms) : run(start());
+            if (hedge && t->result == CURLE_OK && take_shard_redirect(*t)) {
+                t = run(std::move(t));
+            }
+            CURLcode res = t->result;
+            if (res == CURLE_ABORTED_BY_CALLBACK) {
+                check_transfer(res);  // shut down; not the server's fault
+            }
+            long code = res == CURLE_OK ? t->response.http_code : 0;
+            if (res == CURLE_OK && code < 500) {
+                breaker.success();
+                return t;
+            }
+            breaker.failure();
+            
+            // A borrow the server may have granted is not repeated: that
+            // would take a second seat
+            bool repeatable = call != Call::Borrow || request_not_sent(res) || code == 503;
+            if (repeatable && attempts < max_attempts) {
+                auto wait = backoff(attempts);
+                if (Clock::now() + wait < deadline) {
+                    if (metrics && !tool.empty()) {
+                        metrics->count_retry(tool);
+                    }
+                    t.reset();
+                    std::this_thread::sleep_for(wait);
+                    continue;
+                }
+            }
+            check_transfer(res);
+            return t;
+        }
+    }
+    
+    // Full-jitter exponential backoff before retry number @p retry
+    std::chrono::milliseconds backoff(int retry) const {
+        const RetryPolicy& policy = options.retry;
+        long cap = policy.backoff_base_ms;
+        for (int i = 1; i < retry && cap < policy.backoff_max_ms; ++i) {
+            cap *= 2;
+        }
+        cap = std::min(cap, policy.backoff_max_ms);
+        if (cap <= 0) {
+            return std::chrono::milliseconds(0);
+        }
+        return std::chrono::milliseconds(random_id() % static_cast<std::uint64_t>(cap + 1));
+    }
+    
+    /**
+     * Single-threaded curl_multi event loop. Transfers submitted from
+     * any thread are added to the multi handle and driven concurrently;
+     * on_done runs on the loop thread when each one finishes.
+     */
+    class AsyncEngine {
+    public:
+        /**
+         * @param tick Runs on the loop thread at every wakeup, before new
+         *             transfers are added (used to flush queued work).
+         *             Returns the longest the loop may sleep, in ms.
+         * @param shutdown_timeout_ms Grace period for in-flight transfers
+         */
+        AsyncEngine(std::function<long(AsyncEngine&)> tick, long shutdown_timeout_ms)
+            : multi(curl_multi_init()), tick(std::move(tick)),
+              shutdown_timeout(std::chrono::milliseconds(shutdown_timeout_ms)) {
+            if (!multi) {
+                throw LicenseException("Failed to initialize CURL multi handle");
+            }
+            curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+            loop = std::thread([this] { run(); });
+        }
+        
+        ~AsyncEngine() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            curl_multi_wakeup(multi);
+            loop.join();
+            curl_multi_cleanup(multi);
+        }
+        
+        AsyncEngine(const AsyncEngine&) = delete;
+        AsyncEngine& operator=(const AsyncEngine&) = delete;
+        
+        void submit(TransferPtr t) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!closed) {
+                    incoming.push_back(std::move(t));
+                }
+            }
+            if (t) {
+                complete(std::move(t), CURLE_ABORTED_BY_CALLBACK);
+                return;
+            }
+            curl_multi_wakeup(multi);
+        }
+        
+        // Make the loop run another iteration (and its tick) promptly
+        void wakeup() {
+            curl_multi_wakeup(multi);
+        }
+        
+        bool on_loop_thread() const {
+            return std::this_thread::get_id() == loop.get_id();
+        }
+        
+        /**
+         * Run @p t on the loop and block until it finishes. The finished
+         * transfer is handed back instead of recycled, so the caller
+         * reads the response (or t->result) as after curl_easy_perform.
+         */
+        TransferPtr run(TransferPtr t) {
+            SyncWaiter waiter;
+            t->waiter = &waiter;
+            submit(std::move(t));
+            std::unique_lock<std::mutex> lock(waiter.mutex);
+            waiter.cv.wait(lock, [&] { return waiter.transfer != nullptr; });
+            return std::move(waiter.transfer);
+        }
+    
+    private:
+        void run() {
+            std::vector<TransferPtr> batch;
+            std::chrono::steady_clock::time_point stop_deadline;
+            bool draining = false;
+            for (;;) {
+                long wait_ms = IDLE_WAIT_MS;
+                if (tick) {
+                    wait_ms = std::min(wait_ms, std::max(0L, tick(*this)));
+                }
+                bool stop_requested;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stop_requested = stopping;
+                    batch.swap(incoming);
+                }
+                if (stop_requested) {
+                    // Let in-flight work finish within the grace period
+                    auto now = std::chrono::steady_clock::now();
+                    if (!draining) {
+                        draining = true;
+                        stop_deadline = now + shutdown_timeout;
+                    }
+                    auto idle = [](const auto& t) { return t->persistent; };
+                    bool finished = std::all_of(batch.begin(), batch.end(), idle) &&
+                                    std::all_of(active.begin(), active.end(), idle);
+                    if (finished || now >= stop_deadline) {
+                        break;
+                    }
+                }
+                for (auto& t : batch) {
+                    curl_easy_setopt(t->easy, CURLOPT_PRIVATE, t.get());
+                    if (curl_multi_add_handle(multi, t->easy) != CURLM_OK) {
+                        complete(std::move(t), CURLE_FAILED_INIT);
+                        continue;
+                    }
+                    active.insert(t.release());
+                }
+                batch.clear();
+                
+                int running = 0;
+                curl_multi_perform(multi, &running);
+                
+                int queued = 0;
+                while (CURLMsg* msg = curl_multi_info_read(multi, &queued)) {
+                    if (msg->msg != CURLMSG_DONE) continue;
+                    CURL* easy = msg->easy_handle;
+                    CURLcode result = msg->data.result;
+                    char* raw = nullptr;
+                    curl_easy_getinfo(easy, CURLINFO_PRIVATE, &raw);
+                    curl_multi_remove_handle(multi, easy);
+                    Transfer* t = reinterpret_cast<Transfer*>(raw);
+                    if (result == CURLE_OK && t->owner.take_shard_redirect(*t)) {
+                        // On to the node that owns it; still active
+                        if (curl_multi_add_handle(multi, easy) == CURLM_OK) continue;
+                        result = CURLE_FAILED_INIT;
+                    }
+                    active.erase(t);
+                    complete(TransferPtr(t), result);
+                }
+                
+                curl_multi_poll(multi, nullptr, 0, static_cast<int>(draining ? 50 : wait_ms), nullptr);
+            }
+            
+            // Shutting down: fail everything still in flight or queued
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                closed = true;
+            }
+            for (auto& t : batch) {
+                complete(std::move(t), CURLE_ABORTED_BY_CALLBACK);
+            }
+            for (Transfer* t : active) {
+                curl_multi_remove_handle(multi, t->easy);
+                complete(TransferPtr(t), CURLE_ABORTED_BY_CALLBACK);
+            }
+            active.clear();
+            std::vector<TransferPtr> leftover;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                leftover.swap(incoming);
+            }
+            for (auto& t : leftover) {
+                complete(std::move(t), CURLE_ABORTED_BY_CALLBACK);
+            }
+        }
+        
+        static void complete(TransferPtr t, CURLcode result) {
+            t->finish(result);
+            if (result == CURLE_OK) {
+                read_response_info(t->easy, t->response);
+            }
+            if (SyncWaiter* waiter = t->waiter) {
+                t->waiter = nullptr;
+                std::lock_guard<std::mutex> lock(waiter->mutex);
+                waiter->result = result;
+                waiter->transfer = std::move(t);
+                waiter->cv.notify_one();
+                return;
+            }
+            try {
+                if (t->on_done) {
+                    t->on_done(*t, result);
+                }
+            } catch (...) {
+                // Callbacks must not take down the event loop
+            }
+        }
+        
+        static constexpr long IDLE_WAIT_MS = 1000;
+        
+        CURLM* multi;
+        std::function<long(AsyncEngine&)> tick;
+        std::chrono::milliseconds shutdown_timeout;
+        std::thread loop;
+        std::mutex mutex;
+        std::vector<TransferPtr> incoming;
+        std::unordered_set<Transfer*> active;
+        bool stopping = false;
+        bool closed = false;
+    };
+    
+    /**
+     * Stop the event loop. It sends queued returns and waits up to
+     * shutdown_timeout_ms for in-flight requests; aborted transfers hand
+     * their handles back to the pool. Runs from ~LicenseClient, so the
+     * loop is never joined from a thread that merely held the last
+     * reference (handles keep a weak one).
+     */
+    void shutdown() {
+        {
+            std::unique_lock<std::shared_mutex> lock(lifecycle_mutex);
+            if (stopped) return;
+            stopped = true;
+        }
+        release_parked(true);
+        engine.reset();
+        ReturnNode* unsent = return_head.exchange(nullptr, std::memory_order_acquire);
+        while (unsent) {
+            ReturnNode* next = unsent->next;
+            if (agent) {
+                // The agent outlives this client; hand the seat back now
+                return_to_agent(unsent->id);
+            }
+            delete unsent;
+            unsent = next;
+        }
+    }
+    
+    // The event loop thread is only started by the first async call
+    AsyncEngine& async_engine() {
+        ensure_started();
+        std::call_once(engine_once, [this] {
+            engine = std::make_unique<AsyncEngine>(
+                [this](AsyncEngine& loop) {
+                    release_parked(false);
+                    drain_returns(loop);
+                    maintain_status_stream(loop);
+                    return renew_leases(loop);
+                },
+                options.shutdown_timeout_ms);
+        });
+        return *engine;
+    }
+    
+    // Deferred returns: a lock-free LIFO of borrow IDs. Handle
+    // destructors push onto it; the event loop takes the whole list at
+    // once and sends it as batched /licenses/return/batch requests (or,
+    // with an agent, as one RETURN each).
+    struct ReturnNode {
+        std::string id;
+        std::string tool;
+        int attempts = 0;
+        ReturnNode* next = nullptr;
+    };
+    
+    void enqueue_return(const std::string& id, const std::string& tool) noexcept override {
+        std::shared_lock<std::shared_mutex> lock(lifecycle_mutex);
+        if (stopped) return;
+        if (!agent) {
+            try {
+                if (token_verifier && park(id)) return;
+            } catch (...) {
+                // No memory to park it: return it instead
+            }
+            forget_lease(id);
+        }
+        try {
+            auto* node = new ReturnNode{id, tool};
+            pending_returns.fetch_add(1, std::memory_order_relaxed);
+            push_return(node);
+            async_engine().wakeup();
+        } catch (...) {
+            // No memory or no event loop: the server reclaims the seat
+        }
+    }
+    
+    // A return_async that did not reach the server joins the deferred
+    // returns, so the seat is not lost along with the dead handle. Runs
+    // on the loop thread.
+    void retry_return(AsyncEngine& loop, const std::string& id, const std::string& tool) noexcept {
+        try {
+            auto* node = new ReturnNode{id, tool, 1};
+            pending_returns.fetch_add(1, std::memory_order_relaxed);
+            push_return(node);
+            if (metrics) {
+                metrics->count_retry(tool);
+            }
+            loop.wakeup();
+        } catch (...) {
+            // No memory: the server reclaims the seat
+        }
+    }
+    
+    void push_return(ReturnNode* node) {
+        node->next = return_head.load(std::memory_order_relaxed);
+        while (!return_head.compare_exchange_weak(node->next, node,
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed)) {
+        }
+    }
+    
+    // Runs on the loop thread
+    void drain_returns(AsyncEngine& loop) {
+        ReturnNode* list = return_head.exchange(nullptr, std::memory_order_acquire);
+        if (!list) return;
+        
+        // The stack is newest-first; send in queue order
+        std::vector<ReturnNode*> nodes;
+        for (; list; list = list->next) {
+            nodes.push_back(list);
+        }
+        std::reverse(nodes.begin(), nodes.end());
+        if (agent) {
+            // Local round trips, on this thread rather than the callers'
+            std::vector<std::unique_ptr<ReturnNode>> batch(nodes.begin(), nodes.end());
+            for (const auto& node : batch) {
+                return_to_agent(node->id);
+            }
+            finish_returns(loop, batch, true);
+            return;
+        }
+        std::shared_ptr<const ShardRing> ring = shard_ring(false);
+        std::vector<const std::string*> urls = sort_by_issuer(ring.get(), nodes, [](const ReturnNode* node) {
+            return std::string_view(node->id);
+        });
+        
+        for (std::size_t start = 0, end; start < nodes.size(); start = end) {
+            end = batch_end(urls, start);
+            auto batch = std::make_shared<std::vector<std::unique_ptr<ReturnNode>>>();
+            batch->reserve(end - start);
+            for (std::size_t i = start; i < end; ++i) {
+                batch->emplace_back(nodes[i]);
+            }
+            
+            TransferPtr t;
+            try {
+                t = make_post("/licenses/return/batch", [&](std::string& body) {
+                    write_batch_return_body(body, batch->begin(), batch->end(),
+                                            [](const auto& node) -> const std::string& {
+                                                return node->id;
+                                            });
+                });
+                reroute(*t, *urls[start]);
+            } catch (...) {
+                finish_returns(loop, *batch, false);
+                continue;
+            }
+            t->on_done = [this, &loop, batch](Transfer& t, CURLcode res) {
+                // 4xx means the server handled the IDs; retrying won't
+                // help, except after a 421 from a node that is not theirs
+                bool delivered = res == CURLE_OK && t.response.http_code < 500 &&
+                                 t.response.http_code != 421;
+                if (delivered && t.response.http_code == 200 && status_cache) {
+                    note_batch_returned(*batch, t.response);
+                }
+                finish_returns(loop, *batch, delivered);
+            };
+            loop.submit(std::move(t));
+        }
+    }
+    
+    void finish_returns(AsyncEngine& loop, std::vector<std::unique_ptr<ReturnNode>>& batch,
+                        bool delivered) {
+        long done = 0;
+        bool requeued = false;
+        for (auto& node : batch) {
+            if (!delivered && ++node->attempts < MAX_RETURN_ATTEMPTS) {
+                if (metrics) {
+                    metrics->count_retry(node->tool);
+                }
+                push_return(node.release());
+                requeued = true;
+            } else {
+                ++done;
+            }
+        }
+        if (requeued) {
+            loop.wakeup();
+        }
+        if (done > 0) {
+            std::lock_guard<std::mutex> lock(returns_mutex);
+            pending_returns.fetch_sub(done, std::memory_order_relaxed);
+        }
+        returns_cv.notify_all();
+    }
+    
+    void note_batch_returned(const std::vector<std::unique_ptr<ReturnNode>>& batch,
+                             const Response& response) {
+        std::size_t returned = 0;
+        std::vector<std::string> not_found;
+        try {
+            read_batch_return(response, returned, not_found);
+        } catch (const LicenseException&) {
+            return;
+        }
+        for (const auto& node : batch) {
+            if (std::find(not_found.begin(), not_found.end(), node->id) == not_found.end()) {
+                status_cache->adjust(node->tool, -1);
+            }
+        }
+    }
+    
+    void flush_returns() {
+        if (pending_returns.load(std::memory_order_relaxed) == 0) return;
+        async_engine().wakeup();
+        std::unique_lock<std::mutex> lock(returns_mutex);
+        returns_cv.wait(lock, [this] {
+            return pending_returns.load(std::memory_order_relaxed) == 0;
+        });
+    }
+    
+private:
+    struct PoolShard {
+        std::mutex mutex;
+        std::vector<Transfer*> idle;
+    };
+    
+    PoolShard& local_shard() {
+        return shards[thread_shard_index() % shards.size()];
+    }
+    
+    static void share_lock(CURL*, curl_lock_data data, curl_lock_access, void* userp) {
+        static_cast<Impl*>(userp)->share_mutexes[data].lock();
+    }
+    
+    static void share_unlock(CURL*, curl_lock_data data, void* userp) {
+        static_cast<Impl*>(userp)->share_mutexes[data].unlock();
+    }
+    
+    CURLSH* share = nullptr;
+    std::mutex share_mutexes[CURL_LOCK_DATA_LAST];
+    std::atomic<bool> started{false};
+    std::once_flag started_once;
+    
+    // Addresses from the startup cache are handed to libcurl until a
+    // request is answered; if one fails, the next handle purges them
+    enum { RESOLVE_OFF, RESOLVE_CACHED, RESOLVE_PURGE };
+    std::atomic<int> resolve_state{RESOLVE_OFF};
+    curl_slist* cached_resolve = nullptr;
+    curl_slist* purge_resolve = nullptr;
+    std::mutex startup_mutex;
+    std::unordered_set<std::string> seeded_hosts;
+    bool seeded_stale = false;
+    bool via_proxy = false;
+    std::unordered_map<std::string, std::string> learned_addresses;
+    std::vector<PoolShard> shards;
+public:
+    /**
+     * Recently fetched statuses keyed by tool. Readers take a shared
+     * lock; fetches, stream snapshots and local borrow/return
+     * adjustments take it exclusively.
+     */
+    class StatusCache {
+    public:
+        explicit StatusCache(std::chrono::milliseconds ttl) : ttl(ttl) {}
+        
+        bool get(const std::string& tool, LicenseStatus& out) const {
+            auto now = std::chrono::steady_clock::now();
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            auto it = entries.find(tool);
+            if (it == entries.end() || now - it->second.fetched >= ttl) {
+                return false;
+            }
+            out = it->second.status;
+            return true;
+        }
+        
+        bool get_all(std::vector<LicenseStatus>& out) const {
+            auto now = std::chrono::steady_clock::now();
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            if (!have_all || now - all_fetched >= ttl) {
+                return false;
+            }
+            out.clear();
+            out.reserve(order.size());
+            for (const auto& tool : order) {
+                auto it = entries.find(tool);
+                if (it != entries.end()) {
+                    out.push_back(it->second.status);
+                }
+            }
+            return true;
+        }
+        
+        bool get_all(StatusTable& table) const {
+            auto now = std::chrono::steady_clock::now();
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            if (!have_all || now - all_fetched >= ttl) {
+                return false;
+            }
+            table.clear();
+            for (const auto& tool : order) {
+                auto it = entries.find(tool);
+                if (it != entries.end()) {
+                    table.set(it->second.status);
+                }
+            }
+            return true;
+        }
+        
+        void put(const LicenseStatus& status) {
+            auto now = std::chrono::steady_clock::now();
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            entries[status.tool] = Entry{status, now};
+        }
+        
+        // A complete listing: replaces every entry and the tool order
+        void put_all(const std::vector<LicenseStatus>& statuses) {
+            auto now = std::chrono::steady_clock::now();
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            entries.clear();
+            order.clear();
+            order.reserve(statuses.size());
+            for (const auto& status : statuses) {
+                entries[status.tool] = Entry{status, now};
+                order.push_back(status.tool);
+            }
+            all_fetched = now;
+            have_all = true;
+        }
+        
+        // Apply a borrow (+n) or return (-n) made by this client
+        void adjust(const std::string& tool, int delta) {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            auto it = entries.find(tool);
+            if (it == entries.end()) return;
+            LicenseStatus& s = it->second.status;
+            s.borrowed = std::max(s.borrowed + delta, 0);
+            s.available = std::max(s.total - s.borrowed, 0);
+            s.overage = std::max(s.borrowed - s.commit, 0);
+            s.in_commit = s.borrowed <= s.commit;
+        }
+        
+        void clear() {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            entries.clear();
+            order.clear();
+            have_all = false;
+        }
+    
+    private:
+        struct Entry {
+            LicenseStatus status;
+            std::chrono::steady_clock::time_point fetched;
+        };
+        
+        std::chrono::milliseconds ttl;
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+        std::vector<std::string> order;
+        std::chrono::steady_clock::time_point all_fetched;
+        bool have_all = false;
+    };
+    
+    /**
+     * Request metrics, sharded by thread like the transfer pool. A
+     * shard's histograms are created on first use and recorded into
+     * with relaxed atomics, so recording takes no lock; per-tool
+     * counters sit behind the shard's own mutex, which only its thread
+     * and snapshots take.
+     */
+    class Metrics {
+    public:
+        explicit Metrics(std::size_t shard_count) : shards_(shard_count) {}
+        
+        Metrics(const Metrics&) = delete;
+        Metrics& operator=(const Metrics&) = delete;
+        
+        // A finished transfer on its way back to the pool
+        void record(const Transfer& t) noexcept {
+            if (t.op == Operation::None || t.completed_at == std::chrono::steady_clock::time_point()) {
+                return;  // never sent, or not a tracked request
+            }
+            auto parse_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - t.completed_at).count());
+            try {
+                Shard& shard = local();
+                Recorder& r = recorder(shard, t.op);
+                r.requests.fetch_add(1, std::memory_order_relaxed);
+                long code = t.response.http_code;
+                if (t.result != CURLE_OK) {
+                    r.transport_errors.fetch_add(1, std::memory_order_relaxed);
+                } else if (code >= 400) {
+                    r.http_errors.fetch_add(1, std::memory_order_relaxed);
+                }
+                
+                // Microseconds from the start of the transfer to each point
+                curl_off_t dns = 0, connect = 0, tls = 0, sent = 0, first_byte = 0, total = 0;
+                long connects = 0;
+                curl_easy_getinfo(t.easy, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+                curl_easy_getinfo(t.easy, CURLINFO_CONNECT_TIME_T, &connect);
+                curl_easy_getinfo(t.easy, CURLINFO_APPCONNECT_TIME_T, &tls);
+                curl_easy_getinfo(t.easy, CURLINFO_PRETRANSFER_TIME_T, &sent);
+                curl_easy_getinfo(t.easy, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+                curl_easy_getinfo(t.easy, CURLINFO_TOTAL_TIME_T, &total);
+                curl_easy_getinfo(t.easy, CURLINFO_NUM_CONNECTS, &connects);
+                
+                r.phase(PHASE_TOTAL, micros_to_ns(total) + parse_ns);
+                if (connects > 0) {
+                    r.connections.fetch_add(static_cast<std::uint64_t>(connects), std::memory_order_relaxed);
+                    r.phase(PHASE_DNS, micros_to_ns(dns));
+                    r.phase(PHASE_CONNECT, micros_to_ns(connect - dns));
+                    if (tls > 0) {
+                        r.phase(PHASE_TLS, micros_to_ns(tls - connect));
+                    }
+                }
+                if (t.result == CURLE_OK && first_byte > 0) {
+                    r.phase(PHASE_TTFB, micros_to_ns(first_byte - sent));
+                    r.phase(PHASE_TRANSFER, micros_to_ns(total - first_byte));
+                }
+                r.phase(PHASE_PARSE, parse_ns);
+                
+                if ((t.op == Operation::Borrow || t.op == Operation::BorrowBatch ||
+                     t.op == Operation::BorrowWait) && !t.tool.empty()) {
+                    std::lock_guard<std::mutex> lock(shard.tools_mutex);
+                    ToolCounters& counters = shard.tools[t.tool];
+                    if (t.result == CURLE_OK && code == 200) {
+                        ++counters.borrows;
+                    } else if (t.result == CURLE_OK && code == 409) {
+                        ++counters.no_license;
+                    } else {
+                        ++counters.borrow_errors;
+                    }
+                }
+            } catch (...) {
+                // Out of memory: drop the sample
+            }
+        }
+        
+        void count_retry(const std::string& tool) noexcept {
+            count_tool(tool, &ToolCounters::retries);
+        }
+        
+        void count_lease_lost(const std::string& tool) noexcept {
+            count_tool(tool, &ToolCounters::leases_lost);
+        }
+        
+        void count_local_borrow(const std::string& tool) noexcept {
+            count_tool(tool, &ToolCounters::local_borrows);
+        }
+        
+        void count_local_refusal(const std::string& tool) noexcept {
+            count_tool(tool, &ToolCounters::local_refusals);
+        }
+        
+        ClientMetrics snapshot() const {
+            ClientMetrics out;
+            for (std::size_t op = 1; op < OPERATION_COUNT; ++op) {
+                OperationMetrics m;
+                m.operation = OPERATION_NAMES[op];
+                std::vector<detail::Histogram> merged(
+                    PHASE_COUNT, detail::Histogram(METRICS_HIGHEST_NS, METRICS_PRECISION_BITS));
+                std::uint64_t sums[PHASE_COUNT] = {};
+                for (const Shard& shard : shards_) {
+                    const Recorder* r = shard.recorders[op].load(std::memory_order_acquire);
+                    if (!r) continue;
+                    m.requests += r->requests.load(std::memory_order_relaxed);
+                    m.transport_errors += r->transport_errors.load(std::memory_order_relaxed);
+                    m.http_errors += r->http_errors.load(std::memory_order_relaxed);
+                    m.connections += r->connections.load(std::memory_order_relaxed);
+                    for (int p = 0; p < PHASE_COUNT; ++p) {
+                        r->phases[p]->add_to(merged[p]);
+                        sums[p] += r->phases[p]->sum();
+                    }
+                }
+                if (m.requests == 0) continue;
+                LatencyMetrics* targets[PHASE_COUNT] = {
+                    &m.total, &m.dns, &m.connect, &m.tls, &m.ttfb, &m.transfer, &m.parse
+                };
+                for (int p = 0; p < PHASE_COUNT; ++p) {
+                    summarize(merged[p], sums[p], *targets[p]);
+                }
+                out.operations.push_back(std::move(m));
+            }
+            
+            std::unordered_map<std::string, ToolCounters> tools;
+            for (const Shard& shard : shards_) {
+                std::lock_guard<std::mutex> lock(shard.tools_mutex);
+                for (const auto& entry : shard.tools) {
+                    ToolCounters& sum = tools[entry.first];
+                    sum.borrows += entry.second.borrows;
+                    sum.no_license += entry.second.no_license;
+                    sum.borrow_errors += entry.second.borrow_errors;
+                    sum.retries += entry.second.retries;
+                    sum.leases_lost += entry.second.leases_lost;
+                    sum.local_borrows += entry.second.local_borrows;
+                    sum.local_refusals += entry.second.local_refusals;
+                }
+            }
+            for (const auto& entry : tools) {
+                ToolMetrics m;
+                m.tool = entry.first;
+                m.borrows = entry.second.borrows;
+                m.no_license = entry.second.no_license;
+                m.borrow_errors = entry.second.borrow_errors;
+                m.retries = entry.second.retries;
+                m.leases_lost = entry.second.leases_lost;
+                m.local_borrows = entry.second.local_borrows;
+                m.local_refusals = entry.second.local_refusals;
+                out.tools.push_back(std::move(m));
+            }
+            std::sort(out.tools.begin(), out.tools.end(),
+                      [](const ToolMetrics& a, const ToolMetrics& b) { return a.tool < b.tool; });
+            return out;
+        }
+        
+    private:
+        struct Recorder {
+            Recorder() {
+                for (auto& phase : phases) {
+                    phase = std::make_unique<detail::AtomicHistogram>(METRICS_HIGHEST_NS, METRICS_PRECISION_BITS);
+                }
+            }
+            void phase(Phase p, std::uint64_t ns) { phases[p]->record(ns); }
+            
+            std::atomic<std::uint64_t> requests{0};
+            std::atomic<std::uint64_t> transport_errors{0};
+            std::atomic<std::uint64_t> http_errors{0};
+            std::atomic<std::uint64_t> connections{0};
+            std::unique_ptr<detail::AtomicHistogram> phases[PHASE_COUNT];
+        };
+        
+        struct ToolCounters {
+            std::uint64_t borrows = 0;
+            std::uint64_t no_license = 0;
+            std::uint64_t borrow_errors = 0;
+            std::uint64_t retries = 0;
+            std::uint64_t leases_lost = 0;
+            std::uint64_t local_borrows = 0;
+            std::uint64_t local_refusals = 0;
+        };
+        
+        struct Shard {
+            Shard() = default;
+            ~Shard() {
+                for (auto& r : recorders) {
+                    delete r.load(std::memory_order_relaxed);
+                }
+            }
+            std::atomic<Recorder*> recorders[OPERATION_COUNT] = {};
+            mutable std::mutex tools_mutex;
+            std::unordered_map<std::string, ToolCounters> tools;
+        };
+        
+        static std::uint64_t micros_to_ns(curl_off_t us) {
+            return us > 0 ? static_cast<std::uint64_t>(us) * 1000 : 0;
+        }
+        
+        static void summarize(const detail::Histogram& h, std::uint64_t sum_ns, LatencyMetrics& out) {
+            out.count = h.count();
+            out.sum = static_cast<double>(sum_ns) / 1e9;
+            out.p50 = static_cast<double>(h.value_at(50)) / 1e9;
+            out.p90 = static_cast<double>(h.value_at(90)) / 1e9;
+            out.p99 = static_cast<double>(h.value_at(99)) / 1e9;
+            out.max = static_cast<double>(h.max()) / 1e9;
+            const auto& bounds = ClientMetrics::bucket_bounds();
+            out.buckets.reserve(bounds.size());
+            for (double bound : bounds) {
+                out.buckets.push_back(h.count_at_or_below(static_cast<std::uint64_t>(bound * 1e9)));
+            }
+        }
+        
+        Shard& local() {
+            return shards_[thread_shard_index() % shards_.size()];
+        }
+        
+        // Several threads can share a shard, so the first recorder is
+        // published with a compare-exchange
+        Recorder& recorder(Shard& shard, Operation op) {
+            auto& slot = shard.recorders[static_cast<std::size_t>(op)];
+            Recorder* r = slot.load(std::memory_order_acquire);
+            if (r) return *r;
+            auto fresh = std::make_unique<Recorder>();
+            if (slot.compare_exchange_strong(r, fresh.get(), std::memory_order_acq_rel)) {
+                return *fresh.release();
+            }
+            return *r;
+        }
+        
+        void count_tool(const std::string& tool, std::uint64_t ToolCounters::*field) noexcept {
+            try {
+                Shard& shard = local();
+                std::lock_guard<std::mutex> lock(shard.tools_mutex);
+                ++(shard.tools[tool].*field);
+            } catch (...) {
+                // Out of memory: drop the count
+            }
+        }
+        
+        std::vector<Shard> shards_;
+    };
+    
+    // Null unless ClientOptions::collect_metrics is set (and not in agent mode)
+    std::unique_ptr<Metrics> metrics;
+    
+    /**
+     * Circuit breaker for the blocking calls (RetryPolicy). Closed, it
+     * counts consecutive failed attempts; at the threshold it opens
+     * until open_until_. After that one probe at a time is admitted; a
+     * probe that never reports back is replaced after another open
+     * period. Any success closes the circuit.
+     */
+    class CircuitBreaker {
+    public:
+        explicit CircuitBreaker(const RetryPolicy& policy)
+            : threshold_(policy.breaker_failure_threshold),
+              open_ns_(std::max(0L, policy.breaker_open_ms) * 1000000) {}
+        
+        bool allow() {
+            if (threshold_ <= 0) return true;
+            std::int64_t until = open_until_.load(std::memory_order_acquire);
+            if (until == 0) return true;
+            std::int64_t now = now_ns();
+            if (now < until) return false;
+            std::int64_t probe = probe_at_.load(std::memory_order_relaxed);
+            return (probe < until || now - probe >= open_ns_) &&
+                   probe_at_.compare_exchange_strong(probe, now, std::memory_order_acq_rel);
+        }
+        
+        void success() {
+            if (threshold_ <= 0) return;
+            failures_.store(0, std::memory_order_relaxed);
+            if (open_until_.load(std::memory_order_relaxed) != 0) {
+                open_until_.store(0, std::memory_order_release);
+            }
+        }
+        
+        void failure() {
+            if (threshold_ <= 0) return;
+            bool open = open_until_.load(std::memory_order_relaxed) != 0;
+            if (open || failures_.fetch_add(1, std::memory_order_relaxed) + 1 >= threshold_) {
+                // Trips, or a probe failed: (re)open for a full period
+                open_until_.store(now_ns() + open_ns_, std::memory_order_release);
+                failures_.store(0, std::memory_order_relaxed);
+            }
+        }
+        
+    private:
+        static std::int64_t now_ns() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+        
+        int threshold_;
+        std::int64_t open_ns_;
+        std::atomic<int> failures_{0};
+        // Steady clock time the open period ends, or 0 while closed
+        std::atomic<std::int64_t> open_until_{0};
+        // When the last probe was admitted
+        std::atomic<std::int64_t> probe_at_{0};
+    };
+    
+    CircuitBreaker breaker{options.retry};
+    
+    /**
+     * Token bucket for one tool (AdmissionPolicy), kept as the time the
+     * next token is due: taking k tokens moves it k intervals on, and
+     * the bucket is empty while it runs more than a burst ahead of the
+     * clock. Each take is one compare-and-swap. A caller allowed to wait
+     * reserves its token at once and sleeps until it is due, so waiters
+     * are served in order without a queue.
+     */
+    class TokenBucket {
+    public:
+        TokenBucket(std::int64_t interval_ns, int burst)
+            : interval_ns_(interval_ns), burst_ns_(interval_ns * (std::max(1, burst) - 1)) {}
+        
+        // Take up to @p want tokens, the last due within @p max_wait_ns
+        // of @p now; returns how many, with the wait before the last in
+        // @p wait_ns
+        int take(int want, std::int64_t now, std::int64_t max_wait_ns, std::int64_t& wait_ns) {
+            std::int64_t due = due_.load(std::memory_order_relaxed);
+            for (;;) {
+                std::int64_t from = std::max(due, now);
+                std::int64_t slack = now + max_wait_ns + burst_ns_ - from;
+                if (slack < 0) {
+                    return 0;
+                }
+                int count = static_cast<int>(std::min<std::int64_t>(want, slack / interval_ns_ + 1));
+                if (due_.compare_exchange_weak(due, from + count * interval_ns_, std::memory_order_relaxed)) {
+                    wait_ns = std::max<std::int64_t>(0, from + (count - 1) * interval_ns_ - burst_ns_ - now);
+                    return count;
+                }
+            }
+        }
+        
+    private:
+        std::int64_t interval_ns_;
+        std::int64_t burst_ns_;
+        std::atomic<std::int64_t> due_{0};
+    };
+    
+    TokenBucket& bucket(const std::string& tool) {
+        {
+            std::shared_lock<std::shared_mutex> lock(buckets_mutex);
+            auto it = buckets.find(tool);
+            if (it != buckets.end()) {
+                return *it->second;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(buckets_mutex);
+        auto& slot = buckets[tool];
+        if (!slot) {
+            auto interval = static_cast<std::int64_t>(1e9 / options.admission.borrows_per_second);
+            slot = std::make_unique<TokenBucket>(std::max<std::int64_t>(1, interval), options.admission.burst);
+        }
+        return *slot;
+    }
+    
+    [[noreturn]] void refuse(const std::string& tool, AdmissionRefusedException::Reason reason) {
+        if (metrics) {
+            metrics->count_local_refusal(tool);
+        }
+        throw AdmissionRefusedException(tool, reason);
+    }
+    
+    /**
+     * AdmissionPolicy for a borrow of up to @p want seats: how many may
+     * be requested from the server, after waiting for tokens if
+     * @p may_wait. Throws AdmissionRefusedException if none.
+     */
+    int admit(const std::string& tool, int want, bool may_wait) {
+        return admit_rate(tool, admit_status(tool, want), may_wait);
+    }
+    
+    // The cached-status checks of admit()
+    int admit_status(const std::string& tool, int want) {
+        const AdmissionPolicy& policy = options.admission;
+        LicenseStatus status;
+        if ((policy.stay_within_commit || policy.refuse_exhausted) && status_cache &&
+            status_cache->get(tool, status)) {
+            if (policy.refuse_exhausted && (want = std::min(want, status.available)) <= 0) {
+                refuse(tool, AdmissionRefusedException::Reason::Exhausted);
+            }
+            if (policy.stay_within_commit && (want = std::min(want, status.commit - status.borrowed)) <= 0) {
+                refuse(tool, AdmissionRefusedException::Reason::OverCommit);
+            }
+        }
+        return want;
+    }
+    
+    // The token bucket of admit()
+    int admit_rate(const std::string& tool, int want, bool may_wait) {
+        const AdmissionPolicy& policy = options.admission;
+        if (policy.borrows_per_second > 0) {
+            std::int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+            std::int64_t max_wait_ns = may_wait ? std::max(0L, policy.max_wait_ms) * 1000000 : 0;
+            std::int64_t wait_ns = 0;
+            want = bucket(tool).take(want, now, max_wait_ns, wait_ns);
+            if (want == 0) {
+                refuse(tool, AdmissionRefusedException::Reason::RateLimited);
+            }
+            if (wait_ns > 0) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(wait_ns));
+            }
+        }
+        return want;
+    }
+    
+    std::shared_mutex buckets_mutex;
+    std::unordered_map<std::string, std::unique_ptr<TokenBucket>> buckets;
+    
+    // ClientOptions::on_span is set. Root spans are sampled if all are,
+    // or if the low half of their trace ID is below the threshold.
+    bool tracing = false;
+    bool trace_sample_all = true;
+    std::uint64_t trace_sample_below = 0;
+    
+    /**
+     * Client span around one blocking call: one branch unless tracing.
+     * Otherwise the span joins the thread's TraceScope, if any, goes out
+     * in the request's traceparent header, and, if sampled, is passed to
+     * ClientOptions::on_span when it goes out of scope.
+     */
+    class ClientSpan {
+    public:
+        ClientSpan(Impl& impl, const char* name, const std::string& tool)
+            : impl_(impl.tracing ? &impl : nullptr) {
+            if (impl_) start(name, tool);
+        }
+        ~ClientSpan() {
+            if (impl_) end();
+        }
+        ClientSpan(const ClientSpan&) = delete;
+        ClientSpan& operator=(const ClientSpan&) = delete;
+        
+        // Add the traceparent header to a request made by make_post() or
+        // make_get()
+        TransferPtr inject(TransferPtr t) {
+            if (impl_) {
+                std::memcpy(t->trace_header, TRACEPARENT_HEADER, sizeof(TRACEPARENT_HEADER) - 1);
+                char* value = t->trace_header + sizeof(TRACEPARENT_HEADER) - 1;
+                write_traceparent(value, span_.context);
+                value[TRACEPARENT_LENGTH] = '\0';
+                t->add_header(t->trace_header);
+                curl_easy_setopt(t->easy, CURLOPT_HTTPHEADER, t->headers());
+            }
+            return t;
+        }
+        
+        void set_http_status(long code) {
+            if (impl_) span_.http_status = code;
+        }
+        
+    private:
+        void start(const char* name, const std::string& tool) {
+            TraceContext& context = span_.context;
+            if (const TraceContext* parent = TraceScope::current()) {
+                context.trace_id_high = parent->trace_id_high;
+                context.trace_id_low = parent->trace_id_low;
+                context.sampled = parent->sampled;
+                span_.parent_span_id = parent->span_id;
+            } else {
+                context.trace_id_high = random_id();
+                context.trace_id_low = random_id();
+                context.sampled = impl_->trace_sample_all ||
+                    context.trace_id_low < impl_->trace_sample_below;
+            }
+            context.span_id = random_id();
+            if (context.sampled) {
+                span_.name = name;
+                span_.tool = tool;
+                span_.start_unix_nanos = unix_nanos();
+            }
+            exceptions_ = std::uncaught_exceptions();
+        }
+        
+        void end() {
+            if (!span_.context.sampled) return;
+            span_.end_unix_nanos = unix_nanos();
+            span_.error = std::uncaught_exceptions() > exceptions_;
+            try {
+                impl_->options.on_span(span_);
+            } catch (...) {
+                // A failing sink must not fail the call, or throw during unwinding
+            }
+        }
+        
+        Impl* impl_;
+        TraceSpan span_;
+        int exceptions_ = 0;
+    };
+    
+    // Null unless ClientOptions::status_cache_ttl_ms > 0
+    std::unique_ptr<StatusCache> status_cache;
+    
+    // get_all_statuses() lists per node URL, each as of `version`, so a
+    // later call fetches only what changed after it
+    struct StatusSnapshot {
+        std::string version;
+        std::vector<LicenseStatus> statuses;
+    };
+    std::mutex snapshot_mutex;
+    std::unordered_map<std::string, StatusSnapshot> status_snapshots;
+    // Set once a server answers /licenses/status/delta with 404 or 405
+    std::atomic<bool> status_delta_unsupported{false};
+    
+    // Add the status list of the node at @p url to @p out (a list or a
+    // StatusTable), from the tools changed since this client's last look
+    // where the server offers deltas
+    template <typename Out>
+    void node_statuses(const std::string& url, ClientSpan& span, Out& out) {
+        if (!status_delta_unsupported.load(std::memory_order_relaxed)) {
+            std::string since;
+            {
+                std::lock_guard<std::mutex> lock(snapshot_mutex);
+                auto it = status_snapshots.find(url);
+                if (it != status_snapshots.end()) since = it->second.version;
+            }
+            int attempts = 0;
+            auto t = perform_call(Call::Status, std::string(), [&] {
+                auto get = make_get("/licenses/status/delta");
+                if (!since.empty()) {
+                    get->url.append("?since=");
+                    append_escaped(get->url, since);
+                    curl_easy_setopt(get->easy, CURLOPT_URL, get->url.c_str());
+                }
+                reroute(*get, url);
+                return span.inject(std::move(get));
+            }, attempts);
+            span.set_http_status(t->response.http_code);
+            long code = t->response.http_code;
+            if (code != 404 && code != 405) {
+                StatusDelta delta = status_delta_from_response(t->response);
+                std::lock_guard<std::mutex> lock(snapshot_mutex);
+                StatusSnapshot& snapshot = status_snapshots[url];
+                // Skipped when a concurrent call moved the snapshot on meanwhile
+                if (delta.full || snapshot.version == since) {
+                    snapshot.version = std::move(delta.version);
+                    merge_status_delta(snapshot.statuses, std::move(delta));
+                }
+                add_statuses(out, snapshot.statuses);
+                return;
+            }
+            status_delta_unsupported.store(true, std::memory_order_relaxed);
+        }
+        int attempts = 0;
+        auto t = perform_call(Call::Status, std::string(), [&] {
+            auto get = make_get("/licenses/status");
+            reroute(*get, url);
+            return span.inject(std::move(get));
+        }, attempts);
+        span.set_http_status(t->response.http_code);
+        statuses_from_response(t->response, out);
+    }
+    
+    // See shard_ring(); null while unsharded or not yet fetched
+    std::shared_ptr<const ShardRing> ring_;
+    std::mutex shard_mutex;
+    std::mutex shard_fetch_mutex;
+    std::atomic<bool> shard_ring_stale{true};
+    std::chrono::steady_clock::time_point shard_fetched_at{};
+    
+    // Null unless an agent socket is configured
+    std::unique_ptr<AgentLink> agent;
+    
+    static void check_agent_field(const std::string& value) {
+        if (!agent::valid_field(value)) {
+            throw LicenseException("Value not supported by the license agent: '" + value + "'");
+        }
+    }
+    
+    std::string agent_borrow(const std::string& tool, const std::string& user) {
+        check_agent_field(tool);
+        check_agent_field(user);
+        std::string request = "BORROW\t" + tool + "\t" + user + "\n";
+        std::string reply;
+        agent->call(request, [&](agent::LineChannel& channel) {
+            return channel.read_line(reply);
+        });
+        if (reply.compare(0, 3, "OK\t") != 0 || reply.size() == 3) {
+            throw_agent_reply(reply, tool);
+        }
+        return reply.substr(3);
+    }
+    
+    // False if the agent does not know the ID
+    bool agent_return(const std::string& id) {
+        check_agent_field(id);
+        std::string reply;
+        agent->call("RETURN\t" + id + "\n", [&](agent::LineChannel& channel) {
+            return channel.read_line(reply);
+        });
+        if (reply == "NOTFOUND") {
+            return false;
+        }
+        if (reply != "OK") {
+            throw_agent_reply(reply, "");
+        }
+        return true;
+    }
+    
+    // Deferred return of a handle's seat to the agent
+    void return_to_agent(const std::string& id) noexcept {
+        try {
+            agent_return(id);
+        } catch (...) {
+            // Agent gone: it already took the seat back
+        }
+    }
+    
+    LicenseStatus agent_status(const std::string& tool) {
+        check_agent_field(tool);
+        std::string reply;
+        agent->call("STATUS\t" + tool + "\n", [&](agent::LineChannel& channel) {
+            return channel.read_line(reply);
+        });
+        LicenseStatus status;
+        std::vector<std::string_view> fields;
+        agent::split_fields(reply, fields);
+        if (fields[0] != "OK") {
+            throw_agent_reply(reply, tool);
+        }
+        if (!agent::parse_status_fields(fields, 1, status)) {
+            throw LicenseException("Malformed license agent reply: " + reply);
+        }
+        return status;
+    }
+    
+    std::vector<LicenseStatus> agent_statuses() {
+        std::string reply;
+        std::vector<LicenseStatus> statuses;
+        bool malformed = false;
+        agent->call("STATUSALL\n", [&](agent::LineChannel& channel) {
+            if (!channel.read_line(reply)) return false;
+            std::vector<std::string_view> fields;
+            agent::split_fields(reply, fields);
+            if (fields[0] != "OK") return true;
+            std::size_t count = 0;
+            if (fields.size() != 2 ||
+                std::from_chars(fields[1].data(), fields[1].data() + fields[1].size(), count).ec !=
+                    std::errc()) {
+                return false;  // the stream position is unknown; drop it
+            }
+            std::string line;
+            statuses.resize(count);
+            for (auto& status : statuses) {
+                if (!channel.read_line(line)) return false;
+                agent::split_fields(line, fields);
+                malformed = malformed || !agent::parse_status_fields(fields, 0, status);
+            }
+            return true;
+        });
+        if (reply.compare(0, 3, "OK\t") != 0) {
+            throw_agent_reply(reply, "");
+        }
+        if (malformed) {
+            throw LicenseException("Malformed license agent reply");
+        }
+        return statuses;
+    }
+    
+    void note_status_change(const std::string& tool, int delta) {
+        if (status_cache && delta != 0) {
+            status_cache->adjust(tool, delta);
+        }
+    }
+    
+    // The stream is opened by the event loop; make sure it is running
+    void ensure_status_stream() {
+        if (status_cache && options.status_stream) {
+            async_engine();
+        }
+    }
+    
+    /**
+     * Keep a borrow alive: schedule its renewal on the event loop's
+     * timer wheel. Returns through any path call forget_lease.
+     */
+    void track_lease(const std::string& id, const std::string& tool, int lease_seconds) {
+        if (lease_seconds <= 0 || !options.renew_leases || agent) return;
+        std::uint64_t due;
+        {
+            std::lock_guard<std::mutex> lock(lease_mutex);
+            auto result = leases.try_emplace(id);
+            Lease& lease = result.first->second;
+            if (!result.second) {
+                lease_wheel.cancel(lease.timer);
+            }
+            lease.tool = tool;
+            lease.lease_ms = lease_seconds * 1000L;
+            due = lease_tick() + renew_ticks(lease.lease_ms, LEASE_RENEW_DIVISOR);
+            lease.timer = lease_wheel.schedule(due, id);
+            lease_count.store(leases.size(), std::memory_order_relaxed);
+        }
+        // Wake the loop only if it would otherwise sleep past this renewal
+        if (due < lease_wake_tick.load(std::memory_order_relaxed)) {
+            async_engine().wakeup();
+        } else {
+            async_engine();
+        }
+    }
+    
+    void forget_lease(const std::string& id) noexcept {
+        if (lease_count.load(std::memory_order_relaxed) == 0) return;
+        std::lock_guard<std::mutex> lock(lease_mutex);
+        auto it = leases.find(id);
+        if (it == leases.end()) return;
+        lease_wheel.cancel(it->second.timer);
+        leases.erase(it);
+        lease_count.store(leases.size(), std::memory_order_relaxed);
+    }
+    
+    // Null unless OfflineLeasePolicy::public_key_pem is set
+    std::unique_ptr<LeaseTokenVerifier> token_verifier;
+    
+    /**
+     * Remember the lease token of a seat just borrowed from the server,
+     * if seats are parked at all and it verifies and names this borrow,
+     * tool and user.
+     */
+    void keep_offline(const std::string& id, const std::string& tool, const std::string& user,
+                      const std::string& token, int lease_seconds) {
+        LeaseToken claims;
+        if (options.offline.park_ms <= 0 || token.empty() || !token_verifier->verify(token, claims) || claims.id != id ||
+            claims.tool != tool || claims.user != user) {
+            return;
+        }
+        auto usable_until = token_deadline(claims);
+        if (usable_until <= std::chrono::steady_clock::now()) return;
+        std::lock_guard<std::mutex> lock(offline_mutex);
+        offline_seats[id] = OfflineSeat{tool, user, token, lease_seconds, usable_until, {}, false};
+    }
+    
+    /**
+     * Grant a borrow from a parked seat of @p tool and @p user, in memory
+     * or else from the cache file; sets @p id and returns true if found.
+     */
+    bool take_parked(const std::string& tool, const std::string& user, std::string& id) {
+        if (parked_count.load(std::memory_order_relaxed) > 0) {
+            auto now = std::chrono::steady_clock::now();
+            std::lock_guard<std::mutex> lock(offline_mutex);
+            auto range = parked_seats.equal_range(seat_key(tool, user));
+            for (auto it = range.first; it != range.second; ++it) {
+                OfflineSeat& seat = offline_seats.at(it->second);
+                if (seat.parked_until <= now) continue;  // the event loop returns it
+                seat.parked = false;
+                id = it->second;
+                parked_seats.erase(it);
+                parked_count.store(parked_seats.size(), std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return !options.offline.cache_path.empty() && take_cached(tool, user, id);
+    }
+    
+    // take_parked for a borrow call, counted as a local borrow
+    bool borrow_parked(const std::string& tool, const std::string& user, std::string& id) {
+        if (!token_verifier || !take_parked(tool, user, id)) {
+            return false;
+        }
+        if (metrics) {
+            metrics->count_local_borrow(tool);
+        }
+        return true;
+    }
+    
+    // Bookkeeping for a seat the server just granted
+    void adopt_borrow(const LicenseHandle& handle, int lease_seconds, const std::string& lease_token) {
+        note_status_change(handle.tool(), 1);
+        track_lease(handle.id(), handle.tool(), lease_seconds);
+        if (token_verifier) {
+            keep_offline(handle.id(), handle.tool(), handle.user(), lease_token, lease_seconds);
+        }
+    }
+    
+    // Set once the server answers borrow_wait with 404/405; it is then polled
+    std::atomic<bool> borrow_wait_unsupported{false};
+    
+    /**
+     * Keep a returned seat for a local re-borrow instead of returning it.
+     * False if it has no usable token; the caller then returns it.
+     */
+    bool park(const std::string& id) {
+        {
+            std::lock_guard<std::mutex> lock(offline_mutex);
+            auto it = offline_seats.find(id);
+            if (it == offline_seats.end()) return false;
+            OfflineSeat& seat = it->second;
+            auto now = std::chrono::steady_clock::now();
+            if (options.offline.park_ms <= 0 || seat.usable_until <= now) {
+                offline_seats.erase(it);
+                return false;
+            }
+            parked_seats.emplace(seat_key(seat.tool, seat.user), id);
+            seat.parked_until = std::min(seat.usable_until, now + std::chrono::milliseconds(options.offline.park_ms));
+            seat.parked = true;
+            parked_count.store(parked_seats.size(), std::memory_order_relaxed);
+        }
+        // The event loop returns the seat when its hold ends
+        async_engine();
+        return true;
+    }
+    
+    // True if the seat was parked
+    bool forget_offline(const std::string& id) noexcept {
+        if (!token_verifier) return false;
+        std::lock_guard<std::mutex> lock(offline_mutex);
+        auto it = offline_seats.find(id);
+        if (it == offline_seats.end()) return false;
+        bool parked = it->second.parked;
+        if (parked) {
+            auto range = parked_seats.equal_range(seat_key(it->second.tool, it->second.user));
+            for (auto parked = range.first; parked != range.second; ++parked) {
+                if (parked->second == id) {
+                    parked_seats.erase(parked);
+                    break;
+                }
+            }
+            parked_count.store(parked_seats.size(), std::memory_order_relaxed);
+        }
+        offline_seats.erase(it);
+        return parked;
+    }
+    
+    /**
+     * Queue parked seats whose hold has ended for return; on shutdown
+     * (@p all), every parked seat, unless OfflineLeasePolicy::
+     * hand_off_on_exit writes those whose lease the server will reclaim
+     * by itself to the cache file instead.
+     */
+    void release_parked(bool all) {
+        if (parked_count.load(std::memory_order_relaxed) == 0) return;
+        auto now = std::chrono::steady_clock::now();
+        if (!all) {
+            if (now < next_parked_scan) return;
+            next_parked_scan = now + std::chrono::milliseconds(IDLE_TICK_MS);
+        }
+        
+        std::vector<std::pair<std::string, OfflineSeat>> released;
+        {
+            std::lock_guard<std::mutex> lock(offline_mutex);
+            for (auto it = parked_seats.begin(); it != parked_seats.end();) {
+                auto seat = offline_seats.find(it->second);
+                if (all || seat->second.parked_until <= now) {
+                    released.emplace_back(seat->first, std::move(seat->second));
+                    offline_seats.erase(seat);
+                    it = parked_seats.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            parked_count.store(parked_seats.size(), std::memory_order_relaxed);
+        }
+        
+        std::string cached;
+        for (auto& entry : released) {
+            forget_lease(entry.first);
+            const OfflineSeat& seat = entry.second;
+            if (all && options.offline.hand_off_on_exit && !options.offline.cache_path.empty() &&
+                seat.lease_seconds > 0 && seat.usable_until > now) {
+                cached.append(std::to_string(seat.lease_seconds)).push_back(' ');
+                cached.append(seat.token).push_back('\n');
+                continue;
+            }
+            pending_returns.fetch_add(1, std::memory_order_relaxed);
+            push_return(new ReturnNode{entry.first, seat.tool});
+        }
+        if (!cached.empty()) {
+            LeaseCacheFile file(options.offline.cache_path);
+            if (file.is_open()) {
+                file.append(cached);
+            }
+        }
+    }
+    
+private:
+    // Offline lease state. Every live seat that came with a usable token
+    // is in offline_seats; parked ones, returned by the application but
+    // still held from the server, are also indexed by seat_key().
+    struct OfflineSeat {
+        std::string tool;
+        std::string user;
+        std::string token;
+        int lease_seconds = 0;
+        std::chrono::steady_clock::time_point usable_until;
+        std::chrono::steady_clock::time_point parked_until;
+        bool parked = false;
+    };
+    
+    std::mutex offline_mutex;
+    std::unordered_map<std::string, OfflineSeat> offline_seats;
+    std::unordered_multimap<std::string, std::string> parked_seats;
+    std::atomic<std::size_t> parked_count{0};
+    std::chrono::steady_clock::time_point next_parked_scan;  // loop thread only
+    
+    static std::string seat_key(const std::string& tool, const std::string& user) {
+        std::string key;
+        key.reserve(tool.size() + 1 + user.size());
+        key.append(tool).push_back('\0');
+        key.append(user);
+        return key;
+    }
+    
+    // When a token stops being usable, on the steady clock. Its lifetime
+    // counts from the later of its issue time and now, so a local clock
+    // that runs behind the server's cannot stretch it.
+    std::chrono::steady_clock::time_point token_deadline(const LeaseToken& token) const {
+        long long now = static_cast<long long>(unix_nanos() / 1000000000ull);
+        long long remaining = token.expires_at - std::max(now, token.issued_at);
+        return std::chrono::steady_clock::now() + std::chrono::seconds(remaining) -
+               std::chrono::milliseconds(options.offline.expiry_margin_ms);
+    }
+    
+    // Take a seat of @p tool and @p user from the cache file, rewriting it
+    // without that seat and without seats that are no longer usable
+    bool take_cached(const std::string& tool, const std::string& user, std::string& id) {
+        LeaseCacheFile file(options.offline.cache_path);
+        std::string contents;
+        if (!file.is_open() || !file.read(contents)) return false;
+        
+        auto now = std::chrono::steady_clock::now();
+        std::string kept;
+        std::string token;
+        bool found = false;
+        OfflineSeat taken;
+        LeaseToken claims;
+        std::string_view rest = contents;
+        while (!rest.empty()) {
+            std::size_t end = std::min(rest.find('\n'), rest.size());
+            std::string_view line = rest.substr(0, end);
+            rest.remove_prefix(std::min(end + 1, rest.size()));
+            
+            int lease_seconds = 0;
+            auto parsed = std::from_chars(line.data(), line.data() + line.size(), lease_seconds);
+            if (parsed.ec != std::errc() || parsed.ptr == line.data() + line.size() || *parsed.ptr != ' ') {
+                continue;
+            }
+            token.assign(parsed.ptr + 1, line.data() + line.size());
+            if (!token_verifier->verify(token, claims)) continue;
+            auto usable_until = token_deadline(claims);
+            if (usable_until <= now) continue;
+            if (!found && claims.tool == tool && claims.user == user) {
+                found = true;
+                id = claims.id;
+                taken = OfflineSeat{tool, user, token, lease_seconds, usable_until, {}, false};
+                continue;
+            }
+            kept.append(line).push_back('\n');
+        }
+        if (kept.size() != contents.size()) {
+            file.replace(kept);
+        }
+        if (!found) return false;
+        int lease_seconds = taken.lease_seconds;
+        {
+            std::lock_guard<std::mutex> lock(offline_mutex);
+            offline_seats[id] = std::move(taken);
+        }
+        track_lease(id, tool, lease_seconds);
+        return true;
+    }
+    
+
+    // Lease renewal state. The wheel counts LEASE_TICK_MS ticks since
+    // lease_epoch; a lease whose renewal is in flight has no timer.
+    struct Lease {
+        std::string tool;
+        long lease_ms = 0;
+        detail::TimerWheel<std::string>::TimerId timer = detail::TimerWheel<std::string>::NO_TIMER;
+    };
+    
+    std::mutex lease_mutex;
+    std::unordered_map<std::string, Lease> leases;
+    detail::TimerWheel<std::string> lease_wheel;
+    std::atomic<std::size_t> lease_count{0};
+    std::atomic<std::uint64_t> lease_wake_tick{UINT64_MAX};
+    const std::chrono::steady_clock::time_point lease_epoch = std::chrono::steady_clock::now();
+    std::vector<std::string> due_leases;  // loop thread only
+    
+    std::uint64_t lease_tick() const {
+        auto elapsed = std::chrono::steady_clock::now() - lease_epoch;
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / LEASE_TICK_MS);
+    }
+    
+    static std::uint64_t renew_ticks(long lease_ms, int divisor) {
+        return static_cast<std::uint64_t>(std::max(1L, lease_ms / divisor / LEASE_TICK_MS));
     }
     
-    // Generate HMAC-SHA256 signature
-    std::string generate_signature(const std::string& tool, 
-                                   const std::string& user, 
-                                   const std::string& timestamp) {
-        std::string payload;
-        if (!api_key.empty()) {
-            payload = tool + "|" + user + "|" + timestamp + "|" + api_key;
-        } else {
-            payload = tool + "|" + user + "|" + timestamp;
+    // Runs on the loop thread: send due renewals in batched requests and
+    // return how long the loop may sleep before the next one is due
+    long renew_leases(AsyncEngine& loop) {
+        if (lease_count.load(std::memory_order_relaxed) == 0) {
+            lease_wake_tick.store(UINT64_MAX, std::memory_order_relaxed);
+            return IDLE_TICK_MS;
+        }
+        std::uint64_t ticks;
+        {
+            std::lock_guard<std::mutex> lock(lease_mutex);
+            lease_wheel.advance(lease_tick(), [&](std::string&& id) {
+                auto it = leases.find(id);
+                if (it == leases.end()) return;
+                it->second.timer = detail::TimerWheel<std::string>::NO_TIMER;
+                due_leases.push_back(std::move(id));
+            });
+            ticks = lease_wheel.ticks_until_next();
+            std::uint64_t now = lease_wheel.now();
+            lease_wake_tick.store(ticks > UINT64_MAX - now ? UINT64_MAX : now + ticks,
+                                  std::memory_order_relaxed);
         }
         
-        unsigned char* digest = HMAC(EVP_sha256(),
-                                     VENDOR_SECRET.c_str(), VENDOR_SECRET.length(),
-                                     (unsigned char*)payload.c_str(), payload.length(),
-                                     nullptr, nullptr);
-        
-        // Convert to hex string
-        std::stringstream ss;
-        for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-            ss << std::hex << std::setw(2) << std::setfill('0') << (int)digest[i];
+        std::shared_ptr<const ShardRing> ring = shard_ring(false);
+        std::vector<const std::string*> urls = sort_by_issuer(ring.get(), due_leases, [](const std::string& id) {
+            return std::string_view(id);
+        });
+        for (std::size_t start = 0, end; start < due_leases.size(); start = end) {
+            end = batch_end(urls, start);
+            auto batch = std::make_shared<std::vector<std::string>>(
+                std::make_move_iterator(due_leases.begin() + start),
+                std::make_move_iterator(due_leases.begin() + end));
+            TransferPtr t;
+            try {
+                t = make_post("/licenses/renew", [&](std::string& body) {
+                    write_batch_return_body(body, batch->begin(), batch->end(),
+                                            [](const std::string& id) -> const std::string& {
+                                                return id;
+                                            });
+                });
+                reroute(*t, *urls[start]);
+            } catch (...) {
+                finish_renewals(*batch, nullptr);
+                continue;
+            }
+            t->on_done = [this, batch](Transfer& t, CURLcode res) {
+                finish_renewals(*batch, res == CURLE_OK ? &t.response : nullptr);
+            };
+            loop.submit(std::move(t));
         }
-        return ss.str();
+        due_leases.clear();
+        
+        long wait = ticks > static_cast<std::uint64_t>(IDLE_TICK_MS / LEASE_TICK_MS)
+                        ? IDLE_TICK_MS : static_cast<long>(ticks) * LEASE_TICK_MS;
+        return wait;
     }
     
-    // Get current Unix timestamp as string
-    std::string get_timestamp() {
-        auto now = std::chrono::system_clock::now();
-        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(
-            now.time_since_epoch()
-        ).count();
-        return std::to_string(seconds);
+    // Reschedule renewed leases, retry sooner after a failure, and drop
+    // leases the server no longer knows (it reclaimed them)
+    void finish_renewals(const std::vector<std::string>& batch, const Response* response) {
+        std::vector<std::string> not_found;
+        int lease_seconds = 0;
+        bool delivered = response && response->http_code == 200;
+        if (delivered) {
+            try {
+                read_renew(*response, not_found, lease_seconds);
+            } catch (const LicenseException&) {
+                delivered = false;
+            }
+        }
+        std::unordered_set<std::string> lost(not_found.begin(), not_found.end());
+        std::vector<std::pair<std::string, std::string>> lost_leases;
+        {
+            std::lock_guard<std::mutex> lock(lease_mutex);
+            std::uint64_t now = lease_tick();
+            for (const std::string& id : batch) {
+                auto it = leases.find(id);
+                if (it == leases.end() || it->second.timer != detail::TimerWheel<std::string>::NO_TIMER) {
+                    continue;  // returned, or re-tracked, meanwhile
+                }
+                Lease& lease = it->second;
+                if (delivered && lost.count(id)) {
+                    lost_leases.emplace_back(id, std::move(lease.tool));
+                    leases.erase(it);
+                    continue;
+                }
+                std::uint64_t delay;
+                if (delivered) {
+                    if (lease_seconds > 0) lease.lease_ms = lease_seconds * 1000L;
+                    delay = renew_ticks(lease.lease_ms, LEASE_RENEW_DIVISOR);
+                } else {
+                    delay = renew_ticks(lease.lease_ms, LEASE_RETRY_DIVISOR);
+                    if (metrics) {
+                        metrics->count_retry(lease.tool);
+                    }
+                }
+                lease.timer = lease_wheel.schedule(now + delay, id);
+            }
+            lease_count.store(leases.size(), std::memory_order_relaxed);
+        }
+        for (const auto& lease : lost_leases) {
+            // A parked seat has no handle left to tell
+            bool parked = forget_offline(lease.first);
+            note_status_change(lease.second, -1);
+            if (metrics) {
+                metrics->count_lease_lost(lease.second);
+            }
+            if (options.on_lease_lost && !parked) {
+                try {
+                    options.on_lease_lost(lease.first, lease.second);
+                } catch (...) {
+                    // Callbacks must not take down the event loop
+                }
+            }
+        }
     }
     
-    Response http_post(const std::string& endpoint, const std::string& json_data,
-                       const std::string& tool = "", const std::string& user = "") {
-        Response response;
-        std::string url = base_url + endpoint;
+    static constexpr long IDLE_TICK_MS = 1000;
+    
+    // Status stream state; only touched on the loop thread
+    bool stream_open = false;
+    long stream_retry_ms = STREAM_RETRY_MIN_MS;
+    std::chrono::steady_clock::time_point stream_retry_at;
+    std::string stream_buffer;
+    std::vector<LicenseStatus> stream_statuses;
+    
+    void maintain_status_stream(AsyncEngine& loop) {
+        if (!status_cache || !options.status_stream || stream_open) return;
+        if (std::chrono::steady_clock::now() < stream_retry_at) return;
         
-        CURL* h = curl_easy_init();
-        if (!h) {
-            throw LicenseException("Failed to initialize CURL handle");
+        TransferPtr t;
+        try {
+            t = make_get("/realtime/stream?view=status");
+        } catch (...) {
+            schedule_stream_retry();
+            return;
         }
-        curl_easy_setopt(h, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(h, CURLOPT_POSTFIELDS, json_data.c_str());
-        curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(h, CURLOPT_WRITEDATA, &response.data);
-        
-        struct curl_slist* headers = nullptr;
-        headers = curl_slist_append(headers, "Content-Type: application/json");
-        
-        // Add security headers if enabled and tool/user provided
-        if (enable_security && !tool.empty() && !user.empty()) {
-            std::string timestamp = get_timestamp();
-            std::string signature = generate_signature(tool, user, timestamp);
-            
-            std::string sig_header = "X-Signature: " + signature;
-            std::string ts_header = "X-Timestamp: " + timestamp;
-            std::string vendor_header = "X-Vendor-ID: " + VENDOR_ID;
-            
-            headers = curl_slist_append(headers, sig_header.c_str());
-            headers = curl_slist_append(headers, ts_header.c_str());
-            headers = curl_slist_append(headers, vendor_header.c_str());
-            if (!api_key.empty()) {
-                std::string auth_header = "Authorization: Bearer " + api_key;
-                headers = curl_slist_append(headers, auth_header.c_str());
-            }
+        t->persistent = true;
+        curl_easy_setopt(t->easy, CURLOPT_WRITEFUNCTION, stream_write_callback);
+        curl_easy_setopt(t->easy, CURLOPT_WRITEDATA, this);
+        stream_buffer.clear();
+        stream_open = true;
+        t->on_done = [this](Transfer&, CURLcode) {
+            stream_open = false;
+            schedule_stream_retry();
+        };
+        loop.submit(std::move(t));
+    }
+    
+    void schedule_stream_retry() {
+        stream_retry_at = std::chrono::steady_clock::now() +
+                          std::chrono::milliseconds(stream_retry_ms);
+        stream_retry_ms = std::min(stream_retry_ms * 2, STREAM_RETRY_MAX_MS);
+    }
+    
+    static size_t stream_write_callback(void* contents, size_t size, size_t nmemb, void* userp) {
+        auto* self = static_cast<Impl*>(userp);
+        self->stream_buffer.append(static_cast<char*>(contents), size * nmemb);
+        std::size_t end;
+        while ((end = self->stream_buffer.find("\n\n")) != std::string::npos) {
+            self->on_stream_event(self->stream_buffer.substr(0, end));
+            self->stream_buffer.erase(0, end + 2);
         }
-        
-        curl_easy_setopt(h, CURLOPT_HTTPHEADER, headers);
-        
-        CURLcode res = curl_easy_perform(h);
-        curl_slist_free_all(headers);
-        
-        if (res != CURLE_OK) {
-            curl_easy_cleanup(h);
-            throw LicenseException(std::string("CURL error: ") + curl_easy_strerror(res));
+        if (self->stream_buffer.size() > STREAM_MAX_BUFFER) {
+            return 0;  // not an event stream; abort and retry later
         }
-        
-        curl_easy_getinfo(h, CURLINFO_RESPONSE_CODE, &response.http_code);
-        curl_easy_cleanup(h);
-        return response;
+        return size * nmemb;
     }
     
-    Response http_get(const std::string& endpoint) {
-        Response response;
-        std::string url = base_url + endpoint;
-        
-        CURL* h = curl_easy_init();
-        if (!h) {
-            throw LicenseException("Failed to initialize CURL handle");
+    // One SSE event: its data lines carry a JSON snapshot of all tools
+    void on_stream_event(const std::string& event) {
+        Response payload;
+        std::istringstream lines(event);
+        std::string line;
+        while (std::getline(lines, line)) {
+            if (line.compare(0, 5, "data:") != 0) continue;
+            std::size_t start = (line.size() > 5 && line[5] == ' ') ? 6 : 5;
+            if (!payload.data.empty()) payload.data += '\n';
+            payload.data.append(line, start, std::string::npos);
         }
-        curl_easy_setopt(h, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(h, CURLOPT_HTTPGET, 1L);
-        curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(h, CURLOPT_WRITEDATA, &response.data);
-        
-        CURLcode res = curl_easy_perform(h);
+        if (payload.data.empty()) return;
         
-        if (res != CURLE_OK) {
-            curl_easy_cleanup(h);
-            throw LicenseException(std::string("CURL error: ") + curl_easy_strerror(res));
+        try {
+            bool have_tools = false;
+            json::Reader reader(payload.data);
+            reader.object([&](std::string_view key) {
+                if (key == "tools") {
+                    read_statuses(reader, stream_statuses);
+                    have_tools = true;
+                } else {
+                    reader.skip();
+                }
+            });
+            reader.finish();
+            if (!have_tools) return;
+            status_cache->put_all(stream_statuses);
+            stream_retry_ms = STREAM_RETRY_MIN_MS;
+        } catch (const std::exception&) {
+            // Malformed event; keep the previous snapshot
         }
-        
-        curl_easy_getinfo(h, CURLINFO_RESPONSE_CODE, &response.http_code);
-        curl_easy_cleanup(h);
-        return response;
     }
+    
+    std::shared_mutex lifecycle_mutex;
+    bool stopped = false;
+    std::atomic<ReturnNode*> return_head{nullptr};
+    std::atomic<long> pending_returns{0};
+    std::mutex returns_mutex;
+    std::condition_variable returns_cv;
+    std::once_flag engine_once;
+    std::unique_ptr<AsyncEngine> engine;
 };
 
+bool phase_trace_supported() {
+    return LICENSE_CLIENT_PHASE_TRACE != 0;
+}
+
+void set_phase_trace(bool on) {
+    PhaseTrace::set(on);
+}
+
+std::string phase_trace_json() {
+    return PhaseTrace::chrome_json();
+}
+
+std::string default_startup_cache_path() {
+    const char* xdg = std::getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg == '/') {
+        return std::string(xdg) + "/license-client/startup";
+    }
+    const char* home = std::getenv("HOME");
+    if (home && *home) {
+        return std::string(home) + "/.cache/license-client/startup";
+    }
+    return std::string();
+}
+
 // LicenseHandle implementation
+LicenseHandle::LicenseHandle() : valid_(false) {}
+
 LicenseHandle::LicenseHandle(const std::string& id, const std::string& tool, 
                              const std::string& user)
     : id_(id), tool_(tool), user_(user), valid_(true) {}
@@ -179,7 +4239,8 @@ LicenseHandle::LicenseHandle(LicenseHandle&& other) noexcept
     : id_(std::move(other.id_))
     , tool_(std::move(other.tool_))
     , user_(std::move(other.user_))
-    , valid_(other.valid_) {
+    , valid_(other.valid_)
+    , client_(std::move(other.client_)) {
     other.valid_ = false;
 }
 
@@ -194,6 +4255,7 @@ LicenseHandle& LicenseHandle::operator=(LicenseHandle&& other) noexcept {
         tool_ = std::move(other.tool_);
         user_ = std::move(other.user_);
         valid_ = other.valid_;
+        client_ = std::move(other.client_);
         other.valid_ = false;
     }
     return *this;
@@ -202,134 +4264,849 @@ LicenseHandle& LicenseHandle::operator=(LicenseHandle&& other) noexcept {
 void LicenseHandle::return_license() {
     if (!valid_) return;
     
-    // Note: This would need a reference to the client to actually return
-    // For now, mark as invalid
     valid_ = false;
+    if (auto client = client_.lock()) {
+        client->enqueue_return(id_, tool_);
+    }
+}
+
+// Trace context
+std::string TraceContext::to_traceparent() const {
+    std::string out(TRACEPARENT_LENGTH, '0');
+    write_traceparent(&out[0], *this);
+    return out;
+}
+
+TraceContext TraceContext::from_traceparent(std::string_view value) {
+    // Later versions may append fields, after another '-'
+    if (value.size() < TRACEPARENT_LENGTH || value[2] != '-' || value[35] != '-' ||
+        value[52] != '-') {
+        return TraceContext();
+    }
+    std::uint64_t version = 0;
+    std::uint64_t flags = 0;
+    TraceContext context;
+    if (!parse_hex(value.substr(0, 2), version) || version == 0xff ||
+        (version == 0 && value.size() != TRACEPARENT_LENGTH) ||
+        (value.size() > TRACEPARENT_LENGTH && value[TRACEPARENT_LENGTH] != '-') ||
+        !parse_hex(value.substr(3, 16), context.trace_id_high) ||
+        !parse_hex(value.substr(19, 16), context.trace_id_low) ||
+        !parse_hex(value.substr(36, 16), context.span_id) ||
+        !parse_hex(value.substr(53, 2), flags) ||
+        !context.is_valid()) {
+        return TraceContext();
+    }
+    context.sampled = (flags & 1) != 0;
+    return context;
+}
+
+TraceScope::TraceScope(const TraceContext& parent)
+    : context_(parent), previous_(trace_parent) {
+    trace_parent = &context_;
+}
+
+TraceScope::TraceScope(std::string_view traceparent)
+    : TraceScope(TraceContext::from_traceparent(traceparent)) {}
+
+TraceScope::~TraceScope() {
+    trace_parent = previous_;
+}
+
+const TraceContext* TraceScope::current() {
+    const TraceContext* context = trace_parent;
+    return context && context->is_valid() ? context : nullptr;
 }
 
 // LicenseClient implementation
 LicenseClient::LicenseClient(const std::string& base_url)
-    : pimpl_(std::make_unique<Impl>(base_url)) {}
+    : pimpl_(std::make_shared<Impl>(base_url)) {}
 
-LicenseClient::~LicenseClient() = default;
+LicenseClient::LicenseClient(const std::string& base_url, bool enable_security)
+    : pimpl_(std::make_shared<Impl>(base_url, [enable_security] {
+          ClientOptions options;
+          options.enable_security = enable_security;
+          return options;
+      }())) {}
+
+LicenseClient::LicenseClient(const std::string& base_url, const ClientOptions& options)
+    : pimpl_(std::make_shared<Impl>(base_url, options)) {}
+
+LicenseClient::~LicenseClient() {
+    pimpl_->shutdown();
+}
 
 LicenseHandle LicenseClient::borrow(const std::string& tool, const std::string& user) {
-    Json::Value request;
-    request["tool"] = tool;
-    request["user"] = user;
+    if (pimpl_->agent) {
+        LicenseHandle handle(pimpl_->agent_borrow(tool, user), tool, user);
+        handle.client_ = pimpl_;
+        return handle;
+    }
     
-    Json::StreamWriterBuilder writer;
-    std::string json_data = Json::writeString(writer, request);
+    std::string id;
+    if (pimpl_->borrow_parked(tool, user, id)) {
+        LicenseHandle handle(std::move(id), tool, user);
+        handle.client_ = pimpl_;
+        return handle;
+    }
     
+    pimpl_->admit(tool, 1, true);
+    return borrow_admitted(tool, user);
+}
+
+LicenseHandle LicenseClient::borrow_admitted(const std::string& tool, const std::string& user) {
     // Pass tool and user for HMAC signature generation
-    auto response = pimpl_->http_post("/licenses/borrow", json_data, tool, user);
+    Impl::ClientSpan span(*pimpl_, "license.borrow", tool);
+    int attempts = 0;
+    auto t = pimpl_->perform_call(Impl::Call::Borrow, tool, [&] {
+        return span.inject(pimpl_->make_post("/licenses/borrow", [&](std::string& body) {
+            write_borrow_body(body, tool, user);
+        }, tool, user));
+    }, attempts);
+    span.set_http_status(t->response.http_code);
+    int lease_seconds = 0;
+    std::string lease_token;
+    LicenseHandle handle = handle_from_borrow_response(t->response, tool, user, lease_seconds,
+                                                       pimpl_->token_verifier ? &lease_token : nullptr);
+    handle.client_ = pimpl_;
+    pimpl_->adopt_borrow(handle, lease_seconds, lease_token);
+    return handle;
+}
+
+LicenseHandle LicenseClient::borrow_wait(const std::string& tool, const std::string& user,
+                                         long timeout_ms) {
+    using Clock = std::chrono::steady_clock;
+    auto deadline = Clock::now() + std::chrono::milliseconds(std::max(0L, timeout_ms));
+    auto left_ms = [&] {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+        return std::max<long>(0, static_cast<long>(left.count()));
+    };
     
-    if (response.http_code == 409) {
-        throw NoLicensesAvailableException(tool);
+    // Waiting out a tool the cached status shows as exhausted or over
+    // commit is the point, so only the rate limit applies
+    bool admitted = false;
+    if (!pimpl_->agent && !pimpl_->borrow_wait_unsupported.load(std::memory_order_relaxed)) {
+        std::string id;
+        if (pimpl_->borrow_parked(tool, user, id)) {
+            LicenseHandle handle(std::move(id), tool, user);
+            handle.client_ = pimpl_;
+            return handle;
+        }
+        
+        pimpl_->admit_rate(tool, 1, true);
+        admitted = true;
+        Impl::ClientSpan span(*pimpl_, "license.borrow_wait", tool);
+        for (;;) {
+            long wait_ms = left_ms();
+            auto sent = Clock::now();
+            int attempts = 0;
+            auto t = pimpl_->perform_call(Impl::Call::Borrow, tool, [&] {
+                return span.inject(pimpl_->make_post("/licenses/borrow/wait", [&](std::string& body) {
+                    write_borrow_wait_body(body, tool, user, wait_ms);
+                }, tool, user));
+            }, attempts, wait_ms);
+            long code = t->response.http_code;
+            if (code == 404 || code == 405) {
+                // Server predates the wait queue
+                pimpl_->borrow_wait_unsupported.store(true, std::memory_order_relaxed);
+                break;
+            }
+            // The server caps each wait; ask again while time is left. A
+            // quick refusal (e.g. an unknown tool) is final.
+            auto held = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - sent);
+            if (code == 409 && left_ms() > 0 && held.count() >= std::min(wait_ms, 1000L)) {
+                continue;
+            }
+            span.set_http_status(code);
+            int lease_seconds = 0;
+            std::string lease_token;
+            LicenseHandle handle = handle_from_borrow_response(t->response, tool, user, lease_seconds,
+                                                               pimpl_->token_verifier ? &lease_token : nullptr);
+            handle.client_ = pimpl_;
+            pimpl_->adopt_borrow(handle, lease_seconds, lease_token);
+            return handle;
+        }
     }
     
-    if (response.http_code != 200) {
-        throw LicenseException("HTTP error: " + std::to_string(response.http_code));
+    // No server-side queue (the agent, or an older server): poll with
+    // backoff. A fallback from the queue polls first on its token.
+    for (int retry = 1;; ++retry) {
+        try {
+            if (pimpl_->agent) {
+                return borrow(tool, user);
+            }
+            if (!admitted) {
+                std::string id;
+                if (pimpl_->borrow_parked(tool, user, id)) {
+                    LicenseHandle handle(std::move(id), tool, user);
+                    handle.client_ = pimpl_;
+                    return handle;
+                }
+                pimpl_->admit_rate(tool, 1, true);
+            }
+            admitted = false;
+            return borrow_admitted(tool, user);
+        } catch (const NoLicensesAvailableException&) {
+            long left = left_ms();
+            if (left <= 0) {
+                throw;
+            }
+            auto wait = std::max(pimpl_->backoff(retry), std::chrono::milliseconds(10));
+            std::this_thread::sleep_for(std::min(wait, std::chrono::milliseconds(left)));
+        }
+    }
+}
+
+void LicenseClient::return_license(LicenseHandle& handle) {
+    if (!handle.is_valid()) {
+        throw LicenseException("Invalid license handle");
     }
     
-    Json::Value json_response;
-    Json::CharReaderBuilder reader;
-    std::istringstream iss(response.data);
-    std::string errs;
+    if (pimpl_->agent) {
+        if (!pimpl_->agent_return(handle.id())) {
+            throw LicenseException("HTTP error: 404");
+        }
+        handle.valid_ = false;
+        return;
+    }
     
-    if (!Json::parseFromStream(reader, iss, &json_response, &errs)) {
-        throw LicenseException("Failed to parse response: " + errs);
+    if (pimpl_->token_verifier && pimpl_->park(handle.id())) {
+        handle.valid_ = false;
+        return;
     }
     
-    std::string id = json_response["id"].asString();
-    return LicenseHandle(id, tool, user);
+    Impl::ClientSpan span(*pimpl_, "license.return", handle.tool());
+    int attempts = 0;
+    auto t = pimpl_->perform_call(Impl::Call::Return, handle.tool(), [&] {
+        return span.inject(pimpl_->route_borrow(pimpl_->make_post("/licenses/return", [&](std::string& body) {
+            write_return_body(body, handle.id());
+        }), handle.id()));
+    }, attempts);
+    span.set_http_status(t->response.http_code);
+    // After a lost response, the retry finds the seat already returned
+    if (attempts == 1 || t->response.http_code != 404) {
+        check_return_response(t->response);
+    }
+    handle.valid_ = false;
+    pimpl_->forget_lease(handle.id());
+    pimpl_->note_status_change(handle.tool(), -1);
 }
 
-void LicenseClient::return_license(const LicenseHandle& handle) {
-    if (!handle.is_valid()) {
-        throw LicenseException("Invalid license handle");
+void LicenseClient::flush_returns() {
+    pimpl_->flush_returns();
+}
+
+LicenseStatus LicenseClient::get_status(const std::string& tool) {
+    if (pimpl_->agent) {
+        return pimpl_->agent_status(tool);
     }
     
-    Json::Value request;
-    request["id"] = handle.id();
+    LicenseStatus status;
+    if (pimpl_->status_cache) {
+        pimpl_->ensure_status_stream();
+        if (pimpl_->status_cache->get(tool, status)) {
+            return status;
+        }
+    }
     
-    Json::StreamWriterBuilder writer;
-    std::string json_data = Json::writeString(writer, request);
+    Impl::ClientSpan span(*pimpl_, "license.status", tool);
+    int attempts = 0;
+    auto t = pimpl_->perform_call(Impl::Call::Status, tool, [&] {
+        return span.inject(pimpl_->make_status_get(tool));
+    }, attempts);
+    span.set_http_status(t->response.http_code);
+    status = status_from_response(t->response);
+    if (pimpl_->status_cache) {
+        pimpl_->status_cache->put(status);
+    }
+    return status;
+}
+
+std::vector<LicenseStatus> LicenseClient::get_all_statuses() {
+    if (pimpl_->agent) {
+        return pimpl_->agent_statuses();
+    }
     
-    auto response = pimpl_->http_post("/licenses/return", json_data);
+    std::vector<LicenseStatus> statuses;
+    if (pimpl_->status_cache) {
+        pimpl_->ensure_status_stream();
+        if (pimpl_->status_cache->get_all(statuses)) {
+            return statuses;
+        }
+    }
     
-    if (response.http_code != 200) {
-        throw LicenseException("HTTP error: " + std::to_string(response.http_code));
+    // A sharded cluster's nodes each list the tools they own
+    statuses.clear();
+    std::shared_ptr<const ShardRing> ring = pimpl_->shard_ring();
+    const std::vector<std::string> unsharded = {pimpl_->base_url};
+    Impl::ClientSpan span(*pimpl_, "license.status_all", std::string());
+    for (const std::string& url : ring ? ring->urls : unsharded) {
+        pimpl_->node_statuses(url, span, statuses);
+    }
+    if (ring) {
+        std::sort(statuses.begin(), statuses.end(), [](const LicenseStatus& a, const LicenseStatus& b) {
+            return a.tool < b.tool;
+        });
+    }
+    if (pimpl_->status_cache) {
+        pimpl_->status_cache->put_all(statuses);
     }
+    return statuses;
 }
 
-LicenseStatus LicenseClient::get_status(const std::string& tool) {
-    // URL-encode tool using a temporary curl handle
-    CURL* h = curl_easy_init();
-    char* escaped = h ? curl_easy_escape(h, tool.c_str(), static_cast<int>(tool.size())) : nullptr;
-    std::string encoded_tool = escaped ? std::string(escaped) : tool;
-    if (escaped) curl_free(escaped);
-    if (h) curl_easy_cleanup(h);
-    auto response = pimpl_->http_get("/licenses/" + encoded_tool + "/status");
+void LicenseClient::get_all_statuses(StatusTable& table) {
+    if (pimpl_->agent) {
+        table.assign(pimpl_->agent_statuses());
+        return;
+    }
     
-    if (response.http_code != 200) {
-        throw LicenseException("HTTP error: " + std::to_string(response.http_code));
+    if (pimpl_->status_cache) {
+        pimpl_->ensure_status_stream();
+        if (pimpl_->status_cache->get_all(table)) {
+            return;
+        }
+        // A fetch refills the cache, which keeps its own list
+        table.assign(get_all_statuses());
+        return;
     }
     
-    Json::Value json_response;
-    Json::CharReaderBuilder reader;
-    std::istringstream iss(response.data);
-    std::string errs;
+    // Decoded straight into the table; IDs do not depend on node order
+    table.clear();
+    std::shared_ptr<const ShardRing> ring = pimpl_->shard_ring();
+    const std::vector<std::string> unsharded = {pimpl_->base_url};
+    Impl::ClientSpan span(*pimpl_, "license.status_all", std::string());
+    for (const std::string& url : ring ? ring->urls : unsharded) {
+        pimpl_->node_statuses(url, span, table);
+    }
+}
+
+void LicenseClient::invalidate_status_cache() {
+    if (pimpl_->status_cache) {
+        pimpl_->status_cache->clear();
+    }
+}
+
+ClientMetrics LicenseClient::metrics() const {
+    return pimpl_->metrics ? pimpl_->metrics->snapshot() : ClientMetrics();
+}
+
+const std::vector<double>& ClientMetrics::bucket_bounds() {
+    static const std::vector<double> bounds = {
+        0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005,
+        0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+        0.1, 0.25, 0.5, 1, 2.5, 5, 10,
+    };
+    return bounds;
+}
+
+// Prometheus label values escape backslash, quote and newline
+static void append_label(std::string& out, const char* name, const std::string& value) {
+    out.append(name).append("=\"");
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (c == '\n') {
+            out.append("\\n");
+        } else {
+            out.push_back(c);
+        }
+    }
+    out.push_back('"');
+}
+
+static void append_number(std::string& out, double value) {
+    char buf[32];
+    int n = std::snprintf(buf, sizeof(buf), "%.9g", value);
+    out.append(buf, static_cast<std::size_t>(n));
+}
+
+static void append_number(std::string& out, std::uint64_t value) {
+    char buf[24];
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, result.ptr);
+}
+
+static void append_family(std::string& out, const char* name, const char* type, const char* help) {
+    out.append("# HELP ").append(name).push_back(' ');
+    out.append(help).push_back('\n');
+    out.append("# TYPE ").append(name).push_back(' ');
+    out.append(type).push_back('\n');
+}
+
+// One histogram series; @p labels is the rendered label list without braces
+static void append_histogram(std::string& out, const char* name, const std::string& labels,
+                             const LatencyMetrics& latency) {
+    const auto& bounds = ClientMetrics::bucket_bounds();
+    for (std::size_t i = 0; i < bounds.size() && i < latency.buckets.size(); ++i) {
+        out.append(name).append("_bucket{").append(labels).append(",le=\"");
+        append_number(out, bounds[i]);
+        out.append("\"} ");
+        append_number(out, latency.buckets[i]);
+        out.push_back('\n');
+    }
+    out.append(name).append("_bucket{").append(labels).append(",le=\"+Inf\"} ");
+    append_number(out, latency.count);
+    out.push_back('\n');
+    out.append(name).append("_sum{").append(labels).append("} ");
+    append_number(out, latency.sum);
+    out.push_back('\n');
+    out.append(name).append("_count{").append(labels).append("} ");
+    append_number(out, latency.count);
+    out.push_back('\n');
+}
+
+static void append_counter(std::string& out, const char* name, const std::string& labels,
+                           std::uint64_t value) {
+    out.append(name).push_back('{');
+    out.append(labels).append("} ");
+    append_number(out, value);
+    out.push_back('\n');
+}
+
+std::string ClientMetrics::to_prometheus() const {
+    std::string out;
+    std::vector<std::string> labels;
+    for (const auto& op : operations) {
+        std::string label;
+        append_label(label, "operation", op.operation);
+        labels.push_back(std::move(label));
+    }
     
-    if (!Json::parseFromStream(reader, iss, &json_response, &errs)) {
-        throw LicenseException("Failed to parse response: " + errs);
+    append_family(out, "license_client_request_duration_seconds", "histogram",
+                  "Request latency seen by the client, from start to decoded response");
+    for (std::size_t i = 0; i < operations.size(); ++i) {
+        append_histogram(out, "license_client_request_duration_seconds", labels[i], operations[i].total);
     }
     
-    LicenseStatus status;
-    status.tool = json_response["tool"].asString();
-    status.total = json_response["total"].asInt();
-    status.borrowed = json_response["borrowed"].asInt();
-    status.available = json_response["available"].asInt();
-    status.commit = json_response.get("commit", 0).asInt();
-    status.max_overage = json_response.get("max_overage", 0).asInt();
-    status.overage = json_response.get("overage", 0).asInt();
-    status.in_commit = json_response.get("in_commit", true).asBool();
+    append_family(out, "license_client_request_phase_seconds", "histogram",
+                  "Time per request phase: dns, connect and tls for new connections, ttfb, transfer, parse");
+    for (std::size_t i = 0; i < operations.size(); ++i) {
+        const OperationMetrics& op = operations[i];
+        const std::pair<const char*, const LatencyMetrics*> phases[] = {
+            {"dns", &op.dns}, {"connect", &op.connect}, {"tls", &op.tls},
+            {"ttfb", &op.ttfb}, {"transfer", &op.transfer}, {"parse", &op.parse},
+        };
+        for (const auto& phase : phases) {
+            if (phase.second->count == 0) continue;
+            std::string label = labels[i];
+            label.push_back(',');
+            append_label(label, "phase", phase.first);
+            append_histogram(out, "license_client_request_phase_seconds", label, *phase.second);
+        }
+    }
     
-    return status;
+    const std::pair<const char*, std::uint64_t OperationMetrics::*> counters[] = {
+        {"license_client_requests_total", &OperationMetrics::requests},
+        {"license_client_transport_errors_total", &OperationMetrics::transport_errors},
+        {"license_client_http_errors_total", &OperationMetrics::http_errors},
+        {"license_client_connections_total", &OperationMetrics::connections},
+    };
+    const char* const counter_help[] = {
+        "Requests sent",
+        "Requests that got no HTTP response",
+        "Responses with status 400 or above",
+        "Connections opened",
+    };
+    for (std::size_t c = 0; c < std::size(counters); ++c) {
+        append_family(out, counters[c].first, "counter", counter_help[c]);
+        for (std::size_t i = 0; i < operations.size(); ++i) {
+            append_counter(out, counters[c].first, labels[i], operations[i].*counters[c].second);
+        }
+    }
+    
+    append_family(out, "license_client_borrows_total", "counter",
+                  "Borrow requests by tool and result (ok, no_license, error)");
+    for (const auto& tool : tools) {
+        std::string label;
+        append_label(label, "tool", tool.tool);
+        const std::pair<const char*, std::uint64_t> results[] = {
+            {"ok", tool.borrows}, {"no_license", tool.no_license}, {"error", tool.borrow_errors},
+        };
+        for (const auto& result : results) {
+            std::string with_result = label;
+            with_result.push_back(',');
+            append_label(with_result, "result", result.first);
+            append_counter(out, "license_client_borrows_total", with_result, result.second);
+        }
+    }
+    append_family(out, "license_client_retries_total", "counter",
+                  "Deferred returns and lease renewals sent again, by tool");
+    for (const auto& tool : tools) {
+        std::string label;
+        append_label(label, "tool", tool.tool);
+        append_counter(out, "license_client_retries_total", label, tool.retries);
+    }
+    append_family(out, "license_client_leases_lost_total", "counter",
+                  "Leases the server reclaimed before they were renewed, by tool");
+    for (const auto& tool : tools) {
+        std::string label;
+        append_label(label, "tool", tool.tool);
+        append_counter(out, "license_client_leases_lost_total", label, tool.leases_lost);
+    }
+    append_family(out, "license_client_local_borrows_total", "counter",
+                  "Borrows granted from parked seats without a request, by tool");
+    for (const auto& tool : tools) {
+        std::string label;
+        append_label(label, "tool", tool.tool);
+        append_counter(out, "license_client_local_borrows_total", label, tool.local_borrows);
+    }
+    append_family(out, "license_client_local_refusals_total", "counter",
+                  "Borrows refused by the admission policy without a request, by tool");
+    for (const auto& tool : tools) {
+        std::string label;
+        append_label(label, "tool", tool.tool);
+        append_counter(out, "license_client_local_refusals_total", label, tool.local_refusals);
+    }
+    return out;
 }
 
-std::vector<LicenseStatus> LicenseClient::get_all_statuses() {
-    auto response = pimpl_->http_get("/licenses/status");
+std::vector<LicenseHandle> LicenseClient::borrow_many(const std::string& tool,
+                                                     const std::string& user, int count) {
+    std::vector<LicenseHandle> handles;
+    if (count <= 0) {
+        return handles;
+    }
+    handles.reserve(static_cast<std::size_t>(count));
     
-    if (response.http_code != 200) {
-        throw LicenseException("HTTP error: " + std::to_string(response.http_code));
+    if (pimpl_->agent) {
+        // Local round trips; stop at the first refusal like a short batch
+        for (; count > 0; --count) {
+            try {
+                handles.push_back(borrow(tool, user));
+            } catch (const NoLicensesAvailableException&) {
+                break;
+            }
+        }
+        return handles;
     }
     
-    Json::Value json_response;
-    Json::CharReaderBuilder reader;
-    std::istringstream iss(response.data);
-    std::string errs;
+    // Capped like a short batch, as if the server had granted fewer
+    count = pimpl_->admit(tool, count, true);
+    
+    while (count > 0) {
+        int chunk = std::min(count, MAX_BATCH_SIZE);
+        // Not repeated once it may have been granted, like borrow()
+        Impl::ClientSpan span(*pimpl_, "license.borrow_batch", tool);
+        int attempts = 0;
+        auto t = pimpl_->perform_call(Impl::Call::Borrow, tool, [&] {
+            return span.inject(pimpl_->make_post("/licenses/borrow/batch", [&](std::string& body) {
+                write_batch_borrow_body(body, tool, user, chunk);
+            }, tool, user));
+        }, attempts);
+        span.set_http_status(t->response.http_code);
+        const Response& response = t->response;
+        if (response.http_code != 200) {
+            throw LicenseException("HTTP error: " + std::to_string(response.http_code));
+        }
+        
+        std::size_t first = handles.size();
+        int granted = 0;
+        int lease_seconds = 0;
+        decode(response, [&](auto& reader) {
+            reader.object([&](std::string_view key) {
+                if (key == "borrows") {
+                    reader.array([&] {
+                        std::string id;
+                        reader.object([&](std::string_view field) {
+                            if (field == "id") {
+                                reader.string(id);
+                            } else {
+                                reader.skip();
+                            }
+                        });
+                        // Unwinding returns the seats decoded so far
+                        if (id.empty()) {
+                            throw LicenseException("Malformed batch borrow response: borrow without an id");
+                        }
+                        handles.emplace_back(std::move(id), tool, user);
+                        handles.back().client_ = pimpl_;
+                    });
+                } else if (key == "granted") {
+                    granted = reader.integer();
+                } else if (key == "lease_seconds") {
+                    lease_seconds = reader.integer();
+                } else {
+                    reader.skip();
+                }
+            });
+        });
+        pimpl_->note_status_change(tool, static_cast<int>(handles.size() - first));
+        for (std::size_t i = first; i < handles.size(); ++i) {
+            pimpl_->track_lease(handles[i].id(), tool, lease_seconds);
+        }
+        
+        // A short batch means a limit was hit; later chunks would fail too
+        if (granted < chunk) {
+            break;
+        }
+        count -= chunk;
+    }
+    return handles;
+}
+
+BatchReturnResult LicenseClient::return_many(std::vector<LicenseHandle>& handles) {
+    BatchReturnResult result;
+    if (pimpl_->agent) {
+        // A failure leaves the remaining handles valid for a retry
+        for (auto& handle : handles) {
+            if (!handle.is_valid()) continue;
+            if (pimpl_->agent_return(handle.id())) {
+                ++result.returned;
+            } else {
+                result.not_found.push_back(handle.id());
+            }
+            handle.valid_ = false;
+        }
+        return result;
+    }
     
-    if (!Json::parseFromStream(reader, iss, &json_response, &errs)) {
-        throw LicenseException("Failed to parse response: " + errs);
+    std::vector<LicenseHandle*> valid;
+    for (auto& handle : handles) {
+        if (handle.is_valid()) valid.push_back(&handle);
     }
+    // One request per node and batch when sharded
+    std::shared_ptr<const ShardRing> ring = pimpl_->shard_ring();
+    std::vector<const std::string*> urls = pimpl_->sort_by_issuer(ring.get(), valid, [](const LicenseHandle* h) {
+        return std::string_view(h->id());
+    });
     
-    std::vector<LicenseStatus> statuses;
-    for (const auto& item : json_response) {
+    std::vector<LicenseHandle*> pending;
+    std::vector<std::string> chunk_not_found;
+    pending.reserve(std::min<std::size_t>(valid.size(), MAX_BATCH_SIZE));
+    
+    // Handles stay valid if a request fails, so the caller can retry
+    auto flush = [&](const std::string& url) {
+        if (pending.empty()) return;
+        // A batch may mix tools, so the span and retries are not per tool
+        Impl::ClientSpan span(*pimpl_, "license.return_batch", std::string());
+        int attempts = 0;
+        auto t = pimpl_->perform_call(Impl::Call::Return, std::string(), [&] {
+            auto request = pimpl_->make_post("/licenses/return/batch", [&](std::string& body) {
+                write_batch_return_body(body, pending.begin(), pending.end(),
+                                        [](const LicenseHandle* h) -> const std::string& {
+                                            return h->id();
+                                        });
+            });
+            pimpl_->reroute(*request, url);
+            return span.inject(std::move(request));
+        }, attempts);
+        span.set_http_status(t->response.http_code);
+        const Response& response = t->response;
+        if (response.http_code != 200) {
+            throw LicenseException("HTTP error: " + std::to_string(response.http_code));
+        }
+        std::size_t returned = 0;
+        read_batch_return(response, returned, chunk_not_found);
+        if (attempts > 1) {
+            // After a lost response, the retry finds those seats already
+            // returned, as in return_license()
+            returned += chunk_not_found.size();
+            chunk_not_found.clear();
+        }
+        result.returned += returned;
+        std::unordered_set<std::string> not_found(chunk_not_found.begin(), chunk_not_found.end());
+        result.not_found.insert(result.not_found.end(), chunk_not_found.begin(), chunk_not_found.end());
+        for (LicenseHandle* handle : pending) {
+            handle->valid_ = false;
+            pimpl_->forget_lease(handle->id());
+            pimpl_->forget_offline(handle->id());
+            if (!not_found.count(handle->id())) {
+                pimpl_->note_status_change(handle->tool(), -1);
+            }
+        }
+        pending.clear();
+    };
+    
+    for (std::size_t start = 0, end; start < valid.size(); start = end) {
+        end = Impl::batch_end(urls, start);
+        pending.assign(valid.begin() + start, valid.begin() + end);
+        flush(*urls[start]);
+    }
+    return result;
+}
+
+void LicenseClient::borrow_async(const std::string& tool, const std::string& user,
+                                 BorrowCallback callback) {
+    if (pimpl_->agent) {
+        // The agent answers in microseconds; complete inline
+        LicenseHandle handle;
+        std::exception_ptr error;
+        try {
+            handle = borrow(tool, user);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        callback(std::move(handle), error);
+        return;
+    }
+    
+    if (pimpl_->token_verifier) {
+        std::string id;
+        if (pimpl_->take_parked(tool, user, id)) {
+            if (pimpl_->metrics) {
+                pimpl_->metrics->count_local_borrow(tool);
+            }
+            LicenseHandle handle(std::move(id), tool, user);
+            handle.client_ = pimpl_;
+            callback(std::move(handle), nullptr);
+            return;
+        }
+    }
+    
+    try {
+        pimpl_->admit(tool, 1, false);
+    } catch (const AdmissionRefusedException&) {
+        callback(LicenseHandle(), std::current_exception());
+        return;
+    }
+    
+    auto t = pimpl_->make_post("/licenses/borrow", [&](std::string& body) {
+        write_borrow_body(body, tool, user);
+    }, tool, user);
+    std::weak_ptr<Impl> owner = pimpl_;
+    t->on_done = [tool, user, owner, callback = std::move(callback)](Impl::Transfer& t, CURLcode res) {
+        LicenseHandle handle;
+        std::exception_ptr error;
+        try {
+            check_transfer(res);
+            int lease_seconds = 0;
+            std::string lease_token;
+            handle = handle_from_borrow_response(t.response, tool, user, lease_seconds,
+                                                 t.owner.token_verifier ? &lease_token : nullptr);
+            handle.client_ = owner;
+            t.owner.note_status_change(tool, 1);
+            t.owner.track_lease(handle.id(), tool, lease_seconds);
+            if (t.owner.token_verifier) {
+                t.owner.keep_offline(handle.id(), tool, user, lease_token, lease_seconds);
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+        callback(std::move(handle), error);
+    };
+    pimpl_->async_engine().submit(std::move(t));
+}
+
+std::future<LicenseHandle> LicenseClient::borrow_async(const std::string& tool,
+                                                       const std::string& user) {
+    auto promise = std::make_shared<std::promise<LicenseHandle>>();
+    auto future = promise->get_future();
+    borrow_async(tool, user, [promise](LicenseHandle handle, std::exception_ptr error) {
+        if (error) {
+            promise->set_exception(error);
+        } else {
+            promise->set_value(std::move(handle));
+        }
+    });
+    return future;
+}
+
+void LicenseClient::return_async(LicenseHandle& handle, ReturnCallback callback) {
+    if (!handle.is_valid()) {
+        throw LicenseException("Invalid license handle");
+    }
+    
+    if (pimpl_->agent) {
+        std::exception_ptr error;
+        try {
+            if (!pimpl_->agent_return(handle.id())) {
+                throw LicenseException("HTTP error: 404");
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+        handle.valid_ = false;
+        callback(error);
+        return;
+    }
+    
+    if (pimpl_->token_verifier && pimpl_->park(handle.id())) {
+        handle.valid_ = false;
+        callback(nullptr);
+        return;
+    }
+    
+    auto t = pimpl_->route_borrow(pimpl_->make_post("/licenses/return", [&](std::string& body) {
+        write_return_body(body, handle.id());
+    }), handle.id());
+    // The return is in flight; the handle must not queue a second one
+    handle.valid_ = false;
+    pimpl_->forget_lease(handle.id());
+    Impl::AsyncEngine& loop = pimpl_->async_engine();
+    t->on_done = [&loop, id = handle.id(), tool = handle.tool(),
+                  callback = std::move(callback)](Impl::Transfer& t, CURLcode res) {
+        std::exception_ptr error;
+        try {
+            check_transfer(res);
+            check_return_response(t.response);
+            t.owner.note_status_change(tool, -1);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        // As in drain_returns: 4xx means the server handled the ID
+        if (res != CURLE_OK || t.response.http_code >= 500 || t.response.http_code == 421) {
+            t.owner.retry_return(loop, id, tool);
+        }
+        callback(error);
+    };
+    loop.submit(std::move(t));
+}
+
+std::future<void> LicenseClient::return_async(LicenseHandle& handle) {
+    auto promise = std::make_shared<std::promise<void>>();
+    auto future = promise->get_future();
+    return_async(handle, [promise](std::exception_ptr error) {
+        if (error) {
+            promise->set_exception(error);
+        } else {
+            promise->set_value();
+        }
+    });
+    return future;
+}
+
+void LicenseClient::get_status_async(const std::string& tool, StatusCallback callback) {
+    if (pimpl_->agent) {
         LicenseStatus status;
-        status.tool = item["tool"].asString();
-        status.total = item["total"].asInt();
-        status.borrowed = item["borrowed"].asInt();
-        status.available = item["available"].asInt();
-        status.commit = item.get("commit", 0).asInt();
-        status.max_overage = item.get("max_overage", 0).asInt();
-        status.overage = item.get("overage", 0).asInt();
-        status.in_commit = item.get("in_commit", true).asBool();
-        statuses.push_back(status);
+        std::exception_ptr error;
+        try {
+            status = pimpl_->agent_status(tool);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        callback(std::move(status), error);
+        return;
     }
     
-    return statuses;
+    auto t = pimpl_->make_status_get(tool);
+    t->on_done = [callback = std::move(callback)](Impl::Transfer& t, CURLcode res) {
+        LicenseStatus status;
+        std::exception_ptr error;
+        try {
+            check_transfer(res);
+            status = status_from_response(t.response);
+            if (t.owner.status_cache) {
+                t.owner.status_cache->put(status);
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+        callback(std::move(status), error);
+    };
+    pimpl_->async_engine().submit(std::move(t));
 }
 
-} // namespace license
+std::future<LicenseStatus> LicenseClient::get_status_async(const std::string& tool) {
+    auto promise = std::make_shared<std::promise<LicenseStatus>>();
+    auto future = promise->get_future();
+    get_status_async(tool, [promise](LicenseStatus status, std::exception_ptr error) {
+        if (error) {
+            promise->set_exception(error);
+        } else {
+            promise->set_value(std::move(status));
+        }
+    });
+    return future;
+}
 
+} // namespace license
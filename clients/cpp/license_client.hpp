@@ -9,7 +9,13 @@
 #ifndef LICENSE_CLIENT_HPP
 #define LICENSE_CLIENT_HPP
 
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
 #include <string>
+#include <string_view>
 #include <memory>
 #include <optional>
 #include <stdexcept>
@@ -17,13 +23,46 @@
 
 namespace license {
 
+namespace detail {
+
+/**
+ * @brief Client-side sink for deferred license returns
+ * 
+ * Implemented by the client; handles keep a weak reference to it.
+ */
+class ReturnSink {
+public:
+    virtual ~ReturnSink() = default;
+    
+    /**
+     * @brief Queue a borrow ID for return without blocking
+     */
+    virtual void enqueue_return(const std::string& id, const std::string& tool) noexcept = 0;
+};
+
+// Lets the benchmark suite (bench/) reach client internals
+struct BenchAccess;
+
+} // namespace detail
+
+// Struct-of-arrays status table (license_status_table.hpp)
+class StatusTable;
+
 /**
  * @brief License handle with RAII semantics
  * 
- * Automatically returns the license when destroyed (goes out of scope)
+ * Automatically returns the license when destroyed (goes out of scope).
+ * The return is deferred: the destructor only queues the ID, and the
+ * client's background event loop sends queued returns in batches, so
+ * destroying a handle never blocks on the network. A handle that
+ * outlives its LicenseClient can no longer return its license.
  */
 class LicenseHandle {
 public:
+    /**
+     * @brief Construct an empty (invalid) handle
+     */
+    LicenseHandle();
     LicenseHandle(const std::string& id, const std::string& tool, 
                   const std::string& user);
     ~LicenseHandle();
@@ -58,6 +97,9 @@ public:
     
     /**
      * @brief Explicitly return the license (automatic on destruction)
+     * 
+     * Queues a deferred return like the destructor and invalidates the
+     * handle. Use LicenseClient::return_license for a blocking return.
      */
     void return_license();
 
@@ -66,6 +108,7 @@ private:
     std::string tool_;
     std::string user_;
     bool valid_;
+    std::weak_ptr<detail::ReturnSink> client_;
     
     friend class LicenseClient;
 };
@@ -84,6 +127,145 @@ struct LicenseStatus {
     bool in_commit = true;
 };
 
+/**
+ * @brief Outcome of LicenseClient::return_many
+ */
+struct BatchReturnResult {
+    std::size_t returned = 0;            ///< Seats the server released
+    std::vector<std::string> not_found;  ///< IDs the server did not know
+};
+
+/**
+ * @brief Latency distribution in a ClientMetrics snapshot, in seconds
+ */
+struct LatencyMetrics {
+    std::uint64_t count = 0;
+    double sum = 0;   ///< Seconds across all samples
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+    double max = 0;
+    /** Cumulative sample counts at each of ClientMetrics::bucket_bounds() */
+    std::vector<std::uint64_t> buckets;
+};
+
+/**
+ * @brief HTTP requests of one kind, as seen by the client
+ *
+ * Phase timings come from libcurl. dns, connect and tls are sampled only
+ * for requests that opened a connection (tls only for https); ttfb is
+ * the wait from sending the request to the first response byte, mostly
+ * server time; transfer runs from there to the last byte; parse covers
+ * decoding the response and the client's own bookkeeping. total runs
+ * from the start of the request to the end of parse.
+ */
+struct OperationMetrics {
+    std::string operation;              ///< borrow, borrow_batch, borrow_wait, return, return_batch, status, status_all, renew
+    std::uint64_t requests = 0;
+    std::uint64_t transport_errors = 0; ///< No HTTP response (connect failure, timeout, ...)
+    std::uint64_t http_errors = 0;      ///< HTTP status 400 and above, 409 included
+    std::uint64_t connections = 0;      ///< New connections opened
+    LatencyMetrics total;
+    LatencyMetrics dns;
+    LatencyMetrics connect;
+    LatencyMetrics tls;
+    LatencyMetrics ttfb;
+    LatencyMetrics transfer;
+    LatencyMetrics parse;
+};
+
+/**
+ * @brief Per-tool outcomes
+ */
+struct ToolMetrics {
+    std::string tool;
+    std::uint64_t borrows = 0;        ///< Borrow requests answered 200
+    std::uint64_t no_license = 0;     ///< Borrow requests answered 409
+    std::uint64_t borrow_errors = 0;  ///< Other borrow failures
+    std::uint64_t retries = 0;        ///< Requests sent again (RetryPolicy, deferred returns, lease renewals)
+    std::uint64_t leases_lost = 0;    ///< Leases the server reclaimed before renewal
+    std::uint64_t local_borrows = 0;  ///< Borrows granted from parked seats (OfflineLeasePolicy)
+    std::uint64_t local_refusals = 0; ///< Borrows refused without a request (AdmissionPolicy)
+};
+
+/**
+ * @brief Snapshot of a client's metrics since it was created
+ */
+struct ClientMetrics {
+    std::vector<OperationMetrics> operations;  ///< Operations with at least one request
+    std::vector<ToolMetrics> tools;
+
+    /** @brief Upper bounds, in seconds, of the LatencyMetrics::buckets */
+    static const std::vector<double>& bucket_bounds();
+
+    /**
+     * @brief Render in the Prometheus text exposition format
+     *
+     * Histograms license_client_request_duration_seconds and
+     * license_client_request_phase_seconds (labels operation, phase),
+     * counters license_client_requests_total and friends. Serve it from
+     * the application's own /metrics endpoint.
+     */
+    std::string to_prometheus() const;
+};
+
+/**
+ * @brief W3C Trace Context identifiers of one span
+ */
+struct TraceContext {
+    std::uint64_t trace_id_high = 0;
+    std::uint64_t trace_id_low = 0;
+    std::uint64_t span_id = 0;
+    bool sampled = false;
+
+    bool is_valid() const { return (trace_id_high | trace_id_low) != 0 && span_id != 0; }
+
+    /** @brief The traceparent header value, "00-<trace-id>-<span-id>-<flags>" */
+    std::string to_traceparent() const;
+
+    /** @brief Parse a traceparent header value; invalid if malformed */
+    static TraceContext from_traceparent(std::string_view value);
+};
+
+/**
+ * @brief Parent of the client spans started on this thread
+ *
+ * Wrap a unit of work, such as a tool launch, so that the client's spans
+ * join its trace. Scopes nest; each one restores the previous parent
+ * when it ends. An invalid context leaves spans without a parent.
+ */
+class TraceScope {
+public:
+    explicit TraceScope(const TraceContext& parent);
+    /** @brief Parent from a traceparent header value */
+    explicit TraceScope(std::string_view traceparent);
+    ~TraceScope();
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    /** @brief The innermost scope's parent, or nullptr if none or invalid */
+    static const TraceContext* current();
+
+private:
+    TraceContext context_;
+    const TraceContext* previous_;
+};
+
+/**
+ * @brief A finished client span, as passed to ClientOptions::on_span
+ */
+struct TraceSpan {
+    const char* name = "";             ///< license.borrow, license.borrow_wait, license.borrow_batch, license.return, license.return_batch, license.status, license.status_all
+    TraceContext context;              ///< This span; always sampled
+    std::uint64_t parent_span_id = 0;  ///< 0 for a root span
+    std::uint64_t start_unix_nanos = 0;
+    std::uint64_t end_unix_nanos = 0;
+    std::string tool;                  ///< Empty for license.status_all and license.return_batch
+    long http_status = 0;              ///< 0 if no response arrived
+    bool error = false;                ///< The call threw
+};
+
 /**
  * @brief Exception thrown when license operations fail
  */
@@ -100,10 +282,421 @@ class NoLicensesAvailableException : public LicenseException {
 public:
     explicit NoLicensesAvailableException(const std::string& tool)
         : LicenseException("No licenses available for tool: " + tool) {}
+
+protected:
+    NoLicensesAvailableException(const std::string& tool, const char* reason)
+        : LicenseException("No licenses available for tool: " + tool + " (" + reason + ")") {}
+};
+
+/**
+ * @brief Exception thrown without a request when AdmissionPolicy refuses
+ *        a borrow
+ */
+class AdmissionRefusedException : public NoLicensesAvailableException {
+public:
+    enum class Reason {
+        RateLimited,  ///< The tool's token bucket is empty
+        OverCommit,   ///< The cached status has no seats left within commit
+        Exhausted     ///< The cached status has no seats left at all
+    };
+
+    AdmissionRefusedException(const std::string& tool, Reason reason)
+        : NoLicensesAvailableException(tool, reason_text(reason)), reason_(reason) {}
+
+    Reason reason() const { return reason_; }
+
+private:
+    static const char* reason_text(Reason reason) {
+        switch (reason) {
+            case Reason::RateLimited: return "refused locally: rate limit";
+            case Reason::OverCommit: return "refused locally: would exceed commit";
+            case Reason::Exhausted: return "refused locally: none available";
+        }
+        return "refused locally";
+    }
+
+    Reason reason_;
+};
+
+/**
+ * @brief Exception thrown without a request while the circuit breaker
+ *        is open (see RetryPolicy)
+ */
+class ServerUnavailableException : public LicenseException {
+public:
+    ServerUnavailableException()
+        : LicenseException("Server unavailable: circuit open after repeated failures") {}
+};
+
+/**
+ * @brief Timeouts, retries, hedging and circuit breaking for blocking calls
+ *
+ * Applies to borrow(), borrow_wait(), borrow_many(), return_license(),
+ * return_many(), get_status() and get_all_statuses(), each batch request
+ * counting as one call. Failures are transport errors and 5xx responses.
+ * A borrow is only retried when the server cannot have granted it
+ * (connection not established, or 503); other calls are safe to repeat
+ * and are retried on any failure. Timeouts of 0 mean none.
+ */
+struct RetryPolicy {
+    /** Time allowed to establish a connection, per attempt */
+    long connect_timeout_ms = 2000;
+
+    /** Whole-call deadlines, covering every attempt and backoff */
+    long borrow_timeout_ms = 10000;
+    long return_timeout_ms = 10000;
+    long status_timeout_ms = 5000;
+
+    /** Attempts per call, including the first; 1 disables retries */
+    int max_attempts = 3;
+
+    /**
+     * Backoff before retry n is drawn uniformly from
+     * [0, min(backoff_max_ms, backoff_base_ms * 2^(n-1))] ("full jitter"),
+     * so clients that failed together do not retry together.
+     */
+    long backoff_base_ms = 50;
+    long backoff_max_ms = 1000;
+
+    /**
+     * Status reads only: if no response has arrived after this long,
+     * send a second copy and take whichever answers first. 0 disables
+     * hedging. Not used when requests are multiplexed over HTTP/2 or 3.
+     */
+    long hedge_after_ms = 0;
+
+    /**
+     * After this many consecutive failed attempts the circuit opens:
+     * calls throw ServerUnavailableException without a request for
+     * breaker_open_ms. Then one call at a time is let through as a
+     * probe until one succeeds. 0 disables the breaker.
+     */
+    int breaker_failure_threshold = 5;
+    long breaker_open_ms = 5000;
+};
+
+/**
+ * @brief Borrows refused in the client, before they reach the server
+ *
+ * A burst of borrows that the server will refuse, or bill as overage,
+ * costs a round trip each and load on the server. The policy turns them
+ * away locally with AdmissionRefusedException, a
+ * NoLicensesAvailableException, so existing refusal handling applies.
+ * borrow_many() asks for no more seats than the policy allows and throws
+ * only when that is none. borrow_wait() is only rate limited, since it
+ * exists to wait out a tool with no seats free. Borrows answered by an
+ * agent or from parked seats are not checked.
+ */
+struct AdmissionPolicy {
+    /**
+     * Seats per second each tool may request from the server, as a
+     * token bucket holding up to burst seats. 0 disables rate limiting.
+     */
+    double borrows_per_second = 0;
+    int burst = 10;
+
+    /**
+     * How long a blocking borrow() waits for a token before it is
+     * refused. Async borrows never wait. Waiters are served in order.
+     */
+    long max_wait_ms = 0;
+
+    /**
+     * Refuse borrows that the status cache says would go over the tool's
+     * commit, where each seat is billed as overage, and cap borrow_many()
+     * at the seats left within it. Needs status_cache_ttl_ms; tools not
+     * in the cache are let through. The check reads the cached count, so
+     * borrows racing from several threads can overshoot by the number in
+     * flight, as can other hosts between refreshes.
+     */
+    bool stay_within_commit = false;
+
+    /** Likewise refuse borrows when the cached status shows no seat free */
+    bool refuse_exhausted = false;
+};
+
+/**
+ * @brief Local re-borrows from signed lease tokens
+ *
+ * A server with a vendor signing key attaches a short-lived lease token
+ * to each borrow: a JWT naming the borrow, tool and user, signed with the
+ * vendor's private key. With the vendor public key configured here and
+ * park_ms set, the client verifies the token and, when the seat is
+ * returned, keeps it for up to park_ms instead: a borrow() of the same
+ * tool by the same user in that time is granted from memory, with no
+ * request. Seats kept this way (parked) stay borrowed on the server and
+ * their leases keep being renewed; the event loop returns each one when
+ * its hold ends or shortly before its token expires, retrying if the
+ * server cannot be reached, and the destructor returns the rest. A token
+ * never outlives the lease it came with, so a parked seat is still held
+ * even when renewals have been failing.
+ *
+ * Parked seats count as borrowed in the server's status until they are
+ * returned, so other users cannot have them; keep park_ms short.
+ * borrow_many() and return_many() always go to the server.
+ */
+struct OfflineLeasePolicy {
+    /**
+     * Vendor public key (PEM, Ed25519 or RSA) that lease tokens must be
+     * signed with. Empty disables offline leases; tokens are then ignored.
+     * The server publishes it at GET /licenses/token-key, but pin it
+     * here rather than fetching it, or anyone on the path could supply one.
+     */
+    std::string public_key_pem;
+
+    /**
+     * How long a returned seat is parked for a re-borrow, capped by its
+     * token. 0 returns seats at once. A hold of a few seconds covers a
+     * job that releases and retakes a seat; the loop returns the seat
+     * within about a second of the hold ending.
+     */
+    long park_ms = 0;
+
+    /**
+     * Optional file that keeps parked seats across processes. A borrow()
+     * that finds nothing in memory takes a matching seat from the file,
+     * so a tool that is relaunched within the token window starts without
+     * a request. The file is locked while read or written; each seat is
+     * handed to one process. Seats nobody picks up are reclaimed when
+     * their lease runs out.
+     */
+    std::string cache_path;
+
+    /**
+     * On destruction, write parked seats with an expiring lease to
+     * cache_path instead of returning them. They stay out of other
+     * users' reach until picked up or until the server reclaims them, so
+     * this is off by default.
+     */
+    bool hand_off_on_exit = false;
+
+    /**
+     * Tokens count as expired this long before their exp claim, to
+     * leave time to return the seat and to absorb clock skew.
+     */
+    long expiry_margin_ms = 5000;
+};
+
+/**
+ * @brief Response encodings the client can request
+ */
+enum class WireFormat {
+    Json,        ///< JSON only
+    MessagePack  ///< MessagePack when the server supports it, else JSON
+};
+
+/**
+ * @brief HTTP protocol versions the client can use
+ */
+enum class HttpVersion {
+    Default,             ///< libcurl's default: HTTP/2 over TLS when offered, else HTTP/1.1
+    Http1_1,             ///< HTTP/1.1 only
+    Http2,               ///< HTTP/2, multiplexed (negotiated over TLS, prior knowledge otherwise)
+    Http3                ///< HTTP/3 when libcurl supports it, else as Http2
+};
+
+/**
+ * @brief Client configuration
+ *
+ * Defaults match the behaviour of the plain URL constructor.
+ */
+struct ClientOptions {
+    /** Enable HMAC signature authentication on borrow requests */
+    bool enable_security = true;
+
+    /**
+     * Maximum number of idle CURL easy handles kept for reuse per pool
+     * shard. Handles share the DNS cache, TLS session cache and
+     * connection cache, so a warm request needs no new TCP or TLS
+     * handshake.
+     */
+    std::size_t pool_size = 4;
+
+    /**
+     * Number of handle pool shards. Each thread is pinned to one shard,
+     * so threads reuse their own handles without contending on a lock.
+     * 0 selects std::thread::hardware_concurrency().
+     */
+    std::size_t pool_shards = 0;
+
+    /** Send TCP keep-alive probes on pooled connections */
+    bool tcp_keepalive = true;
+
+    /** Idle time in seconds before the first keep-alive probe */
+    long keepalive_idle_secs = 60;
+
+    /** Interval in seconds between keep-alive probes */
+    long keepalive_interval_secs = 30;
+
+    /**
+     * On destruction, how long the client waits for in-flight requests
+     * (including deferred returns) before aborting them.
+     */
+    long shutdown_timeout_ms = 2000;
+
+    /**
+     * Serve get_status() and get_all_statuses() from memory for this
+     * long after a fetch. 0 disables the status cache. This client's own
+     * borrows and returns adjust cached counts in place, so within one
+     * process the cache stays close to the server between fetches.
+     */
+    long status_cache_ttl_ms = 0;
+
+    /**
+     * Keep the status cache fresh from the server's /realtime/stream
+     * feed, which pushes every tool's status every 2 seconds. Requires
+     * status_cache_ttl_ms above that interval; if the stream drops,
+     * entries expire normally and reads fall back to HTTP.
+     */
+    bool status_stream = false;
+
+    /**
+     * Send each request straight to the node that owns its tool (or
+     * issued its borrow) when the server is a sharded cluster. The ring
+     * is read from the server's /cluster/shards on first use and again
+     * whenever a node redirects or refuses a request, which happens
+     * after the node list changes; meanwhile redirects to other nodes of
+     * the ring are followed, and no others.
+     * get_all_statuses() then asks every node. Against an unsharded
+     * server this costs one extra request at startup.
+     */
+    bool shard_routing = false;
+
+    /**
+     * Encoding requested for responses. MessagePack is negotiated with
+     * the Accept header and is smaller and faster to decode, notably
+     * for get_all_statuses(); a server that does not offer it answers in
+     * JSON, which is always understood. Request bodies are always JSON.
+     */
+    WireFormat wire_format = WireFormat::Json;
+
+    /**
+     * HTTP version. With Http2 or Http3 every request, blocking ones
+     * included, runs on the client's event loop and is multiplexed over
+     * one connection per server, so concurrent borrows from many
+     * threads share a connection instead of opening one each. Plain
+     * http:// URLs then speak HTTP/2 with prior knowledge, which the
+     * server (or a proxy in front of it) must support.
+     */
+    HttpVersion http_version = HttpVersion::Default;
+
+    /**
+     * Unix socket of a local license_agentd. When set, or when the
+     * LICENSE_AGENT_SOCKET environment variable is, seats are borrowed
+     * from and returned to the agent, which serves them from seats it
+     * already holds for the host, and status reads are answered from
+     * its cache. Async calls then complete before they return. If the
+     * process exits, the agent takes back its seats.
+     */
+    std::string agent_socket;
+
+    /**
+     * Renew borrows the server grants as expiring leases. Renewals are
+     * scheduled on the client's event loop with a timer wheel and sent
+     * in batches to /licenses/renew, a third of the way through each
+     * lease, so thousands of live handles cost one thread and a few
+     * requests. Servers that do not expire borrows need no renewals.
+     */
+    bool renew_leases = true;
+
+    /**
+     * Called on the event loop thread when the server reports that a
+     * lease was not renewed in time and its seat was reclaimed. The
+     * handle stays valid but no longer holds a seat.
+     */
+    std::function<void(const std::string& id, const std::string& tool)> on_lease_lost;
+
+    /**
+     * Record per-request latency and outcome counters for metrics().
+     * Recording is lock-free: each thread records into its own shard.
+     */
+    bool collect_metrics = true;
+
+    /**
+     * Span sink; tracing is off while unset, at the cost of one branch
+     * per call. When set, each blocking borrow(), return_license(),
+     * get_status() and get_all_statuses() call that goes to the server
+     * runs in a client span. The request carries the span's W3C
+     * traceparent header. Sampled spans are passed here, on the calling
+     * thread, when the call ends. Parent spans come from TraceScope.
+     */
+    std::function<void(const TraceSpan&)> on_span;
+
+    /**
+     * Fraction of spans without a parent that are sampled, decided from
+     * the trace ID. A span with a parent follows the parent's decision.
+     */
+    double trace_sample_ratio = 1.0;
+
+    /**
+     * Timeouts, retries, hedging and circuit breaking for blocking
+     * calls. The request timeouts also bound asynchronous requests and
+     * deferred returns, which are not otherwise retried here.
+     */
+    RetryPolicy retry;
+
+    /** Local re-borrows from signed lease tokens; off by default */
+    OfflineLeasePolicy offline;
+
+    /** Local rate limits and commit protection for borrows; off by default */
+    AdmissionPolicy admission;
+
+    /**
+     * File that carries the server's resolved address and, with libcurl
+     * 8.12 or later, TLS session tickets from one process to the next,
+     * so a short-lived tool's first request skips the DNS lookup and
+     * resumes TLS instead of a full handshake. Empty disables it; see
+     * default_startup_cache_path(). The file holds session secrets and
+     * is created readable by its owner only. Written on destruction.
+     */
+    std::string startup_cache_path;
+
+    /** Entries older than this many seconds are not used */
+    long startup_cache_ttl_secs = 600;
 };
 
+/**
+ * @brief Per-user location for ClientOptions::startup_cache_path:
+ * $XDG_CACHE_HOME/license-client/startup, else
+ * $HOME/.cache/license-client/startup; empty if neither is set
+ */
+std::string default_startup_cache_path();
+
+/**
+ * @brief Per-request phase events, for finding where a slow call spent
+ * its time
+ *
+ * Only in libraries built with LICENSE_CLIENT_PHASE_TRACE (the CMake
+ * option of that name, or make PHASE_TRACE=1); otherwise the recording
+ * points compile away and these functions do nothing. When on, each
+ * request records prepare, sign, dns, connect, tls, server (request
+ * sent to first byte), receive and parse events, and a request event
+ * spanning them, into a ring of the last 4096 events per thread. Where
+ * <sys/sdt.h> is available each event also fires the USDT probe
+ * license_client:phase(phase, operation, request, start_ns, duration_ns).
+ *
+ * The environment variable LICENSE_PHASE_TRACE=<file> turns recording
+ * on from the start and writes the trace to the file whenever a client
+ * is destroyed.
+ */
+bool phase_trace_supported();
+
+/** @brief Start or stop recording phase events, process-wide */
+void set_phase_trace(bool on);
+
+/**
+ * @brief The recorded events in Chrome trace event JSON, which
+ * chrome://tracing and Perfetto (ui.perfetto.dev) open; empty when not
+ * supported. Events stay recorded after a dump.
+ */
+std::string phase_trace_json();
+
 /**
  * @brief Main license client class with HMAC security
+ *
+ * Thread safety: all member functions may be called concurrently on one
+ * shared instance. libcurl global initialization runs once per process,
+ * and each thread reuses its own pooled connections.
  */
 class LicenseClient {
 public:
@@ -122,11 +715,22 @@ public:
      */
     LicenseClient(const std::string& base_url, bool enable_security);
     
+    /**
+     * @brief Construct a license client with full configuration
+     * 
+     * @param base_url Base URL of the license server
+     * @param options Client configuration (security, connection pool)
+     */
+    LicenseClient(const std::string& base_url, const ClientOptions& options);
+    
     /**
      * @brief Destructor
      */
     ~LicenseClient();
     
+    LicenseClient(const LicenseClient&) = delete;
+    LicenseClient& operator=(const LicenseClient&) = delete;
+    
     /**
      * @brief Borrow a license for a specific tool
      * 
@@ -139,16 +743,41 @@ public:
     LicenseHandle borrow(const std::string& tool, const std::string& user);
     
     /**
-     * @brief Return a borrowed license
+     * @brief Borrow a license, waiting for one to be returned if none is free
      * 
-     * @param handle License handle to return
-     * @throws LicenseException on error
+     * The server queues waiters per tool and grants returned seats in
+     * arrival order, so no client has to poll on 409. Against a server
+     * without the wait queue (or through the agent) this polls borrow()
+     * with backoff until @p timeout_ms runs out.
+     * 
+     * @param timeout_ms Longest to wait for a seat; 0 does not wait
+     * @throws NoLicensesAvailableException if no seat came free in time
+     * @throws LicenseException on other errors
+     */
+    LicenseHandle borrow_wait(const std::string& tool, const std::string& user, long timeout_ms);
+    
+    /**
+     * @brief Return a borrowed license and wait for the server
+     * 
+     * @param handle License handle to return; invalidated on success
+     * @throws LicenseException on error (the handle stays valid)
+     */
+    void return_license(LicenseHandle& handle);
+    
+    /**
+     * @brief Wait until all deferred returns queued so far have been sent
+     * 
+     * Handle destruction only queues the return; call this when the
+     * server must reflect the released seats, e.g. before reading status.
      */
-    void return_license(const LicenseHandle& handle);
+    void flush_returns();
     
     /**
      * @brief Get status for a specific tool
      * 
+     * Served from memory while a cached entry is fresh
+     * (see ClientOptions::status_cache_ttl_ms).
+     * 
      * @param tool Tool name
      * @return License status information
      * @throws LicenseException on error
@@ -158,14 +787,155 @@ public:
     /**
      * @brief Get all license statuses
      * 
+     * Served from memory while the last full listing is fresh. Otherwise
+     * only the tools that changed since this client's previous listing
+     * are fetched and merged into it, where the server offers
+     * /licenses/status/delta.
+     * 
      * @return Vector of license statuses for all tools
      * @throws LicenseException on error
      */
     std::vector<LicenseStatus> get_all_statuses();
+    
+    /**
+     * @brief Refill @p table with all license statuses
+     * 
+     * As get_all_statuses(), into a StatusTable (license_status_table.hpp)
+     * whose tool IDs survive the refill, for checks by interned ID. The
+     * response is decoded straight into the table, without a list in
+     * between, unless a status cache or agent keeps one anyway. On error
+     * the table may be left partly refilled.
+     * 
+     * @throws LicenseException on error
+     */
+    void get_all_statuses(StatusTable& table);
+    
+    /**
+     * @brief Drop all cached statuses so the next read goes to the server
+     */
+    void invalidate_status_cache();
+    
+    /**
+     * @brief Snapshot of the request metrics collected so far
+     * 
+     * Empty when ClientOptions::collect_metrics is off, or in agent mode,
+     * where requests do not go over HTTP.
+     */
+    ClientMetrics metrics() const;
+    
+    /**
+     * @brief Borrow several licenses of one tool in one signed request
+     * 
+     * The server admits the whole batch in a single transaction and
+     * grants as many seats as commit/overage limits allow, so the result
+     * may hold fewer than @p count handles (possibly none). Counts above
+     * the server's batch limit (500) are split into several requests.
+     * 
+     * @param tool Tool name
+     * @param user Username
+     * @param count Number of seats wanted
+     * @return Handles for the granted seats
+     * @throws AdmissionRefusedException if the AdmissionPolicy allows no seat
+     * @throws LicenseException on transport or server errors
+     */
+    std::vector<LicenseHandle> borrow_many(const std::string& tool, const std::string& user,
+                                           int count);
+    
+    /**
+     * @brief Return several licenses in one request
+     * 
+     * Every valid handle in @p handles is sent and then marked invalid,
+     * including IDs the server reports as unknown.
+     * 
+     * @param handles Handles to return
+     * @return Number of seats released and IDs the server did not know
+     * @throws LicenseException on transport or server errors
+     */
+    BatchReturnResult return_many(std::vector<LicenseHandle>& handles);
+    
+    /**
+     * @brief Completion callback for borrow_async
+     * 
+     * On success @p error is null and @p handle is valid; on failure
+     * @p error holds the exception the blocking call would have thrown.
+     */
+    using BorrowCallback = std::function<void(LicenseHandle handle, std::exception_ptr error)>;
+    
+    /**
+     * @brief Completion callback for return_async
+     */
+    using ReturnCallback = std::function<void(std::exception_ptr error)>;
+    
+    /**
+     * @brief Completion callback for get_status_async
+     */
+    using StatusCallback = std::function<void(LicenseStatus status, std::exception_ptr error)>;
+    
+    /**
+     * @brief Borrow a license without blocking
+     * 
+     * All async requests are driven by one curl_multi event loop thread
+     * owned by the client, started on first use. Callbacks run on that
+     * thread and must not block; they must not destroy the client.
+     * 
+     * @param tool Tool name
+     * @param user Username
+     * @param callback Invoked once with the handle or the error
+     */
+    void borrow_async(const std::string& tool, const std::string& user, BorrowCallback callback);
+    
+    /**
+     * @brief Borrow a license without blocking
+     * 
+     * @return Future that yields the handle or rethrows the error
+     */
+    std::future<LicenseHandle> borrow_async(const std::string& tool, const std::string& user);
+    
+    /**
+     * @brief Return a borrowed license without blocking
+     * 
+     * A return that fails in transport or with a 5xx still reports the
+     * error, and is retried with the deferred returns (flush_returns()
+     * waits for it), as the handle can no longer be returned.
+     * 
+     * @param handle License handle to return; invalidated immediately
+     * @param callback Invoked once with the error, or null on success
+     * @throws LicenseException if the handle is invalid
+     */
+    void return_async(LicenseHandle& handle, ReturnCallback callback);
+    
+    /**
+     * @brief Return a borrowed license without blocking
+     * 
+     * @param handle License handle to return; invalidated immediately
+     * @return Future that completes when the server confirmed the return
+     * @throws LicenseException if the handle is invalid
+     */
+    std::future<void> return_async(LicenseHandle& handle);
+    
+    /**
+     * @brief Get status for a specific tool without blocking
+     * 
+     * @param tool Tool name
+     * @param callback Invoked once with the status or the error
+     */
+    void get_status_async(const std::string& tool, StatusCallback callback);
+    
+    /**
+     * @brief Get status for a specific tool without blocking
+     * 
+     * @return Future that yields the status or rethrows the error
+     */
+    std::future<LicenseStatus> get_status_async(const std::string& tool);
 
 private:
     class Impl;
-    std::unique_ptr<Impl> pimpl_;
+    std::shared_ptr<Impl> pimpl_;
+    
+    // borrow() from the server once the AdmissionPolicy let it through
+    LicenseHandle borrow_admitted(const std::string& tool, const std::string& user);
+    
+    friend struct detail::BenchAccess;
 };
 
 } // namespace license
@@ -0,0 +1,169 @@
+/**
+ * @file license_client_coro.hpp
+ * @brief C++20 coroutine interface for the License Client Library
+ *
+ * Awaitable wrappers around the LicenseClient async API. A coroutine
+ * that awaits one of these is suspended without blocking any thread and
+ * resumed by the client's curl_multi event loop when the response
+ * arrives.
+ *
+ * Enabled by building with CMAKE_CXX_STANDARD >= 20.
+ */
+
+#ifndef LICENSE_CLIENT_CORO_HPP
+#define LICENSE_CLIENT_CORO_HPP
+
+#include "license_client.hpp"
+
+#if !defined(__cpp_impl_coroutine)
+#error "license_client_coro.hpp requires C++20 coroutine support"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <string>
+#include <utility>
+
+namespace license {
+namespace coro {
+
+/**
+ * @brief Awaitable for LicenseClient::borrow_async
+ *
+ * The awaiting coroutine resumes on the client's event loop thread.
+ * Hand long-running work off to another executor after resuming.
+ */
+class BorrowAwaitable {
+public:
+    BorrowAwaitable(LicenseClient& client, std::string tool, std::string user)
+        : client_(client), tool_(std::move(tool)), user_(std::move(user)) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> awaiting) {
+        // The callback may resume the coroutine before borrow_async
+        // returns, so nothing in this frame is touched afterwards
+        client_.borrow_async(tool_, user_,
+            [this, awaiting](LicenseHandle handle, std::exception_ptr error) {
+                handle_ = std::move(handle);
+                error_ = error;
+                awaiting.resume();
+            });
+    }
+
+    /**
+     * @throws NoLicensesAvailableException if no licenses available
+     * @throws LicenseException on other errors
+     */
+    LicenseHandle await_resume() {
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+        return std::move(handle_);
+    }
+
+private:
+    LicenseClient& client_;
+    std::string tool_;
+    std::string user_;
+    LicenseHandle handle_;
+    std::exception_ptr error_;
+};
+
+/**
+ * @brief Awaitable for LicenseClient::return_async
+ */
+class ReturnAwaitable {
+public:
+    ReturnAwaitable(LicenseClient& client, LicenseHandle& handle)
+        : client_(client), handle_(handle) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> awaiting) {
+        client_.return_async(handle_,
+            [this, awaiting](std::exception_ptr error) {
+                error_ = error;
+                awaiting.resume();
+            });
+    }
+
+    /**
+     * @throws LicenseException on error
+     */
+    void await_resume() {
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+
+private:
+    LicenseClient& client_;
+    LicenseHandle& handle_;
+    std::exception_ptr error_;
+};
+
+/**
+ * @brief Awaitable for LicenseClient::get_status_async
+ */
+class StatusAwaitable {
+public:
+    StatusAwaitable(LicenseClient& client, std::string tool)
+        : client_(client), tool_(std::move(tool)) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> awaiting) {
+        client_.get_status_async(tool_,
+            [this, awaiting](LicenseStatus status, std::exception_ptr error) {
+                status_ = std::move(status);
+                error_ = error;
+                awaiting.resume();
+            });
+    }
+
+    /**
+     * @throws LicenseException on error
+     */
+    LicenseStatus await_resume() {
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+        return std::move(status_);
+    }
+
+private:
+    LicenseClient& client_;
+    std::string tool_;
+    LicenseStatus status_;
+    std::exception_ptr error_;
+};
+
+/**
+ * @brief Borrow a license: `auto handle = co_await coro::borrow(client, tool, user);`
+ */
+inline BorrowAwaitable borrow(LicenseClient& client, std::string tool, std::string user) {
+    return BorrowAwaitable(client, std::move(tool), std::move(user));
+}
+
+/**
+ * @brief Return a license: `co_await coro::return_license(client, handle);`
+ *
+ * @p handle is invalidated as soon as the request is sent; a return that
+ * fails in transport or with a 5xx is retried in the background.
+ */
+inline ReturnAwaitable return_license(LicenseClient& client, LicenseHandle& handle) {
+    return ReturnAwaitable(client, handle);
+}
+
+/**
+ * @brief Get tool status: `auto status = co_await coro::get_status(client, tool);`
+ */
+inline StatusAwaitable get_status(LicenseClient& client, std::string tool) {
+    return StatusAwaitable(client, std::move(tool));
+}
+
+} // namespace coro
+} // namespace license
+
+#endif // LICENSE_CLIENT_CORO_HPP
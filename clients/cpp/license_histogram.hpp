@@ -0,0 +1,234 @@
+/**
+ * @file license_histogram.hpp
+ * @brief Fixed-precision latency histogram (internal)
+ *
+ * An HDR-style histogram: values below 2^precision_bits are counted
+ * exactly; above that, each power-of-two range is split into
+ * 2^(precision_bits - 1) equal buckets, so any recorded value is known
+ * to within 1 part in 2^(precision_bits - 1) (about 0.2% at the default
+ * of 10 bits). Recording is a few shifts and an increment; the counts
+ * live in one flat array sized by the highest trackable value.
+ *
+ * Histogram is not thread-safe: keep one per thread and merge() them to
+ * report. AtomicHistogram can be recorded into from several threads.
+ * Not installed.
+ */
+
+#ifndef LICENSE_HISTOGRAM_HPP
+#define LICENSE_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace license {
+namespace detail {
+
+/**
+ * Bucket layout: values keep their top precision_bits significant bits,
+ * so the bucket of v is shift * half + (v >> shift), where shift drops
+ * the bits below them and half = 2^(precision_bits - 1).
+ */
+class HistogramLayout {
+public:
+    HistogramLayout(std::uint64_t highest, int precision_bits)
+        : bits_(std::min(16, std::max(2, precision_bits))),
+          half_(std::uint64_t(1) << (bits_ - 1)),
+          highest_(std::max<std::uint64_t>(highest, 2 * half_)) {}
+
+    int bits() const { return bits_; }
+    std::uint64_t highest() const { return highest_; }
+    std::size_t size() const { return index_of(highest_) + 1; }
+
+    std::size_t index_of(std::uint64_t value) const {
+        int top = value ? 63 - __builtin_clzll(value) : 0;
+        int shift = std::max(0, top - (bits_ - 1));
+        return static_cast<std::size_t>(static_cast<std::uint64_t>(shift) * half_ + (value >> shift));
+    }
+
+    /** @brief Largest value that falls in bucket @p index */
+    std::uint64_t highest_in(std::size_t index) const {
+        std::uint64_t i = index;
+        if (i < 2 * half_) {
+            return i;
+        }
+        std::uint64_t shift = i / half_ - 1;
+        std::uint64_t mantissa = i - shift * half_;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+private:
+    int bits_;
+    std::uint64_t half_;
+    std::uint64_t highest_;
+};
+
+class Histogram {
+public:
+    /** One hour in nanoseconds */
+    static constexpr std::uint64_t DEFAULT_HIGHEST = 3600ull * 1000 * 1000 * 1000;
+
+    /**
+     * @param highest Largest value tracked; larger values count as this
+     * @param precision_bits Resolution, from 2 to 16 bits
+     */
+    explicit Histogram(std::uint64_t highest = DEFAULT_HIGHEST, int precision_bits = 10)
+        : layout_(highest, precision_bits), counts_(layout_.size()) {}
+
+    void record(std::uint64_t value, std::uint64_t n = 1) {
+        value = std::min(value, layout_.highest());
+        counts_[layout_.index_of(value)] += n;
+        total_ += n;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+        sum_ += static_cast<double>(value) * static_cast<double>(n);
+    }
+
+    /**
+     * @brief Record @p value from a loop that expected one sample every
+     *        @p interval, back-filling the samples a stall kept it from
+     *        taking (coordinated omission correction for closed loops)
+     */
+    void record_corrected(std::uint64_t value, std::uint64_t interval) {
+        record(value);
+        if (interval == 0) {
+            return;
+        }
+        for (std::uint64_t missed = value > interval ? value - interval : 0;
+             missed >= interval; missed -= interval) {
+            record(missed);
+        }
+    }
+
+    /** @brief Add every sample of @p other */
+    void merge(const Histogram& other) {
+        if (other.layout_.bits() == layout_.bits() && other.counts_.size() <= counts_.size()) {
+            for (std::size_t i = 0; i < other.counts_.size(); ++i) {
+                counts_[i] += other.counts_[i];
+            }
+            total_ += other.total_;
+            if (other.total_ > 0) {
+                min_ = std::min(min_, other.min_);
+                max_ = std::max(max_, other.max_);
+            }
+            sum_ += other.sum_;
+            return;
+        }
+        other.for_each([&](std::uint64_t value, std::uint64_t n) { record(value, n); });
+    }
+
+    void reset() {
+        std::fill(counts_.begin(), counts_.end(), 0);
+        total_ = 0;
+        min_ = std::numeric_limits<std::uint64_t>::max();
+        max_ = 0;
+        sum_ = 0;
+    }
+
+    std::uint64_t count() const { return total_; }
+    std::uint64_t min() const { return total_ ? min_ : 0; }
+    std::uint64_t max() const { return max_; }
+    double mean() const { return total_ ? sum_ / static_cast<double>(total_) : 0.0; }
+
+    /**
+     * @brief Smallest value that @p percentile percent of samples are at
+     *        or below, reported as the top of its bucket
+     */
+    std::uint64_t value_at(double percentile) const {
+        if (total_ == 0) {
+            return 0;
+        }
+        percentile = std::min(100.0, std::max(0.0, percentile));
+        auto wanted = static_cast<std::uint64_t>(percentile / 100.0 * static_cast<double>(total_) + 0.5);
+        wanted = std::max<std::uint64_t>(1, std::min(wanted, total_));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= wanted) {
+                return std::min(layout_.highest_in(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    /** @brief Samples at or below @p value, to the bucket resolution */
+    std::uint64_t count_at_or_below(std::uint64_t value) const {
+        std::size_t last = layout_.index_of(std::min(value, layout_.highest()));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i <= last; ++i) {
+            seen += counts_[i];
+        }
+        return seen;
+    }
+
+    /** @brief Call f(value, count) for each non-empty bucket, lowest first */
+    template <typename F>
+    void for_each(F&& f) const {
+        for (std::size_t i = 0; i < counts_.size(); ++i) {
+            if (counts_[i] != 0) {
+                f(std::min(layout_.highest_in(i), max_), counts_[i]);
+            }
+        }
+    }
+
+private:
+    HistogramLayout layout_;
+    std::vector<std::uint64_t> counts_;
+    std::uint64_t total_ = 0;
+    std::uint64_t min_ = std::numeric_limits<std::uint64_t>::max();
+    std::uint64_t max_ = 0;
+    double sum_ = 0;
+};
+
+/**
+ * Histogram that any number of threads may record into while another
+ * reads it: every count is a relaxed atomic, so record() takes no lock.
+ * A snapshot taken during recording may lag by the samples in flight.
+ */
+class AtomicHistogram {
+public:
+    explicit AtomicHistogram(std::uint64_t highest = Histogram::DEFAULT_HIGHEST, int precision_bits = 10)
+        : layout_(highest, precision_bits),
+          counts_(new std::atomic<std::uint64_t>[layout_.size()]()) {}
+
+    void record(std::uint64_t value) {
+        value = std::min(value, layout_.highest());
+        counts_[layout_.index_of(value)].fetch_add(1, std::memory_order_relaxed);
+        total_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        std::uint64_t seen = max_.load(std::memory_order_relaxed);
+        while (value > seen && !max_.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    std::uint64_t count() const { return total_.load(std::memory_order_relaxed); }
+    std::uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    std::uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+    /** @brief Add the samples recorded so far to @p out */
+    void add_to(Histogram& out) const {
+        std::uint64_t top = max();
+        for (std::size_t i = 0, n = layout_.size(); i < n; ++i) {
+            std::uint64_t count = counts_[i].load(std::memory_order_relaxed);
+            if (count != 0) {
+                out.record(std::min(layout_.highest_in(i), top), count);
+            }
+        }
+    }
+
+private:
+    HistogramLayout layout_;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> counts_;
+    std::atomic<std::uint64_t> total_{0};
+    std::atomic<std::uint64_t> sum_{0};
+    std::atomic<std::uint64_t> max_{0};
+};
+
+} // namespace detail
+} // namespace license
+
+#endif // LICENSE_HISTOGRAM_HPP
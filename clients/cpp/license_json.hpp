@@ -0,0 +1,348 @@
+/**
+ * @file license_json.hpp
+ * @brief Minimal pull parser for license server responses (internal)
+ *
+ * Decodes JSON directly from the receive buffer: no DOM and no per-node
+ * allocation. Callers walk the document with object()/array(), pick the
+ * members they need and skip() the rest. Keys are compared in place;
+ * string values are decoded into caller-owned strings so their capacity
+ * can be reused across responses.
+ *
+ * Not installed; used by license_client.cpp only.
+ */
+
+#ifndef LICENSE_JSON_HPP
+#define LICENSE_JSON_HPP
+
+#include "license_client.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+
+namespace license {
+namespace json {
+
+/**
+ * @brief Cursor over one JSON document
+ *
+ * All methods throw LicenseException on malformed input.
+ */
+class Reader {
+public:
+    explicit Reader(std::string_view text)
+        : begin_(text.data()), pos_(text.data()), end_(text.data() + text.size()) {}
+
+    /**
+     * @brief Parse an object; call on_member(key) once per member
+     *
+     * on_member must consume the member's value (read it or skip() it).
+     * The key view is only valid until the next call on this reader.
+     */
+    template <typename F>
+    void object(F&& on_member) {
+        expect('{');
+        if (consume('}')) return;
+        do {
+            std::string_view key = read_key();
+            expect(':');
+            on_member(key);
+        } while (consume(','));
+        expect('}');
+    }
+
+    /**
+     * @brief Parse an array; call on_element() once per element
+     *
+     * on_element must consume the element.
+     */
+    template <typename F>
+    void array(F&& on_element) {
+        expect('[');
+        if (consume(']')) return;
+        do {
+            on_element();
+        } while (consume(','));
+        expect(']');
+    }
+
+    /** @brief Decode a string into @p out (null yields an empty string) */
+    void string(std::string& out) {
+        out.clear();
+        if (consume_literal("null")) return;
+        expect('"');
+        const char* start = pos_;
+        while (pos_ < end_ && *pos_ != '"' && *pos_ != '\\') ++pos_;
+        out.append(start, pos_);
+        if (pos_ < end_ && *pos_ == '\\') {
+            decode_escaped(out);
+        }
+        expect_raw('"');
+    }
+
+    /** @brief Read a number as int (fractions truncate; null yields 0) */
+    int integer() {
+        long long value = integer64();
+        if (value < std::numeric_limits<int>::min() || value > std::numeric_limits<int>::max()) {
+            fail("number out of range");
+        }
+        return static_cast<int>(value);
+    }
+
+    /** @brief Read a number as a 64-bit integer, e.g. a Unix timestamp */
+    long long integer64() {
+        skip_ws();
+        if (consume_literal("null")) return 0;
+        long long value = 0;
+        auto result = std::from_chars(pos_, end_, value);
+        if (result.ec == std::errc() && !is_fraction(result.ptr)) {
+            pos_ = result.ptr;
+        } else {
+            // Fractional or exponent form, e.g. 20.0
+            double d = read_number();
+            if (!(d > -9.2e18 && d < 9.2e18)) fail("number out of range");
+            value = static_cast<long long>(d);
+        }
+        return value;
+    }
+
+    /** @brief Read true/false (null yields false) */
+    bool boolean() {
+        skip_ws();
+        if (consume_literal("true")) return true;
+        if (consume_literal("false") || consume_literal("null")) return false;
+        fail("expected boolean");
+    }
+
+    /** @brief Count an array's elements without decoding them */
+    std::size_t count() {
+        std::size_t n = 0;
+        array([&] { skip(); ++n; });
+        return n;
+    }
+
+    /** @brief Skip any value */
+    void skip(int depth = 0) {
+        if (depth > MAX_DEPTH) fail("nesting too deep");
+        skip_ws();
+        if (pos_ >= end_) fail("unexpected end of input");
+        switch (*pos_) {
+        case '{':
+            object([&](std::string_view) { skip(depth + 1); });
+            break;
+        case '[':
+            array([&] { skip(depth + 1); });
+            break;
+        case '"':
+            skip_string();
+            break;
+        case 't':
+        case 'f':
+            boolean();
+            break;
+        case 'n':
+            if (!consume_literal("null")) fail("invalid literal");
+            break;
+        default:
+            read_number();
+            break;
+        }
+    }
+
+    /** @brief Require that only whitespace remains */
+    void finish() {
+        skip_ws();
+        if (pos_ != end_) fail("trailing characters");
+    }
+
+private:
+    static constexpr int MAX_DEPTH = 64;
+
+    [[noreturn]] void fail(const char* what) const {
+        throw LicenseException("Failed to parse response: " + std::string(what) +
+                               " at offset " + std::to_string(pos_ - begin_));
+    }
+
+    void skip_ws() {
+        while (pos_ < end_ && (*pos_ == ' ' || *pos_ == '\n' || *pos_ == '\r' || *pos_ == '\t')) {
+            ++pos_;
+        }
+    }
+
+    bool consume(char c) {
+        skip_ws();
+        if (pos_ < end_ && *pos_ == c) {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c) {
+        if (!consume(c)) {
+            const char what[] = {'e', 'x', 'p', 'e', 'c', 't', 'e', 'd', ' ', '\'', c, '\'', '\0'};
+            fail(what);
+        }
+    }
+
+    void expect_raw(char c) {
+        if (pos_ >= end_ || *pos_ != c) fail("unterminated string");
+        ++pos_;
+    }
+
+    bool consume_literal(const char* literal) {
+        skip_ws();
+        std::size_t n = std::strlen(literal);
+        if (static_cast<std::size_t>(end_ - pos_) >= n && std::memcmp(pos_, literal, n) == 0) {
+            pos_ += n;
+            return true;
+        }
+        return false;
+    }
+
+    bool is_fraction(const char* p) const {
+        return p < end_ && (*p == '.' || *p == 'e' || *p == 'E');
+    }
+
+    bool digit() const { return pos_ < end_ && *pos_ >= '0' && *pos_ <= '9'; }
+
+    // Strict JSON number grammar. Counts only need integer precision,
+    // so this avoids strtod (which would honour the C locale's decimal
+    // separator).
+    double read_number() {
+        bool negative = pos_ < end_ && *pos_ == '-';
+        if (negative) ++pos_;
+        if (!digit()) fail("invalid number");
+        double value = 0;
+        if (*pos_ == '0') {
+            ++pos_;
+        } else {
+            while (digit()) value = value * 10 + (*pos_++ - '0');
+        }
+        if (pos_ < end_ && *pos_ == '.') {
+            ++pos_;
+            if (!digit()) fail("invalid number");
+            double scale = 0.1;
+            while (digit()) {
+                value += (*pos_++ - '0') * scale;
+                scale /= 10;
+            }
+        }
+        if (pos_ < end_ && (*pos_ == 'e' || *pos_ == 'E')) {
+            ++pos_;
+            bool negative_exp = pos_ < end_ && *pos_ == '-';
+            if (pos_ < end_ && (*pos_ == '+' || *pos_ == '-')) ++pos_;
+            if (!digit()) fail("invalid number");
+            int exponent = 0;
+            while (digit()) {
+                exponent = std::min(exponent * 10 + (*pos_++ - '0'), 1000);
+            }
+            value *= std::pow(10.0, negative_exp ? -exponent : exponent);
+        }
+        return negative ? -value : value;
+    }
+
+    // Keys in server responses never contain escapes; decode if one does
+    std::string_view read_key() {
+        expect('"');
+        const char* start = pos_;
+        while (pos_ < end_ && *pos_ != '"' && *pos_ != '\\') ++pos_;
+        if (pos_ < end_ && *pos_ == '\\') {
+            key_scratch_.assign(start, pos_);
+            decode_escaped(key_scratch_);
+            expect_raw('"');
+            return key_scratch_;
+        }
+        std::string_view key(start, static_cast<std::size_t>(pos_ - start));
+        expect_raw('"');
+        return key;
+    }
+
+    void skip_string() {
+        expect('"');
+        while (pos_ < end_ && *pos_ != '"') {
+            if (*pos_ == '\\') ++pos_;
+            ++pos_;
+        }
+        expect_raw('"');
+    }
+
+    // Decode from a backslash up to (not including) the closing quote
+    void decode_escaped(std::string& out) {
+        while (pos_ < end_ && *pos_ != '"') {
+            if (*pos_ != '\\') {
+                out.push_back(*pos_++);
+                continue;
+            }
+            if (++pos_ >= end_) break;
+            char c = *pos_++;
+            switch (c) {
+            case '"':  out.push_back('"'); break;
+            case '\\': out.push_back('\\'); break;
+            case '/':  out.push_back('/'); break;
+            case 'b':  out.push_back('\b'); break;
+            case 'f':  out.push_back('\f'); break;
+            case 'n':  out.push_back('\n'); break;
+            case 'r':  out.push_back('\r'); break;
+            case 't':  out.push_back('\t'); break;
+            case 'u':  append_utf8(out, read_code_point()); break;
+            default:   fail("invalid escape");
+            }
+        }
+    }
+
+    unsigned read_hex4() {
+        if (end_ - pos_ < 4) fail("invalid \\u escape");
+        unsigned value = 0;
+        auto result = std::from_chars(pos_, pos_ + 4, value, 16);
+        if (result.ptr != pos_ + 4) fail("invalid \\u escape");
+        pos_ += 4;
+        return value;
+    }
+
+    unsigned read_code_point() {
+        unsigned cp = read_hex4();
+        if (cp >= 0xD800 && cp <= 0xDBFF) {
+            if (end_ - pos_ < 2 || pos_[0] != '\\' || pos_[1] != 'u') fail("unpaired surrogate");
+            pos_ += 2;
+            unsigned low = read_hex4();
+            if (low < 0xDC00 || low > 0xDFFF) fail("unpaired surrogate");
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+            fail("unpaired surrogate");
+        }
+        return cp;
+    }
+
+    static void append_utf8(std::string& out, unsigned cp) {
+        if (cp < 0x80) {
+            out.push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    const char* begin_;
+    const char* pos_;
+    const char* end_;
+    std::string key_scratch_;
+};
+
+} // namespace json
+} // namespace license
+
+#endif // LICENSE_JSON_HPP
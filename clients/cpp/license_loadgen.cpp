@@ -0,0 +1,511 @@
+/**
+ * @file license_loadgen.cpp
+ * @brief Load generator that drives LicenseClient
+ *
+ * The C++ counterpart of stress-test/ (Rust): the same workers, modes,
+ * hold time and ramp-up, but every request goes through LicenseClient,
+ * the code path the tools ship with.
+ *
+ * With --rate the load is open loop: operation i is due at a fixed time
+ * on the schedule whether or not earlier ones have finished, and its
+ * response time is measured from that time. A server (or client) stall
+ * then shows up in the percentiles as the queueing it causes, instead of
+ * silently slowing the arrivals down (coordinated omission). Without
+ * --rate each worker runs back to back, like stress-test/; pass
+ * --expected-interval-ms to correct that closed loop instead.
+ *
+ * Latencies go into HDR-style histograms (license_histogram.hpp), one
+ * per worker, merged for the report. --hgrm writes them in HdrHistogram's
+ * percentile distribution format for plotting.
+ */
+
+#include "license_client.hpp"
+#include "license_histogram.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace license;
+using detail::Histogram;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum class Mode { FullCycle, CheckoutOnly, ReturnAll };
+
+struct LoadOptions {
+    std::string url = "http://localhost:8000";
+    int workers = 10;
+    long operations = 100;            // per worker
+    std::string tool = "random";      // or a specific tool name
+    double hold_secs = 1.0;           // full-cycle: how long each seat is held
+    Mode mode = Mode::FullCycle;
+    double ramp_up_secs = 0;
+    double rate = 0;                  // operations/s across workers; 0 = closed loop
+    double expected_interval_ms = 0;  // closed loop only
+    bool enable_security = true;
+    bool msgpack = false;
+    std::string hgrm_prefix;
+};
+
+const char* const TOOLS[] = {
+    "ECU Development Suite",
+    "GreenHills Multi IDE",
+    "AUTOSAR Configuration Tool",
+    "CAN Bus Analyzer Pro",
+    "Model-Based Design Studio",
+};
+
+const char* mode_name(Mode mode) {
+    switch (mode) {
+        case Mode::CheckoutOnly: return "checkout-only";
+        case Mode::ReturnAll: return "return-all";
+        default: return "full-cycle";
+    }
+}
+
+void usage(const char* argv0) {
+    std::cerr << "Usage: " << argv0 << " [options]\n"
+              << "  -u, --url URL              Server URL (default http://localhost:8000)\n"
+              << "  -w, --workers N            Concurrent workers (default 10)\n"
+              << "  -n, --operations N         Operations per worker (default 100)\n"
+              << "  -t, --tool NAME            Tool to borrow, or \"random\" (default)\n"
+              << "  -H, --hold-time S          Seconds each seat is held in full-cycle (default 1)\n"
+              << "  -m, --mode MODE            full-cycle (default), checkout-only or return-all\n"
+              << "  -r, --ramp-up S            Ramp the load up over S seconds (default 0)\n"
+              << "  -R, --rate OPS             Open loop: operations per second across all workers\n"
+              << "      --expected-interval-ms MS\n"
+              << "                             Closed loop: correct for stalls longer than MS\n"
+              << "      --hgrm PREFIX          Write PREFIX-borrow.hgrm and PREFIX-return.hgrm\n"
+              << "      --msgpack              Ask for MessagePack responses\n"
+              << "      --no-security          Disable HMAC request signing\n";
+}
+
+bool parse_args(int argc, char** argv, LoadOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << "\n";
+                return nullptr;
+            }
+            return argv[++i];
+        };
+        const char* v = nullptr;
+        if (arg == "--no-security") {
+            options.enable_security = false;
+        } else if (arg == "--msgpack") {
+            options.msgpack = true;
+        } else if (arg == "--help" || arg == "-h") {
+            return false;
+        } else if ((v = value()) == nullptr) {
+            return false;
+        } else if (arg == "-u" || arg == "--url") {
+            options.url = v;
+        } else if (arg == "-w" || arg == "--workers") {
+            options.workers = std::max(1, std::atoi(v));
+        } else if (arg == "-n" || arg == "--operations") {
+            options.operations = std::max(1L, std::atol(v));
+        } else if (arg == "-t" || arg == "--tool") {
+            options.tool = v;
+        } else if (arg == "-H" || arg == "--hold-time") {
+            options.hold_secs = std::max(0.0, std::atof(v));
+        } else if (arg == "-m" || arg == "--mode") {
+            std::string mode = v;
+            if (mode == "full-cycle") {
+                options.mode = Mode::FullCycle;
+            } else if (mode == "checkout-only") {
+                options.mode = Mode::CheckoutOnly;
+            } else if (mode == "return-all") {
+                options.mode = Mode::ReturnAll;
+            } else {
+                std::cerr << "Unknown mode: " << mode << "\n";
+                return false;
+            }
+        } else if (arg == "-r" || arg == "--ramp-up") {
+            options.ramp_up_secs = std::max(0.0, std::atof(v));
+        } else if (arg == "-R" || arg == "--rate") {
+            options.rate = std::max(0.0, std::atof(v));
+        } else if (arg == "--expected-interval-ms") {
+            options.expected_interval_ms = std::max(0.0, std::atof(v));
+        } else if (arg == "--hgrm") {
+            options.hgrm_prefix = v;
+        } else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Open-loop arrival times: @p rate operations per second, reached by a
+ * linear ramp from zero over @p ramp seconds. The ramp delivers rate *
+ * ramp / 2 operations, so operation i is due at sqrt(2 * ramp * i / rate)
+ * during it and at ramp / 2 + i / rate after.
+ */
+class Schedule {
+public:
+    Schedule(double rate, double ramp) : rate_(rate), ramp_(ramp) {}
+
+    Clock::duration due(std::uint64_t i) const {
+        double n = static_cast<double>(i);
+        double secs = n < rate_ * ramp_ / 2 ? std::sqrt(2 * ramp_ * n / rate_)
+                                            : ramp_ / 2 + n / rate_;
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(secs));
+    }
+
+private:
+    double rate_;
+    double ramp_;
+};
+
+// Latencies of one kind of operation
+struct Latency {
+    Histogram service;   // from send to completion
+    Histogram response;  // from when it was due to completion
+    std::uint64_t ok = 0;
+    std::uint64_t no_license = 0;
+    std::uint64_t errors = 0;
+
+    void merge(const Latency& other) {
+        service.merge(other.service);
+        response.merge(other.response);
+        ok += other.ok;
+        no_license += other.no_license;
+        errors += other.errors;
+    }
+};
+
+struct WorkerStats {
+    Latency borrow;
+    Latency ret;
+};
+
+std::uint64_t nanos(Clock::duration d) {
+    return static_cast<std::uint64_t>(std::max<Clock::rep>(0,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()));
+}
+
+/**
+ * Runs the configured load. Seats borrowed in checkout-only and
+ * return-all mode are kept in held_, indexed by operation, so the return
+ * phase (or the end of the run) can find them.
+ */
+class LoadGenerator {
+public:
+    LoadGenerator(const LoadOptions& options, LicenseClient& client)
+        : options_(options), client_(client),
+          total_(static_cast<std::uint64_t>(options.workers) * static_cast<std::uint64_t>(options.operations)),
+          schedule_(options.rate, options.ramp_up_secs),
+          expected_interval_(nanos(std::chrono::duration_cast<Clock::duration>(
+              std::chrono::duration<double, std::milli>(options.expected_interval_ms)))),
+          stats_(static_cast<std::size_t>(options.workers)) {
+        if (options.mode != Mode::FullCycle) {
+            held_.resize(total_);
+        }
+    }
+
+    void run() {
+        run_phase(Phase::Borrow);
+        if (options_.mode == Mode::ReturnAll) {
+            run_phase(Phase::Return);
+        }
+    }
+
+    WorkerStats totals() const {
+        WorkerStats total;
+        for (const auto& stats : stats_) {
+            total.borrow.merge(stats.borrow);
+            total.ret.merge(stats.ret);
+        }
+        return total;
+    }
+
+    double elapsed_secs() const { return elapsed_; }
+
+    // Seats still held (checkout-only); returned when the generator goes
+    void release_held() { held_.clear(); }
+
+private:
+    enum class Phase { Borrow, Return };
+
+    void run_phase(Phase phase) {
+        next_.store(0);
+        start_ = Clock::now();
+        std::vector<std::thread> threads;
+        for (int w = 0; w < options_.workers; ++w) {
+            threads.emplace_back([this, w, phase] { work(w, phase); });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        elapsed_ += std::chrono::duration<double>(Clock::now() - start_).count();
+    }
+
+    void work(int worker, Phase phase) {
+        WorkerStats& stats = stats_[static_cast<std::size_t>(worker)];
+        std::mt19937 rng(static_cast<std::mt19937::result_type>(worker + 1));
+        std::uniform_int_distribution<std::size_t> pick(0, std::size(TOOLS) - 1);
+        const std::string user = "loadgen-worker-" + std::to_string(worker);
+        const bool open_loop = options_.rate > 0;
+
+        if (!open_loop && options_.ramp_up_secs > 0) {
+            // Closed loop ramps like stress-test/: workers start staggered
+            std::this_thread::sleep_for(std::chrono::duration<double>(
+                options_.ramp_up_secs * worker / options_.workers));
+        }
+
+        for (long n = 0;; ++n) {
+            std::uint64_t op;
+            Clock::time_point due;
+            if (open_loop) {
+                op = next_.fetch_add(1);
+                if (op >= total_) {
+                    break;
+                }
+                due = start_ + schedule_.due(op);
+                std::this_thread::sleep_until(due);
+            } else {
+                if (n >= options_.operations) {
+                    break;
+                }
+                op = static_cast<std::uint64_t>(worker) * static_cast<std::uint64_t>(options_.operations) +
+                     static_cast<std::uint64_t>(n);
+                due = Clock::now();
+            }
+
+            if (phase == Phase::Return) {
+                give_back(held_[op], due, stats.ret);
+                continue;
+            }
+
+            std::string tool = options_.tool == "random" ? TOOLS[pick(rng)] : options_.tool;
+            LicenseHandle handle;
+            if (!borrow(tool, user, due, stats.borrow, handle)) {
+                continue;
+            }
+            if (options_.mode == Mode::FullCycle) {
+                std::this_thread::sleep_for(std::chrono::duration<double>(options_.hold_secs));
+                give_back(handle, Clock::now(), stats.ret);
+            } else {
+                held_[op] = std::move(handle);
+            }
+        }
+    }
+
+    bool borrow(const std::string& tool, const std::string& user, Clock::time_point due,
+                Latency& latency, LicenseHandle& handle) {
+        auto begin = Clock::now();
+        bool ok = false;
+        try {
+            handle = client_.borrow(tool, user);
+            ++latency.ok;
+            ok = true;
+        } catch (const NoLicensesAvailableException&) {
+            ++latency.no_license;
+        } catch (const LicenseException&) {
+            ++latency.errors;
+        }
+        record(latency, begin, due, Clock::now());
+        return ok;
+    }
+
+    void give_back(LicenseHandle& handle, Clock::time_point due, Latency& latency) {
+        if (!handle.is_valid()) {
+            return;  // its borrow failed
+        }
+        auto begin = Clock::now();
+        try {
+            client_.return_license(handle);
+            ++latency.ok;
+        } catch (const LicenseException&) {
+            ++latency.errors;
+        }
+        record(latency, begin, due, Clock::now());
+    }
+
+    void record(Latency& latency, Clock::time_point begin, Clock::time_point due, Clock::time_point end) {
+        latency.service.record(nanos(end - begin));
+        if (options_.rate > 0) {
+            latency.response.record(nanos(end - due));
+        } else {
+            latency.response.record_corrected(nanos(end - due), expected_interval_);
+        }
+    }
+
+    const LoadOptions& options_;
+    LicenseClient& client_;
+    const std::uint64_t total_;
+    const Schedule schedule_;
+    const std::uint64_t expected_interval_;
+    std::vector<WorkerStats> stats_;
+    std::vector<LicenseHandle> held_;
+    std::atomic<std::uint64_t> next_{0};
+    Clock::time_point start_;
+    double elapsed_ = 0;
+};
+
+void print_statuses(LicenseClient& client) {
+    for (const auto& status : client.get_all_statuses()) {
+        std::printf("  %-28s %d total, %d borrowed, %d available\n", status.tool.c_str(),
+                    status.total, status.borrowed, status.available);
+    }
+}
+
+double to_ms(std::uint64_t ns) { return static_cast<double>(ns) / 1e6; }
+
+void print_row(const char* label, const Histogram& h) {
+    std::printf("  %-22s %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n", label,
+                to_ms(h.value_at(50)), to_ms(h.value_at(90)), to_ms(h.value_at(99)),
+                to_ms(h.value_at(99.9)), to_ms(h.value_at(99.99)), to_ms(h.max()),
+                h.mean() / 1e6);
+}
+
+void print_latency(const char* name, const Latency& latency, bool corrected) {
+    std::uint64_t attempts = latency.ok + latency.no_license + latency.errors;
+    std::printf("%s:\n", name);
+    std::printf("  Successful:   %llu\n", static_cast<unsigned long long>(latency.ok));
+    std::printf("  No license:   %llu\n", static_cast<unsigned long long>(latency.no_license));
+    std::printf("  Errors:       %llu\n", static_cast<unsigned long long>(latency.errors));
+    std::printf("  Success rate: %.2f%%\n",
+                attempts ? 100.0 * static_cast<double>(latency.ok) / static_cast<double>(attempts) : 0.0);
+    if (attempts == 0) {
+        std::printf("\n");
+        return;
+    }
+    std::printf("  %-22s %9s %9s %9s %9s %9s %9s %9s\n", "latency (ms)",
+                "p50", "p90", "p99", "p99.9", "p99.99", "max", "mean");
+    print_row("service time", latency.service);
+    if (corrected) {
+        print_row("response time", latency.response);
+    }
+    std::printf("\n");
+}
+
+/**
+ * HdrHistogram percentile distribution (.hgrm), values in milliseconds,
+ * as read by HdrHistogram's plotFiles.html
+ */
+bool write_hgrm(const std::string& path, const Histogram& h) {
+    FILE* out = std::fopen(path.c_str(), "w");
+    if (!out) {
+        std::perror(path.c_str());
+        return false;
+    }
+    std::fprintf(out, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+    std::uint64_t seen = 0;
+    const double total = static_cast<double>(h.count());
+    h.for_each([&](std::uint64_t value, std::uint64_t n) {
+        seen += n;
+        double fraction = static_cast<double>(seen) / total;
+        if (seen < h.count()) {
+            std::fprintf(out, "%12.3f %2.12f %10llu %14.2f\n", to_ms(value), fraction,
+                         static_cast<unsigned long long>(seen), 1.0 / (1.0 - fraction));
+        } else {
+            std::fprintf(out, "%12.3f %2.12f %10llu\n", to_ms(value), fraction,
+                         static_cast<unsigned long long>(seen));
+        }
+    });
+    std::fprintf(out, "#[Mean    = %12.3f]\n", h.mean() / 1e6);
+    std::fprintf(out, "#[Max     = %12.3f, Total count    = %12llu]\n", to_ms(h.max()),
+                 static_cast<unsigned long long>(h.count()));
+    std::fclose(out);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    LoadOptions options;
+    if (!parse_args(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    ClientOptions client_options;
+    client_options.enable_security = options.enable_security;
+    client_options.wire_format = options.msgpack ? WireFormat::MessagePack : WireFormat::Json;
+    client_options.pool_size = std::max<std::size_t>(client_options.pool_size,
+                                                     static_cast<std::size_t>(options.workers));
+    LicenseClient client(options.url, client_options);
+
+    const bool open_loop = options.rate > 0;
+    const bool corrected = open_loop || options.expected_interval_ms > 0;
+    std::printf("Configuration:\n");
+    std::printf("  Server:      %s\n", options.url.c_str());
+    std::printf("  Workers:     %d\n", options.workers);
+    std::printf("  Operations:  %ld per worker\n", options.operations);
+    std::printf("  Total ops:   %ld\n", options.operations * options.workers);
+    std::printf("  Tool:        %s\n", options.tool.c_str());
+    std::printf("  Hold time:   %gs\n", options.hold_secs);
+    std::printf("  Mode:        %s\n", mode_name(options.mode));
+    std::printf("  Ramp-up:     %gs\n", options.ramp_up_secs);
+    if (open_loop) {
+        std::printf("  Load:        open loop, %g ops/s\n", options.rate);
+    } else {
+        std::printf("  Load:        closed loop\n");
+    }
+    std::printf("\nServer status:\n");
+    try {
+        print_statuses(client);
+    } catch (const LicenseException& e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+    std::printf("\n");
+
+    LoadGenerator generator(options, client);
+    generator.run();
+    WorkerStats totals = generator.totals();
+    double elapsed = generator.elapsed_secs();
+
+    std::printf("Performance:\n");
+    std::printf("  Total time:  %.2fs\n", elapsed);
+    std::printf("  Throughput:  %.2f ops/s\n",
+                elapsed > 0 ? static_cast<double>(totals.borrow.ok + totals.ret.ok) / elapsed : 0.0);
+    std::printf("\n");
+    print_latency("Borrow operations", totals.borrow, corrected);
+    if (options.mode != Mode::CheckoutOnly) {
+        print_latency("Return operations", totals.ret, corrected);
+    }
+    if (!corrected) {
+        std::printf("Closed loop: response times are not corrected for coordinated omission;\n"
+                    "use --rate, or --expected-interval-ms.\n\n");
+    }
+
+    if (!options.hgrm_prefix.empty()) {
+        const Histogram& borrow = corrected ? totals.borrow.response : totals.borrow.service;
+        const Histogram& ret = corrected ? totals.ret.response : totals.ret.service;
+        write_hgrm(options.hgrm_prefix + "-borrow.hgrm", borrow);
+        if (options.mode != Mode::CheckoutOnly) {
+            write_hgrm(options.hgrm_prefix + "-return.hgrm", ret);
+        }
+    }
+
+    std::printf("Final server status:\n");
+    try {
+        print_statuses(client);
+    } catch (const LicenseException& e) {
+        std::fprintf(stderr, "  Error: %s\n", e.what());
+    }
+    generator.release_held();
+    std::printf("\n");
+
+    bool failed = totals.borrow.errors + totals.borrow.no_license + totals.ret.errors > 0;
+    std::printf(failed ? "Some operations failed - check server logs\n"
+                       : "All operations completed successfully.\n");
+    return 0;
+}
@@ -0,0 +1,287 @@
+/**
+ * @file license_msgpack.hpp
+ * @brief Minimal MessagePack pull parser for license server responses (internal)
+ *
+ * Same interface as json::Reader, so response decoders are written once
+ * and instantiated for either encoding. Strings are length-prefixed and
+ * unescaped on the wire: keys are views into the receive buffer and
+ * string values are a single copy into caller-owned strings.
+ *
+ * Not installed; used by license_client.cpp only.
+ */
+
+#ifndef LICENSE_MSGPACK_HPP
+#define LICENSE_MSGPACK_HPP
+
+#include "license_client.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+
+namespace license {
+namespace msgpack {
+
+/**
+ * @brief Cursor over one MessagePack value
+ *
+ * All methods throw LicenseException on malformed input.
+ */
+class Reader {
+public:
+    explicit Reader(std::string_view data)
+        : begin_(reinterpret_cast<const unsigned char*>(data.data())),
+          pos_(begin_), end_(begin_ + data.size()) {}
+
+    /**
+     * @brief Parse a map; call on_member(key) once per entry
+     *
+     * on_member must consume the entry's value (read it or skip() it).
+     * Keys must be strings; the view points into the input buffer.
+     */
+    template <typename F>
+    void object(F&& on_member) {
+        std::size_t n = map_header();
+        for (std::size_t i = 0; i < n; ++i) {
+            std::string_view key;
+            if (!read_str(key)) fail("expected string key");
+            on_member(key);
+        }
+    }
+
+    /**
+     * @brief Parse an array; call on_element() once per element
+     */
+    template <typename F>
+    void array(F&& on_element) {
+        std::size_t n = array_header();
+        for (std::size_t i = 0; i < n; ++i) {
+            on_element();
+        }
+    }
+
+    /** @brief Decode a string into @p out (nil yields an empty string) */
+    void string(std::string& out) {
+        if (consume_nil()) {
+            out.clear();
+            return;
+        }
+        std::string_view value;
+        if (!read_str(value)) fail("expected string");
+        out.assign(value.data(), value.size());
+    }
+
+    /** @brief Read a number as int (floats truncate; nil yields 0) */
+    int integer() {
+        if (consume_nil()) return 0;
+        unsigned char b = next();
+        long long value;
+        if (b < 0x80) {
+            value = b;
+        } else if (b >= 0xE0) {
+            value = static_cast<signed char>(b);
+        } else {
+            switch (b) {
+            case 0xCC: value = read_be(1); break;
+            case 0xCD: value = read_be(2); break;
+            case 0xCE: value = read_be(4); break;
+            case 0xCF: {
+                std::uint64_t u = read_be(8);
+                if (u > static_cast<std::uint64_t>(std::numeric_limits<int>::max())) {
+                    fail("number out of range");
+                }
+                value = static_cast<long long>(u);
+                break;
+            }
+            case 0xD0: value = static_cast<std::int8_t>(read_be(1)); break;
+            case 0xD1: value = static_cast<std::int16_t>(read_be(2)); break;
+            case 0xD2: value = static_cast<std::int32_t>(read_be(4)); break;
+            case 0xD3: value = static_cast<std::int64_t>(read_be(8)); break;
+            case 0xCA: {
+                auto bits = static_cast<std::uint32_t>(read_be(4));
+                float f;
+                std::memcpy(&f, &bits, sizeof(f));
+                value = truncate(f);
+                break;
+            }
+            case 0xCB: {
+                std::uint64_t bits = read_be(8);
+                double d;
+                std::memcpy(&d, &bits, sizeof(d));
+                value = truncate(d);
+                break;
+            }
+            default:
+                fail("expected number");
+            }
+        }
+        if (value < std::numeric_limits<int>::min() || value > std::numeric_limits<int>::max()) {
+            fail("number out of range");
+        }
+        return static_cast<int>(value);
+    }
+
+    /** @brief Read true/false (nil yields false) */
+    bool boolean() {
+        unsigned char b = next();
+        if (b == 0xC3) return true;
+        if (b == 0xC2 || b == 0xC0) return false;
+        fail("expected boolean");
+    }
+
+    /** @brief Count an array's elements without decoding them */
+    std::size_t count() {
+        std::size_t n = array_header();
+        for (std::size_t i = 0; i < n; ++i) {
+            skip();
+        }
+        return n;
+    }
+
+    /** @brief Skip any value */
+    void skip(int depth = 0) {
+        if (depth > MAX_DEPTH) fail("nesting too deep");
+        unsigned char b = peek();
+        if (b < 0x80 || b >= 0xE0 || b == 0xC0 || b == 0xC2 || b == 0xC3) {
+            ++pos_;
+        } else if ((b >= 0x80 && b <= 0x8F) || b == 0xDE || b == 0xDF) {
+            std::size_t n = map_header();
+            for (std::size_t i = 0; i < 2 * n; ++i) skip(depth + 1);
+        } else if ((b >= 0x90 && b <= 0x9F) || b == 0xDC || b == 0xDD) {
+            std::size_t n = array_header();
+            for (std::size_t i = 0; i < n; ++i) skip(depth + 1);
+        } else {
+            ++pos_;
+            switch (b) {
+            case 0xCC: case 0xD0: advance(1); break;
+            case 0xCD: case 0xD1: advance(2); break;
+            case 0xCA: case 0xCE: case 0xD2: advance(4); break;
+            case 0xCB: case 0xCF: case 0xD3: advance(8); break;
+            case 0xD4: advance(2); break;   // fixext 1
+            case 0xD5: advance(3); break;   // fixext 2
+            case 0xD6: advance(5); break;   // fixext 4
+            case 0xD7: advance(9); break;   // fixext 8
+            case 0xD8: advance(17); break;  // fixext 16
+            case 0xC4: case 0xD9: advance(read_be(1)); break;
+            case 0xC5: case 0xDA: advance(read_be(2)); break;
+            case 0xC6: case 0xDB: advance(read_be(4)); break;
+            case 0xC7: advance(read_be(1) + 1); break;  // ext 8
+            case 0xC8: advance(read_be(2) + 1); break;  // ext 16
+            case 0xC9: advance(read_be(4) + 1); break;  // ext 32
+            default:
+                if (b >= 0xA0 && b <= 0xBF) {
+                    advance(b & 0x1F);
+                } else {
+                    fail("invalid type byte");
+                }
+            }
+        }
+    }
+
+    /** @brief Require that the whole input was consumed */
+    void finish() {
+        if (pos_ != end_) fail("trailing bytes");
+    }
+
+private:
+    static constexpr int MAX_DEPTH = 64;
+
+    [[noreturn]] void fail(const char* what) const {
+        throw LicenseException("Failed to parse response: " + std::string(what) +
+                               " at offset " + std::to_string(pos_ - begin_));
+    }
+
+    std::size_t remaining() const { return static_cast<std::size_t>(end_ - pos_); }
+
+    unsigned char peek() const {
+        if (pos_ >= end_) fail("unexpected end of input");
+        return *pos_;
+    }
+
+    unsigned char next() {
+        unsigned char b = peek();
+        ++pos_;
+        return b;
+    }
+
+    void advance(std::uint64_t n) {
+        if (n > remaining()) fail("unexpected end of input");
+        pos_ += n;
+    }
+
+    std::uint64_t read_be(std::size_t n) {
+        if (n > remaining()) fail("unexpected end of input");
+        std::uint64_t value = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            value = (value << 8) | pos_[i];
+        }
+        pos_ += n;
+        return value;
+    }
+
+    bool consume_nil() {
+        if (peek() == 0xC0) {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    template <typename Float>
+    long long truncate(Float f) const {
+        if (!(f > -9.2e18 && f < 9.2e18)) fail("number out of range");
+        return static_cast<long long>(f);
+    }
+
+    // Every element takes at least one byte, so a count above the bytes
+    // left is malformed; rejecting it bounds the work on bad input
+    std::size_t checked_count(std::uint64_t n, std::uint64_t bytes_per_element) {
+        if (n > remaining() / bytes_per_element) fail("length exceeds input");
+        return static_cast<std::size_t>(n);
+    }
+
+    std::size_t map_header() {
+        unsigned char b = next();
+        if (b >= 0x80 && b <= 0x8F) return checked_count(b & 0x0F, 2);
+        if (b == 0xDE) return checked_count(read_be(2), 2);
+        if (b == 0xDF) return checked_count(read_be(4), 2);
+        fail("expected map");
+    }
+
+    std::size_t array_header() {
+        unsigned char b = next();
+        if (b >= 0x90 && b <= 0x9F) return checked_count(b & 0x0F, 1);
+        if (b == 0xDC) return checked_count(read_be(2), 1);
+        if (b == 0xDD) return checked_count(read_be(4), 1);
+        fail("expected array");
+    }
+
+    bool read_str(std::string_view& out) {
+        unsigned char b = peek();
+        std::uint64_t n;
+        if (b >= 0xA0 && b <= 0xBF) {
+            ++pos_;
+            n = b & 0x1F;
+        } else if (b == 0xD9 || b == 0xDA || b == 0xDB) {
+            ++pos_;
+            n = read_be(b == 0xD9 ? 1 : b == 0xDA ? 2 : 4);
+        } else {
+            return false;
+        }
+        if (n > remaining()) fail("unexpected end of input");
+        out = std::string_view(reinterpret_cast<const char*>(pos_), static_cast<std::size_t>(n));
+        pos_ += n;
+        return true;
+    }
+
+    const unsigned char* begin_;
+    const unsigned char* pos_;
+    const unsigned char* end_;
+};
+
+} // namespace msgpack
+} // namespace license
+
+#endif // LICENSE_MSGPACK_HPP
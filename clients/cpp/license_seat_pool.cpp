@@ -0,0 +1,245 @@
+/**
+ * @file license_seat_pool.cpp
+ * @brief Pre-borrowed seat pool implementation
+ */
+
+#include "license_seat_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace license {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Pause after a failed refill, so an exhausted tool or an unreachable
+// server is not asked again every tick
+constexpr std::chrono::seconds REFILL_BACKOFF{5};
+
+constexpr std::chrono::seconds TICK{1};
+
+// Seats the pool may pre-borrow without going past what status allows
+int headroom(const LicenseStatus& status, bool allow_overage) {
+    int limit = allow_overage ? status.commit + status.max_overage : status.commit;
+    return std::min(limit, status.total) - status.borrowed;
+}
+
+} // namespace
+
+struct SeatPool::State {
+    struct ToolPool {
+        std::vector<LicenseHandle> spares;
+        Clock::time_point last_acquire;
+        Clock::time_point retry_at;
+        Clock::time_point checked_at;
+        bool active = false;  // acquired since the last idle expiry or drain
+    };
+
+    State(LicenseClient& client, std::string user, SeatPoolOptions options)
+        : client(client), user(std::move(user)), options(options) {
+        this->options.target_spares = std::max(0, this->options.target_spares);
+        this->options.low_water = std::min(std::max(0, this->options.low_water),
+                                           this->options.target_spares);
+    }
+
+    // Keeps up to twice the target, so a tool acquired and released in a
+    // loop settles instead of trading a refill for every return
+    std::size_t max_spares() const {
+        return 2 * static_cast<std::size_t>(options.target_spares);
+    }
+
+    void put_back(LicenseHandle handle) noexcept {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) {
+            return;  // the handle's destructor returns it to the server
+        }
+        try {
+            auto it = tools.find(handle.tool());
+            if (it != tools.end() && it->second.active && it->second.spares.size() < max_spares()) {
+                it->second.spares.push_back(std::move(handle));
+            }
+        } catch (...) {
+            // Out of memory: let the seat go back to the server
+        }
+    }
+
+    LicenseClient& client;
+    const std::string user;
+    SeatPoolOptions options;
+
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::unordered_map<std::string, ToolPool> tools;
+    bool stopping = false;
+};
+
+void SeatPool::Seat::release() noexcept {
+    if (!handle_.is_valid()) {
+        return;
+    }
+    if (auto state = pool_.lock()) {
+        state->put_back(std::move(handle_));
+    } else {
+        LicenseHandle dropped = std::move(handle_);
+    }
+    pool_.reset();
+}
+
+SeatPool::SeatPool(LicenseClient& client, std::string user, SeatPoolOptions options)
+    : state_(std::make_shared<State>(client, std::move(user), options)) {
+    maintainer_ = std::thread([this] { maintain(); });
+}
+
+SeatPool::~SeatPool() {
+    std::vector<LicenseHandle> spares;
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->stopping = true;
+        for (auto& entry : state_->tools) {
+            for (auto& handle : entry.second.spares) {
+                spares.push_back(std::move(handle));
+            }
+        }
+        state_->tools.clear();
+    }
+    state_->cv.notify_all();
+    maintainer_.join();
+    // spares queue their returns as they go out of scope
+}
+
+SeatPool::Seat SeatPool::acquire(const std::string& tool) {
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        State::ToolPool& pool = state_->tools[tool];
+        pool.last_acquire = Clock::now();
+        pool.active = true;
+        if (!pool.spares.empty()) {
+            LicenseHandle handle = std::move(pool.spares.back());
+            pool.spares.pop_back();
+            if (pool.spares.size() < static_cast<std::size_t>(state_->options.low_water)) {
+                state_->cv.notify_all();
+            }
+            return Seat(std::move(handle), state_);
+        }
+    }
+    // Miss: borrow this seat now and let the maintainer fetch spares
+    state_->cv.notify_all();
+    return Seat(state_->client.borrow(tool, state_->user), state_);
+}
+
+std::size_t SeatPool::spares(const std::string& tool) const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    auto it = state_->tools.find(tool);
+    return it == state_->tools.end() ? 0 : it->second.spares.size();
+}
+
+void SeatPool::drain() {
+    std::vector<LicenseHandle> spares;
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    for (auto& entry : state_->tools) {
+        for (auto& handle : entry.second.spares) {
+            spares.push_back(std::move(handle));
+        }
+        entry.second.spares.clear();
+        entry.second.active = false;
+    }
+}
+
+void SeatPool::maintain() {
+    State& state = *state_;
+    const SeatPoolOptions& options = state.options;
+    const auto idle_timeout = std::chrono::milliseconds(options.idle_timeout_ms);
+    const auto status_interval = std::chrono::milliseconds(options.status_interval_ms);
+
+    struct Work {
+        std::string tool;
+        int missing;  // spares wanted; 0 for a commit check only
+    };
+
+    std::unique_lock<std::mutex> lock(state.mutex);
+    while (!state.stopping) {
+        state.cv.wait_for(lock, TICK);
+        if (state.stopping) {
+            break;
+        }
+
+        auto now = Clock::now();
+        std::vector<Work> work;
+        std::vector<LicenseHandle> released;
+        for (auto& entry : state.tools) {
+            State::ToolPool& pool = entry.second;
+            if (!pool.active) {
+                continue;
+            }
+            if (now - pool.last_acquire >= idle_timeout) {
+                for (auto& handle : pool.spares) {
+                    released.push_back(std::move(handle));
+                }
+                pool.spares.clear();
+                pool.active = false;
+                continue;
+            }
+            int have = static_cast<int>(pool.spares.size());
+            int missing = have < options.low_water && now >= pool.retry_at
+                              ? options.target_spares - have : 0;
+            bool check = have > 0 && !options.allow_overage && now - pool.checked_at >= status_interval;
+            if (missing > 0 || check) {
+                pool.checked_at = now;
+                work.push_back({entry.first, missing});
+            }
+        }
+
+        lock.unlock();
+        released.clear();  // queues the returns outside the lock
+
+        for (const Work& item : work) {
+            std::vector<LicenseHandle> seats;
+            int surplus = 0;  // spares to give back because the tool is in overage
+            bool failed = false;
+            try {
+                LicenseStatus status = state.client.get_status(item.tool);
+                int allowed = std::min(item.missing, std::max(0, headroom(status, options.allow_overage)));
+                if (allowed > 0) {
+                    seats = state.client.borrow_many(item.tool, state.user, allowed);
+                }
+                failed = static_cast<int>(seats.size()) < item.missing;
+                if (!options.allow_overage) {
+                    surplus = std::max(0, status.borrowed - status.commit);
+                }
+            } catch (const LicenseException&) {
+                failed = true;
+            }
+
+            lock.lock();
+            auto it = state.tools.find(item.tool);
+            if (!state.stopping && it != state.tools.end() && it->second.active) {
+                State::ToolPool& pool = it->second;
+                if (failed) {
+                    pool.retry_at = Clock::now() + std::max<Clock::duration>(REFILL_BACKOFF, status_interval);
+                }
+                for (; surplus > 0 && !pool.spares.empty(); --surplus) {
+                    released.push_back(std::move(pool.spares.back()));
+                    pool.spares.pop_back();
+                }
+                for (auto& seat : seats) {
+                    if (pool.spares.size() < state.max_spares()) {
+                        pool.spares.push_back(std::move(seat));
+                    }
+                }
+            }
+            lock.unlock();
+            seats.clear();
+            released.clear();
+        }
+        lock.lock();
+    }
+}
+
+} // namespace license
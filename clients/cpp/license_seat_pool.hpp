@@ -0,0 +1,158 @@
+/**
+ * @file license_seat_pool.hpp
+ * @brief Pre-borrowed seat pool on top of LicenseClient
+ *
+ * A long-lived process whose jobs borrow and return the same tools over
+ * and over can keep a few seats per tool borrowed ahead of time. Taking
+ * a seat from the pool is a local operation; the pool refills itself on
+ * a background thread when it runs low and returns a tool's spare seats
+ * once the tool has gone unused for a while.
+ *
+ * Spare seats are speculative, so by default the pool only pre-borrows
+ * seats inside the tool's commit: a seat borrowed into overage is billed
+ * at borrow time whether or not a job ever uses it. While a tool is in
+ * overage the pool gives its spares back, so it never holds an idle seat
+ * that someone else is paying overage for.
+ */
+
+#ifndef LICENSE_SEAT_POOL_HPP
+#define LICENSE_SEAT_POOL_HPP
+
+#include "license_client.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace license {
+
+/**
+ * @brief SeatPool configuration
+ */
+struct SeatPoolOptions {
+    /** Spare seats kept per tool in use */
+    int target_spares = 2;
+
+    /** Refill, back up to target_spares, when spares drop below this */
+    int low_water = 1;
+
+    /** Return a tool's spares after this long without an acquire */
+    long idle_timeout_ms = 30000;
+
+    /**
+     * How often a tool holding spares is checked against its commit.
+     * Uses LicenseClient::get_status, so the client's status cache
+     * (ClientOptions::status_cache_ttl_ms) may serve the check.
+     */
+    long status_interval_ms = 5000;
+
+    /**
+     * Allow spares to be borrowed beyond commit, up to max_overage.
+     * Off by default: prefetched overage seats are billed even if unused.
+     */
+    bool allow_overage = false;
+};
+
+/**
+ * @brief Keeps seats pre-borrowed per tool and lends them out
+ *
+ * Thread safety: acquire() and the Seat operations may be called
+ * concurrently. The LicenseClient must outlive the pool; seats that
+ * outlive the pool return to the server directly.
+ */
+class SeatPool {
+    struct State;
+
+public:
+    /**
+     * @brief A seat lent by the pool
+     *
+     * Goes back to the pool when destroyed or released. The pool keeps
+     * it as a spare or returns it to the server.
+     */
+    class Seat {
+    public:
+        Seat() = default;
+        ~Seat() { release(); }
+
+        Seat(Seat&& other) noexcept = default;
+        Seat& operator=(Seat&& other) noexcept {
+            if (this != &other) {
+                release();
+                handle_ = std::move(other.handle_);
+                pool_ = std::move(other.pool_);
+            }
+            return *this;
+        }
+
+        Seat(const Seat&) = delete;
+        Seat& operator=(const Seat&) = delete;
+
+        /** @brief The underlying license handle */
+        const LicenseHandle& handle() const { return handle_; }
+
+        const std::string& id() const { return handle_.id(); }
+        const std::string& tool() const { return handle_.tool(); }
+        bool is_valid() const { return handle_.is_valid(); }
+
+        /** @brief Give the seat back to the pool now (automatic on destruction) */
+        void release() noexcept;
+
+    private:
+        Seat(LicenseHandle handle, std::weak_ptr<State> pool)
+            : handle_(std::move(handle)), pool_(std::move(pool)) {}
+
+        LicenseHandle handle_;
+        std::weak_ptr<State> pool_;
+
+        friend class SeatPool;
+    };
+
+    /**
+     * @param client Client used for all server traffic
+     * @param user User name the pool borrows seats as
+     * @param options Pool configuration
+     */
+    SeatPool(LicenseClient& client, std::string user, SeatPoolOptions options = {});
+
+    /**
+     * @brief Stops refilling and returns every spare seat
+     */
+    ~SeatPool();
+
+    SeatPool(const SeatPool&) = delete;
+    SeatPool& operator=(const SeatPool&) = delete;
+
+    /**
+     * @brief Take a seat, from the pool when one is spare
+     *
+     * A miss borrows on the calling thread, like LicenseClient::borrow.
+     *
+     * @throws NoLicensesAvailableException if no licenses available
+     * @throws LicenseException on other errors
+     */
+    Seat acquire(const std::string& tool);
+
+    /**
+     * @brief Number of spare seats currently held for @p tool
+     */
+    std::size_t spares(const std::string& tool) const;
+
+    /**
+     * @brief Return every spare seat to the server now
+     *
+     * Tools refill again on their next acquire.
+     */
+    void drain();
+
+private:
+    void maintain();
+
+    std::shared_ptr<State> state_;
+    std::thread maintainer_;
+};
+
+} // namespace license
+
+#endif // LICENSE_SEAT_POOL_HPP
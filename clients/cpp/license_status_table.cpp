@@ -0,0 +1,124 @@
+/**
+ * @file license_status_table.cpp
+ * @brief Interned, struct-of-arrays tool status table
+ */
+
+#include "license_status_table.hpp"
+
+#include <algorithm>
+#include <functional>
+
+namespace license {
+
+std::uint32_t StatusTable::hash(std::string_view tool) {
+    std::size_t h = std::hash<std::string_view>()(tool);
+    return static_cast<std::uint32_t>(h ^ (static_cast<std::uint64_t>(h) >> 32));
+}
+
+std::size_t StatusTable::probe(std::string_view tool, std::uint32_t h) const {
+    std::size_t mask = slots_.size() - 1;
+    for (std::size_t i = h & mask;; i = (i + 1) & mask) {
+        ToolId id = slots_[i];
+        if (id == NO_TOOL || (hashes_[id] == h && this->tool(id) == tool)) {
+            return i;
+        }
+    }
+}
+
+void StatusTable::grow_index() {
+    std::vector<ToolId> slots(std::max<std::size_t>(16, slots_.size() * 2), NO_TOOL);
+    std::size_t mask = slots.size() - 1;
+    for (ToolId id = 0; id < hashes_.size(); ++id) {
+        std::size_t i = hashes_[id] & mask;
+        while (slots[i] != NO_TOOL) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = id;
+    }
+    slots_ = std::move(slots);
+}
+
+StatusTable::ToolId StatusTable::find(std::string_view tool) const {
+    if (slots_.empty()) return NO_TOOL;
+    return slots_[probe(tool, hash(tool))];
+}
+
+StatusTable::ToolId StatusTable::intern(std::string_view tool) {
+    std::uint32_t h = hash(tool);
+    if (!slots_.empty()) {
+        ToolId id = slots_[probe(tool, h)];
+        if (id != NO_TOOL) return id;
+    }
+    if ((size() + 1) * 2 > slots_.size()) {
+        grow_index();
+    }
+    auto id = static_cast<ToolId>(size());
+    names_.append(tool);
+    name_end_.push_back(static_cast<std::uint32_t>(names_.size()));
+    hashes_.push_back(h);
+    slots_[probe(tool, h)] = id;
+
+    total_.push_back(0);
+    borrowed_.push_back(0);
+    available_.push_back(0);
+    commit_.push_back(0);
+    max_overage_.push_back(0);
+    overage_.push_back(0);
+    in_commit_.push_back(1);
+    present_.push_back(0);
+    return id;
+}
+
+void StatusTable::set(ToolId id, const LicenseStatus& status) {
+    total_[id] = status.total;
+    borrowed_[id] = status.borrowed;
+    available_[id] = status.available;
+    commit_[id] = status.commit;
+    max_overage_[id] = status.max_overage;
+    overage_[id] = status.overage;
+    in_commit_[id] = status.in_commit ? 1 : 0;
+    present_[id] = 1;
+}
+
+StatusTable::ToolId StatusTable::set(const LicenseStatus& status) {
+    ToolId id = intern(status.tool);
+    set(id, status);
+    return id;
+}
+
+void StatusTable::clear() {
+    std::fill(present_.begin(), present_.end(), 0);
+}
+
+void StatusTable::assign(const std::vector<LicenseStatus>& statuses) {
+    clear();
+    for (const LicenseStatus& status : statuses) {
+        set(status);
+    }
+}
+
+LicenseStatus StatusTable::status(ToolId id) const {
+    LicenseStatus status;
+    status.tool = std::string(tool(id));
+    status.total = total_[id];
+    status.borrowed = borrowed_[id];
+    status.available = available_[id];
+    status.commit = commit_[id];
+    status.max_overage = max_overage_[id];
+    status.overage = overage_[id];
+    status.in_commit = in_commit_[id] != 0;
+    return status;
+}
+
+std::vector<LicenseStatus> StatusTable::statuses() const {
+    std::vector<LicenseStatus> out;
+    out.reserve(static_cast<std::size_t>(std::count(present_.begin(), present_.end(), 1)));
+    for (ToolId id = 0; id < size(); ++id) {
+        if (present_[id]) {
+            out.push_back(status(id));
+        }
+    }
+    return out;
+}
+
+} // namespace license
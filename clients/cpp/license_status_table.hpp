@@ -0,0 +1,125 @@
+/**
+ * @file license_status_table.hpp
+ * @brief Status of many tools, indexed by interned tool IDs
+ *
+ * A scheduler that asks "can this job's tool run?" before every dispatch
+ * should not walk a std::vector<LicenseStatus> comparing strings. A
+ * StatusTable interns each tool name once into a small integer ID and
+ * keeps the counts in struct-of-arrays form, one array per field, so a
+ * check by ID reads two array elements and a lookup by name is one hash
+ * probe. Names live in a single buffer, not in a string per tool.
+ *
+ * Refill the table with LicenseClient::get_all_statuses(StatusTable&);
+ * IDs interned earlier keep their meaning across refills.
+ */
+
+#ifndef LICENSE_STATUS_TABLE_HPP
+#define LICENSE_STATUS_TABLE_HPP
+
+#include "license_client.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace license {
+
+/**
+ * @brief Tool statuses in struct-of-arrays form, by interned tool ID
+ *
+ * IDs are dense, 0 to size() - 1, and stay valid for the table's
+ * lifetime. A tool the last refill did not list stays interned but is
+ * not present(). Not thread-safe; const members may run concurrently
+ * with each other.
+ */
+class StatusTable {
+public:
+    using ToolId = std::uint32_t;
+    static constexpr ToolId NO_TOOL = std::numeric_limits<ToolId>::max();
+
+    StatusTable() = default;
+    explicit StatusTable(const std::vector<LicenseStatus>& statuses) { assign(statuses); }
+
+    /**
+     * @brief ID of @p tool, interning it (not present, zero counts) if new
+     */
+    ToolId intern(std::string_view tool);
+
+    /**
+     * @brief ID of @p tool, or NO_TOOL if it was never interned
+     */
+    ToolId find(std::string_view tool) const;
+
+    /**
+     * @brief Replace every tool's status: listed tools become present,
+     * the rest absent
+     */
+    void assign(const std::vector<LicenseStatus>& statuses);
+
+    /** @brief Set one tool's status, interning it if new */
+    ToolId set(const LicenseStatus& status);
+    void set(ToolId id, const LicenseStatus& status);
+
+    /** @brief Mark every tool absent; IDs are kept */
+    void clear();
+
+    /** @brief Interned tools, absent ones included */
+    std::size_t size() const { return total_.size(); }
+
+    /** @brief Name of @p id; valid until a new tool is interned */
+    std::string_view tool(ToolId id) const {
+        std::uint32_t begin = id == 0 ? 0 : name_end_[id - 1];
+        return std::string_view(names_.data() + begin, name_end_[id] - begin);
+    }
+
+    bool present(ToolId id) const { return present_[id] != 0; }
+    int total(ToolId id) const { return total_[id]; }
+    int borrowed(ToolId id) const { return borrowed_[id]; }
+    int available(ToolId id) const { return available_[id]; }
+    int commit(ToolId id) const { return commit_[id]; }
+    int max_overage(ToolId id) const { return max_overage_[id]; }
+    int overage(ToolId id) const { return overage_[id]; }
+    bool in_commit(ToolId id) const { return in_commit_[id] != 0; }
+
+    /**
+     * @brief Whether @p seats more seats of @p id are free, as of the last refill
+     */
+    bool can_borrow(ToolId id, int seats = 1) const {
+        return present_[id] != 0 && available_[id] >= seats;
+    }
+
+    /** @brief The status of @p id as a LicenseStatus */
+    LicenseStatus status(ToolId id) const;
+
+    /** @brief Every present tool's status, in ID order */
+    std::vector<LicenseStatus> statuses() const;
+
+private:
+    static std::uint32_t hash(std::string_view tool);
+    // Slot holding @p tool, or the empty slot where it would go
+    std::size_t probe(std::string_view tool, std::uint32_t h) const;
+    void grow_index();
+
+    // All names back to back; tool i ends at name_end_[i]
+    std::string names_;
+    std::vector<std::uint32_t> name_end_;
+    std::vector<std::uint32_t> hashes_;
+    // Open-addressed name index, a power of two in size, at most half full
+    std::vector<ToolId> slots_;
+
+    std::vector<int> total_;
+    std::vector<int> borrowed_;
+    std::vector<int> available_;
+    std::vector<int> commit_;
+    std::vector<int> max_overage_;
+    std::vector<int> overage_;
+    std::vector<std::uint8_t> in_commit_;
+    std::vector<std::uint8_t> present_;
+};
+
+} // namespace license
+
+#endif // LICENSE_STATUS_TABLE_HPP
@@ -0,0 +1,209 @@
+/**
+ * @file license_timer_wheel.hpp
+ * @brief Hierarchical timer wheel (internal)
+ *
+ * Schedules many timers on one thread with O(1) schedule and cancel.
+ * Time is measured in caller-defined ticks. Level 0 has one slot per
+ * tick for the next 64 ticks; each higher level covers 64 times the span
+ * of the one below, and its slots are cascaded down as level 0 wraps, so
+ * a timer is moved at most once per level. Five levels cover 2^30 ticks
+ * ahead; later deadlines wait in the last level and cascade again.
+ *
+ * Not thread-safe; not installed. Used by license_client.cpp only.
+ */
+
+#ifndef LICENSE_TIMER_WHEEL_HPP
+#define LICENSE_TIMER_WHEEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace license {
+namespace detail {
+
+template <typename T>
+class TimerWheel {
+public:
+    using TimerId = std::uint32_t;
+    static constexpr TimerId NO_TIMER = std::numeric_limits<TimerId>::max();
+
+    explicit TimerWheel(std::uint64_t now = 0) : now_(now) {
+        for (auto& level : heads_) {
+            for (auto& head : level) head = NO_TIMER;
+        }
+    }
+
+    std::uint64_t now() const { return now_; }
+    std::size_t size() const { return size_; }
+
+    /** @brief Fire @p value at @p deadline (in the past means next tick) */
+    TimerId schedule(std::uint64_t deadline, T value) {
+        TimerId id;
+        if (free_ != NO_TIMER) {
+            id = free_;
+            free_ = nodes_[id].next;
+        } else {
+            id = static_cast<TimerId>(nodes_.size());
+            nodes_.emplace_back();
+        }
+        Node& node = nodes_[id];
+        node.value = std::move(value);
+        node.deadline = deadline > now_ ? deadline : now_ + 1;
+        node.live = true;
+        link(id);
+        ++size_;
+        return id;
+    }
+
+    /** @brief Drop a pending timer; false if it already fired or was cancelled */
+    bool cancel(TimerId id) {
+        if (id >= nodes_.size() || !nodes_[id].live) return false;
+        unlink(id);
+        release(id);
+        return true;
+    }
+
+    /**
+     * @brief Move time forward to @p now, calling on_expire(T&&) for each
+     *        timer that falls due, one tick at a time
+     */
+    template <typename F>
+    void advance(std::uint64_t now, F&& on_expire) {
+        while (now_ < now) {
+            if (size_ == 0) {
+                now_ = now;
+                return;
+            }
+            // Skip ticks with nothing to do, up to the next level 0 wrap
+            std::uint64_t step = until_next(now - now_);
+            now_ += step;
+            std::size_t slot = static_cast<std::size_t>(now_ & MASK);
+            if (slot == 0) cascade();
+            TimerId id = heads_[0][slot];
+            heads_[0][slot] = NO_TIMER;
+            occupied_[0] &= ~(std::uint64_t(1) << slot);
+            while (id != NO_TIMER) {
+                TimerId next = nodes_[id].next;
+                if (nodes_[id].deadline <= now_) {
+                    T value = std::move(nodes_[id].value);
+                    release(id);
+                    on_expire(std::move(value));
+                } else {
+                    link(id);  // a far deadline parked in the last level
+                }
+                id = next;
+            }
+        }
+    }
+
+    /**
+     * @brief Ticks until advance() next has work: exact within level 0,
+     *        otherwise the next level 0 wrap (when higher levels cascade)
+     */
+    std::uint64_t ticks_until_next() const {
+        if (size_ == 0) return std::numeric_limits<std::uint64_t>::max();
+        return until_next(SLOTS);
+    }
+
+private:
+    static constexpr int LEVELS = 5;
+    static constexpr int BITS = 6;
+    static constexpr std::size_t SLOTS = std::size_t(1) << BITS;
+    static constexpr std::uint64_t MASK = SLOTS - 1;
+
+    struct Node {
+        T value{};
+        std::uint64_t deadline = 0;
+        TimerId prev = NO_TIMER;
+        TimerId next = NO_TIMER;
+        std::uint8_t level = 0;
+        std::uint8_t slot = 0;
+        bool live = false;
+    };
+
+    // Distance to the next occupied level 0 slot after now_, capped at
+    // the wrap and at @p limit
+    std::uint64_t until_next(std::uint64_t limit) const {
+        std::uint64_t current = now_ & MASK;
+        std::uint64_t to_wrap = SLOTS - current;
+        std::uint64_t ahead = current + 1 < SLOTS ? occupied_[0] >> (current + 1) : 0;
+        std::uint64_t step = ahead ? static_cast<std::uint64_t>(__builtin_ctzll(ahead)) + 1 : to_wrap;
+        return step < limit ? step : limit;
+    }
+
+    void link(TimerId id) {
+        Node& node = nodes_[id];
+        std::uint64_t delta = node.deadline - now_;
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (std::uint64_t(1) << (BITS * (level + 1)))) {
+            ++level;
+        }
+        std::uint64_t at = node.deadline;
+        if (level == LEVELS - 1 && delta >= (std::uint64_t(1) << (BITS * LEVELS))) {
+            // Beyond the last level's span: park one full span ahead
+            at = now_ + (std::uint64_t(1) << (BITS * LEVELS)) - 1;
+        }
+        std::size_t slot = static_cast<std::size_t>((at >> (BITS * level)) & MASK);
+        node.level = static_cast<std::uint8_t>(level);
+        node.slot = static_cast<std::uint8_t>(slot);
+        node.prev = NO_TIMER;
+        node.next = heads_[level][slot];
+        if (node.next != NO_TIMER) nodes_[node.next].prev = id;
+        heads_[level][slot] = id;
+        occupied_[level] |= std::uint64_t(1) << slot;
+    }
+
+    void unlink(TimerId id) {
+        Node& node = nodes_[id];
+        if (node.prev != NO_TIMER) {
+            nodes_[node.prev].next = node.next;
+        } else {
+            heads_[node.level][node.slot] = node.next;
+            if (node.next == NO_TIMER) {
+                occupied_[node.level] &= ~(std::uint64_t(1) << node.slot);
+            }
+        }
+        if (node.next != NO_TIMER) nodes_[node.next].prev = node.prev;
+    }
+
+    void release(TimerId id) {
+        Node& node = nodes_[id];
+        node.value = T{};
+        node.live = false;
+        node.next = free_;
+        free_ = id;
+        --size_;
+    }
+
+    // Level 0 wrapped: redistribute the now-current slot of each higher
+    // level whose own index wrapped too
+    void cascade() {
+        for (int level = 1; level < LEVELS; ++level) {
+            std::size_t slot = static_cast<std::size_t>((now_ >> (BITS * level)) & MASK);
+            TimerId id = heads_[level][slot];
+            heads_[level][slot] = NO_TIMER;
+            occupied_[level] &= ~(std::uint64_t(1) << slot);
+            while (id != NO_TIMER) {
+                TimerId next = nodes_[id].next;
+                link(id);
+                id = next;
+            }
+            if (slot != 0) break;
+        }
+    }
+
+    std::uint64_t now_;
+    std::size_t size_ = 0;
+    std::vector<Node> nodes_;
+    TimerId free_ = NO_TIMER;
+    TimerId heads_[LEVELS][SLOTS];
+    std::uint64_t occupied_[LEVELS] = {};
+};
+
+} // namespace detail
+} // namespace license
+
+#endif // LICENSE_TIMER_WHEEL_HPP
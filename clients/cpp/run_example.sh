@@ -16,14 +16,6 @@ echo -e "${BLUE}========================================${NC}"
 echo ""
 
 # Check dependencies
-if ! pkg-config --exists jsoncpp 2>/dev/null; then
-    echo -e "${RED}❌ jsoncpp not found${NC}"
-    echo "Please install jsoncpp:"
-    echo "  Ubuntu/Debian: sudo apt-get install libjsoncpp-dev"
-    echo "  macOS: brew install jsoncpp"
-    exit 1
-fi
-
 if ! pkg-config --exists libcurl 2>/dev/null && ! command -v curl-config &> /dev/null; then
     echo -e "${RED}❌ libcurl not found${NC}"
     echo "Please install libcurl:"
@@ -0,0 +1,56 @@
+/**
+ * @file check.hpp
+ * @brief Assertions for the unit tests, which have no framework
+ *
+ * CHECK records a failure and carries on; the test's main() returns
+ * check::exit_code(), so ctest reports the executable as failed if any
+ * check did.
+ */
+
+#ifndef LICENSE_TESTS_CHECK_HPP
+#define LICENSE_TESTS_CHECK_HPP
+
+#include "license_client.hpp"
+
+#include <cstdio>
+
+namespace check {
+
+inline int& failures() {
+    static int count = 0;
+    return count;
+}
+
+inline void fail(const char* file, int line, const char* what) {
+    std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+    ++failures();
+}
+
+// Whether f() throws LicenseException
+template <typename F>
+bool throws(F&& f) {
+    try {
+        f();
+    } catch (const license::LicenseException&) {
+        return true;
+    }
+    return false;
+}
+
+inline int exit_code() {
+    if (failures() > 0) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures());
+        return 1;
+    }
+    return 0;
+}
+
+} // namespace check
+
+#define CHECK(expr) \
+    do { if (!(expr)) check::fail(__FILE__, __LINE__, #expr); } while (0)
+
+#define CHECK_THROWS(expr) \
+    do { if (!check::throws([&] { expr; })) check::fail(__FILE__, __LINE__, "throws: " #expr); } while (0)
+
+#endif // LICENSE_TESTS_CHECK_HPP
@@ -0,0 +1,148 @@
+/**
+ * @file test_json.cpp
+ * @brief json::Reader on well-formed, hostile and truncated input
+ */
+
+#include "license_json.hpp"
+#include "check.hpp"
+
+#include <string>
+
+using license::json::Reader;
+
+namespace {
+
+std::string decode_string(const std::string& text) {
+    Reader reader(text);
+    std::string out;
+    reader.string(out);
+    reader.finish();
+    return out;
+}
+
+void test_escapes() {
+    CHECK(decode_string(R"("plain")") == "plain");
+    CHECK(decode_string(R"("a\"b\\c\/d")") == "a\"b\\c/d");
+    CHECK(decode_string(R"("\b\f\n\r\t")") == "\b\f\n\r\t");
+    CHECK(decode_string(R"("A\u00e9\u20AC")") == "A\xC3\xA9\xE2\x82\xAC");
+    CHECK(decode_string(R"(null)").empty());
+    CHECK_THROWS(decode_string(R"("\x")"));
+    CHECK_THROWS(decode_string(R"("\u00")"));
+    CHECK_THROWS(decode_string(R"("\u00zz")"));
+    CHECK_THROWS(decode_string(R"("unterminated)"));
+    CHECK_THROWS(decode_string(R"("trailing\)"));
+}
+
+void test_surrogates() {
+    // U+1F600 as a surrogate pair
+    CHECK(decode_string(R"("\uD83D\uDE00")") == "\xF0\x9F\x98\x80");
+    CHECK(decode_string(R"("x\ud83d\ude00y")") == "x\xF0\x9F\x98\x80y");
+    CHECK_THROWS(decode_string(R"("\ud83d")"));
+    CHECK_THROWS(decode_string(R"("\ud83dx")"));
+    CHECK_THROWS(decode_string(R"("\ud83d\u0041")"));
+    CHECK_THROWS(decode_string(R"("\ude00")"));
+}
+
+void test_escaped_keys() {
+    Reader reader(R"({"t\u006fol":"cad","a\/b":1})");
+    std::string tool;
+    int n = 0;
+    reader.object([&](std::string_view key) {
+        if (key == "tool") {
+            reader.string(tool);
+        } else if (key == "a/b") {
+            n = reader.integer();
+        } else {
+            reader.skip();
+        }
+    });
+    CHECK(tool == "cad");
+    CHECK(n == 1);
+}
+
+void test_unknown_fields_skipped() {
+    Reader reader(R"({"extra":{"a":[1,2.5e3,{"b":null}],"c":"\"}"},"id":"x1","more":[true,false],"total":7})");
+    std::string id;
+    int total = 0;
+    reader.object([&](std::string_view key) {
+        if (key == "id") {
+            reader.string(id);
+        } else if (key == "total") {
+            total = reader.integer();
+        } else {
+            reader.skip();
+        }
+    });
+    reader.finish();
+    CHECK(id == "x1");
+    CHECK(total == 7);
+}
+
+void test_depth_limit() {
+    auto nested = [](int depth) {
+        return std::string(static_cast<std::size_t>(depth), '[') + std::string(static_cast<std::size_t>(depth), ']');
+    };
+    const std::string deepest = nested(64);
+    Reader reader(deepest);
+    reader.skip();
+    reader.finish();
+    CHECK_THROWS(Reader(nested(100)).skip());
+    // Deep enough to overflow the stack without the limit
+    CHECK_THROWS(Reader(std::string(100000, '[')).skip());
+    CHECK_THROWS(Reader(std::string(100000, '{')).skip());
+}
+
+void test_numbers() {
+    CHECK(Reader("42").integer() == 42);
+    CHECK(Reader("-7").integer() == -7);
+    CHECK(Reader("20.0").integer() == 20);
+    CHECK(Reader("1e2").integer() == 100);
+    CHECK(Reader("null").integer() == 0);
+    CHECK(Reader("1700000000000").integer64() == 1700000000000LL);
+    CHECK_THROWS(Reader("3000000000").integer());
+    CHECK_THROWS(Reader("1e300").integer64());
+    CHECK_THROWS(Reader("-").integer());
+    CHECK_THROWS(Reader("1.").integer());
+    CHECK_THROWS(Reader("\"5\"").integer());
+}
+
+void test_truncated() {
+    const std::string doc = R"({"id":"abc","borrows":[{"id":"b1"},{"id":"b2"}],"granted":2})";
+    for (std::size_t n = 0; n < doc.size(); ++n) {
+        CHECK_THROWS({
+            Reader reader(std::string_view(doc.data(), n));
+            reader.skip();
+            reader.finish();
+        });
+    }
+    Reader whole(doc);
+    whole.skip();
+    whole.finish();
+    const std::string trailing = doc + "x";
+    CHECK_THROWS({
+        Reader reader(trailing);
+        reader.skip();
+        reader.finish();
+    });
+}
+
+void test_count() {
+    CHECK(Reader("[]").count() == 0);
+    CHECK(Reader(R"([1,"a",{"b":[2]},null])").count() == 4);
+    CHECK_THROWS(Reader("[1,]").count());
+    CHECK_THROWS(Reader("[1 2]").count());
+}
+
+} // namespace
+
+int main() {
+    test_escapes();
+    test_surrogates();
+    test_escaped_keys();
+    test_unknown_fields_skipped();
+    test_depth_limit();
+    test_numbers();
+    test_truncated();
+    test_count();
+    return check::exit_code();
+}
@@ -0,0 +1,177 @@
+/**
+ * @file test_msgpack.cpp
+ * @brief msgpack::Reader on well-formed, hostile and truncated input
+ */
+
+#include "license_msgpack.hpp"
+#include "check.hpp"
+
+#include <initializer_list>
+#include <string>
+
+using license::msgpack::Reader;
+
+namespace {
+
+std::string bytes(std::initializer_list<int> values) {
+    std::string out;
+    for (int v : values) out.push_back(static_cast<char>(v));
+    return out;
+}
+
+std::string fixstr(const std::string& s) {
+    return bytes({0xA0 | static_cast<int>(s.size())}) + s;
+}
+
+void test_strings() {
+    std::string out;
+    const std::string fix = fixstr("cad");
+    Reader(fix).string(out);
+    CHECK(out == "cad");
+
+    const std::string str8 = bytes({0xD9, 5}) + "hello";
+    Reader(str8).string(out);
+    CHECK(out == "hello");
+
+    const std::string str16 = bytes({0xDA, 0x00, 0x02}) + "ok";
+    Reader(str16).string(out);
+    CHECK(out == "ok");
+
+    const std::string nil = bytes({0xC0});
+    out = "stale";
+    Reader(nil).string(out);
+    CHECK(out.empty());
+
+    const std::string number = bytes({0x05});
+    CHECK_THROWS(Reader(number).string(out));
+}
+
+void test_truncated_lengths() {
+    std::string out;
+    // Declared lengths past the end of the input
+    const std::string fix = bytes({0xA5}) + "abc";
+    const std::string str8 = bytes({0xD9, 200}) + "abc";
+    const std::string str32 = bytes({0xDB, 0xFF, 0xFF, 0xFF, 0xFF}) + "abc";
+    const std::string str16_header = bytes({0xDA, 0x00});
+    CHECK_THROWS(Reader(fix).string(out));
+    CHECK_THROWS(Reader(str8).string(out));
+    CHECK_THROWS(Reader(str32).string(out));
+    CHECK_THROWS(Reader(str16_header).string(out));
+
+    const std::string bin32 = bytes({0xC6, 0x7F, 0xFF, 0xFF, 0xFF, 0x00});
+    const std::string ext8 = bytes({0xC7, 0x04, 0x01, 0x00});
+    const std::string fixext16 = bytes({0xD8, 0x01, 0x00, 0x00});
+    const std::string uint64 = bytes({0xCF, 0x00, 0x00});
+    CHECK_THROWS(Reader(bin32).skip());
+    CHECK_THROWS(Reader(ext8).skip());
+    CHECK_THROWS(Reader(fixext16).skip());
+    CHECK_THROWS(Reader(uint64).skip());
+
+    const std::string empty;
+    CHECK_THROWS(Reader(empty).skip());
+    CHECK_THROWS(Reader(empty).integer());
+}
+
+void test_oversized_counts() {
+    // Counts that could not fit in the remaining bytes fail before any
+    // element is read, so a hostile header cannot drive a long loop
+    const std::string array32 = bytes({0xDD, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0x02});
+    const std::string map32 = bytes({0xDF, 0xFF, 0xFF, 0xFF, 0xFF, 0xA1, 'a', 0x01});
+    const std::string array16 = bytes({0xDC, 0x00, 0x03, 0x01, 0x02});
+    const std::string fixmap = bytes({0x82, 0xA1, 'a', 0x01});
+    CHECK_THROWS(Reader(array32).count());
+    CHECK_THROWS(Reader(array32).skip());
+    CHECK_THROWS(Reader(map32).skip());
+    CHECK_THROWS(Reader(array16).count());
+    CHECK_THROWS(Reader(fixmap).object([](std::string_view) {}));
+
+    const std::string exact = bytes({0xDC, 0x00, 0x03, 0x01, 0x02, 0x03});
+    CHECK(Reader(exact).count() == 3);
+}
+
+void test_depth_limit() {
+    auto nested = [](std::size_t depth) {
+        return std::string(depth, static_cast<char>(0x91)) + bytes({0x90});
+    };
+    const std::string deepest = nested(64);
+    Reader reader(deepest);
+    reader.skip();
+    reader.finish();
+
+    const std::string too_deep = nested(100);
+    CHECK_THROWS(Reader(too_deep).skip());
+
+    // fixmap {"k": {"k": ...}}
+    std::string maps;
+    for (int i = 0; i < 10000; ++i) maps += bytes({0x81, 0xA1, 'k'});
+    maps += bytes({0xC0});
+    CHECK_THROWS(Reader(maps).skip());
+}
+
+void test_unknown_fields_skipped() {
+    // {"ext": fixext4, "bin": bin8, "nested": {"f": float64, "a": [nil, true]},
+    //  "id": "x1", "total": 7}
+    std::string doc = bytes({0x85});
+    doc += fixstr("ext") + bytes({0xD6, 0x01, 1, 2, 3, 4});
+    doc += fixstr("bin") + bytes({0xC4, 0x02, 0xAA, 0xBB});
+    doc += fixstr("nested") + bytes({0x82});
+    doc += fixstr("f") + bytes({0xCB, 0x40, 0x09, 0x21, 0xFB, 0x54, 0x44, 0x2D, 0x18});
+    doc += fixstr("a") + bytes({0x92, 0xC0, 0xC3});
+    doc += fixstr("id") + fixstr("x1");
+    doc += fixstr("total") + bytes({0x07});
+
+    Reader reader(doc);
+    std::string id;
+    int total = 0;
+    reader.object([&](std::string_view key) {
+        if (key == "id") {
+            reader.string(id);
+        } else if (key == "total") {
+            total = reader.integer();
+        } else {
+            reader.skip();
+        }
+    });
+    reader.finish();
+    CHECK(id == "x1");
+    CHECK(total == 7);
+
+    const std::string int_key = bytes({0x81, 0x01, 0x02});
+    CHECK_THROWS(Reader(int_key).object([](std::string_view) {}));
+    const std::string reserved = bytes({0xC1});
+    CHECK_THROWS(Reader(reserved).skip());
+}
+
+void test_numbers() {
+    const std::string pos = bytes({0x2A});
+    const std::string neg = bytes({0xFF});
+    const std::string u16 = bytes({0xCD, 0x01, 0x00});
+    const std::string i8 = bytes({0xD0, 0x80});
+    const std::string f64 = bytes({0xCB, 0x40, 0x34, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00});
+    const std::string big = bytes({0xCF, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00});
+    const std::string u32 = bytes({0xCE, 0xFF, 0xFF, 0xFF, 0xFF});
+    CHECK(Reader(pos).integer() == 42);
+    CHECK(Reader(neg).integer() == -1);
+    CHECK(Reader(u16).integer() == 256);
+    CHECK(Reader(i8).integer() == -128);
+    CHECK(Reader(f64).integer() == 20);
+    CHECK_THROWS(Reader(big).integer());
+    CHECK_THROWS(Reader(u32).integer());
+
+    const std::string one = bytes({0x01, 0x02});
+    Reader trailing(one);
+    CHECK(trailing.integer() == 1);
+    CHECK_THROWS(trailing.finish());
+}
+
+} // namespace
+
+int main() {
+    test_strings();
+    test_truncated_lengths();
+    test_oversized_counts();
+    test_depth_limit();
+    test_unknown_fields_skipped();
+    test_numbers();
+    return check::exit_code();
+}
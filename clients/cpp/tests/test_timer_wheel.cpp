@@ -0,0 +1,193 @@
+/**
+ * @file test_timer_wheel.cpp
+ * @brief detail::TimerWheel: cascades, cancellation and far deadlines
+ *
+ * Every timer must fire exactly on its deadline tick, whichever level it
+ * was first linked into.
+ */
+
+#include "license_timer_wheel.hpp"
+#include "check.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+using license::detail::TimerWheel;
+
+namespace {
+
+using Wheel = TimerWheel<std::size_t>;
+
+// Schedules timers and checks each one fires once, on its due tick
+struct Harness {
+    Wheel wheel;
+    std::vector<std::uint64_t> due;
+    std::vector<std::uint64_t> fired_at;
+    std::vector<int> fire_count;
+    std::vector<Wheel::TimerId> ids;
+
+    explicit Harness(std::uint64_t now = 0) : wheel(now) {}
+
+    std::size_t add(std::uint64_t deadline) {
+        std::size_t index = due.size();
+        due.push_back(deadline > wheel.now() ? deadline : wheel.now() + 1);
+        fired_at.push_back(0);
+        fire_count.push_back(0);
+        ids.push_back(wheel.schedule(deadline, index));
+        return index;
+    }
+
+    void advance(std::uint64_t to) {
+        wheel.advance(to, [&](std::size_t index) {
+            fired_at[index] = wheel.now();
+            ++fire_count[index];
+        });
+        CHECK(wheel.now() == to);
+    }
+
+    bool on_time(std::size_t index) const {
+        return fire_count[index] == 1 && fired_at[index] == due[index];
+    }
+
+    bool pending(std::size_t index) const { return fire_count[index] == 0; }
+};
+
+void test_level_boundaries() {
+    // Deadlines either side of each level's span, from an unaligned start
+    for (std::uint64_t start : {std::uint64_t(0), std::uint64_t(10), std::uint64_t(4000)}) {
+        Harness h(start);
+        std::vector<std::size_t> timers;
+        for (int level = 1; level <= 4; ++level) {
+            std::uint64_t span = std::uint64_t(1) << (6 * level);
+            for (std::uint64_t delta : {span - 1, span, span + 1}) {
+                timers.push_back(h.add(start + delta));
+            }
+        }
+        timers.push_back(h.add(start + 1));
+        h.advance(start + (std::uint64_t(1) << 24) + 2);
+        for (std::size_t index : timers) CHECK(h.on_time(index));
+        CHECK(h.wheel.size() == 0);
+    }
+}
+
+void test_past_deadline_fires_next_tick() {
+    Harness h(100);
+    std::size_t past = h.add(5);
+    std::size_t now = h.add(100);
+    h.advance(100);
+    CHECK(h.pending(past));
+    h.advance(101);
+    CHECK(h.on_time(past));
+    CHECK(h.on_time(now));
+    CHECK(h.fired_at[past] == 101);
+}
+
+void test_cancel() {
+    Harness h;
+    std::size_t near = h.add(3);
+    std::size_t cascaded = h.add(5000);
+    std::size_t kept = h.add(5000);
+    std::size_t fired = h.add(2);
+    CHECK(h.wheel.size() == 4);
+
+    CHECK(h.wheel.cancel(h.ids[near]));
+    CHECK(!h.wheel.cancel(h.ids[near]));
+    h.advance(2);
+    CHECK(h.on_time(fired));
+    CHECK(!h.wheel.cancel(h.ids[fired]));
+
+    // Cancel after the timer has cascaded down from a higher level
+    h.advance(4990);
+    CHECK(h.wheel.cancel(h.ids[cascaded]));
+    h.advance(6000);
+    CHECK(h.pending(near));
+    CHECK(h.pending(cascaded));
+    CHECK(h.on_time(kept));
+    CHECK(h.wheel.size() == 0);
+    CHECK(!h.wheel.cancel(Wheel::TimerId(12345)));
+
+    // Released ids are reused
+    std::size_t reused = h.add(6010);
+    CHECK(h.ids[reused] == h.ids[near] || h.ids[reused] == h.ids[cascaded] ||
+          h.ids[reused] == h.ids[kept] || h.ids[reused] == h.ids[fired]);
+    h.advance(6010);
+    CHECK(h.on_time(reused));
+}
+
+void test_far_deadlines() {
+    // Beyond the 2^30-tick reach of the last level
+    const std::uint64_t reach = std::uint64_t(1) << 30;
+    Harness h(7);
+    std::size_t just_past = h.add(7 + reach);
+    std::size_t far = h.add(7 + 2 * reach + 12345);
+    std::size_t near = h.add(70);
+    h.advance(7 + reach - 1);
+    CHECK(h.on_time(near));
+    CHECK(h.pending(just_past));
+    CHECK(h.pending(far));
+    h.advance(7 + reach);
+    CHECK(h.on_time(just_past));
+    h.advance(7 + 2 * reach + 12344);
+    CHECK(h.pending(far));
+    h.advance(7 + 2 * reach + 12345);
+    CHECK(h.on_time(far));
+}
+
+void test_idle_jump() {
+    // An empty wheel jumps straight to the target; later timers still
+    // land on the right slots
+    Harness h;
+    h.advance(1000003);
+    std::size_t a = h.add(1000003 + 64);
+    std::size_t b = h.add(1000003 + 70000);
+    CHECK(h.wheel.ticks_until_next() <= 64);
+    h.advance(1000003 + 80000);
+    CHECK(h.on_time(a));
+    CHECK(h.on_time(b));
+    CHECK(h.wheel.ticks_until_next() == std::numeric_limits<std::uint64_t>::max());
+}
+
+void test_random_against_reference() {
+    std::mt19937_64 rng(42);
+    Harness h(rng() % 100000);
+    std::vector<bool> cancelled;
+    for (int round = 0; round < 200; ++round) {
+        for (int i = 0; i < 20; ++i) {
+            int scale = static_cast<int>(rng() % 4);
+            std::uint64_t delta = rng() % (std::uint64_t(1) << (6 * scale + 6));
+            h.add(h.wheel.now() + delta);
+            cancelled.push_back(false);
+        }
+        for (int i = 0; i < 5; ++i) {
+            // Only live timers: a released id may belong to a newer one
+            std::size_t index = rng() % h.due.size();
+            if (!h.pending(index) || cancelled[index]) continue;
+            CHECK(h.wheel.cancel(h.ids[index]));
+            cancelled[index] = true;
+        }
+        h.advance(h.wheel.now() + rng() % 5000);
+        for (std::size_t index = 0; index < h.due.size(); ++index) {
+            if (cancelled[index]) {
+                CHECK(h.pending(index));
+            } else if (h.due[index] <= h.wheel.now()) {
+                CHECK(h.on_time(index));
+            } else {
+                CHECK(h.pending(index));
+            }
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    test_level_boundaries();
+    test_past_deadline_fires_next_tick();
+    test_cancel();
+    test_far_deadlines();
+    test_idle_jump();
+    test_random_against_reference();
+    return check::exit_code();
+}
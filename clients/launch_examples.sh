@@ -116,15 +116,6 @@ case $LANGUAGE in
         
         cd "${SCRIPT_DIR}/cpp"
         
-        # Check dependencies
-        if ! pkg-config --exists jsoncpp 2>/dev/null; then
-            echo -e "${RED}❌ jsoncpp not found${NC}"
-            echo "Please install jsoncpp:"
-            echo "  Ubuntu/Debian: sudo apt-get install libjsoncpp-dev"
-            echo "  macOS: brew install jsoncpp"
-            exit 1
-        fi
-        
         # Build if needed
         if [ ! -f "license_client_example" ]; then
             echo -e "${BLUE}Building C++ client...${NC}"
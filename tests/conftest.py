@@ -0,0 +1,42 @@
+"""Helpers shared by the API tests; import them with `from conftest import ...`."""
+import os
+import tempfile
+import time
+from contextlib import contextmanager
+
+os.environ["LICENSE_DB_SEED"] = "false"
+
+SEED_LICENSES = [{"tool": "cad_tool", "total": 2, "commit_qty": 1, "max_overage": 1}]
+
+
+@contextmanager
+def temp_db():
+    with tempfile.TemporaryDirectory() as td:
+        db_path = os.path.join(td, "test.db")
+        os.environ["LICENSE_DB_PATH"] = db_path
+        yield db_path
+
+
+def make_app_with_seed(licenses=None):
+    from app.main import app
+    from app.db import initialize_database
+
+    initialize_database(licenses or SEED_LICENSES)
+    return app
+
+
+def make_client(licenses=None):
+    from fastapi.testclient import TestClient
+
+    return TestClient(make_app_with_seed(licenses))
+
+
+def signed_headers(tool, user):
+    from app.security import generate_signature
+
+    timestamp = str(int(time.time()))
+    return {
+        "X-Signature": generate_signature(tool, user, timestamp),
+        "X-Timestamp": timestamp,
+        "X-Vendor-ID": "techvendor",
+    }
@@ -0,0 +1,103 @@
+import asyncio
+import threading
+import time
+
+from app.borrow_queue import BorrowQueue
+from conftest import make_client, signed_headers, temp_db
+
+
+def borrow(client, user):
+    return client.post("/licenses/borrow", json={"tool": "cad_tool", "user": user},
+                       headers=signed_headers("cad_tool", user))
+
+
+def borrow_wait(client, user, timeout_ms):
+    return client.post("/licenses/borrow/wait",
+                       json={"tool": "cad_tool", "user": user, "timeout_ms": timeout_ms},
+                       headers=signed_headers("cad_tool", user))
+
+
+def test_queue_serves_waiters_in_order():
+    seats = {"free": 0}
+
+    def grant(tool, user):
+        if seats["free"] == 0:
+            return None
+        seats["free"] -= 1
+        return user
+
+    async def scenario():
+        queue = BorrowQueue(grant)
+        first = queue.enqueue("cad_tool", "alice")
+        second = queue.enqueue("cad_tool", "bob")
+        assert queue.dispatch("cad_tool") == 0
+        assert queue.waiting("cad_tool") == 2
+
+        seats["free"] = 1
+        assert queue.dispatch("cad_tool") == 1
+        await asyncio.wait_for(first.event.wait(), 1)
+        assert first.result == "alice"
+        assert not second.done
+
+        assert queue.cancel(second)
+        assert not queue.has_waiters("cad_tool")
+        assert not queue.cancel(first)
+
+    asyncio.run(scenario())
+
+
+def test_queue_refuses_waiter_when_grant_raises():
+    def grant(tool, user):
+        raise ValueError("unknown tool")
+
+    async def scenario():
+        queue = BorrowQueue(grant)
+        waiter = queue.enqueue("ghost", "alice")
+        assert queue.dispatch("ghost") == 1
+        assert isinstance(waiter.error, ValueError)
+        assert not queue.has_waiters("ghost")
+
+    asyncio.run(scenario())
+
+
+def test_wait_returns_free_seat_immediately():
+    with temp_db():
+        client = make_client()
+        r = borrow_wait(client, "alice", 5000)
+        assert r.status_code == 200
+        assert r.json()["tool"] == "cad_tool"
+
+
+def test_wait_times_out_with_409():
+    with temp_db():
+        client = make_client()
+        assert borrow(client, "alice").status_code == 200
+        assert borrow(client, "bob").status_code == 200
+        started = time.monotonic()
+        r = borrow_wait(client, "carol", 200)
+        assert r.status_code == 409
+        assert time.monotonic() - started >= 0.2
+
+
+def test_returned_seat_goes_to_waiter():
+    with temp_db():
+        client = make_client()
+        first = borrow(client, "alice").json()["id"]
+        assert borrow(client, "bob").status_code == 200
+
+        result = {}
+        waiting = threading.Thread(target=lambda: result.update(r=borrow_wait(client, "carol", 10000)))
+        waiting.start()
+
+        from app.main import borrow_queue
+        for _ in range(200):
+            if borrow_queue.has_waiters("cad_tool"):
+                break
+            time.sleep(0.01)
+        # A plain borrow may not jump the queue
+        assert borrow(client, "dave").status_code == 409
+
+        assert client.post("/licenses/return", json={"id": first}).status_code == 200
+        waiting.join(10)
+        assert result["r"].status_code == 200
+        assert result["r"].json()["user"] == "carol"
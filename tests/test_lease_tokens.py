@@ -0,0 +1,104 @@
+import base64
+import json
+import os
+import tempfile
+from contextlib import contextmanager
+
+import pytest
+
+serialization = pytest.importorskip("cryptography.hazmat.primitives.serialization")
+from cryptography.hazmat.primitives.asymmetric import ed25519  # noqa: E402
+
+from app import lease_tokens  # noqa: E402
+from conftest import make_client, signed_headers  # noqa: E402
+
+
+@contextmanager
+def signing_key(lease_seconds="0", token_seconds=None):
+    key = ed25519.Ed25519PrivateKey.generate()
+    pem = key.private_bytes(
+        serialization.Encoding.PEM,
+        serialization.PrivateFormat.PKCS8,
+        serialization.NoEncryption(),
+    ).decode("ascii")
+    saved = {name: os.environ.get(name) for name in ("LICENSE_TOKEN_KEY", "LICENSE_TOKEN_SECONDS", "LICENSE_LEASE_SECONDS")}
+    os.environ["LICENSE_TOKEN_KEY"] = pem
+    os.environ["LICENSE_LEASE_SECONDS"] = lease_seconds
+    if token_seconds is None:
+        os.environ.pop("LICENSE_TOKEN_SECONDS", None)
+    else:
+        os.environ["LICENSE_TOKEN_SECONDS"] = token_seconds
+    lease_tokens.reset()
+    try:
+        with tempfile.TemporaryDirectory() as td:
+            os.environ["LICENSE_DB_PATH"] = os.path.join(td, "test.db")
+            yield key.public_key()
+    finally:
+        for name, value in saved.items():
+            if value is None:
+                os.environ.pop(name, None)
+            else:
+                os.environ[name] = value
+        lease_tokens.reset()
+
+
+def b64url_decode(part):
+    return base64.urlsafe_b64decode(part + "=" * (-len(part) % 4))
+
+
+def verify(public_key, token):
+    header, claims, signature = token.split(".")
+    public_key.verify(b64url_decode(signature), f"{header}.{claims}".encode("ascii"))
+    return json.loads(b64url_decode(header)), json.loads(b64url_decode(claims))
+
+
+def test_borrow_carries_verifiable_token():
+    with signing_key() as public_key:
+        client = make_client()
+        r = client.post("/licenses/borrow", json={"tool": "cad_tool", "user": "alice"},
+                        headers=signed_headers("cad_tool", "alice"))
+        assert r.status_code == 200
+        body = r.json()
+
+        header, claims = verify(public_key, body["lease_token"])
+        assert header == {"alg": "EdDSA", "typ": "JWT", "kid": "techvendor"}
+        assert claims["jti"] == body["id"]
+        assert claims["tool"] == "cad_tool"
+        assert claims["sub"] == "alice"
+        assert claims["exp"] - claims["iat"] == lease_tokens.DEFAULT_TOKEN_SECONDS
+
+
+def test_token_never_outlives_lease():
+    with signing_key(lease_seconds="60", token_seconds="600"):
+        assert lease_tokens.token_seconds(60) == 60
+        token = lease_tokens.issue("id-1", "cad_tool", "alice", 60, now=1000)
+        claims = json.loads(b64url_decode(token.split(".")[1]))
+        assert (claims["iat"], claims["exp"]) == (1000, 1060)
+
+
+def test_public_key_endpoint():
+    with signing_key() as public_key:
+        client = make_client()
+        r = client.get("/licenses/token-key")
+        assert r.status_code == 200
+        served = serialization.load_pem_public_key(r.json()["public_key"].encode("ascii"))
+        raw = serialization.Encoding.Raw, serialization.PublicFormat.Raw
+        assert served.public_bytes(*raw) == public_key.public_bytes(*raw)
+
+
+def test_tokens_off_without_key():
+    saved = os.environ.pop("LICENSE_TOKEN_KEY", None)
+    lease_tokens.reset()
+    try:
+        with tempfile.TemporaryDirectory() as td:
+            os.environ["LICENSE_DB_PATH"] = os.path.join(td, "test.db")
+            client = make_client()
+            r = client.post("/licenses/borrow", json={"tool": "cad_tool", "user": "bob"},
+                            headers=signed_headers("cad_tool", "bob"))
+            assert r.status_code == 200
+            assert r.json()["lease_token"] is None
+            assert client.get("/licenses/token-key").status_code == 404
+    finally:
+        if saved is not None:
+            os.environ["LICENSE_TOKEN_KEY"] = saved
+        lease_tokens.reset()
@@ -0,0 +1,139 @@
+import os
+import sqlite3
+import tempfile
+import threading
+from contextlib import contextmanager
+
+import pytest
+
+from app import db, ledger
+
+os.environ["LICENSE_DB_SEED"] = "false"
+
+
+@contextmanager
+def ledger_db(monkeypatch, **env):
+    monkeypatch.setenv("LICENSE_LEDGER", "memory")
+    for name, value in env.items():
+        monkeypatch.setenv(name, value)
+    with tempfile.TemporaryDirectory() as td:
+        db_path = os.path.join(td, "test.db")
+        monkeypatch.setenv("LICENSE_DB_PATH", db_path)
+        db.initialize_database([{"tool": "cad_tool", "total": 3, "commit_qty": 1, "max_overage": 1,
+                                 "overage_price_per_license": 100.0}])
+        try:
+            yield db_path
+        finally:
+            ledger.close()
+
+
+def db_counts(db_path):
+    conn = sqlite3.connect(db_path)
+    try:
+        borrowed = conn.execute("SELECT borrowed FROM licenses WHERE tool = 'cad_tool'").fetchone()[0]
+        borrows = conn.execute("SELECT COUNT(*) FROM borrows").fetchone()[0]
+        charges = conn.execute("SELECT COUNT(*) FROM overage_charges").fetchone()[0]
+        return borrowed, borrows, charges
+    finally:
+        conn.close()
+
+
+def test_admission_matches_database_rules(monkeypatch):
+    with ledger_db(monkeypatch):
+        assert db.borrow_license("cad_tool", "alice", "b1", "t") == (True, False)
+        assert db.borrow_license("cad_tool", "alice", "b2", "t") == (True, True)
+        assert db.borrow_license("cad_tool", "alice", "b3", "t") == (False, False)  # max overage
+        assert db.borrow_license("ghost", "alice", "b4", "t") == (False, False)
+        status = db.get_status("cad_tool")
+        assert (status["borrowed"], status["overage"], status["overage_borrows"]) == (2, 1, 1)
+
+        assert db.return_license("b1") == "cad_tool"
+        assert db.return_license("b1") is None
+        granted, reason = db.borrow_licenses_batch("cad_tool", "bob", 5, "t")
+        assert (len(granted), reason) == (1, "max_overage")
+
+
+def test_changes_reach_database_on_flush(monkeypatch):
+    with ledger_db(monkeypatch, LICENSE_LEDGER_FLUSH_MS="60000") as db_path:
+        db.borrow_license("cad_tool", "alice", "b1", "t")
+        db.borrow_license("cad_tool", "alice", "b2", "t")
+        db.return_license("b1")
+        assert db_counts(db_path) == (0, 0, 0)  # write-behind
+
+        assert ledger.active_ledger().flush() == 3
+        assert db_counts(db_path) == (1, 1, 1)
+
+
+def test_log_is_replayed_after_crash(monkeypatch):
+    with ledger_db(monkeypatch, LICENSE_LEDGER_FLUSH_MS="60000") as db_path:
+        crashed = ledger.active_ledger()
+        db.borrow_license("cad_tool", "alice", "b1", "t")
+        db.borrow_license("cad_tool", "alice", "b2", "t")
+        db.return_license("b1")
+        # Lose the process without a final flush
+        crashed._closed.set()
+        ledger._ledger = None
+
+        recovered = ledger.active_ledger()
+        assert recovered is not crashed
+        assert db_counts(db_path) == (1, 1, 1)
+        assert db.get_status("cad_tool")["borrowed"] == 1
+        assert db.return_license("b2") == "cad_tool"
+
+
+def test_limit_changes_apply_at_once(monkeypatch):
+    with ledger_db(monkeypatch):
+        for i in range(2):
+            assert db.borrow_license("cad_tool", "alice", f"b{i}", "t")[0]
+        # Sees the ledger's count, not the database's
+        assert not db.update_budget_config("cad_tool", 1, 1, 0, 0.0, 0.0)
+        assert db.update_budget_config("cad_tool", 10, 5, 5, 0.0, 0.0)
+        assert db.get_status("cad_tool")["total"] == 10
+        assert db.borrow_license("cad_tool", "alice", "b9", "t") == (True, False)
+
+
+def test_month_to_date_cost_needs_no_flush(monkeypatch):
+    with ledger_db(monkeypatch, LICENSE_LEDGER_FLUSH_MS="60000") as db_path:
+        db.borrow_license("cad_tool", "alice", "b1", db.month_start())
+        db.borrow_license("cad_tool", "alice", "b2", db.month_start())
+        assert db.get_month_to_date_overage_cost("cad_tool") == 100.0
+        assert db_counts(db_path) == (0, 0, 0)  # answered from memory
+
+        # Seeded from this month's charges when the ledger opens
+        conn = sqlite3.connect(db_path)
+        conn.execute("INSERT INTO overage_charges(id, tool, borrow_id, user, charged_at, amount) "
+                     "VALUES ('old', 'cad_tool', 'b0', 'bob', '2000-01-01T00:00:00', 100.0)")
+        conn.commit()
+        conn.close()
+        ledger.close()
+        assert db_counts(db_path)[2] == 2
+        assert db.get_month_to_date_overage_cost("cad_tool") == 100.0
+
+
+def test_expired_leases_are_reclaimed(monkeypatch):
+    with ledger_db(monkeypatch, LICENSE_LEASE_SECONDS="60"):
+        db.borrow_license("cad_tool", "alice", "b1", "t")
+        db.borrow_license("cad_tool", "alice", "b2", "t")
+        now = db._lease_expiry(60)
+        assert db.renew_leases(["b2", "nope"], now=now) == ["b2"]
+        assert db.reclaim_expired_leases(now=now + 1) == {"b1": "cad_tool"}
+        assert db.get_status("cad_tool")["borrowed"] == 1
+
+
+@pytest.mark.parametrize("fsync", ["always", "off"])
+def test_concurrent_borrows_never_oversell(monkeypatch, fsync):
+    with ledger_db(monkeypatch, LICENSE_LEDGER_FSYNC=fsync) as db_path:
+        results = []
+
+        def worker(n):
+            for i in range(20):
+                results.append(db.borrow_license("cad_tool", "u", f"w{n}-{i}", "t")[0])
+
+        threads = [threading.Thread(target=worker, args=(n,)) for n in range(4)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        assert results.count(True) == 2
+        ledger.active_ledger().flush()
+        assert db_counts(db_path)[:2] == (2, 2)
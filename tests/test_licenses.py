@@ -1,26 +1,6 @@
-import os
-import tempfile
-from contextlib import contextmanager
-
 from fastapi.testclient import TestClient
 
-os.environ["LICENSE_DB_SEED"] = "false"
-
-
-@contextmanager
-def temp_db():
-    with tempfile.TemporaryDirectory() as td:
-        db_path = os.path.join(td, "test.db")
-        os.environ["LICENSE_DB_PATH"] = db_path
-        yield db_path
-
-
-def make_app_with_seed():
-    from app.main import app
-    from app.db import initialize_database
-
-    initialize_database([{"tool": "cad_tool", "total": 2, "commit_qty": 1, "max_overage": 1}])
-    return app
+from conftest import make_app_with_seed, signed_headers, temp_db
 
 
 def test_borrow_and_return():
@@ -69,3 +49,76 @@ def test_metrics_endpoint_present():
         assert b"license_borrow_attempts_total" in m.content
 
 
+def test_batch_borrow_and_return():
+    with temp_db():
+        app = make_app_with_seed()
+        client = TestClient(app)
+
+        # 3 requested, only 2 seats exist: partial success
+        r = client.post(
+            "/licenses/borrow/batch",
+            json={"tool": "cad_tool", "user": "ci", "count": 3},
+            headers=signed_headers("cad_tool", "ci"),
+        )
+        assert r.status_code == 200
+        body = r.json()
+        assert body["requested"] == 3
+        assert body["granted"] == 2
+        assert body["reason"] == "exhausted"
+        assert [b["is_overage"] for b in body["borrows"]] == [False, True]
+
+        r = client.get("/licenses/cad_tool/status")
+        assert r.json()["available"] == 0
+
+        ids = [b["id"] for b in body["borrows"]]
+        rr = client.post("/licenses/return/batch", json={"ids": ids + ["missing"]})
+        assert rr.status_code == 200
+        assert sorted(rr.json()["returned"]) == sorted(ids)
+        assert rr.json()["not_found"] == ["missing"]
+
+        r = client.get("/licenses/cad_tool/status")
+        assert r.json()["available"] == 2
+
+
+def test_leases_renew_and_expire(monkeypatch):
+    import time
+    from app.db import reclaim_expired_leases, renew_leases
+
+    monkeypatch.setenv("LICENSE_LEASE_SECONDS", "60")
+    with temp_db():
+        app = make_app_with_seed()
+        client = TestClient(app)
+
+        r = client.post("/licenses/borrow", json={"tool": "cad_tool", "user": "alice"})
+        assert r.status_code == 200
+        assert r.json()["lease_seconds"] == 60
+        kept = r.json()["id"]
+        lapsed = client.post("/licenses/borrow", json={"tool": "cad_tool", "user": "bob"}).json()["id"]
+
+        # Nothing has expired yet
+        assert reclaim_expired_leases() == {}
+
+        rr = client.post("/licenses/renew", json={"ids": [kept, "missing"]})
+        assert rr.status_code == 200
+        assert rr.json()["renewed"] == [kept]
+        assert rr.json()["not_found"] == ["missing"]
+        assert rr.json()["lease_seconds"] == 60
+
+        # Only the borrow renewed 45 s in survives past the original expiry
+        later = time.time() + 45
+        assert renew_leases([kept], now=later) == [kept]
+        assert reclaim_expired_leases(now=later + 30) == {lapsed: "cad_tool"}
+        assert client.get("/licenses/cad_tool/status").json()["borrowed"] == 1
+        assert client.post("/licenses/renew", json={"ids": [lapsed]}).json()["not_found"] == [lapsed]
+
+
+def test_leases_disabled_by_default():
+    with temp_db():
+        app = make_app_with_seed()
+        client = TestClient(app)
+        r = client.post("/licenses/borrow", json={"tool": "cad_tool", "user": "alice"})
+        assert r.json()["lease_seconds"] == 0
+
+        from app.db import reclaim_expired_leases
+        assert reclaim_expired_leases(now=float("inf")) == {}
+        assert client.get("/licenses/cad_tool/status").json()["borrowed"] == 1
@@ -0,0 +1,98 @@
+import os
+import tempfile
+from collections import Counter
+from contextlib import contextmanager
+
+import pytest
+from fastapi.testclient import TestClient
+
+from app import shards
+
+os.environ["LICENSE_DB_SEED"] = "false"
+
+NODES = "a=http://node-a:8000,b=http://node-b:8000,c=http://node-c:8000"
+
+
+@contextmanager
+def shard_node(monkeypatch, self_id):
+    monkeypatch.setenv("LICENSE_SHARD_NODES", NODES)
+    monkeypatch.setenv("LICENSE_SHARD_SELF", self_id)
+    shards.reset()
+    with tempfile.TemporaryDirectory() as td:
+        monkeypatch.setenv("LICENSE_DB_PATH", os.path.join(td, "test.db"))
+        from app.main import app
+        from app.db import initialize_database
+
+        initialize_database([{"tool": f"tool_{i}", "total": 2, "commit_qty": 1, "max_overage": 1} for i in range(20)])
+        try:
+            yield TestClient(app)
+        finally:
+            shards.reset()
+
+
+def test_ring_is_deterministic_and_balanced():
+    nodes = shards.parse_nodes(NODES)
+    first, second = shards.ShardMap(nodes, "a"), shards.ShardMap(nodes, "b")
+    tools = [f"tool_{i}" for i in range(3000)]
+    assert [first.owner(t) for t in tools] == [second.owner(t) for t in tools]
+    assert first.version == second.version
+
+    per_node = Counter(first.owner(t) for t in tools)
+    assert set(per_node) == {"a", "b", "c"}
+    assert min(per_node.values()) > 600
+
+
+def test_adding_a_node_moves_few_tools():
+    three = shards.ShardMap(shards.parse_nodes(NODES), "a")
+    four = shards.ShardMap(shards.parse_nodes(NODES + ",d=http://node-d:8000"), "a")
+    tools = [f"tool_{i}" for i in range(3000)]
+    moved = [t for t in tools if three.owner(t) != four.owner(t)]
+    assert all(four.owner(t) == "d" for t in moved)
+    assert len(moved) < len(tools) / 2
+
+
+def test_borrow_ids_name_their_node():
+    shard_map = shards.ShardMap(shards.parse_nodes(NODES), "b")
+    borrow_id = shard_map.new_borrow_id()
+    assert borrow_id.startswith("b.")
+    assert shard_map.borrow_owner("c.1234") == "c"
+    assert shard_map.borrow_owner("1234-5678") == "b"  # issued before sharding
+    assert shard_map.borrow_owner("zz.1234") == "b"
+
+
+def test_parse_nodes_rejects_bad_entries():
+    with pytest.raises(ValueError):
+        shards.parse_nodes("a=http://x,b")
+    with pytest.raises(ValueError):
+        shards.parse_nodes("a b=http://x")
+
+
+def test_misrouted_requests_are_redirected(monkeypatch):
+    with shard_node(monkeypatch, "a") as client:
+        shard_map = shards.current()
+        foreign = next(f"tool_{i}" for i in range(20) if shard_map.owner(f"tool_{i}") != "a")
+        owner_url = shard_map.urls[shard_map.owner(foreign)]
+
+        r = client.post("/licenses/borrow", json={"tool": foreign, "user": "alice"}, follow_redirects=False)
+        assert r.status_code == 307
+        assert r.headers["location"] == owner_url + "/licenses/borrow"
+
+        r = client.get(f"/licenses/{foreign}/status", follow_redirects=False)
+        assert r.status_code == 307
+
+        r = client.post("/licenses/return", json={"id": "b.1234"}, follow_redirects=False)
+        assert r.headers["location"] == "http://node-b:8000/licenses/return"
+
+        r = client.post("/licenses/renew", json={"ids": ["a.1", "c.2"]})
+        assert r.status_code == 421
+
+
+def test_node_lists_only_owned_tools(monkeypatch):
+    with shard_node(monkeypatch, "a") as client:
+        shard_map = shards.current()
+        listed = {s["tool"] for s in client.get("/licenses/status").json()}
+        assert listed == {f"tool_{i}" for i in range(20) if shard_map.owns(f"tool_{i}")}
+
+        doc = client.get("/cluster/shards").json()
+        assert doc["self"] == "a"
+        assert len(doc["ring"]) == 3 * shards.VNODES
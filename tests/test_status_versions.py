@@ -0,0 +1,70 @@
+from app.status_versions import StatusVersions
+from conftest import make_client, signed_headers, temp_db
+
+LICENSES = [{"tool": "cad_tool", "total": 2, "commit_qty": 1, "max_overage": 1},
+            {"tool": "sim_tool", "total": 2, "commit_qty": 1, "max_overage": 1}]
+
+
+def status(tool, borrowed):
+    return {"tool": tool, "total": 5, "borrowed": borrowed, "available": 5 - borrowed}
+
+
+def test_unchanged_list_keeps_its_version():
+    versions = StatusVersions()
+    first = versions.observe([status("a", 0), status("b", 0)])
+    assert versions.observe([status("a", 0), status("b", 0)]) == first
+
+    delta = versions.changes([status("a", 0), status("b", 0)], first)
+    assert (delta["version"], delta["full"], delta["changed"], delta["removed"]) == (first, False, [], [])
+
+
+def test_delta_holds_only_changed_tools():
+    versions = StatusVersions()
+    first = versions.observe([status("a", 0), status("b", 0), status("c", 0)])
+    second = versions.observe([status("a", 1), status("b", 0), status("c", 0)])
+    assert second != first
+
+    delta = versions.changes([status("a", 1), status("b", 2)], first)
+    assert not delta["full"]
+    assert [s["tool"] for s in delta["changed"]] == ["a", "b"]
+    assert delta["removed"] == ["c"]
+
+    # A client already at the second version misses only the later changes
+    delta = versions.changes([status("a", 1), status("b", 2)], second)
+    assert [s["tool"] for s in delta["changed"]] == ["b"]
+    assert delta["removed"] == ["c"]
+
+
+def test_foreign_version_gets_full_list():
+    versions = StatusVersions()
+    versions.observe([status("a", 0)])
+    for since in (None, "", "bogus", "00000000.1", f"{versions.epoch}.99"):
+        delta = versions.changes([status("a", 0)], since)
+        assert delta["full"]
+        assert delta["changed"] == [status("a", 0)]
+
+
+def test_etag_answers_not_modified():
+    with temp_db():
+        client = make_client(LICENSES)
+        r = client.get("/licenses/status")
+        etag = r.headers["etag"]
+        assert client.get("/licenses/status", headers={"If-None-Match": etag}).status_code == 304
+
+        assert client.post("/licenses/borrow", json={"tool": "cad_tool", "user": "alice"},
+                           headers=signed_headers("cad_tool", "alice")).status_code == 200
+
+        r = client.get("/licenses/status", headers={"If-None-Match": etag})
+        assert r.status_code == 200
+        assert r.headers["etag"] != etag
+
+
+def test_delta_endpoint_follows_versions():
+    with temp_db():
+        client = make_client(LICENSES)
+        full = client.get("/licenses/status/delta").json()
+        assert full["full"]
+        assert [s["tool"] for s in full["changed"]] == ["cad_tool", "sim_tool"]
+
+        delta = client.get("/licenses/status/delta", params={"since": full["version"]}).json()
+        assert (delta["full"], delta["changed"], delta["version"]) == (False, [], full["version"])
@@ -0,0 +1,70 @@
+import pytest
+from fastapi.testclient import TestClient
+
+from app.wire import MessagePackError, accepts_msgpack, packb, unpackb
+from conftest import make_app_with_seed, signed_headers, temp_db
+
+MSGPACK = "application/msgpack"
+
+
+def test_codec_roundtrip():
+    values = [
+        None, True, False, 0, 127, 128, -1, -32, -33, 65536, -2**40, 2**63,
+        1.5, "", "a" * 31, "b" * 32, "c" * 70000, "ü", [], list(range(20)),
+        {"tool": "cad_tool", "nested": {"ids": ["x", "y"]}},
+    ]
+    for value in values:
+        assert unpackb(packb(value)) == value
+
+
+def test_codec_rejects_malformed_input():
+    for data in (b"", b"\xc1", b"\x92\x01", b"\x81\x01\x02", b"\x01\x02"):
+        with pytest.raises(MessagePackError):
+            unpackb(data)
+
+
+def test_accept_negotiation():
+    assert accepts_msgpack(b"application/msgpack")
+    assert accepts_msgpack(b"application/json;q=0.5, application/msgpack")
+    assert not accepts_msgpack(b"application/json")
+    assert not accepts_msgpack(b"application/msgpack;q=0")
+
+
+def test_status_and_borrow_in_msgpack():
+    with temp_db():
+        app = make_app_with_seed()
+        client = TestClient(app)
+
+        r = client.get("/licenses/status", headers={"Accept": MSGPACK})
+        assert r.status_code == 200
+        assert r.headers["content-type"] == MSGPACK
+        statuses = unpackb(r.content)
+        assert statuses[0]["tool"] == "cad_tool"
+        assert statuses[0]["available"] == 2
+
+        r = client.post(
+            "/licenses/borrow",
+            content=packb({"tool": "cad_tool", "user": "alice"}),
+            headers={"Content-Type": MSGPACK, "Accept": MSGPACK, **signed_headers("cad_tool", "alice")},
+        )
+        assert r.status_code == 200
+        borrow_id = unpackb(r.content)["id"]
+
+        # Errors are encoded too
+        r = client.get("/licenses/unknown_tool/status", headers={"Accept": MSGPACK})
+        assert r.status_code == 404
+        assert "detail" in unpackb(r.content)
+
+        # JSON stays the default
+        r = client.post("/licenses/return", json={"id": borrow_id})
+        assert r.status_code == 200
+        assert r.headers["content-type"].startswith("application/json")
+        assert client.get("/licenses/cad_tool/status").json()["available"] == 2
+
+
+def test_malformed_msgpack_body_is_rejected():
+    with temp_db():
+        app = make_app_with_seed()
+        client = TestClient(app)
+        r = client.post("/licenses/return", content=b"\xc1", headers={"Content-Type": MSGPACK})
+        assert r.status_code == 400